@@ -0,0 +1,82 @@
+/*
+	Chippin8 ROM analyzer. Disassembles a ROM without running it, and
+	reports which of its bytes are code, sprites and other data, and the
+	control-flow graph of its code (see ROMAnalysis).
+
+		./<Chippin8Analyze.exe> <ROM_file> [--json] [--output (file)]
+
+	The listing has a label for every basic block (sub_XXXX for the targets
+	of 2NNN, LXXXX for the others) with the blocks it goes on to, followed
+	by its instructions. Sprites are drawn as pixels, and bytes that are
+	never reached are listed as they are. With --json the same is written
+	as JSON instead, for other tools to read.
+*/
+
+#include "emulator.h"
+#include "analyzer.h"
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <stdlib.h>
+
+#define USAGE() do{ \
+		std::cout << "Usage: ./<Chippin8Analyze>.exe <ROM_file>"\
+		<< " [--json] [--output (file)]\n"; \
+		} while(0)
+
+int main(int argc, char* argv[]) {
+	std::string romFile;
+	std::string outputFile;
+	bool isJson = false;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--json") {
+			isJson = true;
+		}
+		else if (arg == "--output" && i + 1 < argc) {
+			outputFile = argv[++i];
+		}
+		else if (arg.rfind("--", 0) != 0 && romFile.empty()) {
+			romFile = arg;
+		}
+		else {
+			USAGE();
+			return EXIT_FAILURE;
+		}
+	}
+	if (romFile.empty()) {
+		USAGE();
+		return EXIT_FAILURE;
+	}
+
+	// Chippin8 is too large for the stack
+	std::unique_ptr<Chippin8> c8(new Chippin8());
+	if (!c8->LoadROM(romFile)) {
+		std::cerr << "Could not load ROM " << romFile << " (at most "
+			<< Chippin8::MAX_ROM_SIZE << " bytes)\n";
+		return EXIT_FAILURE;
+	}
+	ROMAnalysis analysis;
+	analysis.Analyze(*c8);
+
+	std::ofstream file;
+	if (!outputFile.empty()) {
+		file.open(outputFile);
+		if (!file.is_open()) {
+			std::cerr << "Could not write " << outputFile << '\n';
+			return EXIT_FAILURE;
+		}
+	}
+	std::ostream& out = outputFile.empty() ? std::cout : file;
+	if (isJson) {
+		analysis.WriteJSON(out);
+	}
+	else {
+		out << "; " << romFile << '\n';
+		analysis.WriteText(out);
+	}
+	return out.good() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
\ No newline at end of file
@@ -0,0 +1,629 @@
+#include "analyzer.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <string.h>
+
+// Where programs are loaded, and where the analysis starts
+const uint16_t ENTRY_ADDRESS = 0x200;
+
+// Most entries of a BNNN jump table that are followed (V0 is a byte, and
+// every entry is a 2-byte 1NNN)
+const int MAX_JUMP_TABLE_ENTRIES = 128;
+
+// Most values of the index register an instruction is followed with. Paths
+// that reach code already seen with another known index go on, so that
+// e.g. both sprites of "ANNN, skip, ANNN, DXYN" are found.
+const uint8_t MAX_INDEX_STATES = 8;
+
+// Bytes listed per line where they are not code, sprites or data
+const int BYTES_PER_LINE = 8;
+
+/* ----- Instructions ----- */
+
+// Mnemonics by opcode name (see Chippin8::GetOpcodeName). In the formats,
+// %x and %y are the register indexes, %n is N, %b is NN, %a is NNN and %l
+// is the address that follows F000.
+static const struct {
+	const char* name;
+	const char* format;
+} MNEMONICS[] = {
+	{ "00CN", "SCD %n" },
+	{ "00DN", "SCU %n" },
+	{ "00E0", "CLS" },
+	{ "00EE", "RET" },
+	{ "00FB", "SCR" },
+	{ "00FC", "SCL" },
+	{ "00FD", "EXIT" },
+	{ "00FE", "LOW" },
+	{ "00FF", "HIGH" },
+	{ "1NNN", "JP %a" },
+	{ "2NNN", "CALL %a" },
+	{ "3XNN", "SE V%x, %b" },
+	{ "4XNN", "SNE V%x, %b" },
+	{ "5XY0", "SE V%x, V%y" },
+	{ "5XY2", "SAVE V%x - V%y" },
+	{ "5XY3", "LOAD V%x - V%y" },
+	{ "6XNN", "LD V%x, %b" },
+	{ "7XNN", "ADD V%x, %b" },
+	{ "8XY0", "LD V%x, V%y" },
+	{ "8XY1", "OR V%x, V%y" },
+	{ "8XY2", "AND V%x, V%y" },
+	{ "8XY3", "XOR V%x, V%y" },
+	{ "8XY4", "ADD V%x, V%y" },
+	{ "8XY5", "SUB V%x, V%y" },
+	{ "8XY6", "SHR V%x, V%y" },
+	{ "8XY7", "SUBN V%x, V%y" },
+	{ "8XYE", "SHL V%x, V%y" },
+	{ "9XY0", "SNE V%x, V%y" },
+	{ "ANNN", "LD I, %a" },
+	{ "BNNN", "JP V0, %a" },
+	{ "CXNN", "RND V%x, %b" },
+	{ "DXY0", "DRW V%x, V%y, 0" },
+	{ "DXYN", "DRW V%x, V%y, %n" },
+	{ "EX9E", "SKP V%x" },
+	{ "EXA1", "SKNP V%x" },
+	{ "F000", "LD I, %l" },
+	{ "F002", "AUDIO" },
+	{ "FN01", "PLANE %x" },
+	{ "FX07", "LD V%x, DT" },
+	{ "FX0A", "LD V%x, K" },
+	{ "FX15", "LD DT, V%x" },
+	{ "FX18", "LD ST, V%x" },
+	{ "FX1E", "ADD I, V%x" },
+	{ "FX29", "LD F, V%x" },
+	{ "FX30", "LD HF, V%x" },
+	{ "FX33", "LD B, V%x" },
+	{ "FX3A", "PITCH V%x" },
+	{ "FX55", "LD [I], V%x" },
+	{ "FX65", "LD V%x, [I]" },
+	{ "FX75", "LD R, V%x" },
+	{ "FX85", "LD V%x, R" }
+};
+
+static std::string Hex(uint32_t value, int digits) {
+	std::ostringstream out;
+	out << std::hex << std::uppercase << std::setfill('0')
+		<< std::setw(digits) << value;
+	return out.str();
+}
+
+static bool IsNamed(uint16_t opcode, const char* name) {
+	return strcmp(Chippin8::GetOpcodeName(opcode), name) == 0;
+}
+
+// Whether opcode skips the next instruction if its condition holds
+static bool IsSkip(uint16_t opcode) {
+	const char* name = Chippin8::GetOpcodeName(opcode);
+	return strcmp(name, "3XNN") == 0 || strcmp(name, "4XNN") == 0
+		|| strcmp(name, "5XY0") == 0 || strcmp(name, "9XY0") == 0
+		|| strcmp(name, "EX9E") == 0 || strcmp(name, "EXA1") == 0;
+}
+
+// Whether opcode is not an instruction of any profile. 0NNN calls machine
+// code, which is ignored, rather than being invalid.
+static bool IsInvalid(uint16_t opcode) {
+	return IsNamed(opcode, "NOP") && (opcode & 0xF000u) != 0;
+}
+
+void ROMAnalysis::GetFlow(uint16_t address, Flow& flow) const {
+	uint16_t opcode = ReadOpcode(address);
+	uint16_t next = address + 2;
+	const char* name = Chippin8::GetOpcodeName(opcode);
+	flow.length = strcmp(name, "F000") == 0 ? 4 : 2;
+	flow.fallsThrough = true;
+	flow.endsBlock = false;
+	flow.isCall = false;
+	flow.isIndirect = false;
+	flow.isReturn = false;
+	flow.targets.clear();
+
+	if (IsSkip(opcode)) {
+		// F000 NNNN is skipped as a whole
+		bool isLong = IsNamed(ReadOpcode(next), "F000");
+		flow.endsBlock = true;
+		flow.targets.push_back(next + (isLong ? 4 : 2));
+	}
+	else if (strcmp(name, "1NNN") == 0) {
+		flow.fallsThrough = false;
+		flow.endsBlock = true;
+		flow.targets.push_back(opcode & 0x0FFFu);
+	}
+	else if (strcmp(name, "2NNN") == 0) {
+		flow.endsBlock = true;
+		flow.isCall = true;
+		flow.targets.push_back(opcode & 0x0FFFu);
+	}
+	else if (strcmp(name, "BNNN") == 0) {
+		// Most often NNN is a table of jumps, indexed by V0
+		uint16_t table = opcode & 0x0FFFu;
+		flow.fallsThrough = false;
+		flow.endsBlock = true;
+		flow.isIndirect = true;
+		flow.targets.push_back(table);
+		for (int i = 1; i < MAX_JUMP_TABLE_ENTRIES
+			&& IsNamed(ReadOpcode(table), "1NNN")
+			&& IsNamed(ReadOpcode(table + 2), "1NNN"); ++i) {
+			table += 2;
+			flow.targets.push_back(table);
+		}
+	}
+	else if (strcmp(name, "00EE") == 0) {
+		flow.fallsThrough = false;
+		flow.endsBlock = true;
+		flow.isReturn = true;
+	}
+	else if (strcmp(name, "00FD") == 0) {
+		flow.fallsThrough = false;
+		flow.endsBlock = true;
+	}
+	else if (opcode == 0x0000 || IsInvalid(opcode)) {
+		// Padding or data that a path ran into, not code. Whatever comes 
+		// after it is not known to be code either.
+		flow.fallsThrough = false;
+		flow.endsBlock = true;
+	}
+}
+
+std::string ROMAnalysis::Disassemble(uint16_t address) const {
+	uint16_t opcode = ReadOpcode(address);
+	const char* name = Chippin8::GetOpcodeName(opcode);
+
+	// 0NNN calls machine code, which is ignored. Anything else the decoder
+	// does not know is not an instruction.
+	const char* format = (opcode & 0xF000u) == 0 ? "SYS %a" : "DW %w";
+	for (const auto& mnemonic : MNEMONICS) {
+		if (strcmp(mnemonic.name, name) == 0) {
+			format = mnemonic.format;
+			break;
+		}
+	}
+
+	std::string text;
+	for (const char* c = format; *c != '\0'; ++c) {
+		if (*c != '%' || c[1] == '\0') {
+			text += *c;
+			continue;
+		}
+		switch (*++c) {
+		case 'x': text += Hex((opcode & 0x0F00u) >> 8, 1); break;
+		case 'y': text += Hex((opcode & 0x00F0u) >> 4, 1); break;
+		case 'n': text += std::to_string(opcode & 0x000Fu); break;
+		case 'b': text += "0x" + Hex(opcode & 0x00FFu, 2); break;
+		case 'a': text += "0x" + Hex(opcode & 0x0FFFu, 3); break;
+		case 'l': text += "0x" + Hex(ReadOpcode(address + 2), 4); break;
+		case 'w': text += "0x" + Hex(opcode, 4); break;
+		}
+	}
+	return text;
+}
+
+/* ----- Analysis ----- */
+
+ROMAnalysis::ROMAnalysis()
+	: memory(Chippin8::MEMORY_SIZE, 0), flags(Chippin8::MEMORY_SIZE, 0),
+	isInstruction(Chippin8::MEMORY_SIZE, false), romStart(ENTRY_ADDRESS),
+	romSize(0), romHash(0), invalidCount(0) {
+}
+
+void ROMAnalysis::Analyze(const Chippin8& c8) {
+	c8.GetMemory(memory.data());
+	std::fill(flags.begin(), flags.end(), 0);
+	std::fill(isInstruction.begin(), isInstruction.end(), false);
+	instructions.clear();
+	blocks.clear();
+	subroutines.clear();
+	romSize = c8.GetROMSize();
+	romHash = c8.GetROMHash();
+	invalidCount = 0;
+
+	// A path through the program still to be followed, with the value of
+	// the index register if it is known
+	struct Path {
+		uint16_t address;
+		bool knowsIndex;
+		uint16_t index;
+	};
+
+	// A read or write of memory at a known index
+	struct Access {
+		uint16_t address;
+		uint16_t length;
+		bool isSprite;
+	};
+
+	std::vector<bool> isLeader(Chippin8::MEMORY_SIZE, false);
+	std::vector<uint8_t> indexStates(Chippin8::MEMORY_SIZE, 0);
+	std::set<uint32_t> seenStates;		// Address and known index
+	std::vector<Path> paths;
+	std::vector<Access> accesses;
+	int planes = 1;				// Most planes any sprite is drawn to
+
+	paths.push_back({ ENTRY_ADDRESS, false, 0 });
+	paths.push_back({ c8.pc, false, 0 });
+
+	Flow flow;
+	while (!paths.empty()) {
+		Path path = paths.back();
+		paths.pop_back();
+		isLeader[path.address] = true;
+
+		// Follow the path until it ends, leaves the ROM or reaches code 
+		// already seen, with the same index (or none)
+		uint16_t address = path.address;
+		for (;;) {
+			if (!IsInROM(address)) {
+				break;
+			}
+			bool isNew = !isInstruction[address];
+			if (path.knowsIndex) {
+				uint32_t state = ((uint32_t)address << 16) | path.index;
+				if (!isNew && indexStates[address] >= MAX_INDEX_STATES) {
+					break;
+				}
+				if (!seenStates.insert(state).second) {
+					break;
+				}
+				++indexStates[address];
+			}
+			else if (!isNew) {
+				break;
+			}
+
+			if (isNew) {
+				isInstruction[address] = true;
+				instructions.push_back(address);
+			}
+			GetFlow(address, flow);
+			Mark(address, flow.length, CODE);
+
+			uint16_t opcode = ReadOpcode(address);
+			const char* name = Chippin8::GetOpcodeName(opcode);
+			uint8_t X = (opcode & 0x0F00u) >> 8;
+			uint8_t Y = (opcode & 0x00F0u) >> 4;
+			uint8_t N = opcode & 0x000Fu;
+
+			if (isNew && IsInvalid(opcode)) {
+				++invalidCount;
+			}
+
+			// Memory the instruction reads or writes at the index
+			uint16_t length = 0;
+			bool isSprite = false;
+			if (strcmp(name, "DXYN") == 0 || strcmp(name, "DXY0") == 0) {
+				length = N != 0 ? N : 32;
+				isSprite = true;
+			}
+			else if (strcmp(name, "FX33") == 0) {
+				length = 3;
+			}
+			else if (strcmp(name, "FX55") == 0
+				|| strcmp(name, "FX65") == 0) {
+				length = X + 1;
+			}
+			else if (strcmp(name, "5XY2") == 0
+				|| strcmp(name, "5XY3") == 0) {
+				length = (X > Y ? X - Y : Y - X) + 1;
+			}
+			else if (strcmp(name, "F002") == 0) {
+				length = 16;
+			}
+			else if (strcmp(name, "FN01") == 0) {
+				planes = std::max(planes, (X & 1) + ((X >> 1) & 1));
+			}
+			if (length > 0 && path.knowsIndex) {
+				accesses.push_back({ path.index, length, isSprite });
+			}
+
+			// The index afterwards. FX1E adds a register to it, FX29 and
+			// FX30 point it to the font, and how far FX55 and FX65 advance
+			// it depends on the quirk profile.
+			if (strcmp(name, "ANNN") == 0) {
+				path.knowsIndex = true;
+				path.index = opcode & 0x0FFFu;
+			}
+			else if (strcmp(name, "F000") == 0) {
+				path.knowsIndex = true;
+				path.index = ReadOpcode(address + 2);
+			}
+			else if (strcmp(name, "FX1E") == 0 || strcmp(name, "FX29") == 0
+				|| strcmp(name, "FX30") == 0 || strcmp(name, "FX55") == 0
+				|| strcmp(name, "FX65") == 0) {
+				path.knowsIndex = false;
+			}
+
+			for (uint16_t target : flow.targets) {
+				if (flow.isCall && isNew) {
+					subroutines.push_back(target);
+				}
+				paths.push_back({ target, path.knowsIndex, path.index });
+			}
+
+			uint16_t next = address + flow.length;
+			if (!flow.fallsThrough) {
+				break;
+			}
+			if (flow.isCall) {
+				// The subroutine may have changed the index by the time it
+				// returns
+				paths.push_back({ next, false, 0 });
+				break;
+			}
+			if (flow.endsBlock) {
+				isLeader[next] = true;
+			}
+			address = next;
+		}
+	}
+
+	// Sprites are drawn to every plane selected, one after the other
+	for (const Access& access : accesses) {
+		Mark(access.address, access.isSprite
+			? access.length * planes : access.length,
+			access.isSprite ? SPRITE : DATA);
+	}
+
+	std::sort(subroutines.begin(), subroutines.end());
+	subroutines.erase(std::unique(subroutines.begin(), subroutines.end()),
+		subroutines.end());
+	std::sort(instructions.begin(), instructions.end());
+	FindBlocks(isLeader);
+}
+
+void ROMAnalysis::FindBlocks(const std::vector<bool>& isLeader) {
+	Flow flow;
+	bool isOpen = false;		// The last block may go on
+	for (uint16_t address : instructions) {
+		// Instructions that follow the last block without being jumped to
+		// continue it. Otherwise the block falls through into this one.
+		if (!isOpen || isLeader[address] || blocks.back().end != address) {
+			if (isOpen) {
+				blocks.back().successors.push_back(blocks.back().end);
+			}
+			blocks.push_back({ address, address, {}, false, false });
+		}
+
+		BasicBlock& block = blocks.back();
+		GetFlow(address, flow);
+		block.end = address + flow.length;
+		isOpen = !flow.endsBlock;
+		if (flow.endsBlock) {
+			if (flow.fallsThrough) {
+				block.successors.push_back(block.end);
+			}
+			block.successors.insert(block.successors.end(),
+				flow.targets.begin(), flow.targets.end());
+			block.isIndirect = flow.isIndirect;
+			block.isReturn = flow.isReturn;
+		}
+	}
+	if (isOpen) {
+		blocks.back().successors.push_back(blocks.back().end);
+	}
+}
+
+void ROMAnalysis::Mark(uint16_t address, size_t length, uint8_t flag) {
+	for (size_t i = 0; i < length; ++i) {
+		flags[(uint16_t)(address + i)] |= flag;
+	}
+}
+
+/* ----- Results ----- */
+
+std::vector<uint16_t> ROMAnalysis::GetBlockStarts() const {
+	std::vector<uint16_t> starts;
+	for (const BasicBlock& block : blocks) {
+		starts.push_back(block.start);
+	}
+	return starts;
+}
+
+size_t ROMAnalysis::CountBytes(uint8_t flag) const {
+	size_t count = 0;
+	for (size_t address = 0; address < Chippin8::MEMORY_SIZE; ++address) {
+		bool isInROM = IsInROM(address);
+		if (flag == 0 ? isInROM && flags[address] == 0
+			: (flags[address] & flag) != 0) {
+			++count;
+		}
+	}
+	return count;
+}
+
+std::string ROMAnalysis::GetKindName(uint8_t flag) {
+	std::string name;
+	if (flag & CODE) name += "code";
+	if (flag & SPRITE) name += name.empty() ? "sprite" : "+sprite";
+	if (flag & DATA) name += name.empty() ? "data" : "+data";
+	return name.empty() ? "unknown" : name;
+}
+
+void ROMAnalysis::WriteText(std::ostream& out) const {
+	std::vector<bool> isSubroutine(Chippin8::MEMORY_SIZE, false);
+	for (uint16_t address : subroutines) {
+		isSubroutine[address] = true;
+	}
+	auto label = [&isSubroutine](uint16_t address) {
+		return (isSubroutine[address] ? "sub_" : "L") + Hex(address, 4);
+	};
+
+	out << "; " << romSize << " bytes at 0x" << Hex(romStart, 4)
+		<< ", rom_hash " << std::hex << std::setfill('0') << std::setw(16)
+		<< romHash << std::dec << std::setfill(' ') << '\n'
+		<< "; " << CountBytes(CODE) << " bytes of code in " << blocks.size()
+		<< " basic blocks, " << subroutines.size() << " subroutines\n"
+		<< "; " << CountBytes(SPRITE) << " bytes of sprites, "
+		<< CountBytes(DATA) << " bytes of other data, " << CountBytes(0)
+		<< " bytes not reached\n";
+	if (invalidCount > 0) {
+		out << "; " << invalidCount << " invalid instructions reached\n";
+	}
+
+	size_t nextBlock = 0;
+	uint32_t address = 0;
+	while (address < Chippin8::MEMORY_SIZE) {
+		bool isInROM = IsInROM(address);
+		if (!isInROM && flags[address] == 0) {
+			++address;
+			continue;
+		}
+
+		while (nextBlock < blocks.size()
+			&& blocks[nextBlock].start < address) {
+			++nextBlock;
+		}
+		if (nextBlock < blocks.size()
+			&& blocks[nextBlock].start == address) {
+			const BasicBlock& block = blocks[nextBlock];
+			std::string line = "\n";
+			line += label((uint16_t)address) + ":";
+			for (size_t i = 0; i < block.successors.size(); ++i) {
+				line += (i == 0 ? "\t\t; -> " : ", ")
+					+ label(block.successors[i]);
+			}
+			if (block.isIndirect) {
+				line += ", ... (indirect)";
+			}
+			else if (block.isReturn) {
+				line += "\t\t; return";
+			}
+			out << line << '\n';
+		}
+
+		out << '\t' << Hex(address, 4) << "  ";
+		if (isInstruction[address]) {
+			// An instruction that starts within this one is listed too
+			uint32_t length = IsNamed(ReadOpcode(address), "F000") ? 4 : 2;
+			for (uint32_t i = 1; i < length; ++i) {
+				if (isInstruction[(uint16_t)(address + i)]) {
+					length = i;
+					break;
+				}
+			}
+			std::string bytes;
+			for (uint32_t i = 0; i < length; ++i) {
+				bytes += Hex(memory[(uint16_t)(address + i)], 2);
+			}
+			out << std::left << std::setw(10) << bytes << std::right
+				<< Disassemble((uint16_t)address);
+			if (flags[address] & (SPRITE | DATA)) {
+				out << "\t; also " << GetKindName(flags[address] & ~CODE);
+			}
+			out << '\n';
+			address += length;
+		}
+		else if (flags[address] & SPRITE) {
+			uint8_t row = memory[address];
+			out << Hex(row, 2) << "        .sprite ";
+			for (int bit = 7; bit >= 0; --bit) {
+				out << ((row >> bit) & 1 ? '#' : '.');
+			}
+			out << '\n';
+			++address;
+		}
+		else {
+			// Runs of bytes of the same kind, up to a line at a time
+			uint8_t kind = flags[address];
+			uint32_t end = address + 1;
+			while (end < Chippin8::MEMORY_SIZE && end - address < BYTES_PER_LINE
+				&& flags[end] == kind && !isInstruction[end]
+				&& IsInROM(end) == isInROM) {
+				++end;
+			}
+			for (uint32_t i = address; i < end; ++i) {
+				out << Hex(memory[i], 2) << ' ';
+			}
+			out << std::string((BYTES_PER_LINE - (end - address)) * 3, ' ')
+				<< " ; " << GetKindName(kind) << '\n';
+			address = end;
+		}
+	}
+}
+
+void ROMAnalysis::WriteJSON(std::ostream& out) const {
+	auto address = [](uint32_t value) {
+		return "\"0x" + Hex(value, 4) + "\"";
+	};
+
+	out << "{\n"
+		<< "  \"rom_hash\": \"" << std::hex << std::setfill('0')
+		<< std::setw(16) << romHash << std::dec << std::setfill(' ')
+		<< "\",\n"
+		<< "  \"start\": " << address(romStart) << ",\n"
+		<< "  \"size\": " << romSize << ",\n"
+		<< "  \"bytes\": {\"code\": " << CountBytes(CODE)
+		<< ", \"sprite\": " << CountBytes(SPRITE)
+		<< ", \"data\": " << CountBytes(DATA)
+		<< ", \"unknown\": " << CountBytes(0) << "},\n"
+		<< "  \"invalid_instructions\": " << invalidCount << ",\n";
+
+	out << "  \"subroutines\": [";
+	for (size_t i = 0; i < subroutines.size(); ++i) {
+		out << (i > 0 ? ", " : "") << address(subroutines[i]);
+	}
+	out << "],\n";
+
+	out << "  \"blocks\": [";
+	for (size_t i = 0; i < blocks.size(); ++i) {
+		const BasicBlock& block = blocks[i];
+		out << (i > 0 ? ",\n" : "\n")
+			<< "    {\"start\": " << address(block.start)
+			<< ", \"end\": " << address(block.end)
+			<< ", \"successors\": [";
+		for (size_t k = 0; k < block.successors.size(); ++k) {
+			out << (k > 0 ? ", " : "") << address(block.successors[k]);
+		}
+		out << "], \"indirect\": " << (block.isIndirect ? "true" : "false")
+			<< ", \"return\": " << (block.isReturn ? "true" : "false")
+			<< "}";
+	}
+	out << "\n  ],\n";
+
+	out << "  \"instructions\": [";
+	bool isFirst = true;
+	for (uint16_t i : instructions) {
+		out << (isFirst ? "\n" : ",\n")
+			<< "    {\"address\": " << address(i)
+			<< ", \"opcode\": \"" << Hex(ReadOpcode(i), 4)
+			<< "\", \"name\": \"" << Chippin8::GetOpcodeName(ReadOpcode(i))
+			<< "\", \"text\": \"" << Disassemble(i) << "\"}";
+		isFirst = false;
+	}
+	out << "\n  ],\n";
+
+	// Regions of the ROM, and of anything outside it that was reached
+	out << "  \"regions\": [";
+	isFirst = true;
+	uint32_t start = 0;
+	while (start < Chippin8::MEMORY_SIZE) {
+		bool isInROM = IsInROM(start);
+		if (!isInROM && flags[start] == 0) {
+			++start;
+			continue;
+		}
+		uint32_t end = start + 1;
+		while (end < Chippin8::MEMORY_SIZE && flags[end] == flags[start]
+			&& IsInROM(end) == isInROM) {
+			++end;
+		}
+		out << (isFirst ? "\n" : ",\n")
+			<< "    {\"start\": " << address(start)
+			<< ", \"end\": " << address(end)
+			<< ", \"kind\": \"" << GetKindName(flags[start]) << "\"}";
+		isFirst = false;
+		start = end;
+	}
+	out << "\n  ]\n}\n";
+}
+
+bool ROMAnalysis::WriteJSON(const std::string& filename) const {
+	std::ofstream file(filename);
+	if (!file.is_open()) {
+		return false;
+	}
+	WriteJSON(file);
+	return file.good();
+}
\ No newline at end of file
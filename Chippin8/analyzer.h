@@ -0,0 +1,138 @@
+/*
+	Static analysis of a loaded ROM, without running it. Starting at the
+	entry point, every path through the program is followed (jumps, calls,
+	returns and both sides of every skip) to find which bytes are code, and
+	the code is split into basic blocks linked into a control-flow graph.
+	Along the way the index register is tracked through ANNN and F000 NNNN,
+	so that the bytes the program draws (DXYN) are found to be sprites, and
+	the bytes it reads or writes otherwise (FX33, FX55, FX65, ...) to be
+	data. Anything never reached is left unknown.
+
+	Instructions are classified with the same decoder the interpreter uses
+	(see Chippin8::GetOpcodeName), and disassembled into the usual
+	mnemonics (CLS, LD VA, 0x02, DRW V0, V1, 5, ...).
+
+	Paths end where they leave the ROM, or run into bytes that are not an
+	instruction (zero padding or an opcode no profile has), so data after
+	the code is not taken for more of it.
+
+	The analysis is conservative rather than complete: the targets of BNNN
+	depend on V0 (or VX), so only a jump table of 1NNN right at NNN is
+	followed, and code that is only reached through self-modifying code or
+	a computed jump is not found. The block starts are still useful to the
+	Recompiler (see Recompiler::Precompile), which translates them before
+	the program starts and leaves the rest to be found while running.
+*/
+
+#ifndef ANALYZER_H
+#define ANALYZER_H
+
+#include "emulator.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class ROMAnalysis {
+public:
+	// What the byte at an address was found to be. A byte can be more than
+	// one (e.g. code that is also drawn), and none if it was never reached.
+	static constexpr uint8_t CODE = 0x1;
+	static constexpr uint8_t SPRITE = 0x2;	// Drawn by DXYN
+	static constexpr uint8_t DATA = 0x4;	// Read or written otherwise
+
+	// A run of instructions that is only ever entered at its start
+	struct BasicBlock {
+		uint16_t start;					// Address of the first instruction
+		uint16_t end;					// Address after the last instruction
+		std::vector<uint16_t> successors;	// Blocks it may go on to
+		bool isIndirect;				// Ends in BNNN, whose targets are
+										// only known while running
+		bool isReturn;					// Ends in 00EE
+	};
+
+	ROMAnalysis();
+
+	// Analyze the memory of c8, starting at 0x200 and at the program 
+	// counter (e.g. after loading a state)
+	void Analyze(const Chippin8& c8);
+
+	// Flags of the byte at address (see CODE, SPRITE and DATA)
+	uint8_t GetFlags(uint16_t address) const { return flags[address]; }
+
+	// Basic blocks, by start address
+	const std::vector<BasicBlock>& GetBlocks() const { return blocks; }
+
+	// Start addresses of all basic blocks
+	std::vector<uint16_t> GetBlockStarts() const;
+
+	// Targets of 2NNN, by address
+	const std::vector<uint16_t>& GetSubroutines() const {
+		return subroutines;
+	}
+
+	// Number of bytes with any of the given flags, or with none if 0
+	size_t CountBytes(uint8_t flag) const;
+
+	// Reachable instructions that are not instructions of any profile
+	size_t GetInvalidCount() const { return invalidCount; }
+
+	// Mnemonic of the instruction at address, e.g. "LD VA, 0x02"
+	std::string Disassemble(uint16_t address) const;
+
+	// Annotated disassembly of the ROM: code with its block labels,
+	// sprites drawn as pixels and data and unknown bytes as bytes
+	void WriteText(std::ostream& out) const;
+
+	// The same as a JSON object: the blocks with their successors, the
+	// subroutines, every instruction and the ROM split into regions of the
+	// same kind
+	void WriteJSON(std::ostream& out) const;
+	bool WriteJSON(const std::string& filename) const;
+
+private:
+	std::vector<uint8_t> memory;		// Copy of all 64KB
+	std::vector<uint8_t> flags;			// By address
+	std::vector<bool> isInstruction;	// An instruction starts here
+	std::vector<uint16_t> instructions;	// Where they start, in order
+	std::vector<BasicBlock> blocks;
+	std::vector<uint16_t> subroutines;
+	uint16_t romStart;
+	size_t romSize;
+	uint64_t romHash;
+	size_t invalidCount;
+
+	// How the instruction at an address passes control on
+	struct Flow {
+		uint16_t length;			// 4 for F000 NNNN, 2 for anything else
+		bool fallsThrough;			// May go on to the next instruction
+		bool endsBlock;				// Jumps, calls, skips, returns, exits
+		bool isCall;
+		bool isIndirect;			// BNNN
+		bool isReturn;
+		std::vector<uint16_t> targets;	// Anywhere else it may go
+	};
+
+	bool IsInROM(size_t address) const {
+		return address >= romStart && address < romStart + romSize;
+	}
+
+	uint16_t ReadOpcode(uint16_t address) const {
+		return (memory[address] << 8) | memory[(uint16_t)(address + 1)];
+	}
+
+	void GetFlow(uint16_t address, Flow& flow) const;
+
+	// Mark length bytes from address (wrapping around) with flag
+	void Mark(uint16_t address, size_t length, uint8_t flag);
+
+	// Split the instructions found into basic blocks
+	void FindBlocks(const std::vector<bool>& isLeader);
+
+	// Name of the kinds of byte in flag, e.g. "code" or "code+sprite"
+	static std::string GetKindName(uint8_t flag);
+};
+
+#endif // ANALYZER_H
\ No newline at end of file
@@ -0,0 +1,78 @@
+#include "audio.h"
+
+#include <math.h>
+
+// Pattern played by programs that never load one: 4 bits on, 4 bits off,
+// which is 500 Hz at the default pitch
+static const uint8_t BEEPER_PATTERN[16] = {
+	0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+	0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0
+};
+
+const int PATTERN_BITS = 128;
+
+// Bits per second of the pattern at the default pitch (64)
+const double BASE_BIT_RATE = 4000.0;
+
+// A quarter of full scale, loud enough without drowning out anything else
+const float AMPLITUDE = 8192.0f;
+
+// Change in gain per sample. Fading in or out takes about 1 ms.
+const float FADE_STEP = 1.0f / 48;
+
+AudioSynthesizer::AudioSynthesizer() : phase(0), gain(0) {
+	for (int i = 0; i < AUDIO_SAMPLES_PER_FRAME; ++i) {
+		samples[i] = 0;
+	}
+}
+
+void AudioSynthesizer::RenderFrame(const Chippin8& c8, AudioRing& ring,
+	size_t maxBuffered) {
+	bool hasPattern = false;
+	for (int i = 0; i < 16; ++i) {
+		hasPattern |= c8.audioPattern[i] != 0;
+	}
+	double bitRate = BASE_BIT_RATE * pow(2.0, (c8.pitch - 64) / 48.0);
+	Render(hasPattern ? c8.audioPattern : BEEPER_PATTERN, bitRate,
+		c8.buzzerSounded);
+
+	if (ring.Size() <= maxBuffered) {
+		ring.Write(samples, AUDIO_SAMPLES_PER_FRAME);
+	}
+}
+
+void AudioSynthesizer::RenderSilence(AudioRing& ring, size_t maxBuffered) {
+	Render(BEEPER_PATTERN, BASE_BIT_RATE, false);
+	if (ring.Size() <= maxBuffered) {
+		ring.Write(samples, AUDIO_SAMPLES_PER_FRAME);
+	}
+}
+
+void AudioSynthesizer::Render(const uint8_t pattern[16], double bitRate,
+	bool isOn) {
+	// Every tone starts at the start of the pattern, so that it sounds the
+	// same every time
+	if (gain == 0 && isOn) {
+		phase = 0;
+	}
+
+	double step = bitRate / AUDIO_SAMPLE_RATE;
+	float target = isOn ? 1.0f : 0.0f;
+	for (int i = 0; i < AUDIO_SAMPLES_PER_FRAME; ++i) {
+		if (gain < target) {
+			gain = gain + FADE_STEP < target ? gain + FADE_STEP : target;
+		}
+		else if (gain > target) {
+			gain = gain - FADE_STEP > target ? gain - FADE_STEP : target;
+		}
+
+		int bit = (int)phase;
+		bool isSet = (pattern[bit / 8] >> (7 - bit % 8)) & 1;
+		samples[i] = (int16_t)(gain * (isSet ? AMPLITUDE : -AMPLITUDE));
+
+		phase += step;
+		if (phase >= PATTERN_BITS) {
+			phase = fmod(phase, PATTERN_BITS);
+		}
+	}
+}
\ No newline at end of file
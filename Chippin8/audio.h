@@ -0,0 +1,58 @@
+/*
+	Sound. The buzzer is synthesized on the emulation thread, one frame of
+	samples for every frame run, and handed to the audio device through a
+	lock-free ring (see Platform::OpenAudio). The amount of audio is tied
+	to emulated time rather than to the clock: every frame gives exactly
+	AUDIO_SAMPLES_PER_FRAME samples, so the sound is the same however
+	late a frame runs, and the audio thread never takes a lock, allocates
+	or calls into the emulator.
+
+	The buzzer plays the 128-bit XO-CHIP audio pattern (F002) as 1-bit
+	samples, at 4000 * 2 ^ ((pitch - 64) / 48) bits per second (FX3A).
+	Programs that never load a pattern (all of CHIP-8 and SUPER-CHIP) get a
+	plain 500 Hz square wave instead. The sound fades in and out over a
+	millisecond, so starting and stopping doesn't click.
+*/
+
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include "emulator.h"
+#include "lockfree.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Output format: mono, signed 16-bit samples
+const int AUDIO_SAMPLE_RATE = 48000;
+const int AUDIO_SAMPLES_PER_FRAME = AUDIO_SAMPLE_RATE / 60;
+
+// Holds about 85 ms of sound, far more than is ever buffered
+typedef SpscRing<int16_t, 4096> AudioRing;
+
+class AudioSynthesizer {
+public:
+	AudioSynthesizer();
+
+	// Synthesize the sound of the frame c8 has just run, and append it to
+	// ring. If the audio device has fallen behind and the ring already
+	// holds more than maxBuffered samples, the frame is dropped instead,
+	// so that the sound never lags further behind the picture.
+	void RenderFrame(const Chippin8& c8, AudioRing& ring,
+		size_t maxBuffered);
+
+	// Append a frame of silence (fading out whatever was playing), e.g.
+	// for frames that were rewound
+	void RenderSilence(AudioRing& ring, size_t maxBuffered);
+
+private:
+	double phase;		// Position in the pattern, in bits (0 - 128)
+	float gain;			// Current volume, fading towards 0 or 1
+	int16_t samples[AUDIO_SAMPLES_PER_FRAME];
+
+	// Synthesize a frame of the pattern at the given bit rate, fading in
+	// if isOn and out otherwise
+	void Render(const uint8_t pattern[16], double bitRate, bool isOn);
+};
+
+#endif // AUDIO_H
\ No newline at end of file
@@ -0,0 +1,533 @@
+/*
+	Chippin8 benchmarks. Measures how fast the emulator runs a fixed set of
+	workloads, and reports every benchmark with its variance as CSV or JSON,
+	so that the results of two builds can be compared.
+
+		./<Chippin8Bench.exe> [--repetitions (number)] [--cycles (number)]
+			[--frames (number)] [--cycles-per-frame (number)] [--jit]
+			[--roms (directory)] [--filter (text)] [--json]
+			[--output (file)]
+
+	The benchmarks are:
+		stream/...	Instruction streams that stress one kind of instruction
+					each (see benchroms.h), run for --cycles instructions
+					with Cycle()
+		rom/...		The bundled ROMs, and the ROMs in --roms if given, run
+					for --frames frames of --cycles-per-frame instructions.
+					Instructions skipped in idle loops count as executed.
+		frame/...	Presenting --frames frames: expanding the display to
+					32-bit pixels, finding the rows that changed (see
+					UpdateFrame) and copying them to a texture. Uploading
+					the texture to the GPU is left to the driver and not
+					measured, so that the benchmarks run without a display.
+
+	--jit also runs the streams and ROMs on the Recompiler. --filter only
+	runs the benchmarks whose name contains the text.
+
+	Every benchmark is run once to warm up (decode caches, compiled blocks,
+	copied memory pages), then --repetitions times (10 by default), and the
+	rate of every repetition is kept. The report has the mean, standard
+	deviation, minimum, median and maximum rate of every benchmark. A
+	benchmark with a high relative standard deviation was disturbed by
+	something else on the machine, and should be run again before it is
+	compared.
+*/
+
+#include "emulator.h"
+#include "recompiler.h"
+#include "framebuffer.h"
+#include "benchroms.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace fs = std::filesystem;
+
+#define USAGE() do{ \
+		std::cout << "Usage: ./<Chippin8Bench>.exe"\
+		<< " [--repetitions (number)] [--cycles (number)]"\
+		<< " [--frames (number)] [--cycles-per-frame (number)] [--jit]"\
+		<< " [--roms (directory)] [--filter (text)] [--json]"\
+		<< " [--output (file)]\n"; \
+		} while(0)
+
+// Where programs are loaded
+const uint16_t START_ADDRESS = 0x200;
+
+// Extensions of the ROMs that are run from --roms
+const char* ROM_EXTENSIONS[] = { ".ch8", ".sc8", ".xo8" };
+
+struct BenchOptions {
+	int repetitions;		// Measured runs of every benchmark
+	uint64_t cycles;		// Instructions per run of a stream
+	uint64_t frames;		// Frames per run of a ROM or a frame benchmark
+	int cyclesPerFrame;
+	bool useRecompiler;		// Also run streams and ROMs on the Recompiler
+	std::string romDirectory;
+	std::string filter;
+};
+
+struct BenchResult {
+	std::string name;			// e.g. "stream/alu"
+	std::string engine;			// "interpreter", "recompiler" or "host"
+	std::string unit;			// What the rates count
+	uint64_t work;				// Units per run
+	std::vector<double> rates;	// Units per second of every run
+};
+
+// Summary of the rates of a benchmark
+struct BenchStatistics {
+	double mean;
+	double standardDeviation;	// Sample standard deviation
+	double minimum;
+	double median;
+	double maximum;
+};
+
+// Keeps the results of the frame benchmarks alive, so that the compiler
+// can't leave out the work
+static volatile uint32_t sink;
+
+/* ----- Measuring ----- */
+
+// Run step once to warm up, then options.repetitions times, timing each
+template <typename Step>
+static void Measure(BenchResult& result, const BenchOptions& options,
+	Step step) {
+	typedef std::chrono::steady_clock Clock;
+	step();
+	for (int i = 0; i < options.repetitions; ++i) {
+		Clock::time_point start = Clock::now();
+		step();
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+		result.rates.push_back(elapsed.count() > 0
+			? result.work / elapsed.count() : 0);
+	}
+}
+
+static BenchStatistics GetStatistics(const std::vector<double>& rates) {
+	BenchStatistics statistics = {};
+	if (rates.empty()) {
+		return statistics;
+	}
+	std::vector<double> sorted = rates;
+	std::sort(sorted.begin(), sorted.end());
+	size_t count = sorted.size();
+
+	double sum = 0;
+	for (double rate : sorted) {
+		sum += rate;
+	}
+	statistics.mean = sum / count;
+	double squares = 0;
+	for (double rate : sorted) {
+		squares += (rate - statistics.mean) * (rate - statistics.mean);
+	}
+	statistics.standardDeviation = count > 1
+		? std::sqrt(squares / (count - 1)) : 0;
+	statistics.minimum = sorted.front();
+	statistics.maximum = sorted.back();
+	statistics.median = count % 2 == 1 ? sorted[count / 2]
+		: (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+	return statistics;
+}
+
+static double RelativeDeviation(const BenchStatistics& statistics) {
+	return statistics.mean > 0
+		? statistics.standardDeviation / statistics.mean : 0;
+}
+
+static bool IsSelected(const std::string& name, const BenchOptions& options) {
+	return name.find(options.filter) != std::string::npos;
+}
+
+/* ----- Emulation ----- */
+
+// Load one of the bundled programs into a fresh machine
+static void LoadBenchROM(Chippin8& c8, const BenchROM& rom) {
+	std::vector<uint8_t> memory(Chippin8::MEMORY_SIZE);
+	c8.GetMemory(memory.data());
+	memcpy(&memory[START_ADDRESS], rom.data, rom.size);
+	c8.SetMemory(memory.data());
+	c8.SetQuirkProfile(rom.quirkProfile);
+	c8.Seed(0);
+}
+
+static void RunStream(const BenchROM& stream, bool useRecompiler,
+	const BenchOptions& options, std::vector<BenchResult>& results) {
+	BenchResult result;
+	result.name = std::string("stream/") + stream.name;
+	result.engine = useRecompiler ? "recompiler" : "interpreter";
+	result.unit = "instructions";
+	result.work = options.cycles;
+
+	// Both are too large to be kept on the stack comfortably
+	std::unique_ptr<Chippin8> c8(new Chippin8());
+	LoadBenchROM(*c8, stream);
+
+	if (useRecompiler) {
+		std::unique_ptr<Recompiler> recompiler(new Recompiler(*c8));
+		Measure(result, options, [&]() { recompiler->Run(options.cycles); });
+	}
+	else {
+		Measure(result, options, [&]() {
+			for (uint64_t i = 0; i < options.cycles; ++i) {
+				c8->Cycle();
+			}
+		});
+	}
+	results.push_back(result);
+}
+
+// Run a ROM loaded into c8 frame by frame
+static void RunFrames(const std::string& name, Chippin8& c8,
+	bool useRecompiler, const BenchOptions& options,
+	std::vector<BenchResult>& results) {
+	BenchResult result;
+	result.name = name;
+	result.engine = useRecompiler ? "recompiler" : "interpreter";
+	result.unit = "instructions";
+	result.work = options.frames * options.cyclesPerFrame;
+
+	std::unique_ptr<Recompiler> recompiler;
+	if (useRecompiler) {
+		recompiler.reset(new Recompiler(c8));
+	}
+	Measure(result, options, [&]() {
+		for (uint64_t i = 0; i < options.frames; ++i) {
+			if (recompiler) {
+				recompiler->RunFrame(options.cyclesPerFrame);
+			}
+			else {
+				c8.RunFrame(options.cyclesPerFrame);
+			}
+			c8.ClearDisplayDirty();
+		}
+	});
+	results.push_back(result);
+}
+
+static void RunROMs(const BenchOptions& options,
+	std::vector<BenchResult>& results) {
+	std::vector<bool> engines = { false };
+	if (options.useRecompiler) {
+		engines.push_back(true);
+	}
+
+	for (const BenchROM& rom : BENCH_ROMS) {
+		std::string name = std::string("rom/") + rom.name;
+		if (!IsSelected(name, options)) {
+			continue;
+		}
+		for (bool useRecompiler : engines) {
+			std::unique_ptr<Chippin8> c8(new Chippin8());
+			LoadBenchROM(*c8, rom);
+			RunFrames(name, *c8, useRecompiler, options, results);
+		}
+	}
+
+	if (options.romDirectory.empty()) {
+		return;
+	}
+	// In a fixed order, so that reports can be diffed
+	std::vector<fs::path> files;
+	for (const fs::directory_entry& entry
+		: fs::recursive_directory_iterator(options.romDirectory)) {
+		std::string extension = entry.path().extension().string();
+		if (entry.is_regular_file() && std::find(std::begin(ROM_EXTENSIONS),
+			std::end(ROM_EXTENSIONS), extension) != std::end(ROM_EXTENSIONS)) {
+			files.push_back(entry.path());
+		}
+	}
+	std::sort(files.begin(), files.end());
+
+	for (const fs::path& file : files) {
+		std::string name = "rom/" + fs::relative(file,
+			options.romDirectory).generic_string();
+		if (!IsSelected(name, options)) {
+			continue;
+		}
+		for (bool useRecompiler : engines) {
+			std::unique_ptr<Chippin8> c8(new Chippin8());
+			if (!c8->LoadROM(file.string())) {
+				std::cerr << "Skipping " << name << ", it can't be loaded\n";
+				break;
+			}
+			c8->Seed(0);
+			RunFrames(name, *c8, useRecompiler, options, results);
+		}
+	}
+}
+
+/* ----- Frame Conversion ----- */
+
+// Fill frame with random pixels in both planes
+static void FillFrame(VideoFrame& frame, bool highResolution,
+	uint64_t& state) {
+	for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+		for (int y = 0; y < DISPLAY_HEIGHT; ++y) {
+			for (int word = 0; word < DISPLAY_WORDS; ++word) {
+				state ^= state << 13;
+				state ^= state >> 7;
+				state ^= state << 17;
+				frame.display[plane][y][word] = state;
+			}
+		}
+	}
+	frame.highResolution = highResolution;
+}
+
+// Present frames[i % 2] for every frame, like the frontend does: find the
+// rows that changed, expand them and copy them to the texture
+static void RunPresent(const std::string& name, const VideoFrame frames[2],
+	const BenchOptions& options, std::vector<BenchResult>& results) {
+	if (!IsSelected(name, options)) {
+		return;
+	}
+	BenchResult result;
+	result.name = name;
+	result.engine = "host";
+	result.unit = "frames";
+	result.work = options.frames;
+
+	std::vector<uint32_t> pixels(DISPLAY_WIDTH * DISPLAY_HEIGHT);
+	std::vector<uint32_t> texture(DISPLAY_WIDTH * DISPLAY_HEIGHT);
+	std::unique_ptr<VideoFrame> presented(new VideoFrame());
+	*presented = frames[1];
+
+	Measure(result, options, [&]() {
+		for (uint64_t i = 0; i < options.frames; ++i) {
+			int firstRow;
+			int rowCount = UpdateFrame(*presented, frames[i % 2], firstRow);
+			if (rowCount > 0) {
+				ExpandFramebuffer(presented->display,
+					presented->highResolution, firstRow, rowCount,
+					pixels.data(), PIXEL_COLORS);
+				int scale = presented->highResolution ? 1 : 2;
+				size_t offset = (size_t)firstRow * scale * DISPLAY_WIDTH;
+				memcpy(&texture[offset], &pixels[offset],
+					(size_t)rowCount * scale * DISPLAY_WIDTH
+					* sizeof(pixels[0]));
+			}
+		}
+		sink = texture[0];
+	});
+	results.push_back(result);
+}
+
+static void RunFrameConversion(const BenchOptions& options,
+	std::vector<BenchResult>& results) {
+	uint64_t state = 0x9E3779B97F4A7C15ull;
+	std::unique_ptr<VideoFrame[]> frames(new VideoFrame[2]);
+
+	// Expanding whole frames, without looking for changes
+	for (bool highResolution : { false, true }) {
+		std::string name = highResolution ? "frame/expand_high"
+			: "frame/expand_low";
+		if (!IsSelected(name, options)) {
+			continue;
+		}
+		FillFrame(frames[0], highResolution, state);
+		BenchResult result;
+		result.name = name;
+		result.engine = "host";
+		result.unit = "frames";
+		result.work = options.frames;
+
+		std::vector<uint32_t> pixels(DISPLAY_WIDTH * DISPLAY_HEIGHT);
+		int height = highResolution ? DISPLAY_HEIGHT : DISPLAY_HEIGHT / 2;
+		Measure(result, options, [&]() {
+			for (uint64_t i = 0; i < options.frames; ++i) {
+				ExpandFramebuffer(frames[0].display, highResolution, 0,
+					height, pixels.data(), PIXEL_COLORS);
+			}
+			sink = pixels[0];
+		});
+		results.push_back(result);
+	}
+
+	// Every row changes
+	FillFrame(frames[0], true, state);
+	FillFrame(frames[1], true, state);
+	RunPresent("frame/present_full", frames.get(), options, results);
+
+	// Only the rows of an 8 x 15 sprite change, like in most games
+	frames[1] = frames[0];
+	for (int y = 20; y < 35; ++y) {
+		frames[1].display[0][y][0] ^= 0xFFull << 32;
+	}
+	RunPresent("frame/present_sprite", frames.get(), options, results);
+
+	// Nothing changes, only the comparison is left
+	frames[1] = frames[0];
+	RunPresent("frame/present_unchanged", frames.get(), options, results);
+}
+
+/* ----- Reports ----- */
+
+static void WriteCSV(std::ostream& out,
+	const std::vector<BenchResult>& results) {
+	out << "benchmark,engine,unit,work,repetitions,mean_per_second,"
+		<< "stddev_per_second,relative_stddev,min_per_second,"
+		<< "median_per_second,max_per_second\n";
+	for (const BenchResult& result : results) {
+		BenchStatistics statistics = GetStatistics(result.rates);
+		out << '"' << result.name << "\","
+			<< result.engine << ','
+			<< result.unit << ','
+			<< result.work << ','
+			<< result.rates.size() << ','
+			<< statistics.mean << ','
+			<< statistics.standardDeviation << ','
+			<< RelativeDeviation(statistics) << ','
+			<< statistics.minimum << ','
+			<< statistics.median << ','
+			<< statistics.maximum << '\n';
+	}
+}
+
+static void WriteJSON(std::ostream& out,
+	const std::vector<BenchResult>& results) {
+	out << "[\n";
+	for (size_t i = 0; i < results.size(); ++i) {
+		const BenchResult& result = results[i];
+		BenchStatistics statistics = GetStatistics(result.rates);
+		out << "  {\"benchmark\": \"" << result.name
+			<< "\", \"engine\": \"" << result.engine
+			<< "\", \"unit\": \"" << result.unit
+			<< "\", \"work\": " << result.work
+			<< ", \"repetitions\": " << result.rates.size()
+			<< ", \"mean_per_second\": " << statistics.mean
+			<< ", \"stddev_per_second\": " << statistics.standardDeviation
+			<< ", \"relative_stddev\": " << RelativeDeviation(statistics)
+			<< ", \"min_per_second\": " << statistics.minimum
+			<< ", \"median_per_second\": " << statistics.median
+			<< ", \"max_per_second\": " << statistics.maximum
+			<< ", \"samples\": [";
+		for (size_t j = 0; j < result.rates.size(); ++j) {
+			out << (j > 0 ? ", " : "") << result.rates[j];
+		}
+		out << (i + 1 < results.size() ? "]},\n" : "]}\n");
+	}
+	out << "]\n";
+}
+
+/* ----- Main ----- */
+
+// Check if argument is a number
+static bool isNumber(const std::string& s) {
+	return !s.empty() && std::all_of(s.begin(), s.end(), ::isdigit);
+}
+
+int main(int argc, char* argv[]) {
+	BenchOptions options;
+	options.repetitions = 10;		// Default values
+	options.cycles = 5000000;
+	options.frames = 2000;
+	options.cyclesPerFrame = 1000;
+	options.useRecompiler = false;
+
+	bool isJson = false;
+	std::string outputFile;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--jit") {
+			options.useRecompiler = true;
+		}
+		else if (arg == "--json") {
+			isJson = true;
+		}
+		else if (arg == "--output" && i + 1 < argc) {
+			outputFile = argv[++i];
+		}
+		else if (arg == "--roms" && i + 1 < argc) {
+			options.romDirectory = argv[++i];
+		}
+		else if (arg == "--filter" && i + 1 < argc) {
+			options.filter = argv[++i];
+		}
+		else if ((arg == "--repetitions" || arg == "--cycles"
+			|| arg == "--frames" || arg == "--cycles-per-frame")
+			&& i + 1 < argc) {
+			std::string countStr = argv[++i];
+			if (!isNumber(countStr) || std::stoull(countStr) == 0) {
+				USAGE();
+				return EXIT_FAILURE;
+			}
+			uint64_t count = std::stoull(countStr);
+			if (arg == "--repetitions") {
+				options.repetitions = (int)count;
+			}
+			else if (arg == "--cycles") {
+				options.cycles = count;
+			}
+			else if (arg == "--frames") {
+				options.frames = count;
+			}
+			else {
+				options.cyclesPerFrame = (int)count;
+			}
+		}
+		else {
+			USAGE();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!options.romDirectory.empty()
+		&& !fs::is_directory(options.romDirectory)) {
+		USAGE();
+		return EXIT_FAILURE;
+	}
+
+	std::vector<BenchResult> results;
+	for (const BenchROM& stream : BENCH_STREAMS) {
+		if (!IsSelected(std::string("stream/") + stream.name, options)) {
+			continue;
+		}
+		RunStream(stream, false, options, results);
+		if (options.useRecompiler) {
+			RunStream(stream, true, options, results);
+		}
+	}
+	RunROMs(options, results);
+	RunFrameConversion(options, results);
+
+	std::ofstream file;
+	if (!outputFile.empty()) {
+		file.open(outputFile);
+		if (!file.is_open()) {
+			std::cerr << "Could not write " << outputFile << '\n';
+			return EXIT_FAILURE;
+		}
+	}
+	std::ostream& out = outputFile.empty() ? std::cout : file;
+	if (isJson) {
+		WriteJSON(out, results);
+	}
+	else {
+		WriteCSV(out, results);
+	}
+
+	// Summary on stderr, so that it does not end up in the report
+	for (const BenchResult& result : results) {
+		BenchStatistics statistics = GetStatistics(result.rates);
+		std::cerr << result.name << " (" << result.engine << "): "
+			<< statistics.mean / 1e6 << " M " << result.unit
+			<< " per second +/- " << RelativeDeviation(statistics) * 100
+			<< "%\n";
+	}
+
+	return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,210 @@
+/*
+	Programs run by the benchmarks (see bench.cpp). They are small enough to
+	be kept here as data, so that the benchmarks never depend on files that
+	may be missing or may change between releases.
+
+	The instruction streams each stress one kind of instruction in an
+	endless loop, and are run with Cycle() (or the Recompiler) directly.
+	The ROMs behave like real programs, drawing and waiting on the delay
+	timer, and are run frame by frame.
+
+	Maze is David Winter's public domain maze generator, changed to start
+	over instead of stopping when the screen is full. The other programs
+	were written for the benchmarks, and are public domain as well.
+*/
+
+#ifndef BENCHROMS_H
+#define BENCHROMS_H
+
+#include "quirks.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct BenchROM {
+	const char* name;
+	QuirkProfile quirkProfile;	// Profile the program is written for
+	const uint8_t* data;		// Loaded at 0x200
+	size_t size;
+};
+
+/* ----- Instruction Streams ----- */
+
+// Arithmetic and logic (8XYN, 7XNN), one jump per 13 instructions
+const uint8_t ALU_STREAM[] = {
+	0x60, 0x01,		// 200: V0 = 0x01
+	0x61, 0x37,		// 202: V1 = 0x37
+	0x62, 0xA5,		// 204: V2 = 0xA5
+	0x80, 0x14,		// 206: V0 += V1
+	0x81, 0x25,		// 208: V1 -= V2
+	0x82, 0x01,		// 20A: V2 |= V0
+	0x83, 0x12,		// 20C: V3 &= V1
+	0x84, 0x23,		// 20E: V4 ^= V2
+	0x85, 0x06,		// 210: V5 = V0 >> 1
+	0x86, 0x1E,		// 212: V6 = V1 << 1
+	0x87, 0x27,		// 214: V7 = V2 - V7
+	0x88, 0x30,		// 216: V8 = V3
+	0x79, 0x17,		// 218: V9 += 0x17
+	0x8A, 0x94,		// 21A: VA += V9
+	0x8B, 0xA5,		// 21C: VB -= VA
+	0x12, 0x06		// 21E: jump 206
+};
+
+// Skips, calls and returns, hardly anything else
+const uint8_t BRANCH_STREAM[] = {
+	0x70, 0x01,		// 200: V0 += 1
+	0x30, 0x80,		// 202: skip if V0 == 0x80
+	0x71, 0x01,		// 204: V1 += 1
+	0x41, 0x40,		// 206: skip if V1 != 0x40
+	0x61, 0x00,		// 208: V1 = 0
+	0x50, 0x10,		// 20A: skip if V0 == V1
+	0x22, 0x14,		// 20C: call 214
+	0x90, 0x10,		// 20E: skip if V0 != V1
+	0x72, 0x01,		// 210: V2 += 1
+	0x12, 0x00,		// 212: jump 200
+	0x73, 0x01,		// 214: V3 += 1
+	0x33, 0x00,		// 216: skip if V3 == 0
+	0x00, 0xEE,		// 218: return
+	0x74, 0x01,		// 21A: V4 += 1
+	0x00, 0xEE		// 21C: return
+};
+
+// Sprites of 15, 8 and 5 rows at random positions
+const uint8_t DRAW_STREAM[] = {
+	0xA2, 0x14,		// 200: I = 214
+	0xC0, 0x3F,		// 202: V0 = random & 0x3F
+	0xC1, 0x1F,		// 204: V1 = random & 0x1F
+	0xD0, 0x1F,		// 206: draw 15 rows at V0, V1
+	0xD0, 0x18,		// 208: draw 8 rows at V0, V1
+	0xF2, 0x29,		// 20A: I = digit V2
+	0x72, 0x01,		// 20C: V2 += 1
+	0xD1, 0x05,		// 20E: draw 5 rows at V1, V0
+	0x12, 0x00,		// 210: jump 200
+	0x00, 0x00,		// 212:
+	0x18, 0x3C, 0x7E, 0xFF, 0xDB, 0xFF, 0x7E, 0x3C,		// 214: sprite
+	0x18, 0x24, 0x42, 0x81, 0x42, 0x24, 0x18
+};
+
+// Register stores and loads (FX55, FX65) and BCD (FX33), which write to
+// memory and have to invalidate what was decoded there
+const uint8_t MEMORY_STREAM[] = {
+	0xA4, 0x00,		// 200: I = 400
+	0xF0, 0x1E,		// 202: I += V0
+	0xFF, 0x55,		// 204: store V0 - VF
+	0xA4, 0x00,		// 206: I = 400
+	0xF0, 0x1E,		// 208: I += V0
+	0xFF, 0x65,		// 20A: load V0 - VF
+	0xF3, 0x33,		// 20C: store BCD of V3
+	0x70, 0x07,		// 20E: V0 += 7
+	0x12, 0x00		// 210: jump 200
+};
+
+const BenchROM BENCH_STREAMS[] = {
+	{ "alu", QuirkProfile::CosmacVIP, ALU_STREAM, sizeof(ALU_STREAM) },
+	{ "branch", QuirkProfile::CosmacVIP, BRANCH_STREAM,
+		sizeof(BRANCH_STREAM) },
+	{ "draw", QuirkProfile::CosmacVIP, DRAW_STREAM, sizeof(DRAW_STREAM) },
+	{ "memory", QuirkProfile::CosmacVIP, MEMORY_STREAM,
+		sizeof(MEMORY_STREAM) }
+};
+
+/* ----- ROMs ----- */
+
+// Fills the screen with random diagonals, then clears it and starts over
+const uint8_t MAZE_ROM[] = {
+	0xA2, 0x22,		// 200: I = 222 (/)
+	0xC2, 0x01,		// 202: V2 = random & 1
+	0x32, 0x01,		// 204: skip if V2 == 1
+	0xA2, 0x1E,		// 206: I = 21E (\)
+	0xD0, 0x14,		// 208: draw 4 rows at V0, V1
+	0x70, 0x04,		// 20A: V0 += 4
+	0x30, 0x40,		// 20C: skip if V0 == 64
+	0x12, 0x00,		// 20E: jump 200
+	0x60, 0x00,		// 210: V0 = 0
+	0x71, 0x04,		// 212: V1 += 4
+	0x31, 0x20,		// 214: skip if V1 == 32
+	0x12, 0x00,		// 216: jump 200
+	0x00, 0xE0,		// 218: clear
+	0x61, 0x00,		// 21A: V1 = 0
+	0x12, 0x00,		// 21C: jump 200
+	0x80, 0x40, 0x20, 0x10,		// 21E: \ diagonal
+	0x20, 0x40, 0x80, 0x10		// 222: / diagonal
+};
+
+// Draws a frame counter, then waits for the next frame on the delay timer,
+// like most games do
+const uint8_t COUNTER_ROM[] = {
+	0x6A, 0x00,		// 200: VA = 0
+	0x00, 0xE0,		// 202: clear
+	0xA3, 0x00,		// 204: I = 300
+	0xFA, 0x33,		// 206: store BCD of VA
+	0xF2, 0x65,		// 208: load V0 - V2
+	0x6B, 0x00,		// 20A: VB = 0
+	0x6C, 0x00,		// 20C: VC = 0
+	0xF0, 0x29,		// 20E: I = digit V0
+	0xDB, 0xC5,		// 210: draw 5 rows at VB, VC
+	0x7B, 0x05,		// 212: VB += 5
+	0xF1, 0x29,		// 214: I = digit V1
+	0xDB, 0xC5,		// 216: draw 5 rows at VB, VC
+	0x7B, 0x05,		// 218: VB += 5
+	0xF2, 0x29,		// 21A: I = digit V2
+	0xDB, 0xC5,		// 21C: draw 5 rows at VB, VC
+	0x7A, 0x01,		// 21E: VA += 1
+	0x6D, 0x01,		// 220: VD = 1
+	0xFD, 0x15,		// 222: delay = VD
+	0xFD, 0x07,		// 224: VD = delay
+	0x3D, 0x00,		// 226: skip if VD == 0
+	0x12, 0x24,		// 228: jump 224
+	0x12, 0x02		// 22A: jump 202
+};
+
+// High resolution 16 x 16 sprites (DXY0), scrolled down and right
+// (SUPER-CHIP)
+const uint8_t SCROLL_ROM[] = {
+	0x00, 0xFF,		// 200: high resolution
+	0xA2, 0x20,		// 202: I = 220
+	0x60, 0x00,		// 204: V0 = 0
+	0x61, 0x00,		// 206: V1 = 0
+	0xD0, 0x10,		// 208: draw 16 x 16 at V0, V1
+	0x70, 0x03,		// 20A: V0 += 3
+	0x71, 0x02,		// 20C: V1 += 2
+	0xD0, 0x10,		// 20E: draw 16 x 16 at V0, V1
+	0x00, 0xC1,		// 210: scroll down 1
+	0x00, 0xFB,		// 212: scroll right 4
+	0xC2, 0x7F,		// 214: V2 = random & 0x7F
+	0xC3, 0x3F,		// 216: V3 = random & 0x3F
+	0xD2, 0x30,		// 218: draw 16 x 16 at V2, V3
+	0x12, 0x08,		// 21A: jump 208
+	0x00, 0x00, 0x00, 0x00,		// 21C:
+	0x07, 0xE0, 0x1F, 0xF8, 0x3F, 0xFC, 0x7F, 0xFE,		// 220: sprite
+	0x7F, 0xFE, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x7F, 0xFE,
+	0x7F, 0xFE, 0x3F, 0xFC, 0x1F, 0xF8, 0x07, 0xE0
+};
+
+// Sprites drawn to both planes, which are then scrolled apart (XO-CHIP)
+const uint8_t PLANES_ROM[] = {
+	0xF3, 0x01,		// 200: draw to planes 1 and 2
+	0xA2, 0x18,		// 202: I = 218
+	0xC0, 0x3F,		// 204: V0 = random & 0x3F
+	0xC1, 0x1F,		// 206: V1 = random & 0x1F
+	0xD0, 0x18,		// 208: draw 8 rows at V0, V1 on both planes
+	0xF1, 0x01,		// 20A: draw to plane 1
+	0x00, 0xD2,		// 20C: scroll up 2
+	0xF2, 0x01,		// 20E: draw to plane 2
+	0x00, 0xC1,		// 210: scroll down 1
+	0xF3, 0x01,		// 212: draw to planes 1 and 2
+	0x12, 0x04,		// 214: jump 204
+	0x00, 0x00,		// 216:
+	0x3C, 0x42, 0x81, 0x81, 0x81, 0x81, 0x42, 0x3C,		// 218: plane 1
+	0x00, 0x3C, 0x7E, 0x7E, 0x7E, 0x7E, 0x3C, 0x00		// 220: plane 2
+};
+
+const BenchROM BENCH_ROMS[] = {
+	{ "maze", QuirkProfile::CosmacVIP, MAZE_ROM, sizeof(MAZE_ROM) },
+	{ "counter", QuirkProfile::CosmacVIP, COUNTER_ROM, sizeof(COUNTER_ROM) },
+	{ "scroll", QuirkProfile::SuperChip, SCROLL_ROM, sizeof(SCROLL_ROM) },
+	{ "planes", QuirkProfile::XOChip, PLANES_ROM, sizeof(PLANES_ROM) }
+};
+
+#endif // BENCHROMS_H
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include "chippin8.h"
+#include "emulator.h"
+#include "recompiler.h"
+#include "analyzer.h"
+#include "framebuffer.h"
+
+#include <memory>
+#include <new>
+
+static_assert(CHIPPIN8_PLANES == DISPLAY_PLANES,
+	"The framebuffer view has to match the display");
+static_assert((int)CHIPPIN8_QUIRKS_XOCHIP == (int)QuirkProfile::XOChip,
+	"The quirk profiles have to match quirks.h");
+
+struct Chippin8Machine {
+	Chippin8 c8;
+	std::unique_ptr<Recompiler> recompiler;		// Set while it is used
+	uint64_t seed;								// Given to Chippin8_Create
+};
+
+// Translate the code of the ROM loaded before it is run (see ROMAnalysis)
+static void Precompile(Chippin8Machine& machine) {
+	ROMAnalysis analysis;
+	analysis.Analyze(machine.c8);
+	machine.recompiler->Precompile(analysis.GetBlockStarts());
+}
+
+Chippin8Machine* Chippin8_Create(uint64_t seed) {
+	Chippin8Machine* machine = new (std::nothrow) Chippin8Machine();
+	if (machine != nullptr) {
+		machine->seed = seed;
+		machine->c8.Seed(seed);
+	}
+	return machine;
+}
+
+void Chippin8_Destroy(Chippin8Machine* machine) {
+	delete machine;
+}
+
+bool Chippin8_LoadROM(Chippin8Machine* machine, const uint8_t* data,
+	size_t size, Chippin8Quirks quirks) {
+	if (size == 0 || size > Chippin8::MAX_ROM_SIZE) {
+		return false;
+	}
+
+	// Start from a machine as it was created, whatever ran on it before
+	Chippin8& c8 = machine->c8;
+	c8.Reset();
+	c8.Seed(machine->seed);
+	c8.LoadROM(data, size);
+	c8.SetQuirkProfile((QuirkProfile)quirks);
+	if (machine->recompiler) {
+		Precompile(*machine);
+	}
+	return true;
+}
+
+void Chippin8_SetQuirks(Chippin8Machine* machine, Chippin8Quirks quirks) {
+	machine->c8.SetQuirkProfile((QuirkProfile)quirks);
+}
+
+bool Chippin8_UseRecompiler(Chippin8Machine* machine, bool enabled) {
+	if (!enabled) {
+		machine->recompiler.reset();
+	}
+	else if (!machine->recompiler) {
+		machine->recompiler.reset(new Recompiler(machine->c8));
+		Precompile(*machine);
+	}
+	return Recompiler::IsSupported();
+}
+
+void Chippin8_RunCycles(Chippin8Machine* machine, uint64_t cycles) {
+	if (machine->recompiler) {
+		machine->recompiler->Run(cycles);
+		return;
+	}
+	for (uint64_t i = 0; i < cycles; ++i) {
+		machine->c8.Cycle();
+	}
+}
+
+void Chippin8_RunFrame(Chippin8Machine* machine, int cyclesPerFrame) {
+	if (machine->recompiler) {
+		machine->recompiler->RunFrame(cyclesPerFrame);
+	}
+	else {
+		machine->c8.RunFrame(cyclesPerFrame);
+	}
+}
+
+void Chippin8_SetKeypad(Chippin8Machine* machine, uint16_t keypad) {
+	machine->c8.SetKeypadMask(keypad);
+}
+
+uint16_t Chippin8_GetKeypad(const Chippin8Machine* machine) {
+	return machine->c8.GetKeypadMask();
+}
+
+bool Chippin8_IsSoundOn(const Chippin8Machine* machine) {
+	return machine->c8.soundTimer > 0;
+}
+
+Chippin8Framebuffer Chippin8_GetFramebuffer(const Chippin8Machine* machine) {
+	const Chippin8& c8 = machine->c8;
+	Chippin8Framebuffer frame;
+	for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+		frame.planes[plane] = &c8.display[plane][0][0];
+	}
+	frame.width = c8.GetDisplayWidth();
+	frame.height = c8.GetDisplayHeight();
+	frame.stride = DISPLAY_WORDS;
+	frame.dirty = c8.displayDirty;
+	frame.dirtyFirstRow = c8.displayDirty ? c8.dirtyRowFirst : 0;
+	frame.dirtyLastRow = c8.displayDirty ? c8.dirtyRowLast : 0;
+	return frame;
+}
+
+void Chippin8_ClearDirty(Chippin8Machine* machine) {
+	machine->c8.ClearDisplayDirty();
+}
+
+void Chippin8_ExpandFramebuffer(const Chippin8Machine* machine,
+	uint32_t* pixels) {
+	const Chippin8& c8 = machine->c8;
+	ExpandFramebuffer(c8.display, c8.highResolution, 0,
+		c8.GetDisplayHeight(), pixels, PIXEL_COLORS);
+}
+
+size_t Chippin8_GetStateSize(void) {
+	return Chippin8::STATE_SIZE;
+}
+
+size_t Chippin8_SaveState(const Chippin8Machine* machine, uint8_t* buffer,
+	size_t size) {
+	return machine->c8.SaveState(buffer, size);
+}
+
+bool Chippin8_LoadState(Chippin8Machine* machine, const uint8_t* buffer,
+	size_t size) {
+	return machine->c8.LoadState(buffer, size);
+}
\ No newline at end of file
@@ -0,0 +1,131 @@
+/*
+	Library interface to the emulator, for hosting it in another program
+	(e.g. many machines in one server process). It is plain C, so that it
+	can be used from C and C++ alike and from any language with a C FFI,
+	and it does not depend on SDL or on the layout of the Chippin8 class.
+
+	A machine is created with Chippin8_Create, loaded with a ROM from
+	memory, then run frame by frame (or cycle by cycle) with the keypad set
+	between frames. The display can be read in place through
+	Chippin8_GetFramebuffer, without copying it.
+
+		Chippin8Machine* machine = Chippin8_Create(seed);
+		Chippin8_LoadROM(machine, rom, romSize, CHIPPIN8_QUIRKS_VIP);
+		for (;;) {
+			Chippin8_SetKeypad(machine, keys);
+			Chippin8_RunFrame(machine, 10);
+			Chippin8Framebuffer frame = Chippin8_GetFramebuffer(machine);
+			if (frame.dirty) { ... ; Chippin8_ClearDirty(machine); }
+		}
+		Chippin8_Destroy(machine);
+
+	Machines are independent of each other, and different machines may run
+	on different threads at the same time. A single machine must only be
+	used by one thread at a time.
+*/
+
+#ifndef CHIPPIN8_H
+#define CHIPPIN8_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct Chippin8Machine Chippin8Machine;
+
+// Quirk profiles (see quirks.h)
+typedef enum Chippin8Quirks {
+	CHIPPIN8_QUIRKS_VIP,		// COSMAC VIP, plain CHIP-8 ROMs
+	CHIPPIN8_QUIRKS_CHIP48,
+	CHIPPIN8_QUIRKS_SCHIP,		// SUPER-CHIP
+	CHIPPIN8_QUIRKS_XOCHIP
+} Chippin8Quirks;
+
+// Number of bit planes of the display
+#define CHIPPIN8_PLANES 2
+
+// A view of the display as the machine holds it. Every pixel is one bit
+// per plane. Each row is packed into 64-bit words, with the leftmost pixel
+// in the most significant bit of the first word, and the next row starts
+// stride words after it. Plane n is drawn to by programs that select it
+// (CHIP-8 and SUPER-CHIP only use plane 0).
+//
+// The pointers stay valid until the machine is destroyed, and the contents
+// change whenever it runs.
+typedef struct Chippin8Framebuffer {
+	const uint64_t* planes[CHIPPIN8_PLANES];	// First row of every plane
+	int width;				// Pixels per row, 64 or 128 (high resolution)
+	int height;				// Rows, 32 or 64 (high resolution)
+	int stride;				// Words from one row to the next
+	bool dirty;				// Whether the display changed since the last
+							// Chippin8_ClearDirty
+	int dirtyFirstRow;		// Rows that changed, if dirty (inclusive)
+	int dirtyLastRow;
+} Chippin8Framebuffer;
+
+// Create a machine with nothing loaded. The random number generator is
+// seeded with seed, so the same seed, ROM and input give the same run.
+// Returns NULL if out of memory.
+Chippin8Machine* Chippin8_Create(uint64_t seed);
+void Chippin8_Destroy(Chippin8Machine* machine);
+
+// Reset the machine and load a ROM image of size bytes at 0x200, to run it
+// with the given quirk profile. The machine starts the ROM exactly like one
+// just created with the same seed, whatever ran on it before: memory, 
+// registers, stack, timers, display and keypad are all cleared. Returns 
+// false, leaving the machine as it was, if the ROM is empty or does not
+// fit in memory.
+bool Chippin8_LoadROM(Chippin8Machine* machine, const uint8_t* data,
+	size_t size, Chippin8Quirks quirks);
+
+// Switch the quirk profile of the ROM that is loaded
+void Chippin8_SetQuirks(Chippin8Machine* machine, Chippin8Quirks quirks);
+
+// Run on the x86-64 recompiler instead of the interpreter (or back).
+// Returns whether native code is generated on this platform; if not, the
+// recompiler runs the interpreter and the result is the same.
+bool Chippin8_UseRecompiler(Chippin8Machine* machine, bool enabled);
+
+// Execute exactly cycles instructions, without ticking the timers
+void Chippin8_RunCycles(Chippin8Machine* machine, uint64_t cycles);
+
+// Run one 60 Hz frame: cyclesPerFrame instructions, then tick the timers
+void Chippin8_RunFrame(Chippin8Machine* machine, int cyclesPerFrame);
+
+// The keypad as a bitmask, bit n set if key n is pressed
+void Chippin8_SetKeypad(Chippin8Machine* machine, uint16_t keypad);
+uint16_t Chippin8_GetKeypad(const Chippin8Machine* machine);
+
+// Whether the buzzer is sounding (the sound timer is not 0)
+bool Chippin8_IsSoundOn(const Chippin8Machine* machine);
+
+Chippin8Framebuffer Chippin8_GetFramebuffer(const Chippin8Machine* machine);
+
+// Mark the display as presented, so that dirty is only set again by the
+// next change
+void Chippin8_ClearDirty(Chippin8Machine* machine);
+
+// Expand the whole display into 128 x 64 RGBA8888 pixels (low resolution
+// pixels are 2 x 2). For hosts that want pixels rather than planes.
+void Chippin8_ExpandFramebuffer(const Chippin8Machine* machine,
+	uint32_t* pixels);
+
+// Save states (see Chippin8::SaveState). Chippin8_SaveState returns the
+// number of bytes written, or 0 if size is less than
+// Chippin8_GetStateSize(). Chippin8_LoadState returns false, without
+// changing anything, if the buffer does not hold a valid save state.
+size_t Chippin8_GetStateSize(void);
+size_t Chippin8_SaveState(const Chippin8Machine* machine, uint8_t* buffer,
+	size_t size);
+bool Chippin8_LoadState(Chippin8Machine* machine, const uint8_t* buffer,
+	size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIPPIN8_H
\ No newline at end of file
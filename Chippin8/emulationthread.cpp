@@ -0,0 +1,181 @@
+#include "emulationthread.h"
+#include "analyzer.h"
+
+#include <chrono>
+#include <string.h>
+
+// The timers run at 60 Hz, and one frame is produced per timer tick
+const int FRAMES_PER_SECOND = 60;
+
+// Sound buffered ahead of the audio device. If the device plays slower
+// than the frames run, frames of sound are dropped beyond this, so that
+// the sound doesn't drift behind the picture.
+const size_t MAX_AUDIO_BUFFERED = AUDIO_SAMPLES_PER_FRAME * 4;
+
+EmulationThread::EmulationThread(Chippin8& c8, int cyclesPerFrame,
+	bool useRecompiler, size_t rewindBufferSize, uint64_t seed,
+	int runAheadFrames)
+	: c8(c8), recompiler(c8), rewind(rewindBufferSize),
+	cyclesPerFrame(cyclesPerFrame), useRecompiler(useRecompiler), frame(0),
+	runAheadFrames(runAheadFrames), showingRunAhead(false),
+	recorder(nullptr), audio(nullptr), isRunning(false) {
+	inputLog.Reset(seed, cyclesPerFrame, c8.GetROMHash(), 
+		c8.GetQuirkProfile());
+}
+
+EmulationThread::~EmulationThread() {
+	Stop();
+}
+
+void EmulationThread::Start() {
+	if (!isRunning) {
+		isRunning = true;
+		thread = std::thread(&EmulationThread::Run, this);
+	}
+}
+
+void EmulationThread::Stop() {
+	isRunning = false;
+	if (thread.joinable()) {
+		thread.join();
+	}
+	inputLog.Truncate(frame);
+}
+
+bool EmulationThread::TakeFrame(const VideoFrame*& frame) {
+	if (!frames.Update()) {
+		return false;
+	}
+	frame = &frames.GetReadBuffer();
+	return true;
+}
+
+void EmulationThread::Run() {
+	typedef std::chrono::steady_clock Clock;
+	const Clock::duration frameTime = std::chrono::duration_cast<
+		Clock::duration>(std::chrono::seconds(1)) / FRAMES_PER_SECOND;
+
+	// Translate the code the analysis finds before the first frame is due,
+	// rather than while the first frames run
+	if (useRecompiler) {
+		ROMAnalysis analysis;
+		analysis.Analyze(c8);
+		recompiler.Precompile(analysis.GetBlockStarts());
+	}
+
+	InputState input = { c8.GetKeypadMask(), false };
+	Clock::time_point nextFrame = Clock::now();
+
+	while (isRunning.load(std::memory_order_relaxed)) {
+		RunFrame(input);
+
+		// Sleep until the next frame is due. If we fell behind, don't try
+		// to catch up.
+		nextFrame += frameTime;
+		Clock::time_point now = Clock::now();
+		if (now < nextFrame) {
+			std::this_thread::sleep_until(nextFrame);
+		}
+		else {
+			nextFrame = now;
+		}
+	}
+}
+
+void EmulationThread::RunFrame(InputState& input) {
+	// Only the latest state matters, like polling the keyboard once per
+	// frame
+	while (inputQueue.Pop(input)) {}
+	c8.SetKeypadMask(input.keypad);
+
+	if (input.rewind) {
+		// Step back one frame per frame while the hotkey is held. The keys
+		// held right now are kept, not the ones in the history.
+		if (rewind.Pop(c8)) {
+			--frame;
+		}
+		c8.SetKeypadMask(input.keypad);
+	}
+	else {
+		// The state at the start of the frame is kept, so that popping it
+		// undoes exactly this frame. Recording a frame that was rewound
+		// replaces it in the log.
+		rewind.Push(c8);
+		inputLog.Record(frame++, input.keypad);
+		if (useRecompiler) {
+			recompiler.RunFrame(cyclesPerFrame);
+		}
+		else {
+			c8.RunFrame(cyclesPerFrame);
+		}
+	}
+
+	// The recording shows the frames as they are run, not run ahead
+	if (recorder != nullptr) {
+		recorder->Record(c8);
+	}
+
+	// Rewinding is silent, but still has to keep the audio device fed
+	if (audio != nullptr && input.rewind) {
+		synthesizer.RenderSilence(*audio, MAX_AUDIO_BUFFERED);
+	}
+	else if (audio != nullptr) {
+		synthesizer.RenderFrame(c8, *audio, MAX_AUDIO_BUFFERED);
+	}
+
+	// If nothing was drawn, there is no new frame to present. Rewinding
+	// shows the frames as they were, without running ahead.
+	if (runAheadFrames > 0 && !input.rewind) {
+		RunAhead(c8.displayDirty);
+	}
+	else if (c8.displayDirty || showingRunAhead) {
+		PublishFrame();
+		showingRunAhead = false;
+	}
+	c8.ClearDisplayDirty();
+}
+
+void EmulationThread::RunAhead(bool drawn) {
+	// The frames run ahead are not counted by the profiler, since they are
+	// run again for real later
+	Profiler* profiler = c8.profiler;
+	c8.profiler = nullptr;
+	c8.TakeSnapshot(snapshot);
+	c8.ClearDisplayDirty();
+	for (int i = 0; i < runAheadFrames; ++i) {
+		if (useRecompiler) {
+			recompiler.RunFrame(cyclesPerFrame);
+		}
+		else {
+			c8.RunFrame(cyclesPerFrame);
+		}
+	}
+
+	// What was shown last time was drawn ahead with the input of back then,
+	// which may have changed since, so it is replaced even if nothing was
+	// drawn this time
+	bool drawnAhead = c8.displayDirty;
+	if (drawn || drawnAhead || showingRunAhead) {
+		PublishFrame();
+	}
+	showingRunAhead = drawnAhead;
+
+	// Compiled blocks are only discarded if the frames run ahead changed
+	// their code
+	if (useRecompiler) {
+		recompiler.RestoreSnapshot(snapshot);
+	}
+	else {
+		uint16_t codeStart;
+		uint16_t codeLength;
+		c8.RestoreSnapshot(snapshot, codeStart, codeLength);
+	}
+	c8.profiler = profiler;
+}
+
+void EmulationThread::PublishFrame() {
+	VideoFrame& video = frames.GetWriteBuffer();
+	memcpy(video.display, c8.display, sizeof(video.display));
+	video.highResolution = c8.highResolution;
+	frames.Publish();
+}
\ No newline at end of file
@@ -0,0 +1,116 @@
+/*
+	Runs the emulator on its own thread at 60 frames per second, so that
+	rendering (which may block on vsync or a slow driver) never delays
+	emulation. The frontend hands keypad changes to it through a lock-free
+	queue, and takes finished frames from a lock-free triple buffer. Neither
+	thread ever waits for the other.
+
+	To cut the latency from a key press to the display, the thread can run
+	ahead of the input: after every frame it takes a snapshot, runs a few
+	more frames with the keys held right now, hands on the display of the
+	last one and goes back to the snapshot. Games that take a frame or two
+	to react to a key then show the reaction on the frame the key was 
+	pressed in. The frames run ahead are thrown away, so the run itself
+	(and the input log) is the same either way.
+
+	While the thread is running, it is the only one that may touch the
+	Chippin8.
+*/
+
+#ifndef EMULATIONTHREAD_H
+#define EMULATIONTHREAD_H
+
+#include "emulator.h"
+#include "recompiler.h"
+#include "rewind.h"
+#include "inputlog.h"
+#include "lockfree.h"
+#include "framebuffer.h"
+#include "recorder.h"
+#include "audio.h"
+
+#include <atomic>
+#include <thread>
+#include <stdint.h>
+
+// State of the input, sent by the frontend whenever it changes
+struct InputState {
+	uint16_t keypad;		// Bit n set if key n is pressed
+	bool rewind;			// Whether the rewind hotkey is held
+};
+
+typedef SpscQueue<InputState, 64> InputQueue;
+
+class EmulationThread {
+public:
+	// Frames rewound are taken from a history of rewindBufferSize bytes.
+	// The input is recorded into an input log seeded with seed, which c8
+	// must have been seeded with. Every frame presented is runAheadFrames
+	// frames ahead of the input (0 to present the frames as they are run).
+	EmulationThread(Chippin8& c8, int cyclesPerFrame, bool useRecompiler,
+		size_t rewindBufferSize, uint64_t seed, int runAheadFrames = 0);
+	~EmulationThread();
+
+	void Start();
+
+	// Stop the thread and wait for it to finish the current frame
+	void Stop();
+
+	// Queue the frontend pushes input changes to
+	InputQueue& GetInputQueue() { return inputQueue; }
+
+	// Get the latest finished frame. Returns false if the display has not
+	// changed since the last call.
+	bool TakeFrame(const VideoFrame*& frame);
+
+	// Input of every frame run. Only valid after Stop.
+	const InputLog& GetInputLog() const { return inputLog; }
+
+	// Record every frame run (or rewound) to recorder, which must be open.
+	// nullptr to stop. Must be called while the thread is stopped.
+	void SetRecorder(FrameRecorder* recorder) { this->recorder = recorder; }
+
+	// Synthesize the sound of every frame into audio, which the audio 
+	// device plays from (see Platform::OpenAudio). nullptr for no sound.
+	// Must be called while the thread is stopped.
+	void SetAudio(AudioRing* audio) { this->audio = audio; }
+
+private:
+	Chippin8& c8;
+	Recompiler recompiler;
+	RewindBuffer rewind;
+	InputLog inputLog;
+	int cyclesPerFrame;
+	bool useRecompiler;
+	uint64_t frame;			// Number of frames run, minus those rewound
+
+	int runAheadFrames;
+	Chippin8::Snapshot snapshot;	// State to go back to after running ahead
+	bool showingRunAhead;	// Whether the last frame published was drawn
+							// while running ahead
+	FrameRecorder* recorder;
+	AudioRing* audio;
+	AudioSynthesizer synthesizer;
+
+	InputQueue inputQueue;
+	TripleBuffer<VideoFrame> frames;
+
+	std::thread thread;
+	std::atomic<bool> isRunning;
+
+	void Run();
+
+	// Apply the input received since the last frame, and run one frame
+	void RunFrame(InputState& input);
+
+	// Run runAheadFrames frames from the current state, publish the 
+	// display of the last one, then go back to the state. drawn is whether
+	// the frame just run drew to the display. Nothing is published if 
+	// neither it, nor the frames run ahead this time or last time did.
+	void RunAhead(bool drawn);
+
+	// Hand the display of c8 on to the frontend
+	void PublishFrame();
+};
+
+#endif // EMULATIONTHREAD_H
\ No newline at end of file
@@ -1,30 +1,261 @@
 #include "emulator.h"
 #include "fonts.h"
+#include "profiler.h"
+#include "mappedfile.h"
 
+#include <algorithm>
+#include <bit>
+#include <cctype>
 #include <fstream>
 #include <iostream>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <vector>
 #include <stdlib.h>
 #include <time.h>
 #include <stdint.h>
+#include <string.h>
+
+// Most backwards jumps skipped between two idle loop checks
+const int MAX_IDLE_BACKOFF = 64;
 
 //CHIP-8 instructions generally start at memory location 0x200
 const uint16_t START_ADDRESS = 0x200;	
 const uint16_t FONTSET_START_ADDRESS = 0x000;
+const uint16_t BIG_FONTSET_START_ADDRESS = FONTSET_START_ADDRESS + FONTSET_SIZE;
+
+namespace fs = std::filesystem;
+
+/* ----- Shared Memory Pages ----- */
+
+typedef std::shared_ptr<Chippin8::MemoryPage> PagePointer;
+
+// Page filled with zeros, shared by all instances
+static const PagePointer& EmptyPage() {
+	static const PagePointer page = std::make_shared<Chippin8::MemoryPage>();
+	return page;
+}
+
+// Page holding both fonts, shared by all instances
+static const PagePointer& FontPage() {
+	static const PagePointer page = []() {
+		PagePointer font = std::make_shared<Chippin8::MemoryPage>();
+		for (int i = 0; i < FONTSET_SIZE; i++) {
+			(*font)[FONTSET_START_ADDRESS + i] = fontset[i];
+		}
+		for (int i = 0; i < BIG_FONTSET_SIZE; i++) {
+			(*font)[BIG_FONTSET_START_ADDRESS + i] = bigFontset[i];
+		}
+		return font;
+	}();
+	return page;
+}
+
+/* ----- ROM Images ----- */
+/*
+	Every distinct ROM is split into pages once, and every instance loading
+	the same contents shares those pages, whether it loads them from a file
+	or from memory. Images are found by a hash of their contents, and files
+	by name, so that a file that didn't change isn't even read again.
+
+	The caches only hold weak references: an image stays cached while an
+	instance has it loaded, and is freed with the last one. Entries of
+	images that are gone are dropped whenever a new image is cached, so a 
+	host that goes through many ROMs only keeps those it still runs.
+*/
+
+// A ROM, split into pages
+struct ROMImage {
+	uint64_t hash;
+	size_t size;
+	std::vector<PagePointer> pages;
+};
+
+// A ROM file as it was when it was last loaded
+struct ROMFile {
+	uintmax_t size;
+	fs::file_time_type writeTime;
+	std::weak_ptr<const ROMImage> image;
+};
+
+// Guards both caches
+static std::mutex romMutex;
+static std::multimap<uint64_t, std::weak_ptr<const ROMImage>> romImages;
+static std::map<std::string, ROMFile> romFiles;
+
+// Drop the entries of a cache whose images have been freed. romMutex must
+// be held.
+template <typename Cache, typename GetImage>
+static void DropExpiredROMs(Cache& cache, GetImage getImage) {
+	for (auto entry = cache.begin(); entry != cache.end();) {
+		if (getImage(entry->second).expired()) {
+			entry = cache.erase(entry);
+		}
+		else {
+			++entry;
+		}
+	}
+}
+
+// FNV-1a, like the display hash
+static uint64_t HashROM(const uint8_t* data, size_t size) {
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= data[i];
+		hash *= 0x100000001B3ull;
+	}
+	return hash;
+}
+
+// Whether image holds exactly the size bytes at data
+static bool IsSameROM(const ROMImage& image, const uint8_t* data, 
+	size_t size) {
+	if (image.size != size) {
+		return false;
+	}
+	for (size_t offset = 0; offset < size; offset += Chippin8::PAGE_SIZE) {
+		size_t length = std::min(Chippin8::PAGE_SIZE, size - offset);
+		if (memcmp(image.pages[offset / Chippin8::PAGE_SIZE]->data(), 
+			data + offset, length) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Image of the size bytes at data, which must fit in memory. Made (with a
+// single copy of data) the first time these contents are seen.
+static std::shared_ptr<const ROMImage> GetROMImage(const uint8_t* data, 
+	size_t size) {
+	uint64_t hash = HashROM(data, size);
+
+	std::lock_guard<std::mutex> lock(romMutex);
+	auto range = romImages.equal_range(hash);
+	for (auto cached = range.first; cached != range.second; ++cached) {
+		std::shared_ptr<const ROMImage> image = cached->second.lock();
+		if (image != nullptr && IsSameROM(*image, data, size)) {
+			return image;
+		}
+	}
+
+	std::shared_ptr<ROMImage> image = std::make_shared<ROMImage>();
+	image->hash = hash;
+	image->size = size;
+	for (size_t offset = 0; offset < size; offset += Chippin8::PAGE_SIZE) {
+		PagePointer page = std::make_shared<Chippin8::MemoryPage>();
+		memcpy(page->data(), data + offset, 
+			std::min(Chippin8::PAGE_SIZE, size - offset));
+		image->pages.push_back(page);
+	}
+	DropExpiredROMs(romImages, 
+		[](const std::weak_ptr<const ROMImage>& cached) { return cached; });
+	romImages.emplace(hash, image);
+	return image;
+}
+
+// Image of a ROM file, or nullptr if it can't be read, is empty or does
+// not fit in memory. The file is mapped rather than read, and only if it
+// changed since it was last loaded.
+static std::shared_ptr<const ROMImage> LoadROMImage(
+	const std::string& filename) {
+	std::error_code error;
+	uintmax_t size = fs::file_size(filename, error);
+	if (error || size == 0 || size > Chippin8::MAX_ROM_SIZE) {
+		return nullptr;
+	}
+	fs::file_time_type writeTime = fs::last_write_time(filename, error);
+	if (error) {
+		return nullptr;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(romMutex);
+		auto cached = romFiles.find(filename);
+		if (cached != romFiles.end() && cached->second.size == size 
+			&& cached->second.writeTime == writeTime) {
+			std::shared_ptr<const ROMImage> image = cached->second.image.lock();
+			if (image != nullptr) {
+				return image;
+			}
+		}
+	}
+
+	// The file may have changed since its size was checked
+	MappedFile file;
+	if (!file.Open(filename) || file.GetSize() != size) {
+		return nullptr;
+	}
+	std::shared_ptr<const ROMImage> image 
+		= GetROMImage(file.GetData(), file.GetSize());
+
+	std::lock_guard<std::mutex> lock(romMutex);
+	DropExpiredROMs(romFiles, 
+		[](const ROMFile& cached) { return cached.image; });
+	romFiles[filename] = { size, writeTime, image };
+	return image;
+}
 
 Chippin8::Chippin8() {
-	// Set Program Counter starting position
-	pc = START_ADDRESS;
-	
-	// Load font in memory
-	for (int i = 0; i < sizeof(fontset) / sizeof(fontset[0]); i++) {
-		this->memory[FONTSET_START_ADDRESS + i] = fontset[i];
+	codeVersion = 0;
+	profiler = nullptr;
+	skipIdle = true;
+
+	// Random number seed for CXNN instruction. Call Seed() again for 
+	// reproducible runs.
+	Seed((uint64_t)time(NULL));
+
+	// Plain CHIP-8, until LoadROM finds out otherwise
+	SetQuirkProfile(QuirkProfile::CosmacVIP);
+
+	Reset();
+}
+
+void Chippin8::Reset() {
+	// Start from a fully cleared machine, so that runs are reproducible. The
+	// font is loaded in the first page.
+	pages[0] = FontPage();
+	for (size_t i = 1; i < PAGE_COUNT; ++i) {
+		pages[i] = EmptyPage();
 	}
+	for (int i = 0; i < 16; ++i) {
+		registers[i] = 0;
+		stack[i] = 0;
+		flags[i] = 0;
+		audioPattern[i] = 0;
+	}
+	opcode = 0;
+	index = 0;
+	sp = 0;
+	delayTimer = 0;
+	soundTimer = 0;
+	pitch = 64;		// 4000 Hz
+	buzzerSounded = false;
 
-	// Random number seed for CXNN instruction 
-	srand(time(NULL));
+	// Set Program Counter starting position
+	pc = START_ADDRESS;
 
-	//Clear Screen initially
-	opcode_00E0();
+	romImage = nullptr;
+	romHash = 0;
+	romSize = 0;
+	idleCycles = 0;
+	writeCount = 0;
+	idleBackoff = 1;
+	ResetIdleDetection();
+
+	//Clear Screen initially, which marks the whole display to be presented.
+	// Start in low resolution, drawing to the first plane only.
+	highResolution = false;
+	planeMask = 0x1;
+	memset(display, 0, sizeof(display));
+	ClearDisplayDirty();
+	ClearCodeDirty();
+	DecodeAndExecute(0x00E0);
+
+	// Nothing has been decoded yet, or everything decoded (or recompiled)
+	// is for the memory that was just replaced
+	InvalidateDecodeCache(0, DECODE_CACHE_SIZE);
+	++codeVersion;
 
 	// Clear keypad input values
 	for (int i = 0; i < 16; ++i) {
@@ -36,526 +267,1519 @@ Chippin8::~Chippin8() {
 
 }
 
-void Chippin8::LoadROM(std::string filename) {
-	// Open ROM file in binary mode and move file pointer to end 
-	std::ifstream file(filename, std::ios::binary | std::ios::ate);
-
-	if (file.is_open()) {
-		// Get file size and allocate buffer of that size
-		std::streampos size = file.tellg();
-		char* buffer = new char[size];
-
-		// Fill the buffer with contents of the ROM
-		file.seekg(0, std::ios::beg);
-		file.read(buffer, size);
-		file.close();
-
-		// Load ROM into Chippin8 memory at memory location START_ADDRESS
-		for (long i = 0; i < size; ++i) {
-			this->memory[START_ADDRESS + i] = buffer[i];
-		}
-
-		delete[] buffer;
+bool Chippin8::LoadROM(std::string filename) {
+	// The ROM image is read once and shared with every other instance that
+	// loads it, page by page
+	std::shared_ptr<const ROMImage> image = LoadROMImage(filename);
+	if (image == nullptr) {
+		return false;
+	}
+	LoadROMPages(image);
+	SetQuirkProfile(GetQuirkProfileForFile(filename));
 
 //#define DEBUG_MEMORY_CONTENTS
 #ifdef DEBUG_MEMORY_CONTENTS
-		std::cout << std::hex 
-			<< "-- Start of fonts (0x" << FONTSET_START_ADDRESS << ") --";
-		for (long i = 0; i < (long)size + 0x200; ++i) {
-			if (i % 8 == 0) std::cout << std::endl;
-			if (i == 0x200) std::cout << std::hex 
-				<< "-- Start of ROM (0x" << START_ADDRESS << ") --\n";
-			std::cout << std::hex << i << "\t" << (int)memory[i] 
-				<< std::dec << " ";
-		}
-		std::cout << "\n-- End of ROM --\n";
+	std::cout << std::hex 
+		<< "-- Start of fonts (0x" << FONTSET_START_ADDRESS << ") --";
+	for (long i = 0; i < (long)image->size + 0x200; ++i) {
+		if (i % 8 == 0) std::cout << std::endl;
+		if (i == 0x200) std::cout << std::hex 
+			<< "-- Start of ROM (0x" << START_ADDRESS << ") --\n";
+		std::cout << std::hex << i << "\t" << (int)ReadMemory(i) 
+			<< std::dec << " ";
+	}
+	std::cout << "\n-- End of ROM --\n";
 #endif // DEBUG_MEMORY_CONTENTS
+	return true;
+}
+
+bool Chippin8::LoadROM(const uint8_t* data, size_t size) {
+	if (size == 0 || size > MAX_ROM_SIZE) {
+		return false;
 	}
+	LoadROMPages(GetROMImage(data, size));
+	return true;
+}
+
+void Chippin8::LoadROMPages(std::shared_ptr<const ROMImage> image) {
+	// Load ROM into Chippin8 memory at memory location START_ADDRESS
+	for (size_t i = 0; i < image->pages.size(); ++i) {
+		pages[START_ADDRESS / PAGE_SIZE + i] = image->pages[i];
+	}
+	romHash = image->hash;
+	romSize = image->size;
+	romImage = std::move(image);
+
+	// Any previously decoded (or recompiled) instructions are now stale
+	InvalidateDecodeCache(0, DECODE_CACHE_SIZE);
+	++codeVersion;
 }
 
 void Chippin8::Cycle() {
 	// * Fetch
-	// Opcode is 16 bytes, so the first 8 bytes pointed at by the program 
-	// counter in memory, while the next 8 bytes are stored at pc + 1.
-	this->opcode = (memory[pc] << 8) | memory[pc + 1];
-	//std::cout << std::hex << opcode << '\n' << std::dec;
+	// Instructions are looked up in the decode cache by their address. An 
+	// opcode is only fetched from memory and decoded the first time the 
+	// instruction is executed (or after its memory has been modified).
+	// Beyond the cache, it is decoded every time.
+	Instruction uncached;
+	Instruction& instruction = pc < DECODE_CACHE_SIZE 
+		? decodeCache[pc] : uncached;
+#ifndef DEBUG_DECODE_AND_EXECUTE
+	if (pc >= DECODE_CACHE_SIZE || instruction.handler == nullptr)
+#endif // DEBUG_DECODE_AND_EXECUTE
+	{
+		// Opcode is 16 bits, so the first 8 bits are pointed at by the 
+		// program counter in memory, while the next 8 bits are stored at 
+		// pc + 1.
+		instruction = Decode((ReadMemory(pc) << 8) | ReadMemory(pc + 1));
+	}
+	this->opcode = instruction.opcode;
+	if (profiler != nullptr) {
+		profiler->CountInstruction(pc, instruction.opcode);
+	}
 	pc += 2;	// Move program counter to the next instruction in memory.
 
-	// * Decode and Execute
-	DecodeAndExecute(opcode);
+	// * Execute
+	instruction.handler(*this, instruction);
+}
 
+void Chippin8::TickTimers() {
 	// Decrement delayTimer and soundTimer
+	buzzerSounded = soundTimer > 0;
 	if (delayTimer > 0) { --delayTimer; }
 	if (soundTimer > 0) { --soundTimer; }
+
+	if (profiler != nullptr) {
+		profiler->EndFrame();
+	}
+}
+
+void Chippin8::RunFrame(int cyclesPerFrame) {
+	ResetIdleDetection();
+	for (int i = 0; i < cyclesPerFrame; ++i) {
+		Cycle();
+		if (jumpedBack) {
+			i += SkipIdleCycles(i + 1, cyclesPerFrame - i - 1);
+		}
+	}
+	TickTimers();
+}
+
+void Chippin8::ClearDisplayDirty() {
+	displayDirty = false;
+	dirtyRowFirst = DISPLAY_HEIGHT - 1;
+	dirtyRowLast = 0;
+}
+
+void Chippin8::ClearCodeDirty() {
+	codeDirty = false;
+	dirtyCodeFirst = DECODE_CACHE_SIZE - 1;
+	dirtyCodeLast = 0;
+}
+
+void Chippin8::Seed(uint64_t seed) {
+	// Spread the seed over all bits. xorshift must not start at 0.
+	rngState = (seed * 0x9E3779B97F4A7C15ull) | 1;
+}
+
+uint16_t Chippin8::GetKeypadMask() const {
+	uint16_t mask = 0;
+	for (int i = 0; i < 16; ++i) {
+		if (keypad[i]) mask |= 1u << i;
+	}
+	return mask;
+}
+
+void Chippin8::SetKeypadMask(uint16_t mask) {
+	for (int i = 0; i < 16; ++i) {
+		keypad[i] = (mask >> i) & 1;
+	}
+}
+
+/* ----- Quirks ----- */
+
+void Chippin8::SetQuirkProfile(QuirkProfile profile) {
+	quirkProfile = profile;
+	decoder = WithQuirks(profile, [](auto quirks) {
+		return &Chippin8::Decode<decltype(quirks)>;
+	});
+
+	// Everything decoded (or recompiled) so far is for the old profile
+	InvalidateDecodeCache(0, DECODE_CACHE_SIZE);
+	++codeVersion;
+}
+
+QuirkProfile Chippin8::GetQuirkProfileForFile(const std::string& filename) {
+	// The extensions used by Octo
+	std::string extension = fs::path(filename).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(),
+		[](unsigned char c) { return (char)tolower(c); });
+	if (extension == ".sc8") {
+		return QuirkProfile::SuperChip;
+	}
+	if (extension == ".xo8") {
+		return QuirkProfile::XOChip;
+	}
+	return QuirkProfile::CosmacVIP;
+}
+
+static const char* QUIRK_PROFILE_NAMES[QUIRK_PROFILE_COUNT] = {
+	"vip", "chip48", "schip", "xochip"
+};
+
+const char* Chippin8::GetQuirkProfileName(QuirkProfile profile) {
+	return QUIRK_PROFILE_NAMES[(int)profile];
+}
+
+bool Chippin8::ParseQuirkProfile(const std::string& name, 
+	QuirkProfile& profile) {
+	for (int i = 0; i < QUIRK_PROFILE_COUNT; ++i) {
+		if (name == QUIRK_PROFILE_NAMES[i]) {
+			profile = (QuirkProfile)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* ----- Idle Detection ----- */
+
+void Chippin8::ResetIdleDetection() {
+	// The timers and the keypad may have changed since the last frame
+	idleStateCycle = -1;
+	idleCountdown = 0;
+	jumpedBack = false;
+}
+
+int Chippin8::SkipIdleCycles(int cycle, int cyclesLeft) {
+	jumpedBack = false;
+	if (!skipIdle || idleCountdown-- > 0) {
+		return 0;
+	}
+
+	IdleState state;
+	memset(&state, 0, sizeof(state));	// Padding is compared as well
+	state.pc = pc;
+	state.index = index;
+	state.opcode = opcode;
+	memcpy(state.registers, registers, sizeof(registers));
+	memcpy(state.stack, stack, sizeof(stack));
+	state.sp = sp;
+	state.delayTimer = delayTimer;
+	state.soundTimer = soundTimer;
+	state.rngState = rngState;
+	state.writeCount = writeCount;
+
+	if (idleStateCycle < 0 || memcmp(&state, &idleState, sizeof(state)) != 0) {
+		// Not idle (yet). Only back off once a state has been compared.
+		if (idleStateCycle >= 0) {
+			idleBackoff = std::min(idleBackoff * 2, MAX_IDLE_BACKOFF);
+		}
+		idleCountdown = idleBackoff - 1;
+		memcpy(&idleState, &state, sizeof(state));
+		idleStateCycle = cycle;
+		return 0;
+	}
+
+	// Back to the same state: the loop repeats every period instructions
+	// until the end of the frame. Skip all the whole trips around it.
+	int period = cycle - idleStateCycle;
+	int skipped = cyclesLeft - cyclesLeft % period;
+	idleBackoff = 1;
+	idleStateCycle = cycle + skipped;
+	idleCycles += skipped;
+	if (profiler != nullptr) {
+		profiler->CountIdle(skipped);
+	}
+	return skipped;
+}
+
+/* ----- Memory ----- */
+
+void Chippin8::WriteMemory(uint16_t address, uint8_t value) {
+	PagePointer& page = pages[address / PAGE_SIZE];
+
+	// Shared pages are never written to. Whoever shares a page holds a 
+	// reference to it, so a page that only this instance references can't
+	// be shared.
+	if (page.use_count() != 1) {
+		page = std::make_shared<MemoryPage>(*page);
+	}
+	(*page)[address % PAGE_SIZE] = value;
+	++writeCount;
+}
+
+void Chippin8::GetMemory(uint8_t* buffer, size_t size) const {
+	size = std::min(size, MEMORY_SIZE);
+	for (size_t offset = 0; offset < size; offset += PAGE_SIZE) {
+		memcpy(buffer + offset, pages[offset / PAGE_SIZE]->data(), 
+			std::min(PAGE_SIZE, size - offset));
+	}
+}
+
+void Chippin8::SetMemory(const uint8_t* buffer, size_t size) {
+	size = std::min(size, MEMORY_SIZE);
+	for (size_t offset = 0; offset < size; offset += PAGE_SIZE) {
+		const uint8_t* contents = buffer + offset;
+		size_t length = std::min(PAGE_SIZE, size - offset);
+		PagePointer& page = pages[offset / PAGE_SIZE];
+		if (memcmp(page->data(), contents, length) == 0) {
+			continue;
+		}
+
+		// Within the decode cache, find the bytes that change, like
+		// RestoreSnapshot. Code elsewhere in memory stays decoded.
+		if (offset < DECODE_CACHE_SIZE) {
+			size_t first = 0;
+			size_t last = length - 1;
+			while ((*page)[first] == contents[first]) ++first;
+			while ((*page)[last] == contents[last]) --last;
+			InvalidateDecodeCache((uint16_t)(offset + first), 
+				(uint16_t)(last - first + 1));
+			codeDirty = true;
+			dirtyCodeFirst = std::min<uint16_t>(dirtyCodeFirst, 
+				(uint16_t)(offset + first));
+			dirtyCodeLast = std::max<uint16_t>(dirtyCodeLast, 
+				(uint16_t)(offset + last));
+		}
+		if (page.use_count() != 1) {
+			page = std::make_shared<MemoryPage>(*page);
+		}
+		memcpy(page->data(), contents, length);
+	}
+}
+
+void Chippin8::InvalidateDecodeCache(uint16_t address, uint16_t length) {
+	// The instruction starting one byte before address also contains the byte
+	// at address, so it has to be decoded again as well. Addresses beyond 
+	// the cache (including those wrapping around below 0) have nothing to 
+	// discard.
+	for (int i = -1; i < (int)length; ++i) {
+		uint16_t cached = (uint16_t)(address + i);
+		if (cached < DECODE_CACHE_SIZE) {
+			decodeCache[cached].handler = nullptr;
+		}
+	}
+}
+
+void Chippin8::DecodeAndExecute(uint16_t opcode) {
+	Instruction instruction = Decode(opcode);
+	this->opcode = opcode;
+	instruction.handler(*this, instruction);
 }
 
 //#define DEBUG_DECODE_AND_EXECUTE
 #ifdef DEBUG_DECODE_AND_EXECUTE
-#define RUN_OPCODE(x) do{x(); std::cout << #x << "\n";} while(0)
+#define DECODE_HANDLER(x, handlerFunction) do{ \
+		instruction.handler = &Dispatch<&Chippin8::handlerFunction>; \
+		name = #x; \
+		std::cout << #x << "\n"; \
+		} while(0)
 #else
-#define RUN_OPCODE(x) x()
+#define DECODE_HANDLER(x, handlerFunction) do{ \
+		instruction.handler = &Dispatch<&Chippin8::handlerFunction>; \
+		name = #x; \
+		} while(0)
 #endif // DEBUG_DECODE_AND_EXECUTE
 
-void Chippin8::DecodeAndExecute(uint16_t opcode) {
+#define DECODE_OPCODE(x) DECODE_HANDLER(x, x)
+
+// Instruction function that depends on the quirk profile
+#define DECODE_QUIRK_OPCODE(x) DECODE_HANDLER(x, x<Quirks>)
+
+Chippin8::Instruction Chippin8::Decode(uint16_t opcode) const {
+	const char* name;
+	return decoder(opcode, name);
+}
+
+const char* Chippin8::GetOpcodeName(uint16_t opcode) {
+	// Without the "opcode_" prefix of the function name. Any profile gives
+	// the same name.
+	const char* name;
+	Decode<CosmacVIPQuirks>(opcode, name);
+	return name + sizeof("opcode_") - 1;
+}
+
+template <typename Quirks>
+Chippin8::Instruction Chippin8::Decode(uint16_t opcode, const char*& name) {
+	Instruction instruction;
+	instruction.handler = &Dispatch<&Chippin8::opcode_NOP>;
+	name = "opcode_NOP";
+	instruction.opcode = opcode;
+	instruction.NNN = opcode & 0x0FFFu;
+	instruction.NN = opcode & 0x00FFu;
+	instruction.N = opcode & 0x000Fu;
+	instruction.X = (opcode & 0x0F00u) >> 8;
+	instruction.Y = (opcode & 0x00F0u) >> 4;
+
 	switch ((opcode & 0xF000) >> 12) {
 	case 0x0:
 		// Note: no need to decode 0NNN instruction
-		switch ((opcode & 0x000F)) {
-		case 0x0:
-			RUN_OPCODE(opcode_00E0);
+		switch (opcode & 0x0FF0) {
+		case 0x0C0:
+			DECODE_OPCODE(opcode_00CN);
 			break;
-		case 0xE:
-			RUN_OPCODE(opcode_00EE);
+		case 0x0D0:
+			DECODE_OPCODE(opcode_00DN);
+			break;
+		case 0x0E0:
+			if (opcode == 0x00E0) DECODE_OPCODE(opcode_00E0);
+			if (opcode == 0x00EE) DECODE_OPCODE(opcode_00EE);
+			break;
+		case 0x0F0:
+			switch (opcode & 0x000F) {
+			case 0xB:
+				DECODE_OPCODE(opcode_00FB);
+				break;
+			case 0xC:
+				DECODE_OPCODE(opcode_00FC);
+				break;
+			case 0xD:
+				DECODE_OPCODE(opcode_00FD);
+				break;
+			case 0xE:
+				DECODE_OPCODE(opcode_00FE);
+				break;
+			case 0xF:
+				DECODE_OPCODE(opcode_00FF);
+				break;
+			}
 			break;
 		}
 		break;
 	
 	case 0x1:
-		RUN_OPCODE(opcode_1NNN);
+		DECODE_OPCODE(opcode_1NNN);
 		break;
 	
 	case 0x2:
-		RUN_OPCODE(opcode_2NNN);
+		DECODE_OPCODE(opcode_2NNN);
 		break;
 	
 	case 0x3:
-		RUN_OPCODE(opcode_3XNN);
+		DECODE_OPCODE(opcode_3XNN);
 		break;
 	
 	case 0x4:
-		RUN_OPCODE(opcode_4XNN);
+		DECODE_OPCODE(opcode_4XNN);
 		break;
 	
 	case 0x5:
-		RUN_OPCODE(opcode_5XY0);
+		switch (opcode & 0x000F) {
+		case 0x0:
+			DECODE_OPCODE(opcode_5XY0);
+			break;
+		case 0x2:
+			DECODE_OPCODE(opcode_5XY2);
+			break;
+		case 0x3:
+			DECODE_OPCODE(opcode_5XY3);
+			break;
+		}
 		break;
 	
 	case 0x6:
-		RUN_OPCODE(opcode_6XNN);
+		DECODE_OPCODE(opcode_6XNN);
 		break;
 	
 	case 0x7:
-		RUN_OPCODE(opcode_7XNN);
+		DECODE_OPCODE(opcode_7XNN);
 		break;
 	
 	case 0x8:
 		switch (opcode & 0x000F) {
 		case 0x0:
-			RUN_OPCODE(opcode_8XY0);
+			DECODE_OPCODE(opcode_8XY0);
 			break;
 		case 0x1:
-			RUN_OPCODE(opcode_8XY1);
+			DECODE_QUIRK_OPCODE(opcode_8XY1);
 			break;
 		case 0x2:
-			RUN_OPCODE(opcode_8XY2);
+			DECODE_QUIRK_OPCODE(opcode_8XY2);
 			break;
 		case 0x3:
-			RUN_OPCODE(opcode_8XY3);
+			DECODE_QUIRK_OPCODE(opcode_8XY3);
 			break;
 		case 0x4: 
-			RUN_OPCODE(opcode_8XY4);
+			DECODE_OPCODE(opcode_8XY4);
 			break;
 		case 0x5:
-			RUN_OPCODE(opcode_8XY5);
+			DECODE_OPCODE(opcode_8XY5);
 			break;
 		case 0x6:
-			RUN_OPCODE(opcode_8XY6);
+			DECODE_QUIRK_OPCODE(opcode_8XY6);
 			break;
 		case 0x7:
-			RUN_OPCODE(opcode_8XY7);
+			DECODE_OPCODE(opcode_8XY7);
 			break;
 		case 0xE:
-			RUN_OPCODE(opcode_8XYE);
+			DECODE_QUIRK_OPCODE(opcode_8XYE);
 			break;
 		}
 		break;
 	
 	case 0x9:
-		RUN_OPCODE(opcode_9XY0);
+		DECODE_OPCODE(opcode_9XY0);
 		break;
 	
 	case 0xA:
-		RUN_OPCODE(opcode_ANNN);
+		DECODE_OPCODE(opcode_ANNN);
 		break;
 	
 	case 0xB:
-		RUN_OPCODE(opcode_BNNN);
+		DECODE_QUIRK_OPCODE(opcode_BNNN);
 		break;
 	
 	case 0xC:
-		RUN_OPCODE(opcode_CXNN);
+		DECODE_OPCODE(opcode_CXNN);
 		break;
 	
 	case 0xD:
-		RUN_OPCODE(opcode_DXYN);
+		if ((opcode & 0x000F) == 0x0) {
+			DECODE_QUIRK_OPCODE(opcode_DXY0);
+		}
+		else {
+			DECODE_QUIRK_OPCODE(opcode_DXYN);
+		}
 		break;
 	
 	case 0xE:
 		switch (opcode & 0x00FF) {
 		case 0x9E:
-			RUN_OPCODE(opcode_EX9E);
+			DECODE_OPCODE(opcode_EX9E);
 			break;
 		case 0xA1:
-			RUN_OPCODE(opcode_EXA1);
+			DECODE_OPCODE(opcode_EXA1);
 			break;
 		}
 		break;
 	
 	case 0xF:
 		switch (opcode & 0x00FF) {
+		case 0x00:
+			if (opcode == 0xF000) DECODE_OPCODE(opcode_F000);
+			break;
+		case 0x01:
+			DECODE_OPCODE(opcode_FN01);
+			break;
+		case 0x02:
+			if (opcode == 0xF002) DECODE_OPCODE(opcode_F002);
+			break;
 		case 0x07:
-			RUN_OPCODE(opcode_FX07);
+			DECODE_OPCODE(opcode_FX07);
 			break;
 		case 0x0A:
-			RUN_OPCODE(opcode_FX0A);
+			DECODE_OPCODE(opcode_FX0A);
 			break;
 		case 0x15:
-			RUN_OPCODE(opcode_FX15);
+			DECODE_OPCODE(opcode_FX15);
 			break;
 		case 0x18:
-			RUN_OPCODE(opcode_FX18);
+			DECODE_OPCODE(opcode_FX18);
 			break;
 		case 0x1E:
-			RUN_OPCODE(opcode_FX1E);
+			DECODE_OPCODE(opcode_FX1E);
 			break;
 		case 0x29:
-			RUN_OPCODE(opcode_FX29);
+			DECODE_OPCODE(opcode_FX29);
+			break;
+		case 0x30:
+			DECODE_OPCODE(opcode_FX30);
 			break;
 		case 0x33:
-			RUN_OPCODE(opcode_FX33);
+			DECODE_OPCODE(opcode_FX33);
+			break;
+		case 0x3A:
+			DECODE_OPCODE(opcode_FX3A);
 			break;
 		case 0x55:
-			RUN_OPCODE(opcode_FX55);
+			DECODE_QUIRK_OPCODE(opcode_FX55);
 			break;
 		case 0x65:
-			RUN_OPCODE(opcode_FX65);
+			DECODE_QUIRK_OPCODE(opcode_FX65);
+			break;
+		case 0x75:
+			DECODE_OPCODE(opcode_FX75);
+			break;
+		case 0x85:
+			DECODE_OPCODE(opcode_FX85);
 			break;
 		}
 		break;
 
-	default: RUN_OPCODE(opcode_NOP); break;
+	default: DECODE_OPCODE(opcode_NOP); break;
+	}
+
+	return instruction;
+}
+
+/* ----- Save States ----- */
+
+/*
+	Save state format, version 2. All values are little-endian.
+		offset	size	contents
+		0		4		"C8ST"
+		4		2		version
+		6		1		quirk profile + 1, 0 if not recorded
+		7		1		reserved (0)
+		8		65536	memory
+		65544	2048	display (2 planes of 64 rows of 2 8-byte words)
+		67592	16		registers V0 - VF
+		67608	32		stack
+		67640	2		pc
+		67642	2		index
+		67644	2		opcode
+		67646	1		sp
+		67647	1		delay timer
+		67648	1		sound timer
+		67649	2		keypad (bit n set if key n is pressed)
+		67651	8		random number generator state
+		67659	1		1 in high resolution mode, 0 otherwise
+		67660	1		selected planes
+		67661	16		user flags
+		67677	16		audio pattern
+		67693	1		pitch
+
+	Version 1 had 4KB of memory, a 64 x 32 display with one plane (32 rows
+	of 8 bytes), and ended with the random number generator state. States
+	without a quirk profile are loaded with the current one.
+*/
+static const uint8_t STATE_MAGIC[4] = { 'C', '8', 'S', 'T' };
+static const uint16_t STATE_VERSION = 2;
+
+// Layout of a version 1 save state
+static const size_t STATE_V1_SIZE = 4427;
+static const size_t STATE_V1_MEMORY_SIZE = 4096;
+
+static uint8_t* PutWord(uint8_t* out, uint16_t value) {
+	out[0] = value & 0xFF;
+	out[1] = value >> 8;
+	return out + 2;
+}
+
+static uint8_t* PutQword(uint8_t* out, uint64_t value) {
+	for (int i = 0; i < 8; ++i) {
+		out[i] = (value >> (i * 8)) & 0xFF;
+	}
+	return out + 8;
+}
+
+static const uint8_t* GetWord(const uint8_t* in, uint16_t& value) {
+	value = in[0] | (in[1] << 8);
+	return in + 2;
+}
+
+static const uint8_t* GetQword(const uint8_t* in, uint64_t& value) {
+	value = 0;
+	for (int i = 0; i < 8; ++i) {
+		value |= (uint64_t)in[i] << (i * 8);
+	}
+	return in + 8;
+}
+
+size_t Chippin8::SaveState(uint8_t* buffer, size_t size, 
+	bool withMemory) const {
+	if (buffer == nullptr || size < STATE_SIZE) {
+		return 0;
+	}
+
+	uint8_t* out = buffer;
+	memcpy(out, STATE_MAGIC, sizeof(STATE_MAGIC));
+	out = PutWord(out + 4, STATE_VERSION);
+	*out++ = (uint8_t)quirkProfile + 1;
+	*out++ = 0;
+
+	if (withMemory) {
+		GetMemory(out);
+	}
+	out += MEMORY_SIZE;
+	for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+		for (int y = 0; y < DISPLAY_HEIGHT; ++y) {
+			for (int word = 0; word < DISPLAY_WORDS; ++word) {
+				out = PutQword(out, display[plane][y][word]);
+			}
+		}
+	}
+	memcpy(out, registers, sizeof(registers));
+	out += sizeof(registers);
+	for (int i = 0; i < 16; ++i) {
+		out = PutWord(out, stack[i]);
+	}
+	out = PutWord(out, pc);
+	out = PutWord(out, index);
+	out = PutWord(out, opcode);
+	*out++ = sp;
+	*out++ = delayTimer;
+	*out++ = soundTimer;
+
+	out = PutWord(out, GetKeypadMask());
+	out = PutQword(out, rngState);
+
+	*out++ = highResolution ? 1 : 0;
+	*out++ = planeMask;
+	memcpy(out, flags, sizeof(flags));
+	out += sizeof(flags);
+	memcpy(out, audioPattern, sizeof(audioPattern));
+	out += sizeof(audioPattern);
+	*out++ = pitch;
+
+	return out - buffer;
+}
+
+bool Chippin8::LoadState(const uint8_t* buffer, size_t size) {
+	uint16_t version;
+	if (buffer == nullptr || size < 8
+		|| memcmp(buffer, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0) {
+		return false;
+	}
+	GetWord(buffer + 4, version);
+	if ((version != STATE_VERSION || size < STATE_SIZE) 
+		&& (version != 1 || size < STATE_V1_SIZE)) {
+		return false;
+	}
+	uint8_t profile = buffer[6];
+	if (profile > QUIRK_PROFILE_COUNT) {
+		return false;
+	}
+
+	// Read the whole state before changing anything, so that a state that
+	// turns out to be invalid is refused as a whole
+	const uint8_t* in = buffer + 8;
+	const uint8_t* memory = in;
+	DisplayPlane stateDisplay[DISPLAY_PLANES];
+	memset(stateDisplay, 0, sizeof(stateDisplay));
+	if (version == 1) {
+		// Only the first 4KB, and the first plane in low resolution
+		in += STATE_V1_MEMORY_SIZE;
+		for (int y = 0; y < DISPLAY_HEIGHT / 2; ++y) {
+			in = GetQword(in, stateDisplay[0][y][0]);
+		}
+	}
+	else {
+		in += MEMORY_SIZE;
+		for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+			for (int y = 0; y < DISPLAY_HEIGHT; ++y) {
+				for (int word = 0; word < DISPLAY_WORDS; ++word) {
+					in = GetQword(in, stateDisplay[plane][y][word]);
+				}
+			}
+		}
+	}
+	const uint8_t* stateRegisters = in;
+	in += sizeof(registers);
+	uint16_t stateStack[16];
+	for (int i = 0; i < 16; ++i) {
+		in = GetWord(in, stateStack[i]);
+	}
+	uint16_t statePc;
+	uint16_t stateIndex;
+	uint16_t stateOpcode;
+	in = GetWord(in, statePc);
+	in = GetWord(in, stateIndex);
+	in = GetWord(in, stateOpcode);
+	uint8_t stateSp = *in++;
+	uint8_t stateDelayTimer = *in++;
+	uint8_t stateSoundTimer = *in++;
+	uint16_t keys;
+	in = GetWord(in, keys);
+	uint64_t stateRngState;
+	in = GetQword(in, stateRngState);
+
+	// Every address is in the 64KB of memory, but version 1 only had 4KB
+	if (stateSp > sizeof(stack) / sizeof(stack[0]) || stateRngState == 0
+		|| (version == 1 && (statePc >= STATE_V1_MEMORY_SIZE
+			|| stateIndex >= STATE_V1_MEMORY_SIZE))) {
+		return false;
+	}
+	if (version != 1 && (in[0] > 1 || in[1] > 0x3)) {
+		return false;
+	}
+
+	// The state is valid, load it
+	if (profile > 0 && (QuirkProfile)(profile - 1) != quirkProfile) {
+		SetQuirkProfile((QuirkProfile)(profile - 1));
+	}
+	if (version == 1) {
+		std::vector<uint8_t> memory4KB(MEMORY_SIZE, 0);
+		memcpy(memory4KB.data(), memory, STATE_V1_MEMORY_SIZE);
+		SetMemory(memory4KB.data());
+	}
+	else {
+		SetMemory(memory);
+	}
+	memcpy(display, stateDisplay, sizeof(display));
+	memcpy(registers, stateRegisters, sizeof(registers));
+	memcpy(stack, stateStack, sizeof(stack));
+	pc = statePc;
+	index = stateIndex;
+	opcode = stateOpcode;
+	sp = stateSp;
+	delayTimer = stateDelayTimer;
+	soundTimer = stateSoundTimer;
+	buzzerSounded = soundTimer > 0;
+	SetKeypadMask(keys);
+	rngState = stateRngState;
+
+	if (version == 1) {
+		highResolution = false;
+		planeMask = 0x1;
+		memset(flags, 0, sizeof(flags));
+		memset(audioPattern, 0, sizeof(audioPattern));
+		pitch = 64;
+	}
+	else {
+		highResolution = *in++ != 0;
+		planeMask = *in++;
+		memcpy(flags, in, sizeof(flags));
+		in += sizeof(flags);
+		memcpy(audioPattern, in, sizeof(audioPattern));
+		in += sizeof(audioPattern);
+		pitch = *in++;
+	}
+
+	// The whole display has to be presented (SetMemory has taken care of 
+	// the decoded instructions that changed)
+	displayDirty = true;
+	dirtyRowFirst = 0;
+	dirtyRowLast = GetDisplayHeight() - 1;
+
+	return true;
+}
+
+bool Chippin8::SaveState(const std::string& filename) const {
+	uint8_t buffer[STATE_SIZE];
+	size_t size = SaveState(buffer, sizeof(buffer));
+
+	std::ofstream file(filename, std::ios::binary);
+	if (!file.is_open() || size == 0) {
+		return false;
+	}
+	file.write((const char*)buffer, size);
+	return file.good();
+}
+
+bool Chippin8::LoadState(const std::string& filename) {
+	uint8_t buffer[STATE_SIZE];
+
+	std::ifstream file(filename, std::ios::binary);
+	if (!file.is_open()) {
+		return false;
 	}
+	file.read((char*)buffer, sizeof(buffer));
+	return LoadState(buffer, (size_t)file.gcount());
+}
+
+/* ----- Snapshots ----- */
+
+void Chippin8::TakeSnapshot(Snapshot& snapshot) const {
+	// Most pages are still the ones of the last snapshot. Skipping those 
+	// avoids touching their reference counts.
+	for (size_t i = 0; i < PAGE_COUNT; ++i) {
+		if (snapshot.pages[i] != pages[i]) {
+			snapshot.pages[i] = pages[i];
+		}
+	}
+	memcpy(snapshot.display, display, sizeof(display));
+	snapshot.highResolution = highResolution;
+	snapshot.planeMask = planeMask;
+	snapshot.opcode = opcode;
+	snapshot.pc = pc;
+	snapshot.index = index;
+	memcpy(snapshot.registers, registers, sizeof(registers));
+	memcpy(snapshot.stack, stack, sizeof(stack));
+	snapshot.sp = sp;
+	snapshot.delayTimer = delayTimer;
+	snapshot.soundTimer = soundTimer;
+	memcpy(snapshot.keypad, keypad, sizeof(keypad));
+	snapshot.rngState = rngState;
+	memcpy(snapshot.flags, flags, sizeof(flags));
+	memcpy(snapshot.audioPattern, audioPattern, sizeof(audioPattern));
+	snapshot.pitch = pitch;
+	snapshot.buzzerSounded = buzzerSounded;
+	snapshot.displayDirty = displayDirty;
+	snapshot.dirtyRowFirst = dirtyRowFirst;
+	snapshot.dirtyRowLast = dirtyRowLast;
+	snapshot.idleCycles = idleCycles;
+	snapshot.jumpedBack = jumpedBack;
+	snapshot.writeCount = writeCount;
+	snapshot.idleState = idleState;
+	snapshot.idleStateCycle = idleStateCycle;
+	snapshot.idleBackoff = idleBackoff;
+	snapshot.idleCountdown = idleCountdown;
+}
+
+void Chippin8::RestoreSnapshot(const Snapshot& snapshot, uint16_t& codeStart,
+	uint16_t& codeLength) {
+	// Pages written since the snapshot was taken have been copied (the 
+	// snapshot still shares the originals), so those are the only ones
+	// that can differ. Within the decode cache, find the bytes that do.
+	int first = DECODE_CACHE_SIZE;
+	int last = -1;
+	for (size_t i = 0; i < PAGE_COUNT; ++i) {
+		if (snapshot.pages[i] == pages[i]) {
+			continue;
+		}
+		if (i * PAGE_SIZE < DECODE_CACHE_SIZE) {
+			const MemoryPage& current = *pages[i];
+			const MemoryPage& restored = *snapshot.pages[i];
+			for (int j = 0; j < (int)PAGE_SIZE; ++j) {
+				if (current[j] != restored[j]) {
+					first = std::min(first, (int)(i * PAGE_SIZE) + j);
+					last = std::max(last, (int)(i * PAGE_SIZE) + j);
+				}
+			}
+		}
+		pages[i] = snapshot.pages[i];
+	}
+	codeStart = last < 0 ? 0 : (uint16_t)first;
+	codeLength = last < 0 ? 0 : (uint16_t)(last - first + 1);
+	if (codeLength > 0) {
+		InvalidateDecodeCache(codeStart, codeLength);
+	}
+
+	memcpy(display, snapshot.display, sizeof(display));
+	highResolution = snapshot.highResolution;
+	planeMask = snapshot.planeMask;
+	opcode = snapshot.opcode;
+	pc = snapshot.pc;
+	index = snapshot.index;
+	memcpy(registers, snapshot.registers, sizeof(registers));
+	memcpy(stack, snapshot.stack, sizeof(stack));
+	sp = snapshot.sp;
+	delayTimer = snapshot.delayTimer;
+	soundTimer = snapshot.soundTimer;
+	memcpy(keypad, snapshot.keypad, sizeof(keypad));
+	rngState = snapshot.rngState;
+	memcpy(flags, snapshot.flags, sizeof(flags));
+	memcpy(audioPattern, snapshot.audioPattern, sizeof(audioPattern));
+	pitch = snapshot.pitch;
+	buzzerSounded = snapshot.buzzerSounded;
+	displayDirty = snapshot.displayDirty;
+	dirtyRowFirst = snapshot.dirtyRowFirst;
+	dirtyRowLast = snapshot.dirtyRowLast;
+	idleCycles = snapshot.idleCycles;
+	jumpedBack = snapshot.jumpedBack;
+	writeCount = snapshot.writeCount;
+	idleState = snapshot.idleState;
+	idleStateCycle = snapshot.idleStateCycle;
+	idleBackoff = snapshot.idleBackoff;
+	idleCountdown = snapshot.idleCountdown;
 }
 
 /* ----- CHIP - 8 Instructions ----- */
 
-void Chippin8::opcode_NOP() { /* Do nothing */ }
+uint8_t Chippin8::Random() {
+	// xorshift64* (https://en.wikipedia.org/wiki/Xorshift#xorshift*). 
+	// Unlike rand(), every Chippin8 has its own generator, and its state is 
+	// part of the save state.
+	rngState ^= rngState >> 12;
+	rngState ^= rngState << 25;
+	rngState ^= rngState >> 27;
+	return (uint8_t)((rngState * 0x2545F4914F6CDD1Dull) >> 56);
+}
+
+// Extend the dirty range of the display to include rows first to last
+#define MARK_ROWS_DIRTY(first, last) do{ \
+		displayDirty = true; \
+		++writeCount; \
+		if ((first) < dirtyRowFirst) dirtyRowFirst = (first); \
+		if ((last) > dirtyRowLast) dirtyRowLast = (last); \
+		} while(0)
+
+void Chippin8::opcode_NOP(const Instruction&) { /* Do nothing */ }
 
-void Chippin8::opcode_0NNN() {
+void Chippin8::opcode_0NNN(const Instruction&) {
 	// This Opcode calls machine instructions for the RCA 1802. For this 
 	// emulator, it can remain unimplemented. Most CHIP-8 games do not use this
 	// instruction anyway.
 }
 
-void Chippin8::opcode_00E0() {
-	//Clear screen
-	for (int i = 0; i < DISPLAY_WIDTH * DISPLAY_HEIGHT; i++) {
-		display[i] = 0;
+void Chippin8::opcode_00CN(const Instruction& instruction) {
+	// Scroll the selected planes down by N rows. Whole rows are moved, and 
+	// the rows scrolled in at the top are blank.
+	int height = GetDisplayHeight();
+	int rows = std::min<int>(instruction.N, height);
+
+	for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+		if (planeMask & (1u << plane)) {
+			memmove(display[plane][rows], display[plane][0],
+				(height - rows) * sizeof(display[plane][0]));
+			memset(display[plane][0], 0, rows * sizeof(display[plane][0]));
+		}
+	}
+	MARK_ROWS_DIRTY(0, height - 1);
+}
+
+void Chippin8::opcode_00DN(const Instruction& instruction) {
+	// Scroll the selected planes up by N rows
+	int height = GetDisplayHeight();
+	int rows = std::min<int>(instruction.N, height);
+
+	for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+		if (planeMask & (1u << plane)) {
+			memmove(display[plane][0], display[plane][rows],
+				(height - rows) * sizeof(display[plane][0]));
+			memset(display[plane][height - rows], 0, 
+				rows * sizeof(display[plane][0]));
+		}
+	}
+	MARK_ROWS_DIRTY(0, height - 1);
+}
+
+void Chippin8::opcode_00E0(const Instruction&) {
+	//Clear screen (the selected planes)
+	for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+		if (planeMask & (1u << plane)) {
+			memset(display[plane], 0, sizeof(display[plane]));
+		}
 	}
+	MARK_ROWS_DIRTY(0, GetDisplayHeight() - 1);
 }
 
-void Chippin8::opcode_00EE() {
+void Chippin8::opcode_00EE(const Instruction&) {
 	// To return from a subroutine, we pop the last address from the stack,
 	// subtract one from the stack pointer and set the program counter to it.
+	// Returning with an empty stack halts (see StackFault).
+	if (sp == 0) {
+		StackFault();
+		return;
+	}
 	pc = stack[--sp];
 }
 
-void Chippin8::opcode_1NNN() {
+void Chippin8::opcode_00FB(const Instruction&) {
+	// Scroll the selected planes right by 4 pixels. Each row is shifted as
+	// a whole, carrying the pixels from one word into the next. In low
+	// resolution the row is a single word.
+	int height = GetDisplayHeight();
+	int words = highResolution ? DISPLAY_WORDS : 1;
+
+	for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+		if (!(planeMask & (1u << plane))) continue;
+		for (int y = 0; y < height; ++y) {
+			uint64_t* row = display[plane][y];
+			for (int word = words - 1; word > 0; --word) {
+				row[word] = (row[word] >> 4) | (row[word - 1] << 60);
+			}
+			row[0] >>= 4;
+		}
+	}
+	MARK_ROWS_DIRTY(0, height - 1);
+}
+
+void Chippin8::opcode_00FC(const Instruction&) {
+	// Scroll the selected planes left by 4 pixels
+	int height = GetDisplayHeight();
+	int words = highResolution ? DISPLAY_WORDS : 1;
+
+	for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+		if (!(planeMask & (1u << plane))) continue;
+		for (int y = 0; y < height; ++y) {
+			uint64_t* row = display[plane][y];
+			for (int word = 0; word < words - 1; ++word) {
+				row[word] = (row[word] << 4) | (row[word + 1] >> 60);
+			}
+			row[words - 1] <<= 4;
+		}
+	}
+	MARK_ROWS_DIRTY(0, height - 1);
+}
+
+void Chippin8::StackFault() {
+	// Stay on the instruction forever, like 00FD. Nothing outside the stack
+	// is touched, and the state can't change any more, which makes it an
+	// idle loop (see SkipIdleCycles).
+	jumpedBack = true;
+	pc -= 2;
+}
+
+void Chippin8::opcode_00FD(const Instruction&) {
+	// Stay on this instruction forever, like FX0A waiting for a key that
+	// never comes. That is an idle loop too (see SkipIdleCycles).
+	jumpedBack = true;
+	pc -= 2;
+}
+
+void Chippin8::opcode_00FE(const Instruction&) {
+	// Switch to low resolution. The rows no longer mean the same, so the 
+	// whole display is cleared.
+	highResolution = false;
+	memset(display, 0, sizeof(display));
+	MARK_ROWS_DIRTY(0, GetDisplayHeight() - 1);
+}
+
+void Chippin8::opcode_00FF(const Instruction&) {
+	// Switch to high resolution, clearing the display
+	highResolution = true;
+	memset(display, 0, sizeof(display));
+	MARK_ROWS_DIRTY(0, GetDisplayHeight() - 1);
+}
+
+void Chippin8::opcode_1NNN(const Instruction& instruction) {
 	// Jump to address NNN by setting the program counter to last 3 bytes of
-	// the opcode. (uint16_t addr = opcode & 0x0FFFu)
-	pc = opcode & 0x0FFFu;
+	// the opcode. (uint16_t addr = instruction.NNN)
+	// A jump backwards may close an idle loop (see SkipIdleCycles).
+	jumpedBack = instruction.NNN < pc;
+	pc = instruction.NNN;
 }
 
-void Chippin8::opcode_2NNN() {
+void Chippin8::opcode_2NNN(const Instruction& instruction) {
 	// Call a subroutine by pushing the program counter to the stack and 
-	// setting the program counter to NNN.
+	// setting the program counter to NNN. Calling with a full stack halts
+	// (see StackFault).
+	if (sp >= sizeof(stack) / sizeof(stack[0])) {
+		StackFault();
+		return;
+	}
 	stack[sp] = pc;
 	++sp;
-	pc = opcode & 0x0FFFu;
+	pc = instruction.NNN;
 }
 
-void Chippin8::opcode_3XNN() {
+void Chippin8::opcode_3XNN(const Instruction& instruction) {
 	// If Vx == NN, skip the next instruction.
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
-	uint8_t NN = opcode & 0x00FFu;
+	uint8_t Vx = instruction.X;
+	uint8_t NN = instruction.NN;
 	if (registers[Vx] == NN) {
-		pc += 2;
+		SkipNext();
 	}
 }
 
-void Chippin8::opcode_4XNN() {
+void Chippin8::opcode_4XNN(const Instruction& instruction) {
 	// If Vx != NN, skip the next instruction
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
-	uint8_t NN = opcode & 0x00FFu;
+	uint8_t Vx = instruction.X;
+	uint8_t NN = instruction.NN;
 	if (registers[Vx] != NN) {
-		pc += 2;
+		SkipNext();
 	}
 }
 
-void Chippin8::opcode_5XY0() {
+void Chippin8::opcode_5XY0(const Instruction& instruction) {
 	// If Vx == Vy, skip the next instruction
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4;
+	uint8_t Vx = instruction.X;
+	uint8_t Vy = instruction.Y;
 	if (registers[Vx] == registers[Vy]) {
-		pc += 2;
+		SkipNext();
+	}
+}
+
+void Chippin8::opcode_5XY2(const Instruction& instruction) {
+	// Store Vx to Vy to memory, counting down if Vx is after Vy
+	int step = instruction.X <= instruction.Y ? 1 : -1;
+	int count = abs(instruction.Y - instruction.X) + 1;
+
+	for (int i = 0; i < count; ++i) {
+		WriteMemory(index + i, registers[instruction.X + i * step]);
+	}
+
+	// The program may have written over its own code
+	InvalidateDecodeCache(index, count);
+}
+
+void Chippin8::opcode_5XY3(const Instruction& instruction) {
+	// Fill Vx to Vy from memory
+	int step = instruction.X <= instruction.Y ? 1 : -1;
+	int count = abs(instruction.Y - instruction.X) + 1;
+
+	for (int i = 0; i < count; ++i) {
+		registers[instruction.X + i * step] = ReadMemory(index + i);
 	}
 }
 
-void Chippin8::opcode_6XNN() {
+void Chippin8::opcode_6XNN(const Instruction& instruction) {
 	// Set register Vx to NN
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
-	uint8_t NN = opcode & 0x00FFu;
+	uint8_t Vx = instruction.X;
+	uint8_t NN = instruction.NN;
 	registers[Vx] = NN;
 }
 
-void Chippin8::opcode_7XNN() {
+void Chippin8::opcode_7XNN(const Instruction& instruction) {
 	// Add to Vx the value NN
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
-	uint8_t NN = opcode & 0x00FFu;
+	uint8_t Vx = instruction.X;
+	uint8_t NN = instruction.NN;
 	registers[Vx] += NN;
 }
 
-void Chippin8::opcode_8XY0() {
+void Chippin8::opcode_8XY0(const Instruction& instruction) {
 	// Set Vx = Vy
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4;
+	uint8_t Vx = instruction.X;
+	uint8_t Vy = instruction.Y;
 	registers[Vx] = registers[Vy];
 }
 
-void Chippin8::opcode_8XY1() {
+template <typename Quirks>
+void Chippin8::opcode_8XY1(const Instruction& instruction) {
 	// Set Vx to Vx OR Vy
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4;
+	uint8_t Vx = instruction.X;
+	uint8_t Vy = instruction.Y;
 	registers[Vx] |= registers[Vy];
+
+	// The COSMAC VIP did the logic operations in a way that cleared VF
+	if constexpr (Quirks::LOGIC_RESETS_VF) {
+		registers[0xF] = 0;
+	}
 }
 
-void Chippin8::opcode_8XY2() {
+template <typename Quirks>
+void Chippin8::opcode_8XY2(const Instruction& instruction) {
 	// Set Vx to Vx AND Vy
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4;
+	uint8_t Vx = instruction.X;
+	uint8_t Vy = instruction.Y;
 	registers[Vx] &= registers[Vy];
+
+	if constexpr (Quirks::LOGIC_RESETS_VF) {
+		registers[0xF] = 0;
+	}
 }
 
-void Chippin8::opcode_8XY3() {
+template <typename Quirks>
+void Chippin8::opcode_8XY3(const Instruction& instruction) {
 	// Sets Vx to Vx XOR Vy
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4;
+	uint8_t Vx = instruction.X;
+	uint8_t Vy = instruction.Y;
 	registers[Vx] ^= registers[Vy];
+
+	if constexpr (Quirks::LOGIC_RESETS_VF) {
+		registers[0xF] = 0;
+	}
 }
 
-void Chippin8::opcode_8XY4() {
+// The arithmetic instructions below set VF after the result, so if X is F 
+// the result is overwritten by the flag, like on every interpreter.
+
+void Chippin8::opcode_8XY4(const Instruction& instruction) {
 	// Add Vx and Vy and store in Vx. Carry is set in VF
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4;
-	registers[Vx] += registers[Vy];
+	uint8_t Vx = instruction.X;
+	uint8_t Vy = instruction.Y;
+	int sum = registers[Vx] + registers[Vy];
+	registers[Vx] = (uint8_t)sum;
 
 	//Overflow occurs if the the value is greater than 8 bits (255)
-	registers[0xF] = (registers[Vx] > 255) ? 1 : 0;
+	registers[0xF] = (sum > 255) ? 1 : 0;
 }
 
-void Chippin8::opcode_8XY5() {
+void Chippin8::opcode_8XY5(const Instruction& instruction) {
 	// Subtract Vy from Vx and store in Vx. 
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4;
+	uint8_t Vx = instruction.X;
+	uint8_t Vy = instruction.Y;
 
 	// If there is a borrow, VF register is set to 0. Otherwise it is set to 1.
-	registers[0xF] = (registers[Vx] < registers[Vy]) ? 0 : 1;
+	uint8_t noBorrow = (registers[Vx] < registers[Vy]) ? 0 : 1;
 	
 	registers[Vx] -= registers[Vy];
+	registers[0xF] = noBorrow;
 }
 
-void Chippin8::opcode_8XY6() {
-	// Store LSB in VF, then bit-shift Vx to the right by one.
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
-	registers[0xF] = Vx & 0x01u;
+template <typename Quirks>
+void Chippin8::opcode_8XY6(const Instruction& instruction) {
+	// Bit-shift Vy (or Vx) to the right by one into Vx, then store the bit
+	// shifted out (the LSB) in VF.
+	uint8_t Vx = instruction.X;
+	uint8_t value = registers[Quirks::SHIFT_USES_VY ? instruction.Y : Vx];
 
-	registers[Vx] >>= 1;
+	registers[Vx] = value >> 1;
+	registers[0xF] = value & 0x01u;
 }
 
-void Chippin8::opcode_8XY7() {
+void Chippin8::opcode_8XY7(const Instruction& instruction) {
 	// Subtract Vx from Vy and store in Vx
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4;
+	uint8_t Vx = instruction.X;
+	uint8_t Vy = instruction.Y;
 	
 	// If there is a borrow, VF register is set to 0. Otherwise it is set to 1.
-	registers[0xF] = (registers[Vy] < registers[Vx]) ? 0 : 1;
+	uint8_t noBorrow = (registers[Vy] < registers[Vx]) ? 0 : 1;
 
 	registers[Vx] = registers[Vy] - registers[Vx];
+	registers[0xF] = noBorrow;
 }
 
-void Chippin8::opcode_8XYE() {
-	// Store MSB in VF, then bit-shift to the left by one.
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
-	registers[0xF] = (Vx & 0x80u) >> 7;
+template <typename Quirks>
+void Chippin8::opcode_8XYE(const Instruction& instruction) {
+	// Bit-shift Vy (or Vx) to the left by one into Vx, then store the bit 
+	// shifted out (the MSB) in VF.
+	uint8_t Vx = instruction.X;
+	uint8_t value = registers[Quirks::SHIFT_USES_VY ? instruction.Y : Vx];
 
-	registers[Vx] <<= 1;
+	registers[Vx] = value << 1;
+	registers[0xF] = (value & 0x80u) >> 7;
 }
 
-void Chippin8::opcode_9XY0() {
+void Chippin8::opcode_9XY0(const Instruction& instruction) {
 	// If Vx != Vy, skip the next instruction
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4;
+	uint8_t Vx = instruction.X;
+	uint8_t Vy = instruction.Y;
 
 	if (registers[Vx] != registers[Vy]) {
-		pc += 2;
+		SkipNext();
 	}
 }
 
-void Chippin8::opcode_ANNN() {
+void Chippin8::opcode_ANNN(const Instruction& instruction) {
 	// Set Index register to NNN
-	index = opcode & 0x0FFFu;
+	index = instruction.NNN;
 }
 
-void Chippin8::opcode_BNNN() {
-	// Jump to address NNN + V0
-	uint8_t NNN = opcode & 0x0FFFu;
-	pc = NNN + registers[0x0];
+template <typename Quirks>
+void Chippin8::opcode_BNNN(const Instruction& instruction) {
+	// Jump to address NNN + V0. With the jump quirk, the instruction is 
+	// BXNN and VX is added instead.
+	uint8_t V = Quirks::JUMP_USES_VX ? instruction.X : 0x0;
+	pc = instruction.NNN + registers[V];
 }
 
-void Chippin8::opcode_CXNN() {
+void Chippin8::opcode_CXNN(const Instruction& instruction) {
 	// Set Vx to random number (from 0 to 255) AND NN
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
-	uint8_t NN = opcode & 0x00FFu;
-	uint8_t random = rand() % 256;
+	uint8_t Vx = instruction.X;
+	uint8_t NN = instruction.NN;
+	uint8_t random = Random();
 
 	registers[Vx] = random & NN;
 }
 
-// @TODO: review this code later
-void Chippin8::opcode_DXYN() {
+template <typename Quirks>
+void Chippin8::opcode_DXYN(const Instruction& instruction) {
 	// Draw a sprite at coordinate (X, Y), with a width of 8 pixels and height of 
-	// N pixels. Drawing is done by XORing using a mask to set displaybits on or 
-	// off
-
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4;
-	const uint8_t width = 8; // Sprite width is guaranteed to be 8 pixels wide
-	uint8_t height = opcode & 0x000Fu; // Sprite height ranges from 1 to 15
-
-	uint8_t xPosition = registers[Vx] % DISPLAY_WIDTH;
-	uint8_t yPosition = registers[Vy] % DISPLAY_HEIGHT;
-
-	registers[0xF] = 0;
-
-	// Iterate through the sprite pixels. Note that "index" will point to the 
-	// the location of the sprite values in memory
-	for (int i = 0; i < height; i++) {
-		uint8_t sprite = memory[index + i];
-
-		for (int j = 0; j < width; j++) {
-			// (0x80u >> j) scans through the width of the pixels at every
-			// iteration. It is ANDed with the value of sprite to get the 
-			// value of the pixel
-			uint8_t spritePixel = sprite & (0x80u >> j); 
-			
-			uint32_t* screenPixel 
-				= &display[(yPosition + i) * DISPLAY_WIDTH + (xPosition + j)];
-
-			if (spritePixel) {
-				// If a collision occurs between the sprite pixel and screen 
-				// pixel, set register VF to 1
-				if ((*screenPixel) == 0xFFFFFFFF) {
-					registers[0xF] = 1;
-				}
-				// XOR sprite pixel with screen pixel
-				*screenPixel ^= 0xFFFFFFFF;
+	// N pixels. Drawing is done by XORing the sprite into the display rows.
+	DrawSprite<Quirks>(instruction, instruction.N, false);
+}
+
+template <typename Quirks>
+void Chippin8::opcode_DXY0(const Instruction& instruction) {
+	// Draw a 16 x 16 sprite at coordinate (X, Y)
+	DrawSprite<Quirks>(instruction, 16, true);
+}
+
+template <typename Quirks>
+void Chippin8::DrawSprite(const Instruction& instruction, int rows, 
+	bool wide) {
+	uint8_t Vx = instruction.X;
+	uint8_t Vy = instruction.Y;
+	int width = GetDisplayWidth();
+	int height = GetDisplayHeight();
+	int words = highResolution ? DISPLAY_WORDS : 1;
+
+	// Rows below the bottom edge are clipped, or wrap around to the top
+	int xPosition = registers[Vx] % width;
+	int yPosition = registers[Vy] % height;
+	int visibleRows = Quirks::CLIP_SPRITES 
+		? std::min(rows, height - yPosition) : rows;
+
+	// The sprite is shifted into place across the word the x position is in
+	// and the one after it. Whatever would go past the last word of the 
+	// row is off the right edge, and clipped or wrapped around to the 
+	// first word.
+	int word = xPosition / 64;
+	int shift = xPosition % 64;
+	int nextWord = Quirks::CLIP_SPRITES ? word + 1 : (word + 1) % words;
+	int bytesPerRow = wide ? 2 : 1;
+	uint16_t address = index;
+	uint32_t collidedRows = 0;	// Bit i set if row i of the sprite collided
+
+	for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+		if (!(planeMask & (1u << plane))) continue;
+
+		// Each row of the sprite is 1 or 2 bytes in memory, starting at 
+		// "index". The leftmost pixel is the most significant bit, like in
+		// the display rows.
+		for (int i = 0; i < visibleRows; i++) {
+			uint64_t sprite = (uint64_t)ReadMemory(address + i * bytesPerRow)
+				<< 56;
+			if (wide) {
+				sprite |= (uint64_t)ReadMemory(address + i * 2 + 1) << 48;
+			}
+			uint64_t* displayRow = display[plane][(yPosition + i) % height];
+
+			// If a collision occurs between the sprite and the screen 
+			// pixels, set register VF to 1
+			uint64_t spriteRow = sprite >> shift;
+			bool collision = (displayRow[word] & spriteRow) != 0;
+			displayRow[word] ^= spriteRow;
+			if (shift > 0 && nextWord < words) {
+				spriteRow = sprite << (64 - shift);
+				collision |= (displayRow[nextWord] & spriteRow) != 0;
+				displayRow[nextWord] ^= spriteRow;
 			}
+			collidedRows |= (uint32_t)collision << i;
 		}
+		address += rows * bytesPerRow;
+	}
+
+	if (Quirks::COLLISION_COUNTS_ROWS && highResolution) {
+		// SUPER-CHIP counts the rows that collided, plus those clipped at 
+		// the bottom
+		registers[0xF] = (uint8_t)(std::popcount(collidedRows) 
+			+ rows - visibleRows);
+	}
+	else {
+		registers[0xF] = collidedRows != 0 ? 1 : 0;
+	}
+
+	if (yPosition + visibleRows > height) {
+		MARK_ROWS_DIRTY(0, height - 1);
+	}
+	else if (visibleRows > 0) {
+		MARK_ROWS_DIRTY(yPosition, yPosition + visibleRows - 1);
 	}
 }
 
-void Chippin8::opcode_EX9E() {
-	// If key Vx is pressed, skip the next instruction
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
+void Chippin8::opcode_EX9E(const Instruction& instruction) {
+	// If key Vx is pressed, skip the next instruction. Only the low 4 bits
+	// of Vx select the key.
+	uint8_t Vx = instruction.X;
 	
-	if (keypad[registers[Vx]]) {
-		pc += 2;
+	if (keypad[registers[Vx] & 0x0Fu]) {
+		SkipNext();
 	}
 }
 
-void Chippin8::opcode_EXA1() {
+void Chippin8::opcode_EXA1(const Instruction& instruction) {
 	//If key Vx is not pressed, skip the next instruction
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
+	uint8_t Vx = instruction.X;
+
+	if (!keypad[registers[Vx] & 0x0Fu]) {
+		SkipNext();
+	}
+}
+
+void Chippin8::opcode_F000(const Instruction&) {
+	// The address is the next 2 bytes, which are skipped
+	index = (ReadMemory(pc) << 8) | ReadMemory(pc + 1);
+	pc += 2;
+}
+
+void Chippin8::opcode_FN01(const Instruction& instruction) {
+	// Select the planes N (bit n for plane n)
+	planeMask = instruction.X & 0x3u;
+	++writeCount;	// Changes what idle loops draw to
+}
 
-	if (!keypad[registers[Vx]]) {
-		pc += 2;
+void Chippin8::opcode_F002(const Instruction&) {
+	// Load the audio pattern from memory
+	for (int i = 0; i < 16; ++i) {
+		audioPattern[i] = ReadMemory(index + i);
 	}
+	++writeCount;
 }
 
-void Chippin8::opcode_FX07() {
+void Chippin8::opcode_FX07(const Instruction& instruction) {
 	// Set register Vx to the delay timer
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
+	uint8_t Vx = instruction.X;
 	registers[Vx] = delayTimer;
 }
 
-void Chippin8::opcode_FX0A() {
+void Chippin8::opcode_FX0A(const Instruction& instruction) {
 	// Wait for a key press and store its value in Vx after receiving it.
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
+	uint8_t Vx = instruction.X;
 
 	// This instruction should block execution, unless it receives a key press.
 	// Waiting can be done by subtracting the program counter. The idea here is
 	// that, unless a key press is recieved, we do not allow the program 
 	// counter to advance to the next instruction, thus constantly waiting.
-	for (int i = 0; i < sizeof(keypad) / sizeof(keypad[0]); i++) {
+	for (size_t i = 0; i < sizeof(keypad) / sizeof(keypad[0]); i++) {
 		if (keypad[i]) {
-			registers[Vx] = keypad[i];
+			registers[Vx] = (uint8_t)i;
 			return;
 		}
 	}
+	// Waiting is an idle loop (see SkipIdleCycles)
+	jumpedBack = true;
 	pc -= 2;
 }
 
-void Chippin8::opcode_FX15() {
+void Chippin8::opcode_FX15(const Instruction& instruction) {
 	// Set the delay timer to Vx
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
+	uint8_t Vx = instruction.X;
 	delayTimer = registers[Vx];
 }
 
-void Chippin8::opcode_FX18() {
+void Chippin8::opcode_FX18(const Instruction& instruction) {
 	// Set the delay timer to Vx
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
+	uint8_t Vx = instruction.X;
 	soundTimer = registers[Vx];
 }
 
-void Chippin8::opcode_FX1E() {
+void Chippin8::opcode_FX1E(const Instruction& instruction) {
 	// Add Vx to Index register
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
+	uint8_t Vx = instruction.X;
 	index += registers[Vx];
 }
 
-void Chippin8::opcode_FX29() {
+void Chippin8::opcode_FX29(const Instruction& instruction) {
 	// Set the index register to the location of the sprite stored in Vx
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
+	uint8_t Vx = instruction.X;
 	
 	// Each character is described by 5 bytes, so there is an offset of 5 for 
 	// each character
 	index = FONTSET_START_ADDRESS + (registers[Vx] * 5);
 }
 
-void Chippin8::opcode_FX33() {
+void Chippin8::opcode_FX30(const Instruction& instruction) {
+	// Set the index register to the location of the large sprite stored in
+	// Vx. Each character is described by 10 bytes.
+	uint8_t Vx = instruction.X;
+	index = BIG_FONTSET_START_ADDRESS + (registers[Vx] & 0x0Fu) * 10;
+}
+
+void Chippin8::opcode_FX33(const Instruction& instruction) {
 	// Store BCD representation of Vx
 	// Vx[hundreds] at I, Vx[Tens] at I+1, Vx[Ones] at I+2
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
+	uint8_t Vx = instruction.X;
+
+	WriteMemory(index, (registers[Vx] / 100) % 10);
+	WriteMemory(index + 1, (registers[Vx] / 10) % 10);
+	WriteMemory(index + 2, registers[Vx] % 10);
 
-	memory[index] = (registers[Vx] / 100) % 10;
-	memory[index + 1] = (registers[Vx] / 10) % 10;
-	memory[index + 2] = registers[Vx] % 10;
+	// The program may have written over its own code
+	InvalidateDecodeCache(index, 3);
 }
 
-void Chippin8::opcode_FX55() {
+void Chippin8::opcode_FX3A(const Instruction& instruction) {
+	// Set the pitch of the audio pattern to Vx
+	uint8_t Vx = instruction.X;
+	pitch = registers[Vx];
+	++writeCount;
+}
+
+template <typename Quirks>
+void Chippin8::opcode_FX55(const Instruction& instruction) {
 	// Store to memory values from V0 to Vx
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
+	uint8_t Vx = instruction.X;
 	
 	for (int i = 0; i <= Vx; ++i) {
-		memory[index + i] = registers[i];
+		WriteMemory(index + i, registers[i]);
 	}
+
+	// The program may have written over its own code
+	InvalidateDecodeCache(index, Vx + 1);
+	AdvanceIndex<Quirks>(Vx);
 }
 
-void Chippin8::opcode_FX65() {
+template <typename Quirks>
+void Chippin8::opcode_FX65(const Instruction& instruction) {
 	// Fill registers V0 to Vx values from memory
-	uint8_t Vx = (opcode & 0x0F00u) >> 8;
+	uint8_t Vx = instruction.X;
+
+	for (int i = 0; i <= Vx; ++i) {
+		registers[i] = ReadMemory(index + i);
+	}
+	AdvanceIndex<Quirks>(Vx);
+}
+
+void Chippin8::opcode_FX75(const Instruction& instruction) {
+	// Store V0 to Vx in the user flags
+	uint8_t Vx = instruction.X;
+
+	for (int i = 0; i <= Vx; ++i) {
+		flags[i] = registers[i];
+	}
+	++writeCount;
+}
+
+void Chippin8::opcode_FX85(const Instruction& instruction) {
+	// Fill V0 to Vx from the user flags
+	uint8_t Vx = instruction.X;
 
 	for (int i = 0; i <= Vx; ++i) {
-		registers[i] = memory[index + i];
+		registers[i] = flags[i];
 	}
 }
\ No newline at end of file
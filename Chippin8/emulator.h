@@ -5,182 +5,669 @@
 #ifndef EMULATOR_H
 #define EMULATOR_H
 
+#include "quirks.h"
+
 #include <stdint.h>
+#include <stddef.h>
 #include <string>
+#include <array>
+#include <memory>
+#include <vector>
+
+// Size of the display in high resolution mode (SUPER-CHIP). In the 
+// original low resolution mode it is half as wide and half as high.
+#define DISPLAY_WIDTH 128
+#define DISPLAY_HEIGHT 64
+#define DISPLAY_WORDS (DISPLAY_WIDTH / 64)	// 64-bit words per row
+#define DISPLAY_PLANES 2					// Bit planes (XO-CHIP)
 
-#define DISPLAY_WIDTH 64
-#define DISPLAY_HEIGHT 32
+class Profiler;
+struct ROMImage;
 
 class Chippin8 {
 public:
 	Chippin8();
 	~Chippin8();
 
+	struct Instruction;
+
+	// Instruction handlers are called with the pre-decoded instruction. They
+	// are plain function pointers (see Dispatch) rather than pointers to 
+	// member functions, which are slower to call.
+	typedef void (*OpcodeHandler)(Chippin8&, const Instruction&);
+
+	// An instruction that has already been decoded. The handler and operands
+	// are extracted once, the first time the instruction is fetched, so that
+	// executing it again does not need to decode the opcode again.
+	struct Instruction {
+		OpcodeHandler handler;	// Instruction function. nullptr if not decoded
+		uint16_t opcode;		// Raw opcode
+		uint16_t NNN;			// Address (lowest 12 bits)
+		uint8_t NN;				// 8-bit constant (lowest 8 bits)
+		uint8_t N;				// 4-bit constant (lowest 4 bits)
+		uint8_t X;				// Register index (bits 8 - 11)
+		uint8_t Y;				// Register index (bits 4 - 7)
+	};
+
 	/* ----- System components ----- */
-	uint8_t memory[4096];	// 4KB memory.
-	uint32_t display[DISPLAY_WIDTH * DISPLAY_HEIGHT]; // 64 x 32 pixel display
+	// 64KB memory (XO-CHIP), in pages. See ReadMemory and WriteMemory.
+	static constexpr size_t MEMORY_SIZE = 65536;
+	static constexpr size_t PAGE_SIZE = 256;
+	static constexpr size_t PAGE_COUNT = MEMORY_SIZE / PAGE_SIZE;
+
+	// Programs are loaded at 0x200, so they can fill the rest of memory
+	static constexpr size_t MAX_ROM_SIZE = MEMORY_SIZE - 0x200;
+	typedef std::array<uint8_t, PAGE_SIZE> MemoryPage;
+
+	// Only the first 4KB of code are kept decoded (see decodeCache). Code
+	// beyond that is rare, and decoded every time it is executed.
+	static constexpr size_t DECODE_CACHE_SIZE = 4096;
+
+	// One bit plane of the display. One bit per pixel, each row is packed 
+	// into 64-bit words with the leftmost pixel in the most significant bit 
+	// of the first word. In low resolution mode only the first 32 rows and
+	// the first word of each row are used.
+	typedef uint64_t DisplayPlane[DISPLAY_HEIGHT][DISPLAY_WORDS];
+
+	// 64 x 32 pixel display, or 128 x 64 in high resolution mode. Every
+	// pixel has one bit in each plane. CHIP-8 and SUPER-CHIP programs only
+	// draw to the first plane.
+	DisplayPlane display[DISPLAY_PLANES];
+	bool highResolution;	// 128 x 64 mode (00FF), until 00FE
+	uint8_t planeMask;		// Planes that are drawn to (FN01). Plane n is bit n
 	uint16_t opcode;		// Opcode
 	uint16_t pc;			// Program counter
 	uint16_t index;			// Index register. Points at locations in memory
 	uint8_t registers[16];	// 16 8-bit registers (V0 - VF)
 	uint16_t stack[16];		// Stack for storing 16-bit addresses
-	uint8_t sp;				// Stack pointer
+	uint8_t sp;				// Stack pointer, 0 (empty) to 16 (full)
 	uint8_t delayTimer;		// Used for timing events of games
 	uint8_t soundTimer;		// Used for sound effects. Beeps at non-zero values
 	uint8_t keypad[16];		// Store keypad values
+	uint64_t rngState;		// State of the random number generator (CXNN)
+	uint8_t flags[16];		// User flags (FX75, FX85), the HP48 RPL flags
+	uint8_t audioPattern[16];	// 1-bit samples played by the buzzer (F002)
+	uint8_t pitch;			// Playback rate of audioPattern (FX3A)
+
+	// Whether the buzzer sounded during the last frame, i.e. the sound 
+	// timer was not 0 when the timers last ticked. A sound timer set to 1
+	// sounds for that one frame, even though it is 0 by the end of it.
+	bool buzzerSounded;
+
+	// Incremented whenever memory is replaced as a whole (LoadROM, Reset),
+	// or the instructions change (SetQuirkProfile), so that anything 
+	// caching translated code knows to discard it.
+	uint32_t codeVersion;
+
+	// Set when SetMemory (or LoadState) changes any of the first 4KB, 
+	// together with the range of bytes that changed, so that anything
+	// caching translated code only discards the code from there. Cleared
+	// with ClearCodeDirty() once it has.
+	bool codeDirty;
+	uint16_t dirtyCodeFirst;	// First changed byte
+	uint16_t dirtyCodeLast;		// Last changed byte (inclusive)
+
+	// Set when an instruction changes the display, together with the range 
+	// of rows that were drawn to (at the current resolution), so that the 
+	// frontend only has to upload and present what changed. Cleared by the 
+	// frontend with ClearDisplayDirty().
+	bool displayDirty;
+	uint8_t dirtyRowFirst;	// First changed row
+	uint8_t dirtyRowLast;	// Last changed row (inclusive)
+
+	// If set, every instruction executed and every frame is counted (see
+	// Profiler). nullptr by default.
+	Profiler* profiler;
+
+	// Whether RunFrame fast-forwards through idle loops (see 
+	// SkipIdleCycles). On by default. The outcome is the same either way.
+	bool skipIdle;
+	uint64_t idleCycles;	// Number of instructions skipped so far
+
+	// Set by a jump backwards (1NNN) and by FX0A waiting for a key, which
+	// are where idle loops close. Cleared by SkipIdleCycles.
+	bool jumpedBack;
 
 	/* ----- System Functionality ----- */
 
-	// Load ROM file 
-	void LoadROM(std::string filename);
+	// Load ROM file. The quirk profile is picked by the file extension (see
+	// GetQuirkProfileForFile). Call SetQuirkProfile afterwards to run it 
+	// with another one. Returns false, leaving memory as it was, if the 
+	// file can't be read, is empty or is larger than MAX_ROM_SIZE.
+	bool LoadROM(std::string filename);
+
+	// Load a ROM image of size bytes from data. The quirk profile is left
+	// as it is. Returns false, like the above, if size is 0 or larger than
+	// MAX_ROM_SIZE.
+	bool LoadROM(const uint8_t* data, size_t size);
+
+	// Hash of the contents of the ROM last loaded (0 if none), the same for
+	// the same contents whatever the file is called
+	uint64_t GetROMHash() const { return romHash; }
+
+	// Size in bytes of the ROM last loaded (0 if none)
+	size_t GetROMSize() const { return romSize; }
+
+	// Clear the machine to the state of a new one: only the font in memory,
+	// and the registers, stack, timers, display and keypad cleared. The 
+	// quirk profile, random number generator, profiler and skipIdle are
+	// kept. Call Seed() as well to start the same run as a new instance.
+	void Reset();
 
 	// Instruction Cycle (Fetch, Decode, Execute)
 	void Cycle();
+
+	// Decrement the delay and sound timers. Must be called at 60 Hz.
+	void TickTimers();
+
+	// Run one 60 Hz frame: execute cyclesPerFrame instructions, then tick 
+	// the timers once. The host should present the display once per frame.
+	void RunFrame(int cyclesPerFrame);
+
+	// Reset the display dirty flag after the display has been presented
+	void ClearDisplayDirty();
+
+	// Reset the code dirty flag after the code that changed is discarded
+	void ClearCodeDirty();
+
+	// Size of the display in pixels at the current resolution
+	int GetDisplayWidth() const {
+		return highResolution ? DISPLAY_WIDTH : DISPLAY_WIDTH / 2;
+	}
+	int GetDisplayHeight() const {
+		return highResolution ? DISPLAY_HEIGHT : DISPLAY_HEIGHT / 2;
+	}
+
+	/* ----- Quirks ----- */
+	/*
+		Instructions that interpreters disagree on behave like on the 
+		interpreter of the quirk profile (see quirks.h). Each profile has its
+		own instance of the quirky instruction functions, and the decoder
+		picks the ones of the current profile, so the quirks are never 
+		checked while running.
+	*/
+
+	// Switch to another quirk profile. All instructions are decoded again.
+	void SetQuirkProfile(QuirkProfile profile);
+	QuirkProfile GetQuirkProfile() const { return quirkProfile; }
+
+	// Profile for a ROM file: SUPER-CHIP for .sc8, XO-CHIP for .xo8 and 
+	// COSMAC VIP for anything else
+	static QuirkProfile GetQuirkProfileForFile(const std::string& filename);
+
+	// Short name of a profile ("vip", "chip48", "schip" or "xochip"), and
+	// the other way around. Parse returns false for an unknown name.
+	static const char* GetQuirkProfileName(QuirkProfile profile);
+	static bool ParseQuirkProfile(const std::string& name, 
+		QuirkProfile& profile);
+
+	/* ----- Idle Detection ----- */
+	/*
+		Many ROMs spend most of their time in loops that wait for the delay
+		timer (FX07, 3XNN, 1NNN), jump to themselves, or wait for a key 
+		(FX0A). Within a frame the timers and the keypad can't change, so if
+		the machine comes back to exactly the same state (registers, pc, 
+		stack, ...) without writing to memory or the display, it will keep
+		going around the same loop until the end of the frame. The rest of 
+		the frame can then be skipped, except for the last partial trip
+		around the loop, which gives the same state as running it all.
+	*/
+
+	// Forget the loop seen so far. Called at the start of every frame.
+	void ResetIdleDetection();
+
+	// Called after an instruction that set jumpedBack, once cycle 
+	// instructions of the frame have run. Returns how many of the 
+	// cyclesLeft instructions left in the frame can be skipped (the caller
+	// skips them), which is 0 unless the machine is idle.
+	int SkipIdleCycles(int cycle, int cyclesLeft);
+
+	/* ----- Memory ----- */
+	/*
+		Memory is split into pages that start out shared with every other
+		instance holding the same contents: the font is loaded once per 
+		process, a ROM image once while any instance has it loaded, and 
+		empty pages are all the same page. A
+		page is only copied when the program writes to it (FX33/FX55), so
+		most of the memory of an instance is never copied, and copying a
+		Chippin8 shares all of its pages. Addresses wrap around at 64KB.
+	*/
+
+	uint8_t ReadMemory(uint16_t address) const {
+		return (*pages[address / PAGE_SIZE])[address % PAGE_SIZE];
+	}
+	void WriteMemory(uint16_t address, uint8_t value);
+
+	// Copy the first size bytes of memory (all of it by default) to or from
+	// buffer. Pages that stay the same keep being shared, and only the
+	// instructions decoded from bytes that change are discarded (see 
+	// codeDirty).
+	void GetMemory(uint8_t* buffer, size_t size = MEMORY_SIZE) const;
+	void SetMemory(const uint8_t* buffer, size_t size = MEMORY_SIZE);
+
+	// The page holding memory[page * PAGE_SIZE]. A page that is shared 
+	// (e.g. with a Snapshot) is copied before it is written to, so as long
+	// as the page is still the same object, it holds the same contents.
+	const MemoryPage& GetPage(size_t page) const { return *pages[page]; }
+
+	// Reset the random number generator. The same seed, ROM and input give
+	// the same run every time.
+	void Seed(uint64_t seed);
+
+	// The keypad as a bitmask, bit n set if key n is pressed
+	uint16_t GetKeypadMask() const;
+	void SetKeypadMask(uint16_t mask);
+
+	/* ----- Save States ----- */
+
+	// Size in bytes of a save state, and where memory is in it
+	static constexpr size_t STATE_SIZE = 67694;
+	static constexpr size_t STATE_MEMORY_OFFSET = 8;
+
+	// Write a snapshot of the whole machine (memory, registers, stack, 
+	// timers, display, keypad, random number generator, flags, audio and
+	// quirk profile) to buffer. Returns the number of bytes written, or 0
+	// if size is less than STATE_SIZE. Without memory, the MEMORY_SIZE 
+	// bytes at STATE_MEMORY_OFFSET are left as they are, for callers that
+	// keep track of memory by its pages (see RewindBuffer).
+	size_t SaveState(uint8_t* buffer, size_t size, 
+		bool withMemory = true) const;
+
+	// Restore a snapshot written by SaveState, or by a previous version 
+	// that did not have the SUPER-CHIP and XO-CHIP state yet. Returns 
+	// false, without changing anything, if the buffer does not hold a 
+	// valid save state: one that is too short, of an unknown version or
+	// quirk profile, or with a value no machine can be in (e.g. a stack
+	// pointer above 16, or planes that don't exist).
+	bool LoadState(const uint8_t* buffer, size_t size);
+
+	// Same as above, but to and from a file
+	bool SaveState(const std::string& filename) const;
+	bool LoadState(const std::string& filename);
+
+	/* ----- Snapshots ----- */
+	/*
+		A snapshot is a copy of the machine kept in memory, to go back to it
+		a few frames later (see EmulationThread, which runs ahead of the
+		input this way). Unlike a save state nothing is serialized: memory
+		pages are shared with the snapshot rather than copied, and only the
+		pages that changed since the last snapshot are swapped, so taking or
+		restoring one costs about as much as copying the display.
+	*/
+	struct Snapshot;
+
+	// Copy the machine into snapshot. Reusing the same snapshot every time
+	// is faster than taking a new one.
+	void TakeSnapshot(Snapshot& snapshot) const;
+
+	// Go back to the state of snapshot. The quirk profile, profiler and 
+	// codeVersion are left as they are. Instructions decoded from memory 
+	// that differs from the snapshot are discarded. The range of the first
+	// 4KB that differed is returned in codeStart and codeLength (0 if 
+	// none), for anything else caching translated code (see Recompiler).
+	void RestoreSnapshot(const Snapshot& snapshot, uint16_t& codeStart,
+		uint16_t& codeLength);
 	
 	// Decode opcode and call instruction function
 	void DecodeAndExecute(uint16_t opcode);
 
+	// Decode opcode into its instruction function (for the current quirk 
+	// profile) and operands
+	Instruction Decode(uint16_t opcode) const;
+
+	// Name of the instruction opcode decodes to, e.g. "8XY4" or "NOP". The
+	// same for every quirk profile.
+	static const char* GetOpcodeName(uint16_t opcode);
+
+	// Discard the decoded instructions overlapping memory[address] to 
+	// memory[address + length - 1]. Must be called whenever code in memory is
+	// modified, otherwise the old instructions will keep being executed.
+	void InvalidateDecodeCache(uint16_t address, uint16_t length);
+
+private:
+	// Memory pages, copied on the first write if shared (see WriteMemory)
+	std::shared_ptr<MemoryPage> pages[PAGE_COUNT];
+
+	// Map the pages of a ROM image into memory at START_ADDRESS
+	void LoadROMPages(std::shared_ptr<const ROMImage> image);
+
+	// The ROM last loaded, which stays cached for other instances while
+	// this one holds it
+	std::shared_ptr<const ROMImage> romImage;
+	uint64_t romHash;		// See GetROMHash
+	size_t romSize;			// See GetROMSize
+
+	// Incremented by every write to memory or the display
+	uint32_t writeCount;
+
+	// State at the last backwards jump, compared by SkipIdleCycles
+	struct IdleState {
+		uint16_t pc;
+		uint16_t index;
+		uint16_t opcode;
+		uint8_t registers[16];
+		uint16_t stack[16];
+		uint8_t sp;
+		uint8_t delayTimer;
+		uint8_t soundTimer;
+		uint64_t rngState;
+		uint32_t writeCount;
+	};
+	IdleState idleState;
+	int idleStateCycle;		// Cycle of the frame it was taken at, -1 if none
+
+	// Loops that aren't idle are only checked every idleBackoff-th time 
+	// (doubling up to a limit with every miss), so that busy loops hardly
+	// pay for the check. A state taken a number of trips apart still 
+	// matches if the loop is idle.
+	int idleBackoff;
+	int idleCountdown;		// Jumps left until the next check
+
+public:
+	// Everything that running the machine changes, except the decode cache
+	// (see TakeSnapshot)
+	struct Snapshot {
+		std::shared_ptr<MemoryPage> pages[PAGE_COUNT];
+		DisplayPlane display[DISPLAY_PLANES];
+		bool highResolution;
+		uint8_t planeMask;
+		uint16_t opcode;
+		uint16_t pc;
+		uint16_t index;
+		uint8_t registers[16];
+		uint16_t stack[16];
+		uint8_t sp;
+		uint8_t delayTimer;
+		uint8_t soundTimer;
+		uint8_t keypad[16];
+		uint64_t rngState;
+		uint8_t flags[16];
+		uint8_t audioPattern[16];
+		uint8_t pitch;
+		bool buzzerSounded;
+		bool displayDirty;
+		uint8_t dirtyRowFirst;
+		uint8_t dirtyRowLast;
+		uint64_t idleCycles;
+		bool jumpedBack;
+		uint32_t writeCount;
+		IdleState idleState;
+		int idleStateCycle;
+		int idleBackoff;
+		int idleCountdown;
+	};
+
 private:
+	// Decode for the current quirk profile, one of the Decode<Quirks>
+	typedef Instruction (*DecodeFunction)(uint16_t opcode, const char*& name);
+	QuirkProfile quirkProfile;
+	DecodeFunction decoder;
+
+	// Decoded instruction for every address in the first 4KB of memory.
+	// Instructions are 2 bytes but can start at even or odd addresses, so 
+	// there is one entry per byte.
+	Instruction decodeCache[DECODE_CACHE_SIZE];
+
+	// Same as Decode, for the quirk profile Quirks, also giving the name of
+	// the instruction function
+	template <typename Quirks>
+	static Instruction Decode(uint16_t opcode, const char*& name);
+
+	// Next number from the random number generator (xorshift64*)
+	uint8_t Random();
+
+	// A call (2NNN) with all 16 stack entries in use, or a return (00EE)
+	// with none. The program can't go on, so the machine halts at the
+	// instruction.
+	void StackFault();
+
+	// Skip the instruction at pc. F000 NNNN (XO-CHIP) is 4 bytes long and
+	// is skipped as a whole.
+	void SkipNext() {
+		pc += (ReadMemory(pc) == 0xF0 && ReadMemory(pc + 1) == 0x00) ? 4 : 2;
+	}
+
+	// XOR a sprite of rows rows into the selected planes at (VX, VY). Each
+	// row is 8 pixels wide (1 byte), or 16 if wide (2 bytes). The sprite
+	// for each selected plane follows the one for the plane before it.
+	template <typename Quirks>
+	void DrawSprite(const Instruction& instruction, int rows, bool wide);
+
+	// Move I past the registers FX55 and FX65 transferred, V0 to VX
+	template <typename Quirks>
+	void AdvanceIndex(uint8_t X) {
+		if constexpr (Quirks::INDEX_ADVANCE == IndexAdvance::ByX) {
+			index += X;
+		}
+		else if constexpr (Quirks::INDEX_ADVANCE 
+			== IndexAdvance::ByXPlusOne) {
+			index += X + 1;
+		}
+	}
+
+	// Calls the instruction function H. One of these is instantiated for 
+	// every instruction, so each call is direct and can be inlined.
+	template <void (Chippin8::*H)(const Instruction&)>
+	static void Dispatch(Chippin8& c8, const Instruction& instruction) {
+		(c8.*H)(instruction);
+	}
+
 
 	/* ----- CHIP - 8 Instructions ----- */
 	/*
 		Implementing the Opcode table from wikipedia: 
 		https://en.wikipedia.org/wiki/CHIP-8#Opcode_table
+		The SUPER-CHIP and XO-CHIP extensions are marked as such. They don't
+		overlap with any CHIP-8 instruction, so all of them are always 
+		available. The instructions that depend on the quirk profile are 
+		templates, instantiated for every profile.
 	*/
 
 	// NOP instruction. Does nothing
-	void opcode_NOP();
+	void opcode_NOP(const Instruction& instruction);
 
 	// Calls machine code routine (RCA 1802 for COSMAC VIP) at address NNN. 
 	// Not necessary for most ROMs.
-	void opcode_0NNN();
+	void opcode_0NNN(const Instruction& instruction);
+
+	// Scrolls the display down by N pixels (SUPER-CHIP)
+	void opcode_00CN(const Instruction& instruction);
+
+	// Scrolls the display up by N pixels (XO-CHIP)
+	void opcode_00DN(const Instruction& instruction);
 
 	// Clears the screen
-	void opcode_00E0();
+	void opcode_00E0(const Instruction& instruction);
 
 	// Returns from a subroutine
-	void opcode_00EE();
+	void opcode_00EE(const Instruction& instruction);
+
+	// Scrolls the display right by 4 pixels (SUPER-CHIP)
+	void opcode_00FB(const Instruction& instruction);
+
+	// Scrolls the display left by 4 pixels (SUPER-CHIP)
+	void opcode_00FC(const Instruction& instruction);
+
+	// Exits the interpreter (SUPER-CHIP). The machine stops here.
+	void opcode_00FD(const Instruction& instruction);
+
+	// Switches to 64 x 32 low resolution mode and clears the screen 
+	// (SUPER-CHIP)
+	void opcode_00FE(const Instruction& instruction);
+
+	// Switches to 128 x 64 high resolution mode and clears the screen 
+	// (SUPER-CHIP)
+	void opcode_00FF(const Instruction& instruction);
 
 	// Jump to address NNN
-	void opcode_1NNN();
+	void opcode_1NNN(const Instruction& instruction);
 
 	// Calls subroutine at NNN
-	void opcode_2NNN();
+	void opcode_2NNN(const Instruction& instruction);
 
 	// Skips the next instruction if VX equals NN (usually the next instruction
 	// is a jump to skip a code block).
-	void opcode_3XNN();
+	void opcode_3XNN(const Instruction& instruction);
 
 	// Skips the next instruction if VX does not equal NN (usually the next 
 	// instruction is a jump to skip a code block).
-	void opcode_4XNN();
+	void opcode_4XNN(const Instruction& instruction);
 
 	// Skips the next instruction if VX equals VY (usually the next instruction
 	// is a jump to skip a code block).
-	void opcode_5XY0();
+	void opcode_5XY0(const Instruction& instruction);
+
+	// Stores VX to VY (in that order, which may be descending) in memory, 
+	// starting at address I. I is not changed. (XO-CHIP)
+	void opcode_5XY2(const Instruction& instruction);
+
+	// Fills VX to VY (in that order) with values from memory, starting at 
+	// address I. I is not changed. (XO-CHIP)
+	void opcode_5XY3(const Instruction& instruction);
 
 	// Sets VX to NN
-	void opcode_6XNN();
+	void opcode_6XNN(const Instruction& instruction);
 
 	// Adds NN to VX (carry flag is not changed).
-	void opcode_7XNN();
+	void opcode_7XNN(const Instruction& instruction);
 
 	// Sets VX to the value of VY.
-	void opcode_8XY0();
+	void opcode_8XY0(const Instruction& instruction);
 
-	// Sets VX to VX or VY. (bitwise OR operation)
-	void opcode_8XY1();
+	// Sets VX to VX or VY. (bitwise OR operation) VF is reset to 0 on the
+	// COSMAC VIP.
+	template <typename Quirks>
+	void opcode_8XY1(const Instruction& instruction);
 
-	// Sets VX to VX and VY. (bitwise AND operation)
-	void opcode_8XY2();
+	// Sets VX to VX and VY. (bitwise AND operation) VF is reset as above.
+	template <typename Quirks>
+	void opcode_8XY2(const Instruction& instruction);
 
-	// Sets VX to VX xor VY.
-	void opcode_8XY3();
+	// Sets VX to VX xor VY. VF is reset as above.
+	template <typename Quirks>
+	void opcode_8XY3(const Instruction& instruction);
 
 	// Adds VY to VX. VF is set to 1 when there's a carry, and to 0 when there
 	// is not.
-	void opcode_8XY4();
+	void opcode_8XY4(const Instruction& instruction);
 
 	// VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 
 	// when there is not.
-	void opcode_8XY5();
+	void opcode_8XY5(const Instruction& instruction);
 
-	// Stores the least significant bit of VX in VF and then shifts VX to the 
-	// right by 1.
-	void opcode_8XY6();
+	// Shifts VY (or VX, depending on the quirk profile) to the right by 1
+	// and stores the result in VX. VF is set to the bit shifted out.
+	template <typename Quirks>
+	void opcode_8XY6(const Instruction& instruction);
 
 	// Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 
 	// when there is not.
-	void opcode_8XY7();
+	void opcode_8XY7(const Instruction& instruction);
 
-	// Stores the most significant bit of VX in VF and then shifts VX to the 
-	// left by 1.
-	void opcode_8XYE();
+	// Shifts VY (or VX, depending on the quirk profile) to the left by 1 
+	// and stores the result in VX. VF is set to the bit shifted out.
+	template <typename Quirks>
+	void opcode_8XYE(const Instruction& instruction);
 
 	// Skips the next instruction if VX does not equal VY. (Usually the next 
 	// instruction is a jump to skip a code block)
-	void opcode_9XY0();
+	void opcode_9XY0(const Instruction& instruction);
 
 	// Sets I to the address NNN.
-	void opcode_ANNN();
+	void opcode_ANNN(const Instruction& instruction);
 
-	// Jumps to the address NNN plus V0.
-	void opcode_BNNN();
+	// Jumps to the address NNN plus V0. CHIP-48 and SUPER-CHIP read it as 
+	// BXNN instead, and jump to XNN plus VX.
+	template <typename Quirks>
+	void opcode_BNNN(const Instruction& instruction);
 
 	// Sets VX to the result of a bitwise and operation on a random number 
 	// (Typically: 0 to 255) and NN.
-	void opcode_CXNN();
+	void opcode_CXNN(const Instruction& instruction);
 
 	// Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a
 	// height of N pixels. Each row of 8 pixels is read as bit-coded starting 
 	// from memory location I; I value does not change after the execution of 
 	// this instruction. As described above, VF is set to 1 if any screen 
 	// pixels are flipped from set to unset when the sprite is drawn, and to 0 
-	// if that does not happen.
-	void opcode_DXYN();
+	// if that does not happen. Sprites are clipped at the edges of the 
+	// screen, or wrap around (XO-CHIP).
+	template <typename Quirks>
+	void opcode_DXYN(const Instruction& instruction);
+
+	// Draws a 16 x 16 sprite at coordinate (VX, VY), with each row read as 
+	// 2 bytes from memory location I. VF is set as in DXYN. (SUPER-CHIP)
+	template <typename Quirks>
+	void opcode_DXY0(const Instruction& instruction);
 
 	// Skips the next instruction if the key stored in VX is pressed (usually 
 	// the next instruction is a jump to skip a code block).
-	void opcode_EX9E();
+	void opcode_EX9E(const Instruction& instruction);
 
 	// Skips the next instruction if the key stored in VX is not pressed 
 	// (usually the next instruction is a jump to skip a code block).
-	void opcode_EXA1();
+	void opcode_EXA1(const Instruction& instruction);
+
+	// Sets I to the 16-bit address NNNN in the 2 bytes following the 
+	// instruction, which makes it 4 bytes long. (XO-CHIP)
+	void opcode_F000(const Instruction& instruction);
+
+	// Selects the bit planes N that are drawn to, cleared and scrolled. 
+	// (XO-CHIP)
+	void opcode_FN01(const Instruction& instruction);
+
+	// Loads the 16 byte audio pattern from memory location I. (XO-CHIP)
+	void opcode_F002(const Instruction& instruction);
 
 	// Sets VX to the value of the delay timer.
-	void opcode_FX07();
+	void opcode_FX07(const Instruction& instruction);
 
 	// A key press is awaited, and then stored in VX (blocking operation, all 
 	// instruction halted until next key event).
-	void opcode_FX0A();
+	void opcode_FX0A(const Instruction& instruction);
 
 	// Sets the delay timer to VX.
-	void opcode_FX15();
+	void opcode_FX15(const Instruction& instruction);
 
 	// Sets the sound timer to VX.
-	void opcode_FX18();
+	void opcode_FX18(const Instruction& instruction);
 
 	// Adds VX to I. VF is not affected.
-	void opcode_FX1E();
+	void opcode_FX1E(const Instruction& instruction);
 
 	// Sets I to the location of the sprite for the character in VX. Characters
 	// 0-F (in hexadecimal) are represented by a 4x5 font.
-	void opcode_FX29();
+	void opcode_FX29(const Instruction& instruction);
+
+	// Sets I to the location of the large 8x10 sprite for the character in 
+	// VX. (SUPER-CHIP, and XO-CHIP for the letters)
+	void opcode_FX30(const Instruction& instruction);
 
 	// Stores the binary-coded decimal representation of VX, with the hundreds 
 	// digit in memory at location in I, the tens digit at location I+1, and 
 	// the ones digit at location I+2.
-	void opcode_FX33();
+	void opcode_FX33(const Instruction& instruction);
+
+	// Sets the pitch of the audio pattern to VX. (XO-CHIP)
+	void opcode_FX3A(const Instruction& instruction);
 
 	// Stores from V0 to VX (including VX) in memory, starting at address I. 
-	// The offset from I is increased by 1 for each value written, but I 
-	// itself is left unmodified.
-	void opcode_FX55();
+	// The offset from I is increased by 1 for each value written. Whether I
+	// itself is moved depends on the quirk profile.
+	template <typename Quirks>
+	void opcode_FX55(const Instruction& instruction);
 
 	// Fills from V0 to VX (including VX) with values from memory, starting at 
-	// address I. The offset from I is increased by 1 for each value read, but 
-	// I itself is left unmodified.
-	void opcode_FX65();
+	// address I. The offset from I is increased by 1 for each value read. I 
+	// is moved as in FX55.
+	template <typename Quirks>
+	void opcode_FX65(const Instruction& instruction);
+
+	// Stores V0 to VX (including VX) in the user flags. (SUPER-CHIP)
+	void opcode_FX75(const Instruction& instruction);
+
+	// Fills V0 to VX (including VX) from the user flags. (SUPER-CHIP)
+	void opcode_FX85(const Instruction& instruction);
 	
 };
 
@@ -0,0 +1,426 @@
+/*
+	Chippin8 ROM farm. Runs every CHIP-8 ROM in a directory headless, each in
+	its own Chippin8, for a fixed number of cycles or frames, and reports the
+	display hash, the number of instructions per second and the wall time of
+	every ROM as CSV or JSON. Used for validating a whole ROM corpus at once.
+	Every ROM is reported with a hash of its contents too, by which copies
+	of the same ROM under different names can be found.
+
+		./<Chippin8Farm.exe> <ROM_directory> [--cycles (number) |
+			--frames (number)] [--cycles-per-frame (number)] [--jit]
+			[--seed (number)] [--threads (number)] [--json]
+			[--output (file)] [--quirks (profile)] [--capture (directory)]
+
+	The ROMs are the .ch8, .sc8 and .xo8 files (in any case), each run with
+	the quirk profile for its extension unless --quirks is given (see
+	quirks.h).
+
+	If an input log (see InputLog) with the same name as a ROM but the
+	extension .c8in exists, it is replayed. Otherwise the ROM is run without
+	input. All ROMs are seeded with the same seed (0 unless --seed is given),
+	so that the results can be compared between runs.
+
+	--capture records every frame of every ROM as a Y4M video (see 
+	FrameRecorder) into the given directory, with the same name and
+	subdirectory as the ROM has in the ROM directory.
+
+	The jobs are spread over all cores with a work-stealing pool: every
+	worker has its own queue of jobs and takes from the back of it, and when
+	it runs out, it steals from the front of the queue of another worker.
+	ROMs run for very different amounts of time (e.g. a replay is much longer
+	than a plain run), so this keeps all the workers busy until the end
+	without a single shared queue that every worker contends on.
+*/
+
+#include "emulator.h"
+#include "headless.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <stdint.h>
+
+namespace fs = std::filesystem;
+
+#define USAGE() do{ \
+		std::cout << "Usage: ./<Chippin8Farm>.exe <ROM_directory>"\
+		<< " [--cycles (number) | --frames (number)]"\
+		<< " [--cycles-per-frame (number)] [--jit] [--seed (number)]"\
+		<< " [--threads (number)] [--json] [--output (file)]"\
+		<< " [--quirks (profile)] [--capture (directory)]\n"; \
+		} while(0)
+
+// Extension of the input logs replayed with a ROM
+const char INPUT_LOG_EXTENSION[] = ".c8in";
+
+// Extension of the videos recorded with --capture
+const char CAPTURE_EXTENSION[] = ".y4m";
+
+// Extensions of the ROMs that are run
+const char* ROM_EXTENSIONS[] = { ".ch8", ".sc8", ".xo8" };
+
+struct FarmJob {
+	HeadlessOptions options;
+	HeadlessResult result;
+	uint16_t pc;				// Final program counter
+	uint64_t displayHash;		// Final display hash
+	uint64_t romHash;			// Hash of the ROM contents (see GetROMHash)
+	QuirkProfile quirkProfile;	// Profile the ROM ran with
+	double wallSeconds;			// Including loading the ROM
+	bool succeeded;
+};
+
+/* ----- Work-Stealing Pool ----- */
+
+class WorkStealingPool {
+public:
+	explicit WorkStealingPool(int workerCount) : queues(workerCount) {}
+
+	// Hand out the jobs round-robin. Must be called before Run.
+	void Add(size_t job) {
+		Queue& queue = queues[nextQueue++ % queues.size()];
+		queue.jobs.push_back(job);
+	}
+
+	// Run every job with work(job) on all workers and wait until all jobs
+	// are done. No jobs are added while running, so a worker can stop as
+	// soon as it finds all queues empty.
+	template <typename Work>
+	void Run(Work work) {
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < queues.size(); ++i) {
+			threads.emplace_back([this, i, &work]() {
+				size_t job;
+				while (Take(i, job)) {
+					work(job);
+				}
+			});
+		}
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+	}
+
+private:
+	// Jobs are whole ROM runs, so a lock per queue costs nothing compared to
+	// the work. What matters is that workers don't share one.
+	struct Queue {
+		std::mutex mutex;
+		std::deque<size_t> jobs;
+	};
+
+	std::vector<Queue> queues;
+	size_t nextQueue = 0;
+
+	// Take a job from worker's own queue, or steal one from another queue
+	bool Take(size_t worker, size_t& job) {
+		{
+			Queue& own = queues[worker];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.jobs.empty()) {
+				job = own.jobs.back();
+				own.jobs.pop_back();
+				return true;
+			}
+		}
+		for (size_t i = 1; i < queues.size(); ++i) {
+			Queue& victim = queues[(worker + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.jobs.empty()) {
+				job = victim.jobs.front();
+				victim.jobs.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+/* ----- Reports ----- */
+
+static uint64_t CyclesPerSecond(const FarmJob& job) {
+	return job.result.seconds > 0
+		? (uint64_t)(job.result.cycles / job.result.seconds) : 0;
+}
+
+// Quote a string for CSV or JSON. File names are the only strings written.
+static std::string Quote(const std::string& s, bool isJson) {
+	std::string quoted = "\"";
+	for (char c : s) {
+		if (c == '"') {
+			quoted += isJson ? "\\\"" : "\"\"";
+		}
+		else if (c == '\\' && isJson) {
+			quoted += "\\\\";
+		}
+		else {
+			quoted += c;
+		}
+	}
+	return quoted + "\"";
+}
+
+static std::string Hex(uint64_t value, int digits) {
+	std::ostringstream out;
+	out << std::hex << std::setfill('0') << std::setw(digits) << value;
+	return out.str();
+}
+
+static void WriteCSV(std::ostream& out, const std::vector<FarmJob>& jobs) {
+	out << "rom,rom_hash,input_log,engine,quirks,status,cycles,frames,"
+		<< "cycles_per_frame,"
+		<< "pc,display_hash,cycles_per_second,emulation_seconds,"
+		<< "wall_seconds\n";
+	for (const FarmJob& job : jobs) {
+		out << Quote(job.options.romFile, false) << ','
+			<< Hex(job.romHash, 16) << ','
+			<< Quote(job.options.replayFile, false) << ','
+			<< (job.options.useRecompiler ? "recompiler" : "interpreter")
+			<< ','
+			<< Chippin8::GetQuirkProfileName(job.quirkProfile) << ','
+			<< (job.succeeded ? "ok" : Quote(job.result.error, false)) << ','
+			<< job.result.cycles << ','
+			<< job.result.frames << ','
+			<< job.result.cyclesPerFrame << ','
+			<< "0x" << Hex(job.pc, 4) << ','
+			<< Hex(job.displayHash, 16) << ','
+			<< CyclesPerSecond(job) << ','
+			<< job.result.seconds << ','
+			<< job.wallSeconds << '\n';
+	}
+}
+
+static void WriteJSON(std::ostream& out, const std::vector<FarmJob>& jobs) {
+	out << "[\n";
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		const FarmJob& job = jobs[i];
+		out << "  {\"rom\": " << Quote(job.options.romFile, true)
+			<< ", \"rom_hash\": \"" << Hex(job.romHash, 16) << '"'
+			<< ", \"input_log\": " << Quote(job.options.replayFile, true)
+			<< ", \"engine\": \""
+			<< (job.options.useRecompiler ? "recompiler" : "interpreter")
+			<< "\", \"quirks\": \""
+			<< Chippin8::GetQuirkProfileName(job.quirkProfile)
+			<< "\", \"status\": "
+			<< Quote(job.succeeded ? "ok" : job.result.error, true)
+			<< ", \"cycles\": " << job.result.cycles
+			<< ", \"frames\": " << job.result.frames
+			<< ", \"cycles_per_frame\": " << job.result.cyclesPerFrame
+			<< ", \"pc\": " << job.pc
+			<< ", \"display_hash\": \"" << Hex(job.displayHash, 16)
+			<< "\", \"cycles_per_second\": " << CyclesPerSecond(job)
+			<< ", \"emulation_seconds\": " << job.result.seconds
+			<< ", \"wall_seconds\": " << job.wallSeconds
+			<< (i + 1 < jobs.size() ? "},\n" : "}\n");
+	}
+	out << "]\n";
+}
+
+/* ----- Main ----- */
+
+// Check if argument is a number
+static bool isNumber(const std::string& s) {
+	return !s.empty() && std::all_of(s.begin(), s.end(), ::isdigit);
+}
+
+int main(int argc, char* argv[]) {
+	HeadlessOptions defaults;
+	defaults.cycles = 1000000;		// Default value
+	defaults.frames = 0;
+	defaults.cyclesPerFrame = 10;
+	defaults.useRecompiler = false;
+	defaults.hasSeed = true;		// Same seed for every ROM and every run
+	defaults.seed = 0;
+	defaults.lanes = 1;
+	defaults.hasQuirkProfile = false;
+	defaults.quirkProfile = QuirkProfile::CosmacVIP;
+
+	int threadCount = (int)std::thread::hardware_concurrency();
+	bool isJson = false;
+	std::string outputFile;
+	std::string captureDirectory;
+	std::string directory;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--jit") {
+			defaults.useRecompiler = true;
+		}
+		else if (arg == "--json") {
+			isJson = true;
+		}
+		else if (arg == "--output" && i + 1 < argc) {
+			outputFile = argv[++i];
+		}
+		else if (arg == "--capture" && i + 1 < argc) {
+			captureDirectory = argv[++i];
+		}
+		else if (arg == "--quirks" && i + 1 < argc) {
+			if (!Chippin8::ParseQuirkProfile(argv[++i], 
+				defaults.quirkProfile)) {
+				USAGE();
+				return EXIT_FAILURE;
+			}
+			defaults.hasQuirkProfile = true;
+		}
+		else if ((arg == "--cycles" || arg == "--frames"
+			|| arg == "--cycles-per-frame" || arg == "--seed"
+			|| arg == "--threads") && i + 1 < argc) {
+			std::string countStr = argv[++i];
+			if (!isNumber(countStr)) {
+				USAGE();
+				return EXIT_FAILURE;
+			}
+			uint64_t count = std::stoull(countStr);
+			if (arg == "--cycles") {
+				defaults.cycles = count;
+			}
+			else if (arg == "--frames") {
+				defaults.frames = count;
+			}
+			else if (arg == "--cycles-per-frame") {
+				defaults.cyclesPerFrame = (int)count;
+			}
+			else if (arg == "--seed") {
+				defaults.seed = count;
+			}
+			else {
+				threadCount = (int)count;
+			}
+		}
+		else if (arg.rfind("--", 0) == 0 || !directory.empty()) {
+			USAGE();
+			return EXIT_FAILURE;
+		}
+		else {
+			directory = arg;
+		}
+	}
+
+	if (directory.empty() || !fs::is_directory(directory)) {
+		USAGE();
+		return EXIT_FAILURE;
+	}
+	// Collect the ROMs, in a fixed order so that reports can be diffed.
+	// Directories that can't be read are skipped, and if the walk fails 
+	// halfway, the ROMs found up to there are still run.
+	std::vector<FarmJob> jobs;
+	std::error_code walkError;
+	for (fs::recursive_directory_iterator it(directory,
+		fs::directory_options::skip_permission_denied, walkError);
+		!walkError && it != fs::recursive_directory_iterator();
+		it.increment(walkError)) {
+		const fs::directory_entry& entry = *it;
+		// Extensions are matched like GetQuirkProfileForFile does
+		std::string extension = entry.path().extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(),
+			[](unsigned char c) { return (char)tolower(c); });
+		std::error_code entryError;
+		if (!entry.is_regular_file(entryError) 
+			|| std::find(std::begin(ROM_EXTENSIONS), std::end(ROM_EXTENSIONS),
+			extension) == std::end(ROM_EXTENSIONS)) {
+			continue;
+		}
+		FarmJob job;
+		job.options = defaults;
+		job.options.romFile = entry.path().string();
+		fs::path inputLog = entry.path();
+		inputLog.replace_extension(INPUT_LOG_EXTENSION);
+		if (fs::exists(inputLog, entryError)) {
+			job.options.replayFile = inputLog.string();
+		}
+		if (!captureDirectory.empty()) {
+			fs::path capture = fs::path(captureDirectory)
+				/ fs::relative(entry.path(), directory);
+			capture.replace_extension(CAPTURE_EXTENSION);
+			std::error_code error;
+			fs::create_directories(capture.parent_path(), error);
+			job.options.captureFile = capture.string();
+		}
+		job.result = HeadlessResult();
+		job.pc = 0;
+		job.displayHash = 0;
+		job.quirkProfile = QuirkProfile::CosmacVIP;
+		job.wallSeconds = 0;
+		job.succeeded = false;
+		jobs.push_back(job);
+	}
+	if (walkError) {
+		std::cerr << "Could not read all of " << directory << ": " 
+			<< walkError.message() << '\n';
+	}
+	std::sort(jobs.begin(), jobs.end(),
+		[](const FarmJob& a, const FarmJob& b) {
+			return a.options.romFile < b.options.romFile;
+		});
+
+	auto start = std::chrono::steady_clock::now();
+
+	int workerCount = std::max(1, std::min(threadCount, (int)jobs.size()));
+	WorkStealingPool pool(workerCount);
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		pool.Add(i);
+	}
+	pool.Run([&jobs](size_t i) {
+		FarmJob& job = jobs[i];
+		auto jobStart = std::chrono::steady_clock::now();
+
+		// Chippin8 is too large for the worker's stack
+		std::unique_ptr<Chippin8> c8(new Chippin8());
+		job.succeeded = RunROM(*c8, job.options, job.result);
+		job.pc = c8->pc;
+		job.displayHash = DisplayHash(*c8);
+		job.romHash = c8->GetROMHash();
+		job.quirkProfile = c8->GetQuirkProfile();
+
+		std::chrono::duration<double> elapsed
+			= std::chrono::steady_clock::now() - jobStart;
+		job.wallSeconds = elapsed.count();
+	});
+
+	std::chrono::duration<double> elapsed
+		= std::chrono::steady_clock::now() - start;
+
+	std::ofstream file;
+	if (!outputFile.empty()) {
+		file.open(outputFile);
+		if (!file.is_open()) {
+			std::cerr << "Could not write " << outputFile << '\n';
+			return EXIT_FAILURE;
+		}
+	}
+	std::ostream& out = outputFile.empty() ? std::cout : file;
+	if (isJson) {
+		WriteJSON(out, jobs);
+	}
+	else {
+		WriteCSV(out, jobs);
+	}
+
+	// Summary on stderr, so that it does not end up in the report
+	uint64_t totalCycles = 0;
+	size_t failed = 0;
+	for (const FarmJob& job : jobs) {
+		totalCycles += job.result.cycles;
+		failed += !job.succeeded;
+	}
+	std::cerr << jobs.size() << " ROMs (" << failed << " failed) on "
+		<< workerCount << " threads in " << elapsed.count() << " seconds, "
+		<< (elapsed.count() > 0 ? (uint64_t)(totalCycles / elapsed.count())
+			: 0)
+		<< " cycles per second\n";
+
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
\ No newline at end of file
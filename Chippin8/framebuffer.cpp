@@ -0,0 +1,127 @@
+#include "framebuffer.h"
+#include "emulator.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) \
+	|| (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHIPPIN8_SSE2
+#include <emmintrin.h>
+#endif
+
+void ExpandFramebuffer(const Chippin8::DisplayPlane* planes, 
+	bool highResolution, int firstRow, int rowCount, uint32_t* pixels, 
+	const uint32_t colors[4]) {
+	// Every row and pixel of the planes is 1 or 2 of the frame
+	int scale = highResolution ? 1 : 2;
+	int width = DISPLAY_WIDTH / scale;
+
+#ifdef CHIPPIN8_SSE2
+	// Every group of 4 pixels is expanded at once: the bytes holding them 
+	// are broadcast to all lanes, each lane tests its own bit in both 
+	// planes, and the resulting masks select between the four colors.
+	const __m128i highBits = _mm_set_epi32(0x10, 0x20, 0x40, 0x80);
+	const __m128i lowBits = _mm_set_epi32(0x01, 0x02, 0x04, 0x08);
+	const __m128i none = _mm_set1_epi32((int)colors[0]);
+	const __m128i second = _mm_set1_epi32((int)colors[2]);
+	const __m128i firstDifference 
+		= _mm_set1_epi32((int)(colors[1] ^ colors[0]));
+	const __m128i bothDifference 
+		= _mm_set1_epi32((int)(colors[3] ^ colors[2]));
+
+	for (int y = firstRow; y < firstRow + rowCount; ++y) {
+		const uint64_t* row0 = planes[0][y];
+		const uint64_t* row1 = planes[1][y];
+		uint32_t* line = &pixels[y * scale * DISPLAY_WIDTH];
+		__m128i* out = (__m128i*)line;
+
+		for (int x = 0; x < width; x += 8) {
+			int shift = 56 - x % 64;
+			__m128i byte0 
+				= _mm_set1_epi32((int)(row0[x / 64] >> shift) & 0xFF);
+			__m128i byte1 
+				= _mm_set1_epi32((int)(row1[x / 64] >> shift) & 0xFF);
+
+			for (int half = 0; half < 2; ++half) {
+				__m128i bits = half == 0 ? highBits : lowBits;
+				__m128i set0 
+					= _mm_cmpeq_epi32(_mm_and_si128(byte0, bits), bits);
+				__m128i set1 
+					= _mm_cmpeq_epi32(_mm_and_si128(byte1, bits), bits);
+
+				// Pick by the first plane, then by the second
+				__m128i without = _mm_xor_si128(none,
+					_mm_and_si128(set0, firstDifference));
+				__m128i with = _mm_xor_si128(second,
+					_mm_and_si128(set0, bothDifference));
+				__m128i color = _mm_xor_si128(without, _mm_and_si128(set1,
+					_mm_xor_si128(without, with)));
+
+				if (scale == 1) {
+					_mm_storeu_si128(out++, color);
+				}
+				else {
+					_mm_storeu_si128(out++, _mm_unpacklo_epi32(color, color));
+					_mm_storeu_si128(out++, _mm_unpackhi_epi32(color, color));
+				}
+			}
+		}
+
+		if (scale == 2) {
+			memcpy(line + DISPLAY_WIDTH, line, DISPLAY_WIDTH * sizeof(*line));
+		}
+	}
+#else
+	for (int y = firstRow; y < firstRow + rowCount; ++y) {
+		const uint64_t* row0 = planes[0][y];
+		const uint64_t* row1 = planes[1][y];
+		uint32_t* line = &pixels[y * scale * DISPLAY_WIDTH];
+
+		for (int x = 0; x < width; ++x) {
+			int plane0 = (row0[x / 64] >> (63 - x % 64)) & 1;
+			int plane1 = (row1[x / 64] >> (63 - x % 64)) & 1;
+			uint32_t color = colors[plane0 | (plane1 << 1)];
+			for (int i = 0; i < scale; ++i) {
+				line[x * scale + i] = color;
+			}
+		}
+
+		if (scale == 2) {
+			memcpy(line + DISPLAY_WIDTH, line, DISPLAY_WIDTH * sizeof(*line));
+		}
+	}
+#endif // CHIPPIN8_SSE2
+}
+
+int UpdateFrame(VideoFrame& presented, const VideoFrame& frame, 
+	int& firstRow) {
+	bool resized = frame.highResolution != presented.highResolution;
+	int height = frame.highResolution ? DISPLAY_HEIGHT : DISPLAY_HEIGHT / 2;
+	const size_t rowSize = sizeof(frame.display[0][0]);
+	int lastRow = -1;
+	firstRow = height;
+	for (int y = 0; y < height; ++y) {
+		bool changed = resized;
+		for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+			if (memcmp(frame.display[plane][y], presented.display[plane][y],
+				rowSize) != 0) {
+				memcpy(presented.display[plane][y], frame.display[plane][y],
+					rowSize);
+				changed = true;
+			}
+		}
+		if (changed) {
+			firstRow = std::min(firstRow, y);
+			lastRow = y;
+		}
+	}
+	presented.highResolution = frame.highResolution;
+
+	if (lastRow < 0) {
+		firstRow = 0;
+		return 0;
+	}
+	return lastRow - firstRow + 1;
+}
\ No newline at end of file
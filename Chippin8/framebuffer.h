@@ -0,0 +1,42 @@
+/*
+	The emulator keeps its display as packed 1-bit rows, one set per bit
+	plane. These are only expanded to 32-bit pixels when a frame is 
+	presented.
+*/
+
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "emulator.h"
+
+#include <stdint.h>
+
+// Colors of the pixels (RGBA8888) by which planes they are set in: none, 
+// the first, the second, both
+const uint32_t PIXEL_COLORS[4] = {
+	0x00000000, 0xFFFFFFFF, 0xAAAAAAFF, 0x555555FF
+};
+
+// A finished frame. Same layout as Chippin8::display.
+struct VideoFrame {
+	Chippin8::DisplayPlane display[DISPLAY_PLANES];
+	bool highResolution;
+};
+
+// Expand rowCount rows of the display planes, starting at firstRow, into 
+// 32-bit pixels. Rows are counted at the resolution the planes were drawn 
+// in, but pixels always holds the whole DISPLAY_WIDTH x DISPLAY_HEIGHT 
+// frame: in low resolution every pixel is expanded to 2 x 2. Only the 
+// requested rows are written.
+void ExpandFramebuffer(const Chippin8::DisplayPlane* planes, 
+	bool highResolution, int firstRow, int rowCount, uint32_t* pixels, 
+	const uint32_t colors[4]);
+
+// Bring presented up to date with frame, copying only the rows that 
+// differ. Returns how many rows changed, starting at firstRow, at the 
+// resolution of frame: all of them if the resolution changed, 0 (with 
+// firstRow 0) if nothing did.
+int UpdateFrame(VideoFrame& presented, const VideoFrame& frame, 
+	int& firstRow);
+
+#endif // FRAMEBUFFER_H
\ No newline at end of file
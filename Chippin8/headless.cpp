@@ -0,0 +1,284 @@
+#include "headless.h"
+#include "recompiler.h"
+#include "analyzer.h"
+#include "inputlog.h"
+#include "lockstep.h"
+#include "profiler.h"
+#include "recorder.h"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <memory>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+uint64_t DisplayHash(const Chippin8& c8) {
+	uint64_t hash = 0xCBF29CE484222325ull;	// FNV-1a 64-bit offset basis
+	const uint64_t prime = 0x100000001B3ull;	// FNV-1a 64-bit prime
+
+	// The second plane and the resolution only count once they are used, so
+	// CHIP-8 programs hash the same as with the original 64 x 32 display
+	bool isExtended = c8.highResolution;
+	for (int y = 0; y < DISPLAY_HEIGHT; ++y) {
+		for (int word = 0; word < DISPLAY_WORDS; ++word) {
+			isExtended |= c8.display[1][y][word] != 0;
+		}
+	}
+
+	int planes = isExtended ? DISPLAY_PLANES : 1;
+	for (int plane = 0; plane < planes; ++plane) {
+		for (int y = 0; y < c8.GetDisplayHeight(); ++y) {
+			for (int x = 0; x < c8.GetDisplayWidth(); x += 8) {
+				// 8 pixels at a time, leftmost pixel first
+				uint64_t word = c8.display[plane][y][x / 64];
+				uint8_t pixels = (word >> (56 - x % 64)) & 0xFF;
+				hash ^= pixels;
+				hash *= prime;
+			}
+		}
+	}
+	if (isExtended) {
+		hash ^= c8.highResolution ? 1 : 0;
+		hash *= prime;
+	}
+	return hash;
+}
+
+void PrintState(std::ostream& out, const Chippin8& c8) {
+	out << std::hex << std::setfill('0')
+		<< "pc=0x" << std::setw(4) << c8.pc << '\n'
+		<< "index=0x" << std::setw(4) << c8.index << '\n'
+		<< "opcode=0x" << std::setw(4) << c8.opcode << '\n'
+		<< "registers=";
+	for (int i = 0; i < 16; ++i) {
+		out << std::setw(2) << (int)c8.registers[i] << (i < 15 ? " " : "\n");
+	}
+	out << "stack=";
+	for (int i = 0; i < c8.sp && i < 16; ++i) {
+		out << std::setw(4) << c8.stack[i] << ' ';
+	}
+	out << '\n' << std::dec
+		<< "sp=" << (int)c8.sp << '\n'
+		<< "delay_timer=" << (int)c8.delayTimer << '\n'
+		<< "sound_timer=" << (int)c8.soundTimer << '\n'
+		<< "display_hash=" << std::hex << std::setw(16) << DisplayHash(c8)
+		<< std::dec << std::setfill(' ') << '\n'
+		<< "quirks=" << Chippin8::GetQuirkProfileName(c8.GetQuirkProfile())
+		<< '\n';
+}
+
+bool RunROM(Chippin8& c8, const HeadlessOptions& options, 
+	HeadlessResult& result) {
+	if (!c8.LoadROM(options.romFile)) {
+		result.error = "Could not load ROM " + options.romFile + " (at most "
+			+ std::to_string(Chippin8::MAX_ROM_SIZE) + " bytes)";
+		return false;
+	}
+
+	InputLog log;
+	bool isReplay = !options.replayFile.empty();
+	if (isReplay && !log.Load(options.replayFile)) {
+		result.error = "Could not load input log " + options.replayFile;
+		return false;
+	}
+	// A log recorded with another ROM or with other quirks would replay as
+	// a different run, so it is refused rather than replayed wrongly
+	QuirkProfile logProfile = QuirkProfile::CosmacVIP;
+	bool hasLogProfile = isReplay && log.GetQuirkProfile(logProfile);
+	if (isReplay && log.GetROMHash() != 0 
+		&& log.GetROMHash() != c8.GetROMHash()) {
+		result.error = "Input log " + options.replayFile 
+			+ " was recorded with another ROM";
+		return false;
+	}
+	if (hasLogProfile && options.hasQuirkProfile 
+		&& options.quirkProfile != logProfile) {
+		result.error = "Input log " + options.replayFile 
+			+ " was recorded with the " 
+			+ Chippin8::GetQuirkProfileName(logProfile) + " quirks";
+		return false;
+	}
+	if (isReplay) {
+		c8.Seed(log.GetSeed());
+	}
+	else if (options.hasSeed) {
+		c8.Seed(options.seed);
+	}
+	if (hasLogProfile) {
+		c8.SetQuirkProfile(logProfile);
+	}
+
+	if (!options.loadStateFile.empty() 
+		&& !c8.LoadState(options.loadStateFile)) {
+		result.error = "Could not load save state " + options.loadStateFile;
+		return false;
+	}
+	// The save state brings its own quirk profile, which has to be the one
+	// the log was checked against above
+	if (hasLogProfile && !options.loadStateFile.empty()
+		&& c8.GetQuirkProfile() != logProfile) {
+		result.error = "Save state " + options.loadStateFile 
+			+ " has the " 
+			+ Chippin8::GetQuirkProfileName(c8.GetQuirkProfile()) 
+			+ " quirks, but input log " + options.replayFile 
+			+ " was recorded with the " 
+			+ Chippin8::GetQuirkProfileName(logProfile) + " quirks";
+		return false;
+	}
+	if (options.hasQuirkProfile) {
+		c8.SetQuirkProfile(options.quirkProfile);
+	}
+
+	// Run whole frames, so that the timers tick at the same rate as in the
+	// interactive frontend, followed by any leftover cycles
+	int cyclesPerFrame 
+		= options.cyclesPerFrame > 0 ? options.cyclesPerFrame : 1;
+	uint64_t cycles = options.cycles;
+	if (isReplay) {
+		cyclesPerFrame = log.GetCyclesPerFrame() > 0 
+			? log.GetCyclesPerFrame() : cyclesPerFrame;
+		uint64_t frames 
+			= options.frames > 0 ? options.frames : log.GetFrameCount();
+		cycles = frames * cyclesPerFrame;
+	}
+	else if (options.frames > 0) {
+		cycles = options.frames * cyclesPerFrame;
+	}
+	uint64_t frames = cycles / cyclesPerFrame;
+	uint64_t leftover = cycles % cyclesPerFrame;
+
+	std::unique_ptr<Profiler> profiler;
+	if (!options.profileFile.empty() && options.lanes <= 1) {
+		profiler.reset(new Profiler());
+		c8.profiler = profiler.get();
+	}
+
+	// The run waits for the recorder rather than dropping frames, so every
+	// frame is in the capture however fast the run is
+	std::unique_ptr<FrameRecorder> recorder;
+	if (!options.captureFile.empty() && options.lanes <= 1) {
+		recorder.reset(new FrameRecorder());
+		if (!recorder->Open(options.captureFile, false)) {
+			result.error = "Could not write capture " + options.captureFile;
+			return false;
+		}
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	if (options.lanes > 1) {
+		// Every lane gets the same input, so the seeds tell them apart.
+		// Lane 0 is seeded too, so that it does not keep the generator of
+		// a save state or of the constructor.
+		LockstepEngine engine(c8, options.lanes);
+		uint64_t seed = isReplay ? log.GetSeed()
+			: options.hasSeed ? options.seed : (uint64_t)time(NULL);
+		for (int i = 0; i < options.lanes; ++i) {
+			c8.Seed(seed + i);
+			engine.SetLane(i, c8);
+		}
+		for (uint64_t i = 0; i < frames; ++i) {
+			if (isReplay) {
+				for (int lane = 0; lane < options.lanes; ++lane) {
+					engine.SetKeypadMask(lane, log.MaskAt(i));
+				}
+			}
+			engine.RunFrame(cyclesPerFrame);
+		}
+		engine.Run((int)leftover);
+		engine.GetLane(0, c8);
+	}
+	else if (options.useRecompiler) {
+		// The code the analysis finds is translated before the first frame
+		Recompiler recompiler(c8);
+		ROMAnalysis analysis;
+		analysis.Analyze(c8);
+		recompiler.Precompile(analysis.GetBlockStarts());
+		for (uint64_t i = 0; i < frames; ++i) {
+			if (isReplay) {
+				c8.SetKeypadMask(log.MaskAt(i));
+			}
+			recompiler.RunFrame(cyclesPerFrame);
+			if (recorder) {
+				recorder->Record(c8);
+			}
+		}
+		recompiler.Run(leftover);
+	}
+	else {
+		for (uint64_t i = 0; i < frames; ++i) {
+			if (isReplay) {
+				c8.SetKeypadMask(log.MaskAt(i));
+			}
+			c8.RunFrame(cyclesPerFrame);
+			if (recorder) {
+				recorder->Record(c8);
+			}
+		}
+		for (uint64_t i = 0; i < leftover; ++i) {
+			c8.Cycle();
+		}
+	}
+
+	std::chrono::duration<double> elapsed
+		= std::chrono::steady_clock::now() - start;
+
+	result.cycles = cycles;
+	result.frames = frames;
+	result.cyclesPerFrame = cyclesPerFrame;
+	result.seconds = elapsed.count();
+
+	if (recorder && !recorder->Close()) {
+		result.error = "Could not write capture " + options.captureFile;
+		return false;
+	}
+
+	if (profiler) {
+		c8.profiler = nullptr;
+		if (!profiler->WriteJSON(options.profileFile)) {
+			result.error = "Could not write profile " + options.profileFile;
+			return false;
+		}
+	}
+
+	if (!options.saveStateFile.empty() 
+		&& !c8.SaveState(options.saveStateFile)) {
+		result.error = "Could not write save state " + options.saveStateFile;
+		return false;
+	}
+	return true;
+}
+
+int RunHeadless(const HeadlessOptions& options) {
+	Chippin8 c8;
+	HeadlessResult result;
+	if (!RunROM(c8, options, result)) {
+		std::cerr << result.error << '\n';
+		return EXIT_FAILURE;
+	}
+
+	std::cout << "rom=" << options.romFile << '\n'
+		<< "rom_hash=" << std::hex << std::setfill('0') << std::setw(16)
+		<< c8.GetROMHash() << std::dec << std::setfill(' ') << '\n'
+		<< "engine=" << (options.lanes > 1 ? "lockstep"
+			: options.useRecompiler ? "recompiler" : "interpreter") << '\n';
+	if (options.lanes > 1) {
+		std::cout << "lanes=" << options.lanes << '\n';
+	}
+	std::cout
+		<< "cycles=" << result.cycles << '\n'
+		<< "frames=" << result.frames << '\n'
+		<< "cycles_per_frame=" << result.cyclesPerFrame << '\n';
+	PrintState(std::cout, c8);
+	std::cout << "seconds=" << result.seconds << '\n';
+	if (result.seconds > 0) {
+		// Counting the instructions of all lanes
+		uint64_t lanes = options.lanes > 1 ? options.lanes : 1;
+		std::cout << "cycles_per_second="
+			<< (uint64_t)(result.cycles * lanes / result.seconds) << '\n';
+	}
+
+	return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,78 @@
+/*
+	Headless mode runs a ROM without SDL (no window, no input, no delays) as
+	fast as the host allows, then prints the final state of the machine to
+	stdout. Useful for batch runs and regression tests on machines without a
+	display.
+*/
+
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include "emulator.h"
+
+#include <stdint.h>
+#include <string>
+#include <ostream>
+
+struct HeadlessOptions {
+	std::string romFile;		// ROM to run
+	uint64_t cycles;			// Number of instructions to execute
+	uint64_t frames;			// Number of frames to run. Overrides cycles
+	int cyclesPerFrame;			// Instructions per 60 Hz timer tick
+	bool useRecompiler;			// Run on the Recompiler instead of Cycle()
+	std::string loadStateFile;	// If set, resume from this save state
+	std::string saveStateFile;	// If set, save the final state here
+	bool hasSeed;				// Seed the random number generator with seed
+	uint64_t seed;
+	bool hasQuirkProfile;		// Run with quirkProfile instead of the
+	QuirkProfile quirkProfile;	// profile picked for the ROM (or recorded in
+								// the save state)
+	std::string replayFile;		// If set, replay this input log (see 
+								// InputLog). Its seed, cycles per frame and
+								// quirk profile are used, and all its frames
+								// are run unless frames is set. A log 
+								// recorded with another ROM, or with another
+								// profile than quirkProfile or the save
+								// state, is refused.
+	int lanes;					// If more than 1, run this many copies of
+								// the ROM on the LockstepEngine, lane k 
+								// seeded with seed + k. Lane 0 is the result.
+								// useRecompiler is ignored with lanes.
+	std::string profileFile;	// If set, profile the run (see Profiler) and
+								// write the results here as JSON. Not 
+								// available with lanes.
+	std::string captureFile;	// If set, record every frame to this file
+								// (see FrameRecorder). Not available with
+								// lanes.
+};
+
+// Outcome of RunROM
+struct HeadlessResult {
+	uint64_t cycles;			// Number of instructions executed
+	uint64_t frames;			// Number of whole frames run
+	int cyclesPerFrame;			// Instructions per frame actually used
+	double seconds;				// Wall time spent emulating
+	std::string error;			// Why the run failed
+};
+
+// Hash of the display contents (FNV-1a over the pixels at the current 
+// resolution, 1 bit per pixel, row by row, leftmost pixel in the most 
+// significant bit). If the second plane or high resolution is used, the 
+// second plane and the resolution are hashed as well.
+uint64_t DisplayHash(const Chippin8& c8);
+
+// Print the state of the machine, and the quirk profile, as "key=value" 
+// lines
+void PrintState(std::ostream& out, const Chippin8& c8);
+
+// Run the ROM as described by options on c8, without printing anything. 
+// Returns false, with result.error set, if a file could not be loaded or 
+// saved.
+bool RunROM(Chippin8& c8, const HeadlessOptions& options, 
+	HeadlessResult& result);
+
+// Run the ROM as described by options and print the results to stdout.
+// Returns the process exit code.
+int RunHeadless(const HeadlessOptions& options);
+
+#endif // HEADLESS_H
\ No newline at end of file
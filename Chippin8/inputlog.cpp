@@ -0,0 +1,187 @@
+#include "inputlog.h"
+
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <string.h>
+
+/*
+	File format, version 2 (all values little-endian):
+		offset	size	contents
+		0		4		magic "C8IN"
+		4		2		format version
+		6		1		quirk profile + 1, 0 if not recorded
+		7		1		reserved (0)
+		8		8		random number generator seed
+		16		4		cycles per frame
+		20		8		number of frames
+		28		8		number of events
+		36		8		ROM hash, 0 if not recorded
+		44		...		events: frame (varint, relative to the previous
+						event), keypad mask (2 bytes)
+
+	Version 1 had neither the quirk profile nor the ROM hash, and the
+	events started at offset 36.
+*/
+static const uint8_t LOG_MAGIC[4] = { 'C', '8', 'I', 'N' };
+static const uint16_t LOG_VERSION = 2;
+static const size_t LOG_HEADER_SIZE = 44;
+static const size_t LOG_V1_HEADER_SIZE = 36;
+
+static void PutValue(std::vector<uint8_t>& out, uint64_t value, int size) {
+	for (int i = 0; i < size; ++i) {
+		out.push_back((value >> (i * 8)) & 0xFF);
+	}
+}
+
+static uint64_t GetValue(const uint8_t* in, int size) {
+	uint64_t value = 0;
+	for (int i = 0; i < size; ++i) {
+		value |= (uint64_t)in[i] << (i * 8);
+	}
+	return value;
+}
+
+InputLog::InputLog() {
+	Reset(0, 0);
+	hasQuirkProfile = false;
+}
+
+void InputLog::Reset(uint64_t seed, int cyclesPerFrame, uint64_t romHash,
+	QuirkProfile quirkProfile) {
+	this->seed = seed;
+	this->cyclesPerFrame = cyclesPerFrame;
+	this->romHash = romHash;
+	this->quirkProfile = quirkProfile;
+	hasQuirkProfile = true;
+	frameCount = 0;
+	events.clear();
+}
+
+bool InputLog::GetQuirkProfile(QuirkProfile& profile) const {
+	if (hasQuirkProfile) {
+		profile = quirkProfile;
+	}
+	return hasQuirkProfile;
+}
+
+void InputLog::Record(uint64_t frame, uint16_t mask) {
+	if (frame < frameCount) {
+		Truncate(frame);
+	}
+
+	// Only changes are stored. The keypad starts out released.
+	uint16_t previous = events.empty() ? 0 : events.back().mask;
+	if (mask != previous) {
+		events.push_back({ frame, mask });
+	}
+	frameCount = frame + 1;
+}
+
+void InputLog::Truncate(uint64_t frameCount) {
+	while (!events.empty() && events.back().frame >= frameCount) {
+		events.pop_back();
+	}
+	this->frameCount = std::min(this->frameCount, frameCount);
+}
+
+uint16_t InputLog::MaskAt(uint64_t frame) const {
+	// Last event at or before frame
+	auto it = std::upper_bound(events.begin(), events.end(), frame,
+		[](uint64_t frame, const Event& event) { return frame < event.frame; });
+	return it == events.begin() ? 0 : std::prev(it)->mask;
+}
+
+bool InputLog::Save(const std::string& filename) const {
+	std::vector<uint8_t> data(LOG_MAGIC, LOG_MAGIC + sizeof(LOG_MAGIC));
+	PutValue(data, LOG_VERSION, 2);
+	PutValue(data, hasQuirkProfile ? (int)quirkProfile + 1 : 0, 1);
+	PutValue(data, 0, 1);
+	PutValue(data, seed, 8);
+	PutValue(data, (uint32_t)cyclesPerFrame, 4);
+	PutValue(data, frameCount, 8);
+	PutValue(data, events.size(), 8);
+	PutValue(data, romHash, 8);
+
+	uint64_t previous = 0;
+	for (const Event& event : events) {
+		uint64_t delta = event.frame - previous;
+		while (delta >= 0x80) {
+			data.push_back((uint8_t)(delta | 0x80));
+			delta >>= 7;
+		}
+		data.push_back((uint8_t)delta);
+		PutValue(data, event.mask, 2);
+		previous = event.frame;
+	}
+
+	std::ofstream file(filename, std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+	file.write((const char*)data.data(), data.size());
+	return file.good();
+}
+
+bool InputLog::Load(const std::string& filename) {
+	Reset(0, 0);
+	hasQuirkProfile = false;
+
+	std::ifstream file(filename, std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)),
+		std::istreambuf_iterator<char>());
+
+	if (data.size() < LOG_V1_HEADER_SIZE
+		|| memcmp(data.data(), LOG_MAGIC, sizeof(LOG_MAGIC)) != 0) {
+		return false;
+	}
+	uint64_t version = GetValue(&data[4], 2);
+	if (version != 1
+		&& (version != LOG_VERSION || data.size() < LOG_HEADER_SIZE)) {
+		return false;
+	}
+	uint8_t profile = version == 1 ? 0 : data[6];
+	if (profile > QUIRK_PROFILE_COUNT) {
+		return false;
+	}
+	uint64_t seed = GetValue(&data[8], 8);
+	int cyclesPerFrame = (int)GetValue(&data[16], 4);
+	uint64_t frameCount = GetValue(&data[20], 8);
+	uint64_t eventCount = GetValue(&data[28], 8);
+	uint64_t romHash = version == 1 ? 0 : GetValue(&data[36], 8);
+
+	std::vector<Event> events;
+	const uint8_t* in = data.data()
+		+ (version == 1 ? LOG_V1_HEADER_SIZE : LOG_HEADER_SIZE);
+	const uint8_t* end = data.data() + data.size();
+	uint64_t frame = 0;
+	for (uint64_t i = 0; i < eventCount; ++i) {
+		uint64_t delta = 0;
+		for (int shift = 0; ; shift += 7) {
+			if (in == end || shift > 63) {
+				return false;
+			}
+			uint8_t byte = *in++;
+			delta |= (uint64_t)(byte & 0x7F) << shift;
+			if (!(byte & 0x80)) break;
+		}
+		if (end - in < 2) {
+			return false;
+		}
+		frame += delta;
+		events.push_back({ frame, (uint16_t)GetValue(in, 2) });
+		in += 2;
+	}
+
+	Reset(seed, cyclesPerFrame, romHash);
+	hasQuirkProfile = profile > 0;
+	if (hasQuirkProfile) {
+		quirkProfile = (QuirkProfile)(profile - 1);
+	}
+	this->frameCount = frameCount;
+	this->events.swap(events);
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+/*
+	Input log for deterministic runs. The emulator only depends on its ROM,
+	its quirk profile, the random number generator seed and the keypad, and
+	the keypad only changes between frames. So a run is fully described by
+	the seed, the cycles per frame and the keypad bitmask of every frame,
+	and only the frames where the keypad changed have to be stored. The
+	hash of the ROM (see Chippin8::GetROMHash) and the quirk profile are
+	stored as well, so that a log is not replayed against anything else.
+
+	The frontend records a log with --record, and headless mode replays it
+	with --replay, as fast as the host allows.
+*/
+
+#ifndef INPUTLOG_H
+#define INPUTLOG_H
+
+#include "quirks.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class InputLog {
+public:
+	InputLog();
+
+	// Start an empty log of a run of the ROM with the given hash (0 if not
+	// known), with the given quirk profile
+	void Reset(uint64_t seed, int cyclesPerFrame, uint64_t romHash = 0,
+		QuirkProfile quirkProfile = QuirkProfile::CosmacVIP);
+
+	// Record the keypad (see Chippin8::GetKeypadMask) used for the given
+	// frame. Frames are recorded in order. Recording a frame that is already
+	// in the log (e.g. after rewinding) drops it and all the frames after it.
+	void Record(uint64_t frame, uint16_t mask);
+
+	// Drop all frames from frameCount on
+	void Truncate(uint64_t frameCount);
+
+	// Keypad used for the given frame
+	uint16_t MaskAt(uint64_t frame) const;
+
+	uint64_t GetSeed() const { return seed; }
+	int GetCyclesPerFrame() const { return cyclesPerFrame; }
+	uint64_t GetFrameCount() const { return frameCount; }
+
+	// Hash of the ROM the log was recorded with, 0 if not known (logs of
+	// the first version)
+	uint64_t GetROMHash() const { return romHash; }
+
+	// Quirk profile the log was recorded with. Returns false if not known.
+	bool GetQuirkProfile(QuirkProfile& profile) const;
+
+	// Write or read the log. Load returns false, leaving the log empty, if
+	// the file is not a valid input log.
+	bool Save(const std::string& filename) const;
+	bool Load(const std::string& filename);
+
+private:
+	// The keypad changed to mask at the start of frame
+	struct Event {
+		uint64_t frame;
+		uint16_t mask;
+	};
+
+	uint64_t seed;				// Random number generator seed
+	int cyclesPerFrame;
+	uint64_t romHash;			// See GetROMHash
+	bool hasQuirkProfile;
+	QuirkProfile quirkProfile;	// Set if hasQuirkProfile
+	uint64_t frameCount;		// Number of frames recorded
+	std::vector<Event> events;	// Ordered by frame
+};
+
+#endif // INPUTLOG_H
\ No newline at end of file
@@ -0,0 +1,168 @@
+/*
+	Lock-free containers for handing data between exactly two threads, one
+	that writes and one that reads. Neither side ever waits for the other,
+	so a slow reader (e.g. a render thread blocked on vsync) can't stall the
+	writer, and the other way around.
+*/
+
+#ifndef LOCKFREE_H
+#define LOCKFREE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Size of a cache line. Data written by different threads is kept on
+// different cache lines, so that the threads don't keep stealing the line
+// from each other.
+const size_t CACHE_LINE_SIZE = 64;
+
+/* ----- Single-Producer Single-Consumer Queue ----- */
+/*
+	Fixed-size ring buffer. Push is only called by the producer thread, and
+	Pop only by the consumer thread. Capacity must be a power of two.
+*/
+template <typename T, size_t Capacity>
+class SpscQueue {
+	static_assert((Capacity & (Capacity - 1)) == 0,
+		"Capacity must be a power of two");
+
+public:
+	SpscQueue() : head(0), tail(0) {}
+
+	// Add an item to the back. Returns false if the queue is full.
+	bool Push(const T& item) {
+		size_t back = tail.load(std::memory_order_relaxed);
+		if (back - head.load(std::memory_order_acquire) == Capacity) {
+			return false;
+		}
+		items[back & (Capacity - 1)] = item;
+		tail.store(back + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Remove the item at the front. Returns false if the queue is empty.
+	bool Pop(T& item) {
+		size_t front = head.load(std::memory_order_relaxed);
+		if (front == tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+		item = items[front & (Capacity - 1)];
+		head.store(front + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	// Both only ever increase. The slot is the count modulo Capacity.
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> head;	// Items popped
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail;	// Items pushed
+	alignas(CACHE_LINE_SIZE) T items[Capacity];
+};
+
+/* ----- Single-Producer Single-Consumer Ring ----- */
+/*
+	Same as SpscQueue, but for streams of small items that are written and
+	read many at a time (e.g. audio samples), with one atomic update per 
+	call rather than per item. Capacity must be a power of two.
+*/
+template <typename T, size_t Capacity>
+class SpscRing {
+	static_assert((Capacity & (Capacity - 1)) == 0,
+		"Capacity must be a power of two");
+
+public:
+	SpscRing() : head(0), tail(0) {}
+
+	// Append up to count items, as many as there is room for. Returns the
+	// number of items written. Only called by the producer.
+	size_t Write(const T* source, size_t count) {
+		size_t back = tail.load(std::memory_order_relaxed);
+		size_t room = Capacity - (back - head.load(std::memory_order_acquire));
+		count = count < room ? count : room;
+		for (size_t i = 0; i < count; ++i) {
+			items[(back + i) & (Capacity - 1)] = source[i];
+		}
+		tail.store(back + count, std::memory_order_release);
+		return count;
+	}
+
+	// Remove up to count items from the front, as many as there are. 
+	// Returns the number of items read. Only called by the consumer.
+	size_t Read(T* destination, size_t count) {
+		size_t front = head.load(std::memory_order_relaxed);
+		size_t available = tail.load(std::memory_order_acquire) - front;
+		count = count < available ? count : available;
+		for (size_t i = 0; i < count; ++i) {
+			destination[i] = items[(front + i) & (Capacity - 1)];
+		}
+		head.store(front + count, std::memory_order_release);
+		return count;
+	}
+
+	// Number of items that can be read. The other thread may change it 
+	// right away: the consumer may find more, the producer less.
+	size_t Size() const {
+		return tail.load(std::memory_order_acquire) 
+			- head.load(std::memory_order_acquire);
+	}
+
+private:
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> head;	// Items read
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail;	// Items written
+	alignas(CACHE_LINE_SIZE) T items[Capacity];
+};
+
+/* ----- Triple Buffer ----- */
+/*
+	Passes the latest value from a writer to a reader, e.g. frames from the
+	emulation to the renderer. The writer fills the back buffer and
+	publishes it, which swaps it with the middle buffer. The reader swaps
+	the middle buffer with its front buffer whenever a new one has been
+	published. Values the reader had no time for are skipped, so it always
+	gets the most recent one.
+*/
+template <typename T>
+class TripleBuffer {
+public:
+	TripleBuffer() : middle(1), back(0), front(2) {}
+
+	/* ----- Writer ----- */
+
+	// Buffer to fill before calling Publish
+	T& GetWriteBuffer() { return buffers[back]; }
+
+	// Make the write buffer the latest value
+	void Publish() {
+		back = middle.exchange(back | FRESH, std::memory_order_acq_rel)
+			& INDEX_MASK;
+	}
+
+	/* ----- Reader ----- */
+
+	// Take the latest value, if one was published since the last call.
+	// Returns false, and keeps the current read buffer, otherwise.
+	bool Update() {
+		if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+			return false;
+		}
+		front = middle.exchange(front, std::memory_order_acq_rel)
+			& INDEX_MASK;
+		return true;
+	}
+
+	// Latest value taken by Update
+	const T& GetReadBuffer() const { return buffers[front]; }
+
+private:
+	// The middle index has this bit set when it holds a value that the
+	// reader hasn't taken yet
+	static const uint8_t FRESH = 0x4;
+	static const uint8_t INDEX_MASK = 0x3;
+
+	T buffers[3];
+	alignas(CACHE_LINE_SIZE) std::atomic<uint8_t> middle;
+	alignas(CACHE_LINE_SIZE) uint8_t back;	// Only used by the writer
+	alignas(CACHE_LINE_SIZE) uint8_t front;	// Only used by the reader
+};
+
+#endif // LOCKFREE_H
\ No newline at end of file
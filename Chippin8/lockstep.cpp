@@ -0,0 +1,944 @@
+#include "lockstep.h"
+#include "lockstepavx2.h"
+
+#include <algorithm>
+#include <bit>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Lanes per vector. The lane arrays are padded to a multiple of this.
+const int LANE_BLOCK = 32;
+
+// Below this share of the lanes (1 in N), running the selected lanes one by
+// one is cheaper than running the vector kernels over all lanes
+const int VECTOR_MIN_SHARE = 16;
+
+// Font locations, same as in emulator.cpp
+const uint16_t FONTSET_START_ADDRESS = 0x000;
+const uint16_t BIG_FONTSET_START_ADDRESS = 0x050;
+
+// Lanes only have the low resolution display, and the first plane of it
+const int LANE_DISPLAY_WIDTH = DISPLAY_WIDTH / 2;
+const int LANE_DISPLAY_HEIGHT = DISPLAY_HEIGHT / 2;
+
+namespace {
+
+/* ----- Vector Kernels ----- */
+/*
+	Each kernel applies one operation to every lane selected in the mask
+	(0xFF or 0xFFFF per lane) and leaves the other lanes unchanged. If the CPU
+	has AVX2, the AVX2 versions (see lockstepavx2.h) process 32 byte or 16
+	word lanes at once. The scalar loop handles the rest, which is everything
+	without AVX2.
+*/
+
+#ifdef CHIPPIN8_LOCKSTEP_AVX2
+const bool USE_AVX2 = IsAVX2Supported();
+#endif
+
+// dst = value
+void SetBytes(uint8_t* dst, uint8_t value, const uint8_t* mask, int n) {
+	int i = 0;
+#ifdef CHIPPIN8_LOCKSTEP_AVX2
+	if (USE_AVX2) {
+		i = n / 32 * 32;
+		SetBytesAVX2(dst, value, mask, i);
+	}
+#endif // CHIPPIN8_LOCKSTEP_AVX2
+	for (; i < n; ++i) {
+		if (mask[i]) dst[i] = value;
+	}
+}
+
+// dst += value
+void AddBytes(uint8_t* dst, uint8_t value, const uint8_t* mask, int n) {
+	int i = 0;
+#ifdef CHIPPIN8_LOCKSTEP_AVX2
+	if (USE_AVX2) {
+		i = n / 32 * 32;
+		AddBytesAVX2(dst, value, mask, i);
+	}
+#endif // CHIPPIN8_LOCKSTEP_AVX2
+	for (; i < n; ++i) {
+		if (mask[i]) dst[i] += value;
+	}
+}
+
+// dst = operation(dst, src)
+void CombineBytes(ByteOperation operation, uint8_t* dst, const uint8_t* src,
+	const uint8_t* mask, int n) {
+	int i = 0;
+#ifdef CHIPPIN8_LOCKSTEP_AVX2
+	if (USE_AVX2) {
+		i = n / 32 * 32;
+		CombineBytesAVX2(operation, dst, src, mask, i);
+	}
+#endif // CHIPPIN8_LOCKSTEP_AVX2
+	for (; i < n; ++i) {
+		if (!mask[i]) continue;
+		switch (operation) {
+		case BYTE_MOVE: dst[i] = src[i]; break;
+		case BYTE_OR: dst[i] |= src[i]; break;
+		case BYTE_AND: dst[i] &= src[i]; break;
+		case BYTE_XOR: dst[i] ^= src[i]; break;
+		case BYTE_ADD: dst[i] += src[i]; break;
+		case BYTE_SUBTRACT: dst[i] -= src[i]; break;
+		case BYTE_SUBTRACT_FROM: dst[i] = src[i] - dst[i]; break;
+		case BYTE_SHIFT_RIGHT: dst[i] = src[i] >> 1; break;
+		default: dst[i] = src[i] << 1; break;
+		}
+	}
+}
+
+// dst = operation(a, b) in all lanes, selected or not. dst is a scratch
+// row, which keeps the flag an instruction sets VF to while its result 
+// overwrites a or b. b is only used for the carry and the borrow.
+void FlagBytes(FlagOperation operation, uint8_t* dst, const uint8_t* a,
+	const uint8_t* b, int n) {
+	int i = 0;
+#ifdef CHIPPIN8_LOCKSTEP_AVX2
+	if (USE_AVX2) {
+		i = n / 32 * 32;
+		FlagBytesAVX2(operation, dst, a, b, i);
+	}
+#endif // CHIPPIN8_LOCKSTEP_AVX2
+	for (; i < n; ++i) {
+		switch (operation) {
+		case FLAG_CARRY: dst[i] = (a[i] + b[i] > 255) ? 1 : 0; break;
+		case FLAG_NO_BORROW: dst[i] = (a[i] < b[i]) ? 0 : 1; break;
+		case FLAG_LOW_BIT: dst[i] = a[i] & 0x01u; break;
+		default: dst[i] = a[i] >> 7; break;
+		}
+	}
+}
+
+// condition = (a == b) == equal ? 0xFF : 0. b is a row, or the constant
+// value if b is nullptr.
+void CompareBytes(uint8_t* condition, const uint8_t* a, const uint8_t* b,
+	uint8_t value, bool equal, int n) {
+	int i = 0;
+#ifdef CHIPPIN8_LOCKSTEP_AVX2
+	if (USE_AVX2) {
+		i = n / 32 * 32;
+		CompareBytesAVX2(condition, a, b, value, equal, i);
+	}
+#endif // CHIPPIN8_LOCKSTEP_AVX2
+	for (; i < n; ++i) {
+		condition[i] = ((a[i] == (b ? b[i] : value)) == equal) ? 0xFF : 0;
+	}
+}
+
+// Timers: dst = (dst > 0) ? dst - 1 : 0, for all lanes
+void DecrementBytes(uint8_t* dst, int n) {
+	int i = 0;
+#ifdef CHIPPIN8_LOCKSTEP_AVX2
+	if (USE_AVX2) {
+		i = n / 32 * 32;
+		DecrementBytesAVX2(dst, i);
+	}
+#endif // CHIPPIN8_LOCKSTEP_AVX2
+	for (; i < n; ++i) {
+		if (dst[i] > 0) --dst[i];
+	}
+}
+
+// dst = value
+void SetWords(uint16_t* dst, uint16_t value, const uint16_t* mask, int n) {
+	int i = 0;
+#ifdef CHIPPIN8_LOCKSTEP_AVX2
+	if (USE_AVX2) {
+		i = n / 16 * 16;
+		SetWordsAVX2(dst, value, mask, i);
+	}
+#endif // CHIPPIN8_LOCKSTEP_AVX2
+	for (; i < n; ++i) {
+		if (mask[i]) dst[i] = value;
+	}
+}
+
+// pc = next, plus 2 where condition is set
+void SkipWords(uint16_t* pc, uint16_t next, const uint8_t* condition,
+	const uint16_t* mask, int n) {
+	int i = 0;
+#ifdef CHIPPIN8_LOCKSTEP_AVX2
+	if (USE_AVX2) {
+		i = n / 16 * 16;
+		SkipWordsAVX2(pc, next, condition, mask, i);
+	}
+#endif // CHIPPIN8_LOCKSTEP_AVX2
+	for (; i < n; ++i) {
+		if (mask[i]) pc[i] = next + (condition[i] ? 2 : 0);
+	}
+}
+
+// dst = (accumulate ? dst : 0) + src * scale
+void WordsFromBytes(uint16_t* dst, const uint8_t* src, uint16_t scale,
+	bool accumulate, const uint16_t* mask, int n) {
+	int i = 0;
+#ifdef CHIPPIN8_LOCKSTEP_AVX2
+	if (USE_AVX2) {
+		i = n / 16 * 16;
+		WordsFromBytesAVX2(dst, src, scale, accumulate, mask, i);
+	}
+#endif // CHIPPIN8_LOCKSTEP_AVX2
+	for (; i < n; ++i) {
+		if (mask[i]) dst[i] = (accumulate ? dst[i] : 0) + src[i] * scale;
+	}
+}
+
+// dst = src
+void CopyWords(uint16_t* dst, const uint16_t* src, const uint16_t* mask,
+	int n) {
+	int i = 0;
+#ifdef CHIPPIN8_LOCKSTEP_AVX2
+	if (USE_AVX2) {
+		i = n / 16 * 16;
+		CopyWordsAVX2(dst, src, mask, i);
+	}
+#endif // CHIPPIN8_LOCKSTEP_AVX2
+	for (; i < n; ++i) {
+		if (mask[i]) dst[i] = src[i];
+	}
+}
+
+// Whether row equals value in all selected lanes
+bool AllEqual(const uint8_t* row, uint8_t value, const uint8_t* mask, int n) {
+	int i = 0;
+#ifdef CHIPPIN8_LOCKSTEP_AVX2
+	if (USE_AVX2) {
+		i = n / 32 * 32;
+		if (!AllEqualAVX2(row, value, mask, i)) return false;
+	}
+#endif // CHIPPIN8_LOCKSTEP_AVX2
+	for (; i < n; ++i) {
+		if (mask[i] && row[i] != value) return false;
+	}
+	return true;
+}
+
+// dst = Random() & value, with each lane's own xorshift64* generator (see
+// Chippin8::Random())
+void RandomBytes(uint8_t* dst, uint64_t* state, uint8_t value,
+	const uint8_t* mask, int n) {
+	const uint64_t MULTIPLIER = 0x2545F4914F6CDD1Dull;
+	int i = 0;
+#ifdef CHIPPIN8_LOCKSTEP_AVX2
+	if (USE_AVX2) {
+		i = n / 4 * 4;
+		RandomBytesAVX2(dst, state, value, mask, i);
+	}
+#endif // CHIPPIN8_LOCKSTEP_AVX2
+	for (; i < n; ++i) {
+		if (!mask[i]) continue;
+		uint64_t& s = state[i];
+		s ^= s >> 12;
+		s ^= s << 25;
+		s ^= s >> 27;
+		dst[i] = (uint8_t)((s * MULTIPLIER) >> 56) & value;
+	}
+}
+
+// Lowest pc of the lanes with instructions remaining
+uint16_t LowestPc(const uint16_t* pc, const uint16_t* remaining, int n) {
+	int i = 0;
+	uint16_t lowest = 0xFFFF;
+#ifdef CHIPPIN8_LOCKSTEP_AVX2
+	if (USE_AVX2) {
+		i = n / 16 * 16;
+		lowest = LowestPcAVX2(pc, remaining, i);
+	}
+#endif // CHIPPIN8_LOCKSTEP_AVX2
+	for (; i < n; ++i) {
+		if (remaining[i] > 0 && pc[i] < lowest) lowest = pc[i];
+	}
+	return lowest;
+}
+
+// One instruction less remaining, and opcode is the last one executed. 
+// Returns the lowest pc of the lanes with instructions remaining after that,
+// i.e. where the next step runs.
+uint16_t FinishStep(uint16_t* remaining, uint16_t* lastOpcode, 
+	uint16_t opcode, const uint16_t* mask, const uint16_t* pc, int n) {
+	int i = 0;
+	uint16_t lowest = 0xFFFF;
+#ifdef CHIPPIN8_LOCKSTEP_AVX2
+	if (USE_AVX2) {
+		i = n / 16 * 16;
+		lowest = FinishStepAVX2(remaining, lastOpcode, opcode, mask, pc, i);
+	}
+#endif // CHIPPIN8_LOCKSTEP_AVX2
+	for (; i < n; ++i) {
+		if (mask[i]) {
+			--remaining[i];
+			lastOpcode[i] = opcode;
+		}
+		if (remaining[i] > 0 && pc[i] < lowest) lowest = pc[i];
+	}
+	return lowest;
+}
+
+} // namespace
+
+/* ----- Lanes ----- */
+
+LockstepEngine::LockstepEngine(const Chippin8& c8, int laneCount) {
+	this->laneCount = laneCount > 0 ? laneCount : 1;
+	stride = (this->laneCount + LANE_BLOCK - 1) / LANE_BLOCK * LANE_BLOCK;
+
+	registers.resize(16 * stride);
+	pc.resize(stride);
+	index.resize(stride);
+	opcode.resize(stride);
+	stack.resize(16 * stride);
+	sp.resize(stride);
+	delayTimer.resize(stride);
+	soundTimer.resize(stride);
+	keypad.resize(stride);
+	rngState.resize(stride);
+	display.resize(LANE_DISPLAY_HEIGHT * stride);
+	memory.resize((size_t)stride * LANE_MEMORY_SIZE);
+	modifiedPages.assign(stride, 0);
+	for (int page = 0; page < 16; ++page) {
+		pageLaneCount[page] = 0;
+	}
+	c8.GetMemory(image, sizeof(image));
+
+	remaining.assign(stride, 0);
+	mask.assign(stride, 0);
+	byteMask.assign(stride, 0);
+	condition.assign(stride, 0);
+	laneBits.assign(stride / LANE_BLOCK, 0);
+	instructionCount = 0;
+	stepCount = 0;
+
+	// All lanes run with the quirks of c8
+	quirkProfile = c8.GetQuirkProfile();
+	runChunk = WithQuirks(quirkProfile, [](auto quirks) {
+		return &LockstepEngine::RunChunk<decltype(quirks)>;
+	});
+
+	// The padding lanes are copies as well, but never run
+	for (int lane = 0; lane < stride; ++lane) {
+		SetLane(lane, c8);
+	}
+}
+
+void LockstepEngine::SetLane(int lane, const Chippin8& c8) {
+	for (int r = 0; r < 16; ++r) {
+		registers[r * stride + lane] = c8.registers[r];
+		stack[r * stride + lane] = c8.stack[r];
+	}
+	pc[lane] = c8.pc;
+	index[lane] = c8.index;
+	opcode[lane] = c8.opcode;
+	sp[lane] = c8.sp;
+	delayTimer[lane] = c8.delayTimer;
+	soundTimer[lane] = c8.soundTimer;
+	keypad[lane] = c8.GetKeypadMask();
+	rngState[lane] = c8.rngState;
+	for (int y = 0; y < LANE_DISPLAY_HEIGHT; ++y) {
+		display[y * stride + lane] = c8.display[0][y][0];
+	}
+
+	uint8_t* laneMemory = LaneMemory(lane);
+	c8.GetMemory(laneMemory, sizeof(image));
+	uint16_t pages = 0;
+	for (int page = 0; page < 16; ++page) {
+		if (memcmp(&laneMemory[page * 256], &image[page * 256], 256) != 0) {
+			pages |= 1u << page;
+		}
+	}
+	SetModifiedPages(lane, pages);
+}
+
+void LockstepEngine::GetLane(int lane, Chippin8& c8) const {
+	for (int r = 0; r < 16; ++r) {
+		c8.registers[r] = registers[r * stride + lane];
+		c8.stack[r] = stack[r * stride + lane];
+	}
+	c8.pc = pc[lane];
+	c8.index = index[lane];
+	c8.opcode = opcode[lane];
+	c8.sp = sp[lane];
+	c8.delayTimer = delayTimer[lane];
+	c8.soundTimer = soundTimer[lane];
+	c8.SetKeypadMask(keypad[lane]);
+	c8.rngState = rngState[lane];
+	memset(c8.display, 0, sizeof(c8.display));
+	c8.highResolution = false;
+	c8.planeMask = 0x1;
+	for (int y = 0; y < LANE_DISPLAY_HEIGHT; ++y) {
+		c8.display[0][y][0] = display[y * stride + lane];
+	}
+	c8.SetMemory(&memory[(size_t)lane * LANE_MEMORY_SIZE], sizeof(image));
+	if (c8.GetQuirkProfile() != quirkProfile) {
+		c8.SetQuirkProfile(quirkProfile);
+	}
+
+	// The whole display has to be presented
+	c8.displayDirty = true;
+	c8.dirtyRowFirst = 0;
+	c8.dirtyRowLast = LANE_DISPLAY_HEIGHT - 1;
+}
+
+void LockstepEngine::SetKeypadMask(int lane, uint16_t mask) {
+	keypad[lane] = mask;
+}
+
+void LockstepEngine::MarkModified(int lane, uint16_t address, int length) {
+	uint16_t pages = modifiedPages[lane];
+	for (int i = 0; i < length; ++i) {
+		pages |= 1u << (((address + i) & 0x0FFFu) >> 8);
+	}
+	SetModifiedPages(lane, pages);
+}
+
+void LockstepEngine::SetModifiedPages(int lane, uint16_t pages) {
+	if (pages == modifiedPages[lane]) {
+		return;
+	}
+	for (int page = 0; page < 16; ++page) {
+		pageLaneCount[page] += ((pages >> page) & 1)
+			- ((modifiedPages[lane] >> page) & 1);
+	}
+	modifiedPages[lane] = pages;
+}
+
+/* ----- Execution ----- */
+
+void LockstepEngine::Run(int cycles) {
+	// The instructions remaining per lane are counted in 16 bits
+	while (cycles > 0) {
+		uint16_t chunk = cycles > 0xFFFF ? 0xFFFF : (uint16_t)cycles;
+		(this->*runChunk)(chunk);
+		cycles -= chunk;
+	}
+}
+
+void LockstepEngine::TickTimers() {
+	DecrementBytes(delayTimer.data(), stride);
+	DecrementBytes(soundTimer.data(), stride);
+}
+
+void LockstepEngine::RunFrame(int cyclesPerFrame) {
+	Run(cyclesPerFrame);
+	TickTimers();
+}
+
+template <typename Quirks>
+void LockstepEngine::RunChunk(uint16_t cycles) {
+	for (int lane = 0; lane < laneCount; ++lane) {
+		remaining[lane] = cycles;
+	}
+	uint64_t total = (uint64_t)cycles * laneCount;
+
+	// The lanes furthest behind go first, which is where the lanes that
+	// took a different branch meet again
+	uint16_t address = LowestPc(pc.data(), remaining.data(), stride);
+
+	while (total > 0) {
+		int leader;
+		int count = SelectLanes(address, leader);
+
+		const uint8_t* code = LaneMemory(leader);
+		uint16_t op = (code[address & 0x0FFFu] << 8)
+			| code[(address + 1) & 0x0FFFu];
+		if (pageLaneCount[(address & 0x0FFFu) >> 8] > 0
+			|| pageLaneCount[((address + 1) & 0x0FFFu) >> 8] > 0) {
+			count = DeselectModifiedCode(address, op, leader, count);
+		}
+
+		if (count * VECTOR_MIN_SHARE < stride
+			|| !ExecuteVector<Quirks>(address, op, leader)) {
+			for (int block = 0; block < stride / LANE_BLOCK; ++block) {
+				for (uint32_t bits = laneBits[block]; bits; bits &= bits - 1) {
+					int lane = block * LANE_BLOCK + std::countr_zero(bits);
+					ExecuteLane<Quirks>(lane, address, op);
+				}
+			}
+		}
+		address = FinishStep(remaining.data(), opcode.data(), op, mask.data(),
+			pc.data(), stride);
+
+		total -= count;
+		instructionCount += count;
+		++stepCount;
+	}
+}
+
+int LockstepEngine::SelectLanes(uint16_t address, int& leader) {
+	int count = 0;
+	leader = -1;
+
+	for (int block = 0; block < stride / LANE_BLOCK; ++block) {
+		int first = block * LANE_BLOCK;
+		uint32_t bits = 0;
+#ifdef CHIPPIN8_LOCKSTEP_AVX2
+		if (USE_AVX2) {
+			bits = SelectLanesAVX2(&pc[first], &remaining[first], address,
+				&mask[first], &byteMask[first]);
+		} else
+#endif // CHIPPIN8_LOCKSTEP_AVX2
+		for (int i = 0; i < LANE_BLOCK; ++i) {
+			int lane = first + i;
+			bool selected = remaining[lane] > 0 && pc[lane] == address;
+			mask[lane] = selected ? 0xFFFF : 0;
+			byteMask[lane] = selected ? 0xFF : 0;
+			bits |= (uint32_t)selected << i;
+		}
+		laneBits[block] = bits;
+		count += std::popcount(bits);
+		if (leader < 0 && bits) {
+			leader = first + std::countr_zero(bits);
+		}
+	}
+	return count;
+}
+
+int LockstepEngine::DeselectModifiedCode(uint16_t address, uint16_t op,
+	int leader, int count) {
+	uint16_t pages = (1u << ((address & 0x0FFFu) >> 8))
+		| (1u << (((address + 1) & 0x0FFFu) >> 8));
+	bool leaderModified = (modifiedPages[leader] & pages) != 0;
+
+	for (int block = 0; block < stride / LANE_BLOCK; ++block) {
+		for (uint32_t bits = laneBits[block]; bits; bits &= bits - 1) {
+			int bit = std::countr_zero(bits);
+			int lane = block * LANE_BLOCK + bit;
+			if (!leaderModified && !(modifiedPages[lane] & pages)) {
+				continue;
+			}
+			const uint8_t* code = LaneMemory(lane);
+			uint16_t laneOp = (code[address & 0x0FFFu] << 8)
+				| code[(address + 1) & 0x0FFFu];
+			if (laneOp != op) {
+				// Runs in a later step, with its own instruction
+				mask[lane] = 0;
+				byteMask[lane] = 0;
+				laneBits[block] &= ~(1u << bit);
+				--count;
+			}
+		}
+	}
+	return count;
+}
+
+template <typename Quirks>
+bool LockstepEngine::ExecuteVector(uint16_t address, uint16_t op,
+	int leader) {
+	uint8_t X = (op & 0x0F00u) >> 8;
+	uint8_t Y = (op & 0x00F0u) >> 4;
+	uint8_t NN = op & 0x00FFu;
+	uint16_t NNN = op & 0x0FFFu;
+	uint16_t next = address + 2;
+	const uint8_t* m8 = byteMask.data();
+	const uint16_t* m16 = mask.data();
+	uint8_t* Vx = Register(X);
+	uint8_t* Vy = Register(Y);
+	uint8_t* VF = Register(0xF);
+
+	// Same decoding as Chippin8::Decode. Anything that reads or writes
+	// memory, the stack, the display or the keypad runs per lane.
+	switch ((op & 0xF000u) >> 12) {
+	case 0x0:
+		if (op == 0x00EE) {
+			// Calls and returns can only run together if the lanes are at
+			// the same stack depth, which they usually are. Returning with
+			// an empty stack halts, see Chippin8::StackFault.
+			uint8_t depth = sp[leader];
+			if (depth == 0) return false;
+			if (!AllEqual(sp.data(), depth, m8, stride)) return false;
+			AddBytes(sp.data(), 0xFF, m8, stride);
+			CopyWords(pc.data(), &stack[(depth - 1) * stride], m16, stride);
+			return true;
+		}
+		// The display instructions (00NN) run per lane, 0NNN does nothing
+		if ((op & 0xFF00u) == 0x0000u) return false;
+		break;
+
+	case 0x1:
+		SetWords(pc.data(), NNN, m16, stride);
+		return true;
+
+	case 0x2: {
+		uint8_t depth = sp[leader];
+		if (depth >= 16) return false;
+		if (!AllEqual(sp.data(), depth, m8, stride)) return false;
+		SetWords(&stack[depth * stride], next, m16, stride);
+		AddBytes(sp.data(), 1, m8, stride);
+		SetWords(pc.data(), NNN, m16, stride);
+		return true;
+	}
+
+	case 0x3:
+	case 0x4:
+		if (MayBeLongInstruction(next)) return false;
+		CompareBytes(condition.data(), Vx, nullptr, NN,
+			((op & 0xF000u) >> 12) == 0x3, stride);
+		SkipWords(pc.data(), next, condition.data(), m16, stride);
+		return true;
+
+	case 0x5:
+	case 0x9:
+		// 5XY2 and 5XY3 access memory
+		if (((op & 0xF000u) >> 12) == 0x5 && (op & 0x000Fu) != 0x0) {
+			return false;
+		}
+		if (MayBeLongInstruction(next)) return false;
+		CompareBytes(condition.data(), Vx, Vy, 0,
+			((op & 0xF000u) >> 12) == 0x5, stride);
+		SkipWords(pc.data(), next, condition.data(), m16, stride);
+		return true;
+
+	case 0x6:
+		SetBytes(Vx, NN, m8, stride);
+		break;
+
+	case 0x7:
+		AddBytes(Vx, NN, m8, stride);
+		break;
+
+	case 0x8: {
+		// The order of the writes to VF matters when X or Y is F. Like in
+		// Chippin8, the flag is taken from the operands first and written
+		// after the result.
+		uint8_t* flag = condition.data();
+		const uint8_t* shifted = Quirks::SHIFT_USES_VY ? Vy : Vx;
+		switch (op & 0x000Fu) {
+		case 0x0: CombineBytes(BYTE_MOVE, Vx, Vy, m8, stride); break;
+		case 0x1: CombineBytes(BYTE_OR, Vx, Vy, m8, stride); break;
+		case 0x2: CombineBytes(BYTE_AND, Vx, Vy, m8, stride); break;
+		case 0x3: CombineBytes(BYTE_XOR, Vx, Vy, m8, stride); break;
+		case 0x4:
+			FlagBytes(FLAG_CARRY, flag, Vx, Vy, stride);
+			CombineBytes(BYTE_ADD, Vx, Vy, m8, stride);
+			break;
+		case 0x5:
+			FlagBytes(FLAG_NO_BORROW, flag, Vx, Vy, stride);
+			CombineBytes(BYTE_SUBTRACT, Vx, Vy, m8, stride);
+			break;
+		case 0x6:
+			FlagBytes(FLAG_LOW_BIT, flag, shifted, nullptr, stride);
+			CombineBytes(BYTE_SHIFT_RIGHT, Vx, shifted, m8, stride);
+			break;
+		case 0x7:
+			FlagBytes(FLAG_NO_BORROW, flag, Vy, Vx, stride);
+			CombineBytes(BYTE_SUBTRACT_FROM, Vx, Vy, m8, stride);
+			break;
+		case 0xE:
+			FlagBytes(FLAG_HIGH_BIT, flag, shifted, nullptr, stride);
+			CombineBytes(BYTE_SHIFT_LEFT, Vx, shifted, m8, stride);
+			break;
+		}
+		switch (op & 0x000Fu) {
+		case 0x1:
+		case 0x2:
+		case 0x3:
+			if constexpr (Quirks::LOGIC_RESETS_VF) {
+				SetBytes(VF, 0, m8, stride);
+			}
+			break;
+		case 0x4:
+		case 0x5:
+		case 0x6:
+		case 0x7:
+		case 0xE:
+			CombineBytes(BYTE_MOVE, VF, flag, m8, stride);
+			break;
+		}
+		break;
+	}
+
+	case 0xA:
+		SetWords(index.data(), NNN, m16, stride);
+		break;
+
+	case 0xF:
+		switch (op & 0x00FFu) {
+		case 0x07:
+			CombineBytes(BYTE_MOVE, Vx, delayTimer.data(), m8, stride);
+			break;
+		case 0x15:
+			CombineBytes(BYTE_MOVE, delayTimer.data(), Vx, m8, stride);
+			break;
+		case 0x18:
+			CombineBytes(BYTE_MOVE, soundTimer.data(), Vx, m8, stride);
+			break;
+		case 0x1E:
+			WordsFromBytes(index.data(), Vx, 1, true, m16, stride);
+			break;
+		case 0x29:
+			WordsFromBytes(index.data(), Vx, 5, false, m16, stride);
+			break;
+		case 0x00:
+		case 0x02:
+		case 0x0A:
+		case 0x30:
+		case 0x33:
+		case 0x55:
+		case 0x65:
+			return false;
+		}
+		break;
+
+	case 0xC:
+		RandomBytes(Vx, rngState.data(), NN, m8, stride);
+		break;
+
+	case 0xB:
+	case 0xD:
+		return false;
+
+	case 0xE:
+		if ((op & 0x00FFu) == 0x9E || (op & 0x00FFu) == 0xA1) return false;
+		break;
+	}
+
+	SetWords(pc.data(), next, m16, stride);
+	return true;
+}
+
+template <typename Quirks>
+void LockstepEngine::ExecuteLane(int lane, uint16_t address, uint16_t op) {
+	uint8_t X = (op & 0x0F00u) >> 8;
+	uint8_t Y = (op & 0x00F0u) >> 4;
+	uint8_t N = op & 0x000Fu;
+	uint8_t NN = op & 0x00FFu;
+	uint16_t NNN = op & 0x0FFFu;
+	uint8_t& Vx = registers[X * stride + lane];
+	uint8_t& Vy = registers[Y * stride + lane];
+	uint8_t& VF = registers[0xF * stride + lane];
+	uint8_t& V0 = registers[lane];
+	uint16_t& PC = pc[lane];
+	uint16_t& I = index[lane];
+	uint8_t& SP = sp[lane];
+	uint8_t* ram = LaneMemory(lane);
+
+	uint64_t* rows = &display[lane];	// Row y is rows[y * stride]
+
+	// How far FX55 and FX65 move I, see Chippin8::AdvanceIndex
+	const int indexAdvance 
+		= Quirks::INDEX_ADVANCE == IndexAdvance::ByX ? X
+		: Quirks::INDEX_ADVANCE == IndexAdvance::ByXPlusOne ? X + 1 : 0;
+
+	// Skip the next instruction, F000 NNNN as a whole
+	auto skip = [&]() {
+		PC += (ram[PC & 0x0FFFu] == 0xF0 && ram[(PC + 1) & 0x0FFFu] == 0x00)
+			? 4 : 2;
+	};
+
+	// The instructions below are the same as the Chippin8 instruction
+	// functions, including their quirks, on the state of one lane
+	PC = address + 2;
+
+	switch ((op & 0xF000u) >> 12) {
+	case 0x0:
+		if ((op & 0xFFF0u) == 0x00C0u) {
+			for (int y = LANE_DISPLAY_HEIGHT - 1; y >= 0; --y) {
+				rows[y * stride] = y >= N ? rows[(y - N) * stride] : 0;
+			}
+		}
+		else if ((op & 0xFFF0u) == 0x00D0u) {
+			for (int y = 0; y < LANE_DISPLAY_HEIGHT; ++y) {
+				rows[y * stride] = y + N < LANE_DISPLAY_HEIGHT 
+					? rows[(y + N) * stride] : 0;
+			}
+		}
+		else if (op == 0x00E0u || op == 0x00FEu) {
+			for (int y = 0; y < LANE_DISPLAY_HEIGHT; ++y) {
+				rows[y * stride] = 0;
+			}
+		}
+		else if (op == 0x00EEu) {
+			// An empty stack halts, see Chippin8::StackFault
+			if (SP == 0) PC = address;
+			else PC = stack[(--SP) * stride + lane];
+		}
+		else if (op == 0x00FBu || op == 0x00FCu) {
+			for (int y = 0; y < LANE_DISPLAY_HEIGHT; ++y) {
+				if (op == 0x00FBu) rows[y * stride] >>= 4;
+				else rows[y * stride] <<= 4;
+			}
+		}
+		else if (op == 0x00FDu) {
+			PC -= 2;
+		}
+		break;
+
+	case 0x1: PC = NNN; break;
+
+	case 0x2:
+		// A full stack halts as well
+		if (SP >= 16) {
+			PC = address;
+			break;
+		}
+		stack[SP * stride + lane] = PC;
+		++SP;
+		PC = NNN;
+		break;
+
+	case 0x3: if (Vx == NN) skip(); break;
+	case 0x4: if (Vx != NN) skip(); break;
+
+	case 0x5:
+		if (N == 0x0) {
+			if (Vx == Vy) skip();
+		}
+		else if (N == 0x2 || N == 0x3) {
+			int step = X <= Y ? 1 : -1;
+			int count = abs(Y - X) + 1;
+			for (int i = 0; i < count; ++i) {
+				uint8_t& V = registers[(X + i * step) * stride + lane];
+				if (N == 0x2) ram[(I + i) & 0x0FFFu] = V;
+				else V = ram[(I + i) & 0x0FFFu];
+			}
+			if (N == 0x2) {
+				MarkModified(lane, I, count);
+			}
+		}
+		break;
+
+	case 0x6: Vx = NN; break;
+	case 0x7: Vx += NN; break;
+
+	case 0x8: {
+		// The flag is taken from the operands, and VF is written after the
+		// result, as in Chippin8
+		uint8_t shifted = Quirks::SHIFT_USES_VY ? Vy : Vx;
+		uint8_t flag;
+		switch (N) {
+		case 0x0: Vx = Vy; break;
+		case 0x1: Vx |= Vy; break;
+		case 0x2: Vx &= Vy; break;
+		case 0x3: Vx ^= Vy; break;
+		case 0x4: flag = (Vx + Vy > 255) ? 1 : 0; Vx += Vy; VF = flag; break;
+		case 0x5: flag = (Vx < Vy) ? 0 : 1; Vx -= Vy; VF = flag; break;
+		case 0x6: flag = shifted & 0x01u; Vx = shifted >> 1; VF = flag; break;
+		case 0x7: flag = (Vy < Vx) ? 0 : 1; Vx = Vy - Vx; VF = flag; break;
+		case 0xE:
+			flag = (shifted & 0x80u) >> 7;
+			Vx = shifted << 1;
+			VF = flag;
+			break;
+		}
+		// The COSMAC VIP clears VF in the logic instructions
+		if constexpr (Quirks::LOGIC_RESETS_VF) {
+			if (N >= 0x1 && N <= 0x3) VF = 0;
+		}
+		break;
+	}
+
+	case 0x9: if (Vx != Vy) skip(); break;
+	case 0xA: I = NNN; break;
+	case 0xB: PC = NNN + (Quirks::JUMP_USES_VX ? Vx : V0); break;
+
+	case 0xC: {
+		// xorshift64*, same as Chippin8::Random()
+		uint64_t& state = rngState[lane];
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		Vx = (uint8_t)((state * 0x2545F4914F6CDD1Dull) >> 56) & NN;
+		break;
+	}
+
+	case 0xD: {
+		// DXY0 draws 16 x 16
+		bool wide = N == 0;
+		int height = wide ? 16 : N;
+		int xPosition = Vx % LANE_DISPLAY_WIDTH;
+		int yPosition = Vy % LANE_DISPLAY_HEIGHT;
+		int visibleRows = Quirks::CLIP_SPRITES
+			? std::min(height, LANE_DISPLAY_HEIGHT - yPosition) : height;
+		bool collision = false;
+		for (int i = 0; i < visibleRows; ++i) {
+			uint64_t sprite;
+			if (wide) {
+				sprite = ((uint64_t)ram[(I + i * 2) & 0x0FFFu] << 56)
+					| ((uint64_t)ram[(I + i * 2 + 1) & 0x0FFFu] << 48);
+			}
+			else {
+				sprite = (uint64_t)ram[(I + i) & 0x0FFFu] << 56;
+			}
+			// Without clipping, what goes past the right edge comes back 
+			// on the left
+			uint64_t spriteRow = sprite >> xPosition;
+			if (!Quirks::CLIP_SPRITES && xPosition > 0) {
+				spriteRow |= sprite << (64 - xPosition);
+			}
+			uint64_t& displayRow 
+				= rows[((yPosition + i) % LANE_DISPLAY_HEIGHT) * stride];
+			collision |= (displayRow & spriteRow) != 0;
+			displayRow ^= spriteRow;
+		}
+		// SUPER-CHIP only counts the rows in high resolution mode
+		VF = collision ? 1 : 0;
+		break;
+	}
+
+	case 0xE: {
+		// Only the low 4 bits of VX select the key
+		bool pressed = (keypad[lane] >> (Vx & 0x0Fu)) & 1;
+		if (NN == 0x9E && pressed) skip();
+		if (NN == 0xA1 && !pressed) skip();
+		break;
+	}
+
+	case 0xF:
+		switch (NN) {
+		case 0x00:
+			if (op == 0xF000u) {
+				I = (ram[PC & 0x0FFFu] << 8) | ram[(PC + 1) & 0x0FFFu];
+				PC += 2;
+			}
+			break;
+		case 0x07: Vx = delayTimer[lane]; break;
+		case 0x0A:
+			// Like Chippin8, VX is set to the lowest key pressed
+			if (keypad[lane]) {
+				Vx = (uint8_t)std::countr_zero(keypad[lane]);
+			}
+			else {
+				PC -= 2;
+			}
+			break;
+		case 0x15: delayTimer[lane] = Vx; break;
+		case 0x18: soundTimer[lane] = Vx; break;
+		case 0x1E: I += Vx; break;
+		case 0x29: I = FONTSET_START_ADDRESS + Vx * 5; break;
+		case 0x30: I = BIG_FONTSET_START_ADDRESS + (Vx & 0x0Fu) * 10; break;
+		case 0x33:
+			ram[I & 0x0FFFu] = (Vx / 100) % 10;
+			ram[(I + 1) & 0x0FFFu] = (Vx / 10) % 10;
+			ram[(I + 2) & 0x0FFFu] = Vx % 10;
+			MarkModified(lane, I, 3);
+			break;
+		case 0x55:
+			for (int i = 0; i <= X; ++i) {
+				ram[(I + i) & 0x0FFFu] = registers[i * stride + lane];
+			}
+			MarkModified(lane, I, X + 1);
+			I += indexAdvance;
+			break;
+		case 0x65:
+			for (int i = 0; i <= X; ++i) {
+				registers[i * stride + lane] = ram[(I + i) & 0x0FFFu];
+			}
+			I += indexAdvance;
+			break;
+		}
+		break;
+	}
+}
+
+bool LockstepEngine::MayBeLongInstruction(uint16_t address) const {
+	// Lanes that modified the memory there may hold anything
+	if (pageLaneCount[(address & 0x0FFFu) >> 8] > 0
+		|| pageLaneCount[((address + 1) & 0x0FFFu) >> 8] > 0) {
+		return true;
+	}
+	return image[address & 0x0FFFu] == 0xF0
+		&& image[(address + 1) & 0x0FFFu] == 0x00;
+}
\ No newline at end of file
@@ -0,0 +1,151 @@
+/*
+	Execution engine for running many copies of the same ROM at once, e.g.
+	for input search and fuzzing, where hundreds of machines differ only in
+	their input (or random seed).
+
+	The state of all machines (lanes) is kept as a structure of arrays:
+	register V0 of every lane is stored next to each other, then V1, and so
+	on, and the same for pc, index, the timers and the display rows. Every
+	step, the lanes at the lowest program counter execute the instruction
+	there together. Simple instructions are executed for all of them at once
+	with AVX2 (32 lanes per instruction), everything else runs per lane.
+	The AVX2 kernels are picked when the engine starts if the CPU has AVX2,
+	whatever the build targets. Otherwise the same kernels are plain loops,
+	which gives the same results but no speedup.
+	Lanes that branch differently are left behind by the others, and join
+	them again as soon as they reach the same address, since the lowest
+	address always runs first.
+
+	Each lane produces exactly the same state as a Chippin8 running the same
+	ROM with the same seed and input, as long as the ROM stays within what
+	lanes hold: the first 4KB of memory and the first plane of the 64 x 32
+	display. The SUPER-CHIP and XO-CHIP instructions that work within that
+	(scrolling, 16 x 16 sprites, the large font, 5XY2, 5XY3, F000 NNNN) are
+	supported. High resolution mode, plane selection, the user flags and the
+	audio pattern are not, and those instructions are ignored.
+
+	The lanes follow the quirk profile of the Chippin8 the engine is created
+	from. Like in Chippin8, the execution functions are instantiated for
+	every profile (see quirks.h), and the engine picks one of them once.
+*/
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include "emulator.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+class LockstepEngine {
+public:
+	// Bytes per lane in the memory array. The first 4KB of memory of every 
+	// lane are followed by a cache line of padding, so that the same address
+	// in many lanes does not map to the same cache set.
+	static const size_t LANE_MEMORY_SIZE = 4096 + 64;
+
+	// All lanes start out as copies of c8. Its memory is the image that the
+	// lanes share their code with.
+	LockstepEngine(const Chippin8& c8, int laneCount);
+
+	int GetLaneCount() const { return laneCount; }
+
+	// Copy the state of c8 into a lane, or the state of a lane (and the 
+	// quirk profile of the lanes) into c8
+	void SetLane(int lane, const Chippin8& c8);
+	void GetLane(int lane, Chippin8& c8) const;
+
+	// Set the keys pressed in a lane (see Chippin8::SetKeypadMask)
+	void SetKeypadMask(int lane, uint16_t mask);
+
+	// Execute the given number of instructions in every lane. Same as
+	// calling Chippin8::Cycle() that many times for each lane.
+	void Run(int cycles);
+
+	// Same as Chippin8::TickTimers() for every lane
+	void TickTimers();
+
+	// Same as Chippin8::RunFrame() for every lane
+	void RunFrame(int cyclesPerFrame);
+
+	// Number of instructions executed in all lanes, and the number of steps
+	// that took. The ratio is the average number of lanes that ran together.
+	uint64_t GetInstructionCount() const { return instructionCount; }
+	uint64_t GetStepCount() const { return stepCount; }
+
+private:
+	int laneCount;
+	int stride;						// laneCount rounded up to the vector size
+	QuirkProfile quirkProfile;		// Profile all lanes run with
+
+	/* ----- Lane state, one array element per lane ----- */
+	std::vector<uint8_t> registers;	// V0 to VF, stride elements each
+	std::vector<uint16_t> pc;
+	std::vector<uint16_t> index;
+	std::vector<uint16_t> opcode;	// Last executed opcode
+	std::vector<uint16_t> stack;	// 16 levels, stride elements each
+	std::vector<uint8_t> sp;
+	std::vector<uint8_t> delayTimer;
+	std::vector<uint8_t> soundTimer;
+	std::vector<uint16_t> keypad;	// Bitmask of the keys pressed
+	std::vector<uint64_t> rngState;
+	std::vector<uint64_t> display;	// 32 rows, stride elements each
+
+	// Memory is written rarely (FX33/FX55), so each lane has its own 4KB
+	// block of it, and a bit for every 256-byte page that no longer matches
+	// the shared image. Only code in pages modified by any lane has to be 
+	// checked to really be the same instruction in all lanes.
+	std::vector<uint8_t> memory;	// LANE_MEMORY_SIZE bytes per lane
+	std::vector<uint16_t> modifiedPages;
+	int pageLaneCount[16];			// Number of lanes that modified a page
+	uint8_t image[4096];			// Memory shared by all lanes
+
+	/* ----- Execution ----- */
+	std::vector<uint16_t> remaining;	// Instructions left to run
+	std::vector<uint16_t> mask;			// 0xFFFF if the lane runs this step
+	std::vector<uint8_t> byteMask;		// Same as mask, one byte per lane
+	std::vector<uint8_t> condition;		// Scratch row for skips
+	std::vector<uint32_t> laneBits;		// Bit per selected lane, 32 per word
+	uint64_t instructionCount;
+	uint64_t stepCount;
+
+	uint8_t* Register(int r) { return &registers[r * stride]; }
+	uint8_t* LaneMemory(int lane) {
+		return &memory[(size_t)lane * LANE_MEMORY_SIZE];
+	}
+
+	// Run up to 65535 instructions in every lane, with the quirks of the
+	// profile the engine was created for (see runChunk)
+	template <typename Quirks>
+	void RunChunk(uint16_t cycles);
+	void (LockstepEngine::*runChunk)(uint16_t cycles);
+
+	// Select the lanes at address with instructions remaining. Returns their
+	// number, and the first of them in leader.
+	int SelectLanes(uint16_t address, int& leader);
+
+	// Remove the lanes whose (modified) memory holds a different opcode at
+	// address than the leader's. Returns the number of lanes left.
+	int DeselectModifiedCode(uint16_t address, uint16_t opcode, int leader,
+		int count);
+
+	// Execute opcode in all selected lanes at once. Returns false, without
+	// doing anything, if the instruction has to run per lane.
+	template <typename Quirks>
+	bool ExecuteVector(uint16_t address, uint16_t opcode, int leader);
+
+	// Execute opcode in one lane
+	template <typename Quirks>
+	void ExecuteLane(int lane, uint16_t address, uint16_t opcode);
+
+	// Whether the instruction at address may be F000 NNNN in any lane, which
+	// skips are 4 bytes long over
+	bool MayBeLongInstruction(uint16_t address) const;
+
+	// Mark the memory written by a lane as modified
+	void MarkModified(int lane, uint16_t address, int length);
+	void SetModifiedPages(int lane, uint16_t pages);
+};
+
+#endif // LOCKSTEP_H
\ No newline at end of file
@@ -0,0 +1,289 @@
+#include "lockstepavx2.h"
+
+#ifdef CHIPPIN8_LOCKSTEP_AVX2
+
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Code in this file is compiled for AVX2 whatever the target of the build.
+// MSVC allows AVX2 intrinsics anywhere, GCC and Clang only in functions
+// compiled for it.
+#ifdef _MSC_VER
+#define AVX2_FUNCTION
+#else
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+
+bool IsAVX2Supported() {
+#if defined(__AVX2__)
+	// The whole program requires it already
+	return true;
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	// The OS has to save the upper halves of the registers as well
+	// (OSXSAVE and AVX, then the SSE and AVX state enabled in XCR0)
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0
+		|| (_xgetbv(0) & 0x6) != 0x6) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	// Also checks that the OS saves the AVX state
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+AVX2_FUNCTION static inline __m256i Load(const void* p) {
+	return _mm256_loadu_si256((const __m256i*)p);
+}
+
+AVX2_FUNCTION static inline void Store(void* p, __m256i v) {
+	_mm256_storeu_si256((__m256i*)p, v);
+}
+
+// Bytes (or words) of a where the mask is set, of b elsewhere
+AVX2_FUNCTION static inline __m256i Select(__m256i mask, __m256i a,
+	__m256i b) {
+	return _mm256_blendv_epi8(b, a, mask);
+}
+
+// Lowest of the 16 words
+AVX2_FUNCTION static inline uint16_t Lowest(__m256i words) {
+	__m128i half = _mm_min_epu16(_mm256_castsi256_si128(words),
+		_mm256_extracti128_si256(words, 1));
+	return (uint16_t)_mm_cvtsi128_si32(_mm_minpos_epu16(half));
+}
+
+AVX2_FUNCTION void SetBytesAVX2(uint8_t* dst, uint8_t value,
+	const uint8_t* mask, int n) {
+	const __m256i v = _mm256_set1_epi8((char)value);
+	for (int i = 0; i < n; i += 32) {
+		Store(dst + i, Select(Load(mask + i), v, Load(dst + i)));
+	}
+}
+
+AVX2_FUNCTION void AddBytesAVX2(uint8_t* dst, uint8_t value,
+	const uint8_t* mask, int n) {
+	const __m256i v = _mm256_set1_epi8((char)value);
+	for (int i = 0; i < n; i += 32) {
+		__m256i d = Load(dst + i);
+		Store(dst + i, Select(Load(mask + i), _mm256_add_epi8(d, v), d));
+	}
+}
+
+AVX2_FUNCTION void CombineBytesAVX2(ByteOperation operation, uint8_t* dst,
+	const uint8_t* src, const uint8_t* mask, int n) {
+	const __m256i low7 = _mm256_set1_epi8(0x7F);
+	for (int i = 0; i < n; i += 32) {
+		__m256i d = Load(dst + i);
+		__m256i s = Load(src + i);
+		__m256i r;
+		switch (operation) {
+		case BYTE_MOVE: r = s; break;
+		case BYTE_OR: r = _mm256_or_si256(d, s); break;
+		case BYTE_AND: r = _mm256_and_si256(d, s); break;
+		case BYTE_XOR: r = _mm256_xor_si256(d, s); break;
+		case BYTE_ADD: r = _mm256_add_epi8(d, s); break;
+		case BYTE_SUBTRACT: r = _mm256_sub_epi8(d, s); break;
+		case BYTE_SUBTRACT_FROM: r = _mm256_sub_epi8(s, d); break;
+		// There are no byte shifts, shift words and drop the bit that
+		// crossed over from the neighbouring byte
+		case BYTE_SHIFT_RIGHT:
+			r = _mm256_and_si256(_mm256_srli_epi16(s, 1), low7);
+			break;
+		default: r = _mm256_add_epi8(s, s); break;
+		}
+		Store(dst + i, Select(Load(mask + i), r, d));
+	}
+}
+
+AVX2_FUNCTION void FlagBytesAVX2(FlagOperation operation, uint8_t* dst,
+	const uint8_t* a, const uint8_t* b, int n) {
+	const __m256i one = _mm256_set1_epi8(1);
+	const __m256i ones = _mm256_set1_epi8(-1);
+	for (int i = 0; i < n; i += 32) {
+		__m256i x = Load(a + i);
+		__m256i r;
+		switch (operation) {
+		case FLAG_CARRY: {
+			// There is no carry if a <= 255 - b
+			__m256i limit = _mm256_xor_si256(Load(b + i), ones);
+			r = _mm256_andnot_si256(_mm256_cmpeq_epi8(
+				_mm256_max_epu8(x, limit), limit), one);
+			break;
+		}
+		case FLAG_NO_BORROW:
+			r = _mm256_and_si256(_mm256_cmpeq_epi8(
+				_mm256_max_epu8(x, Load(b + i)), x), one);
+			break;
+		case FLAG_LOW_BIT: r = _mm256_and_si256(x, one); break;
+		default: r = _mm256_and_si256(_mm256_srli_epi16(x, 7), one); break;
+		}
+		Store(dst + i, r);
+	}
+}
+
+AVX2_FUNCTION void CompareBytesAVX2(uint8_t* condition, const uint8_t* a,
+	const uint8_t* b, uint8_t value, bool equal, int n) {
+	const __m256i v = _mm256_set1_epi8((char)value);
+	const __m256i invert = equal ? _mm256_setzero_si256()
+		: _mm256_set1_epi8(-1);
+	for (int i = 0; i < n; i += 32) {
+		__m256i eq = _mm256_cmpeq_epi8(Load(a + i), b ? Load(b + i) : v);
+		Store(condition + i, _mm256_xor_si256(eq, invert));
+	}
+}
+
+AVX2_FUNCTION void DecrementBytesAVX2(uint8_t* dst, int n) {
+	const __m256i one = _mm256_set1_epi8(1);
+	for (int i = 0; i < n; i += 32) {
+		Store(dst + i, _mm256_subs_epu8(Load(dst + i), one));
+	}
+}
+
+AVX2_FUNCTION void SetWordsAVX2(uint16_t* dst, uint16_t value,
+	const uint16_t* mask, int n) {
+	const __m256i v = _mm256_set1_epi16((short)value);
+	for (int i = 0; i < n; i += 16) {
+		Store(dst + i, Select(Load(mask + i), v, Load(dst + i)));
+	}
+}
+
+AVX2_FUNCTION void SkipWordsAVX2(uint16_t* pc, uint16_t next,
+	const uint8_t* condition, const uint16_t* mask, int n) {
+	const __m256i v = _mm256_set1_epi16((short)next);
+	const __m256i two = _mm256_set1_epi16(2);
+	for (int i = 0; i < n; i += 16) {
+		__m256i skip = _mm256_cvtepi8_epi16(
+			_mm_loadu_si128((const __m128i*)(condition + i)));
+		__m256i target = _mm256_add_epi16(v, _mm256_and_si256(skip, two));
+		Store(pc + i, Select(Load(mask + i), target, Load(pc + i)));
+	}
+}
+
+AVX2_FUNCTION void WordsFromBytesAVX2(uint16_t* dst, const uint8_t* src,
+	uint16_t scale, bool accumulate, const uint16_t* mask, int n) {
+	const __m256i s = _mm256_set1_epi16((short)scale);
+	for (int i = 0; i < n; i += 16) {
+		__m256i d = Load(dst + i);
+		__m256i r = _mm256_mullo_epi16(_mm256_cvtepu8_epi16(
+			_mm_loadu_si128((const __m128i*)(src + i))), s);
+		if (accumulate) {
+			r = _mm256_add_epi16(d, r);
+		}
+		Store(dst + i, Select(Load(mask + i), r, d));
+	}
+}
+
+AVX2_FUNCTION void CopyWordsAVX2(uint16_t* dst, const uint16_t* src,
+	const uint16_t* mask, int n) {
+	for (int i = 0; i < n; i += 16) {
+		Store(dst + i, Select(Load(mask + i), Load(src + i), Load(dst + i)));
+	}
+}
+
+AVX2_FUNCTION bool AllEqualAVX2(const uint8_t* row, uint8_t value,
+	const uint8_t* mask, int n) {
+	const __m256i v = _mm256_set1_epi8((char)value);
+	for (int i = 0; i < n; i += 32) {
+		__m256i different = _mm256_andnot_si256(
+			_mm256_cmpeq_epi8(Load(row + i), v), Load(mask + i));
+		if (!_mm256_testz_si256(different, different)) return false;
+	}
+	return true;
+}
+
+AVX2_FUNCTION void RandomBytesAVX2(uint8_t* dst, uint64_t* state,
+	uint8_t value, const uint8_t* mask, int n) {
+	// There is no 64-bit multiply. Only the low 64 bits of the product are
+	// needed, which are lo * lo + ((lo * hi + hi * lo) << 32).
+	const uint64_t MULTIPLIER = 0x2545F4914F6CDD1Dull;
+	const __m256i multiplier = _mm256_set1_epi64x((long long)MULTIPLIER);
+	const __m256i multiplierHigh = _mm256_srli_epi64(multiplier, 32);
+	for (int i = 0; i < n; i += 4) {
+		__m256i m = _mm256_cvtepi8_epi64(
+			_mm_cvtsi32_si128(*(const int*)(mask + i)));
+		__m256i x = Load(state + i);
+		__m256i s = x;
+		s = _mm256_xor_si256(s, _mm256_srli_epi64(s, 12));
+		s = _mm256_xor_si256(s, _mm256_slli_epi64(s, 25));
+		s = _mm256_xor_si256(s, _mm256_srli_epi64(s, 27));
+		Store(state + i, Select(m, s, x));
+
+		__m256i cross = _mm256_add_epi64(
+			_mm256_mul_epu32(s, multiplierHigh),
+			_mm256_mul_epu32(_mm256_srli_epi64(s, 32), multiplier));
+		__m256i product = _mm256_add_epi64(_mm256_mul_epu32(s, multiplier),
+			_mm256_slli_epi64(cross, 32));
+		uint64_t random[4];
+		Store(random, _mm256_srli_epi64(product, 56));
+		for (int j = 0; j < 4; ++j) {
+			if (mask[i + j]) dst[i + j] = (uint8_t)random[j] & value;
+		}
+	}
+}
+
+AVX2_FUNCTION uint16_t LowestPcAVX2(const uint16_t* pc,
+	const uint16_t* remaining, int n) {
+	// Lanes that are done are ignored by setting all bits of their pc
+	__m256i lowest = _mm256_set1_epi16(-1);
+	const __m256i zero = _mm256_setzero_si256();
+	for (int i = 0; i < n; i += 16) {
+		__m256i done = _mm256_cmpeq_epi16(Load(remaining + i), zero);
+		lowest = _mm256_min_epu16(lowest,
+			_mm256_or_si256(Load(pc + i), done));
+	}
+	return Lowest(lowest);
+}
+
+AVX2_FUNCTION uint16_t FinishStepAVX2(uint16_t* remaining,
+	uint16_t* lastOpcode, uint16_t opcode, const uint16_t* mask,
+	const uint16_t* pc, int n) {
+	const __m256i v = _mm256_set1_epi16((short)opcode);
+	const __m256i one = _mm256_set1_epi16(1);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i lowest = _mm256_set1_epi16(-1);
+	for (int i = 0; i < n; i += 16) {
+		__m256i m = Load(mask + i);
+		__m256i r = _mm256_sub_epi16(Load(remaining + i),
+			_mm256_and_si256(m, one));
+		Store(remaining + i, r);
+		Store(lastOpcode + i, Select(m, v, Load(lastOpcode + i)));
+
+		__m256i done = _mm256_cmpeq_epi16(r, zero);
+		lowest = _mm256_min_epu16(lowest,
+			_mm256_or_si256(Load(pc + i), done));
+	}
+	return Lowest(lowest);
+}
+
+AVX2_FUNCTION uint32_t SelectLanesAVX2(const uint16_t* pc,
+	const uint16_t* remaining, uint16_t address, uint16_t* mask,
+	uint8_t* byteMask) {
+	const __m256i a = _mm256_set1_epi16((short)address);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i low = _mm256_andnot_si256(
+		_mm256_cmpeq_epi16(Load(remaining), zero),
+		_mm256_cmpeq_epi16(Load(pc), a));
+	__m256i high = _mm256_andnot_si256(
+		_mm256_cmpeq_epi16(Load(remaining + 16), zero),
+		_mm256_cmpeq_epi16(Load(pc + 16), a));
+	Store(mask, low);
+	Store(mask + 16, high);
+	// Packing works on 128-bit halves, put the quarters back in order
+	__m256i bytes = _mm256_permute4x64_epi64(
+		_mm256_packs_epi16(low, high), 0xD8);
+	Store(byteMask, bytes);
+	return (uint32_t)_mm256_movemask_epi8(bytes);
+}
+
+#endif // CHIPPIN8_LOCKSTEP_AVX2
\ No newline at end of file
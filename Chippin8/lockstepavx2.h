@@ -0,0 +1,83 @@
+/*
+	AVX2 versions of the vector kernels of the LockstepEngine (see
+	lockstep.cpp). They are compiled for AVX2 whatever the rest of the
+	program is compiled for, and lockstep.cpp only calls them if the CPU has
+	it (see IsAVX2Supported), so a default build runs 32 lanes per
+	instruction on any CPU that can.
+
+	Every kernel works on whole vectors: n is a multiple of 32 byte lanes, 16
+	word lanes or 4 random generators, and lockstep.cpp runs any lanes after
+	them with its scalar loops.
+*/
+
+#ifndef LOCKSTEPAVX2_H
+#define LOCKSTEPAVX2_H
+
+#include <stdint.h>
+
+// The kernels exist on x86-64, and are used there if the CPU has AVX2
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIPPIN8_LOCKSTEP_AVX2
+#endif
+
+enum ByteOperation {
+	BYTE_MOVE,			// dst = src
+	BYTE_OR,			// dst |= src
+	BYTE_AND,			// dst &= src
+	BYTE_XOR,			// dst ^= src
+	BYTE_ADD,			// dst += src
+	BYTE_SUBTRACT,		// dst -= src
+	BYTE_SUBTRACT_FROM,	// dst = src - dst
+	BYTE_SHIFT_RIGHT,	// dst = src >> 1
+	BYTE_SHIFT_LEFT		// dst = src << 1
+};
+
+enum FlagOperation {
+	FLAG_CARRY,			// (a + b > 255) ? 1 : 0
+	FLAG_NO_BORROW,		// (a >= b) ? 1 : 0
+	FLAG_LOW_BIT,		// a & 1
+	FLAG_HIGH_BIT		// a >> 7
+};
+
+#ifdef CHIPPIN8_LOCKSTEP_AVX2
+
+// Whether the CPU (and the OS) supports AVX2
+bool IsAVX2Supported();
+
+// See the kernels of the same name without AVX2 in lockstep.cpp
+void SetBytesAVX2(uint8_t* dst, uint8_t value, const uint8_t* mask, int n);
+void AddBytesAVX2(uint8_t* dst, uint8_t value, const uint8_t* mask, int n);
+void CombineBytesAVX2(ByteOperation operation, uint8_t* dst,
+	const uint8_t* src, const uint8_t* mask, int n);
+void FlagBytesAVX2(FlagOperation operation, uint8_t* dst, const uint8_t* a,
+	const uint8_t* b, int n);
+void CompareBytesAVX2(uint8_t* condition, const uint8_t* a,
+	const uint8_t* b, uint8_t value, bool equal, int n);
+void DecrementBytesAVX2(uint8_t* dst, int n);
+void SetWordsAVX2(uint16_t* dst, uint16_t value, const uint16_t* mask,
+	int n);
+void SkipWordsAVX2(uint16_t* pc, uint16_t next, const uint8_t* condition,
+	const uint16_t* mask, int n);
+void WordsFromBytesAVX2(uint16_t* dst, const uint8_t* src, uint16_t scale,
+	bool accumulate, const uint16_t* mask, int n);
+void CopyWordsAVX2(uint16_t* dst, const uint16_t* src, const uint16_t* mask,
+	int n);
+bool AllEqualAVX2(const uint8_t* row, uint8_t value, const uint8_t* mask,
+	int n);
+void RandomBytesAVX2(uint8_t* dst, uint64_t* state, uint8_t value,
+	const uint8_t* mask, int n);
+
+// Lowest pc of the lanes in the first n with instructions remaining,
+// 0xFFFF if none
+uint16_t LowestPcAVX2(const uint16_t* pc, const uint16_t* remaining, int n);
+uint16_t FinishStepAVX2(uint16_t* remaining, uint16_t* lastOpcode,
+	uint16_t opcode, const uint16_t* mask, const uint16_t* pc, int n);
+
+// Select the 32 lanes at address with instructions remaining, in mask and
+// byteMask. Returns a bit per lane selected.
+uint32_t SelectLanesAVX2(const uint16_t* pc, const uint16_t* remaining,
+	uint16_t address, uint16_t* mask, uint8_t* byteMask);
+
+#endif // CHIPPIN8_LOCKSTEP_AVX2
+
+#endif // LOCKSTEPAVX2_H
\ No newline at end of file
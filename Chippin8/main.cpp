@@ -13,11 +13,55 @@
 	COSMAC VIP and Telmac-1800 from the 70s.
 
 	Currently, this emulator is capable of running CHIP-8 roms (.ch8 file), 
-	which is supplied to the emulator via command line argument.
+	as well as SUPER-CHIP and XO-CHIP roms, which is supplied to the 
+	emulator via command line argument.
 		./<Chippin8.exe> <ROM_file.ch8>
 
+	The emulator runs at 60 frames per second. Each frame executes a fixed
+	number of instructions (Cycles Per Frame), ticks the timers once and 
+	presents the display once. Emulation runs on its own thread, so a slow
+	present never holds it up.
+
+	With --headless the ROM is run without a window for a fixed number of 
+	cycles (--cycles) or frames (--frames), as fast as possible, and the 
+	final state is printed. --jit runs the ROM on the x86-64 recompiler 
+	instead of the interpreter. --load-state resumes from a save state and
+	--save-state writes one at the end, so long runs can be continued.
+		./<Chippin8.exe> <ROM_file.ch8> --headless --frames 600
+
+	--record writes the keypad input of every frame, together with the 
+	random number generator seed (--seed, or the current time), the ROM 
+	hash and the quirk profile, to an input log. --replay plays it back in
+	headless mode, which gives exactly the same run, so bug reports can be
+	reproduced and regression runs can be done much faster than real time.
+	A log recorded with another ROM or other --quirks, or replayed from a
+	--load-state with other quirks, is refused.
+		./<Chippin8.exe> <ROM_file.ch8> --record bug.c8in
+		./<Chippin8.exe> <ROM_file.ch8> --headless --replay bug.c8in
+
+	--capture records every frame to a Y4M video (.y4m) or to PNG 
+	screenshots of every frame that changes (any other name), on a thread
+	of its own (see FrameRecorder). In the window, frames are dropped 
+	rather than holding up the emulation if the disk can't keep up, in 
+	headless mode the run waits for it instead.
+		./<Chippin8.exe> <ROM_file.ch8> --headless --frames 600 --capture a.y4m
+
+	--profile counts the instructions executed by opcode and by address, 
+	and the instructions per frame, and writes them to a JSON file at exit.
+
+	--lanes runs that many copies of the ROM in headless mode at once on the
+	LockstepEngine, each with its own seed (seed + lane number). On CPUs
+	with AVX2 that is much faster than running them one after another, 
+	without it no faster. It can't be combined with --jit, --profile or
+	--capture.
+
+	The instructions that interpreters disagree on run like on the COSMAC
+	VIP, or SUPER-CHIP for .sc8 files and XO-CHIP for .xo8 files. --quirks
+	(vip, chip48, schip or xochip) picks the profile (see quirks.h).
+
 	This project uses SDL2 to display the programs as well as for keyboard 
-	input.
+	input. Built with CHIPPIN8_HEADLESS defined there is no SDL at all, and
+	every run is headless (see CMakeLists.txt).
 	
 	The following keys act as keypad input for the system:
 			1  2  3  4		 keypad[1] keypad[2] keypad[3] keypad[C]
@@ -25,98 +69,370 @@
 			A  S  D  F		 keypad[7] keypad[8] keypad[9] keypad[E]
 			Z  X  C  V		 keypad[A] keypad[0] keypad[B] keypad[F]
 
-	Sound support is not added yet, but may be added in the future.
+	Hold Backspace to rewind. The last few minutes of play are kept.
+
+	--run-ahead hides the frames that games take to react to a key: every
+	frame presented is that many frames ahead of the input, run with the 
+	keys held right now and thrown away again (see EmulationThread). 1 or 2
+	is enough for most games, more makes them jump ahead of the input.
+		./<Chippin8.exe> <ROM_file.ch8> --run-ahead 1
+
+	The buzzer sounds while the sound timer runs, as a 500 Hz tone or as 
+	the XO-CHIP audio pattern (see AudioSynthesizer). --mute turns it off.
 */
 
 #include "emulator.h"
+#include "headless.h"
+#include "profiler.h"
+#ifndef CHIPPIN8_HEADLESS
 #include "platform.h"
+#include "framebuffer.h"
+#include "emulationthread.h"
 
 #include <SDL.h>
+#endif // CHIPPIN8_HEADLESS
 #include <iostream>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <time.h>
 #include <algorithm>
 #include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
 
 namespace fs = std::filesystem;
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define USAGE() do{ \
 		std::cout << "Usage: ./<Chippin8>.exe <ROM_file>.ch8"\
-		<< " [Video Scale (number)] [Cycle Delay (number)]\n"; \
+		<< " [Video Scale (number)] [Cycles Per Frame (number)] [--jit]"\
+		<< " [--seed (number)] [--record (file)] [--profile (file)]"\
+		<< " [--quirks (profile)] [--run-ahead (number)]"\
+		<< " [--capture (file)] [--mute]\n"\
+		<< "       ./<Chippin8>.exe <ROM_file>.ch8 --headless"\
+		<< " [--cycles (number) | --frames (number)]"\
+		<< " [--cycles-per-frame (number)] [--jit]"\
+		<< " [--load-state (file)] [--save-state (file)]"\
+		<< " [--seed (number)] [--replay (file)] [--lanes (number)]"\
+		<< " [--profile (file)] [--quirks (profile)] [--capture (file)]\n";\
 		} while(0)
 
 // Maximum size is limited to prevent user from creating a ginormous window
 const int MAXIMUM_VIDEO_SCALE = 25; 
 
+// Running further ahead costs more than it could hide
+const int MAXIMUM_RUN_AHEAD_FRAMES = 8;
+
+// Memory used to keep the rewind history. ROMs that keep the whole screen
+// moving take about 700 bytes a frame, which still leaves minutes of it.
+const size_t REWIND_BUFFER_SIZE = 8 * 1024 * 1024;
+
 // Check if argument is a number https://stackoverflow.com/a/17976083
 bool isNumber(std::string& s) {
 	return !s.empty() && std::all_of(s.begin(), s.end(), ::isdigit);
 }
 
 int main(int argc, char* argv[]) {
-	int videoScale = 10;		// Default value
-	uint32_t cycleDelay = 5;	// Default value
+	int cyclesPerFrame = 10;	// Default value (600 instructions per second)
+	bool useRecompiler = false;
+
+#ifdef CHIPPIN8_HEADLESS
+	bool isHeadless = true;		// There is no window to run in
+#else
+	bool isHeadless = false;
+	bool isMuted = false;
+	int runAheadFrames = 0;
+#endif // CHIPPIN8_HEADLESS
+	HeadlessOptions headless;
+	headless.cycles = 1000000;	// Default value
+	headless.frames = 0;
+	headless.hasSeed = false;
+	headless.seed = 0;
+	headless.hasQuirkProfile = false;
+	headless.quirkProfile = QuirkProfile::CosmacVIP;
+	headless.lanes = 1;
+	std::string recordFile;
+
+	// Separate the options (--name [value]) from the positional arguments
+	std::vector<std::string> args;
+	std::string cyclesPerFrameStr;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--headless") {
+			isHeadless = true;
+		}
+		else if (arg == "--jit") {
+			useRecompiler = true;
+		}
+		else if (arg == "--mute") {
+#ifndef CHIPPIN8_HEADLESS
+			isMuted = true;
+#endif // CHIPPIN8_HEADLESS
+		}
+		else if ((arg == "--cycles" || arg == "--frames" 
+			|| arg == "--cycles-per-frame" || arg == "--seed" 
+			|| arg == "--lanes" || arg == "--run-ahead") && i + 1 < argc) {
+			std::string countStr = argv[++i];
+			if (!isNumber(countStr)) {
+				USAGE();
+				return EXIT_FAILURE;
+			}
+			if (arg == "--cycles") {
+				headless.cycles = std::stoull(countStr);
+			}
+			else if (arg == "--frames") {
+				headless.frames = std::stoull(countStr);
+			}
+			else if (arg == "--seed") {
+				headless.hasSeed = true;
+				headless.seed = std::stoull(countStr);
+			}
+			else if (arg == "--lanes") {
+				headless.lanes = std::stoi(countStr);
+			}
+			else if (arg == "--run-ahead") {
+#ifndef CHIPPIN8_HEADLESS
+				runAheadFrames = MIN(std::stoi(countStr), 
+					MAXIMUM_RUN_AHEAD_FRAMES);
+#endif // CHIPPIN8_HEADLESS
+			}
+			else {
+				cyclesPerFrameStr = countStr;
+			}
+		}
+		else if (arg == "--load-state" && i + 1 < argc) {
+			headless.loadStateFile = argv[++i];
+		}
+		else if (arg == "--save-state" && i + 1 < argc) {
+			headless.saveStateFile = argv[++i];
+		}
+		else if (arg == "--replay" && i + 1 < argc) {
+			headless.replayFile = argv[++i];
+		}
+		else if (arg == "--record" && i + 1 < argc) {
+			recordFile = argv[++i];
+		}
+		else if (arg == "--capture" && i + 1 < argc) {
+			headless.captureFile = argv[++i];
+		}
+		else if (arg == "--profile" && i + 1 < argc) {
+			headless.profileFile = argv[++i];
+		}
+		else if (arg == "--quirks" && i + 1 < argc) {
+			if (!Chippin8::ParseQuirkProfile(argv[++i], 
+				headless.quirkProfile)) {
+				USAGE();
+				return EXIT_FAILURE;
+			}
+			headless.hasQuirkProfile = true;
+		}
+		else if (arg.rfind("--", 0) == 0) {
+			USAGE();
+			return EXIT_FAILURE;
+		}
+		else {
+			args.push_back(arg);
+		}
+	}
 
-	if (argc == 1 || argc > 4) {
+	if (args.empty() || args.size() > 3) {
 		USAGE();
 		return EXIT_FAILURE;
 	}
 	
-	std::string ROMFile = argv[1];
+	std::string ROMFile = args[0];
 	fs::path ROMFilePath(ROMFile);
 	if (!fs::exists(ROMFilePath)) {
 		std::cerr << "Invalid CHIP-8 ROM file enetered\n";
 		return EXIT_FAILURE;
 	}
 
-	if (argc > 2) {
-		// Check if user entered a video scale value
-		if (argv[2]) {
-			std::string videoScaleStr = argv[2];
-			if (isNumber(videoScaleStr)) {
-				videoScale = MIN(abs(std::stoi(videoScaleStr)), 
-								MAXIMUM_VIDEO_SCALE);
-				std::cout << "Video Scale: " << videoScale << '\n';
-			}
-			else {
-				std::cout << "Invalid video scale. Using defaiult value: "
-					<< videoScale << '\n';
-			}
+	if (args.size() > 2) {
+		cyclesPerFrameStr = args[2];
+	}
+
+	if (!cyclesPerFrameStr.empty()) {
+		// Check if user entered a Cycles Per Frame (speed) value. Headless
+		// mode only prints its key=value report on stdout.
+		if (!isNumber(cyclesPerFrameStr) || std::stoi(cyclesPerFrameStr) <= 0) {
+			std::cerr << "Invalid cycles per frame: " << cyclesPerFrameStr
+				<< '\n';
+			return EXIT_FAILURE;
+		}
+		cyclesPerFrame = std::stoi(cyclesPerFrameStr);
+		if (!isHeadless) {
+			std::cout << "Cycles Per Frame: " << cyclesPerFrame << '\n';
 		}
+	}
 
-		// Check if user entered a Cycle Delay (speed) value
-		if (argv[3]) {
-			std::string cycleDelayStr = argv[3];
-			std::cout << cycleDelayStr << '\n';
-			if (isNumber(cycleDelayStr)) {
-				cycleDelay = (uint32_t) abs(std::stoi(cycleDelayStr));
-				std::cout << "Cycle Delay: " << cycleDelay << '\n';
-			}
+	// Headless mode never touches SDL
+	if (isHeadless) {
+		// Lanes run on the LockstepEngine only, and nothing watches them
+		// frame by frame, so these would be dropped without a word
+		if (headless.lanes > 1 && (useRecompiler 
+			|| !headless.profileFile.empty() 
+			|| !headless.captureFile.empty())) {
+			std::cerr << "--lanes can't be combined with --jit, --profile "
+				"or --capture\n";
+			return EXIT_FAILURE;
+		}
+		headless.romFile = ROMFile;
+		headless.cyclesPerFrame = cyclesPerFrame;
+		headless.useRecompiler = useRecompiler;
+		return RunHeadless(headless);
+	}
+
+#ifndef CHIPPIN8_HEADLESS
+	int videoScale = 10;		// Default value
+	if (args.size() > 1) {
+		// Check if user entered a video scale value
+		std::string videoScaleStr = args[1];
+		if (isNumber(videoScaleStr)) {
+			videoScale = MIN(abs(std::stoi(videoScaleStr)), 
+							MAXIMUM_VIDEO_SCALE);
+			std::cout << "Video Scale: " << videoScale << '\n';
+		}
+		else {
+			std::cout << "Invalid video scale. Using defaiult value: "
+				<< videoScale << '\n';
 		}
 	}
 
 	std::cout << "Launching Chippin8\n";
 	std::cout << "Running " << ROMFile << '\n';
 
-	Platform platform("Chippin8", DISPLAY_WIDTH * videoScale, 
-		DISPLAY_HEIGHT * videoScale, DISPLAY_WIDTH, DISPLAY_HEIGHT
+	// Before opening a window that would only close again
+	Chippin8 c8;
+	if (!c8.LoadROM(ROMFile)) {
+		std::cerr << "Could not load ROM " << ROMFile << " (at most "
+			<< Chippin8::MAX_ROM_SIZE << " bytes)\n";
+		return EXIT_FAILURE;
+	}
+	if (headless.hasQuirkProfile) {
+		c8.SetQuirkProfile(headless.quirkProfile);
+	}
+
+	// Sound is passed from the emulation thread to the audio thread, so it
+	// has to outlive both (and the Platform, which owns the audio thread)
+	std::unique_ptr<AudioRing> audio(new AudioRing());
+
+	// The video scale is in low resolution pixels. The texture always has
+	// the high resolution size.
+	Platform platform("Chippin8", DISPLAY_WIDTH / 2 * videoScale, 
+		DISPLAY_HEIGHT / 2 * videoScale, DISPLAY_WIDTH, DISPLAY_HEIGHT
 	);
 
-	Chippin8 c8;
-	c8.LoadROM(ROMFile);
+	// Seed explicitly, so that the run can be replayed from the input log
+	uint64_t seed = headless.hasSeed ? headless.seed : (uint64_t)time(NULL);
+	c8.Seed(seed);
+
+	std::unique_ptr<Profiler> profiler;
+	if (!headless.profileFile.empty()) {
+		profiler.reset(new Profiler());
+		c8.profiler = profiler.get();
+	}
+
+	// The emulation runs on its own thread, this one only handles the 
+	// window: it passes the input on and presents every new frame.
+	EmulationThread emulation(c8, cyclesPerFrame, useRecompiler, 
+		REWIND_BUFFER_SIZE, seed, runAheadFrames);
+
+	// A slow disk must not make the game stutter, so frames are dropped 
+	// instead of waiting for it
+	std::unique_ptr<FrameRecorder> recorder;
+	if (!headless.captureFile.empty()) {
+		recorder.reset(new FrameRecorder());
+		if (!recorder->Open(headless.captureFile, true)) {
+			std::cerr << "Could not write capture " << headless.captureFile
+				<< '\n';
+			return EXIT_FAILURE;
+		}
+		emulation.SetRecorder(recorder.get());
+	}
+
+	// Without an audio device the emulator just runs silently
+	if (!isMuted) {
+		if (platform.OpenAudio(*audio)) {
+			emulation.SetAudio(audio.get());
+		}
+		else {
+			std::cerr << "Could not open an audio device: " 
+				<< SDL_GetError() << '\n';
+		}
+	}
+	emulation.Start();
 	
-	int videoPitch = sizeof(c8.display[0]) * DISPLAY_WIDTH;
+	// The display is expanded to 32-bit pixels only when it is presented
+	uint32_t pixels[DISPLAY_WIDTH * DISPLAY_HEIGHT];
+	int videoPitch = sizeof(pixels[0]) * DISPLAY_WIDTH;
+	VideoFrame presented = {};
+	ExpandFramebuffer(presented.display, presented.highResolution, 0, 
+		DISPLAY_HEIGHT / 2, pixels, PIXEL_COLORS);
 	bool isRunning = true;
 
 	while (isRunning) {
-		isRunning = platform.ProcessInputs(c8.keypad);
+		isRunning = platform.ProcessInputs(emulation.GetInputQueue());
 
-		c8.Cycle();
-		platform.Update(c8.display, videoPitch);
-		
-		SDL_Delay(cycleDelay);
+		// Only the rows that changed since the last frame presented are 
+		// expanded and uploaded (frames may have been skipped in between),
+		// or all of them if the resolution changed. If there is no new 
+		// frame, nothing is presented.
+		int firstRow = 0;
+		int rowCount = 0;
+		const VideoFrame* frame;
+		if (emulation.TakeFrame(frame)) {
+			rowCount = UpdateFrame(presented, *frame, firstRow);
+			if (rowCount > 0) {
+				ExpandFramebuffer(presented.display, 
+					presented.highResolution, firstRow, rowCount, pixels, 
+					PIXEL_COLORS);
+
+				// Rows of the texture, which has the high resolution size
+				int scale = presented.highResolution ? 1 : 2;
+				firstRow *= scale;
+				rowCount *= scale;
+			}
+		}
+		platform.Update(pixels, videoPitch, firstRow, rowCount);
+
+		// Presenting waits for vsync. Without a new frame, check for one
+		// (and for input) again shortly.
+		if (rowCount == 0) {
+			SDL_Delay(1);
+		}
+	}
+
+	emulation.Stop();
+
+	if (recorder) {
+		if (!recorder->Close()) {
+			std::cerr << "Could not write capture " << headless.captureFile
+				<< '\n';
+			return EXIT_FAILURE;
+		}
+		std::cout << "Captured " << recorder->GetFrameCount() 
+			<< " frames to " << headless.captureFile << " ("
+			<< recorder->GetDroppedFrames() << " dropped)\n";
+	}
+
+	if (profiler && !profiler->WriteJSON(headless.profileFile)) {
+		std::cerr << "Could not write profile " << headless.profileFile 
+			<< '\n';
+		return EXIT_FAILURE;
+	}
+
+	if (!recordFile.empty()) {
+		const InputLog& inputLog = emulation.GetInputLog();
+		if (!inputLog.Save(recordFile)) {
+			std::cerr << "Could not write input log " << recordFile << '\n';
+			return EXIT_FAILURE;
+		}
+		std::cout << "Recorded " << inputLog.GetFrameCount() 
+			<< " frames to " << recordFile << '\n';
 	}
 	
 	return EXIT_SUCCESS;
+#endif // CHIPPIN8_HEADLESS
 }
\ No newline at end of file
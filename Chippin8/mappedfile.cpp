@@ -0,0 +1,93 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // _WIN32
+
+MappedFile::MappedFile() : data(nullptr), size(0) {
+}
+
+MappedFile::~MappedFile() {
+	Close();
+}
+
+bool MappedFile::Open(const std::string& filename) {
+	Close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ,
+		FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+		nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) {
+		CloseHandle(file);
+		return false;
+	}
+	if (fileSize.QuadPart == 0) {
+		CloseHandle(file);
+		return true;
+	}
+
+	// The view keeps the file open, the handles are not needed any more
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0,
+		nullptr);
+	CloseHandle(file);
+	if (mapping == nullptr) {
+		return false;
+	}
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (view == nullptr) {
+		return false;
+	}
+	data = (const uint8_t*)view;
+	size = (size_t)fileSize.QuadPart;
+#else
+	int file = open(filename.c_str(), O_RDONLY);
+	if (file < 0) {
+		return false;
+	}
+	struct stat status;
+	if (fstat(file, &status) != 0 || !S_ISREG(status.st_mode)) {
+		close(file);
+		return false;
+	}
+	if (status.st_size == 0) {
+		close(file);
+		return true;
+	}
+
+	// The mapping keeps the file open, the descriptor is not needed any more
+	void* view = mmap(nullptr, (size_t)status.st_size, PROT_READ,
+		MAP_PRIVATE, file, 0);
+	close(file);
+	if (view == MAP_FAILED) {
+		return false;
+	}
+	data = (const uint8_t*)view;
+	size = (size_t)status.st_size;
+#endif // _WIN32
+	return true;
+}
+
+void MappedFile::Close() {
+	if (data != nullptr) {
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+#else
+		munmap((void*)data, size);
+#endif // _WIN32
+	}
+	data = nullptr;
+	size = 0;
+}
\ No newline at end of file
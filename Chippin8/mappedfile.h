@@ -0,0 +1,37 @@
+/*
+	Read-only view of a whole file, mapped into memory rather than read
+	into a buffer. The contents are paged in by the OS as they are touched,
+	so loading a ROM copies it once, straight from the page cache into the
+	emulated memory.
+*/
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Map filename. Returns false if it can't be opened. An empty file
+	// maps to no data.
+	bool Open(const std::string& filename);
+	void Close();
+
+	// Contents of the file, valid until it is closed
+	const uint8_t* GetData() const { return data; }
+	size_t GetSize() const { return size; }
+
+private:
+	const uint8_t* data;
+	size_t size;
+};
+
+#endif // MAPPEDFILE_H
\ No newline at end of file
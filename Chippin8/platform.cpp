@@ -5,7 +5,7 @@
 #include <iostream>
 
 Platform::Platform(std::string title, int width, int height, int tWidth, int tHeight) {
-	if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0) {
 		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR,
 			"SDL Error",
 			"Could not Initialize SDL",
@@ -23,7 +23,8 @@ Platform::Platform(std::string title, int width, int height, int tWidth, int tHe
 		height,
 		windowFlags);
 
-	renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+	renderer = SDL_CreateRenderer(window, -1, 
+		SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 	
 	texture = SDL_CreateTexture(
 		renderer, 
@@ -31,9 +32,21 @@ Platform::Platform(std::string title, int width, int height, int tWidth, int tHe
 		SDL_TEXTUREACCESS_STREAMING, 
 		tWidth,  
 		tHeight);
+	textureWidth = tWidth;
+	textureHeight = tHeight;
+	needsRedraw = true;
+	keypad = 0;
+	rewindHeld = false;
+	inputChanged = false;
+	audioDevice = 0;
+	audioRing = nullptr;
+	audioPrimed = false;
 }
 
 Platform::~Platform() {
+	if (audioDevice != 0) {
+		SDL_CloseAudioDevice(audioDevice);
+	}
 	SDL_DestroyTexture(texture);
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
@@ -41,13 +54,59 @@ Platform::~Platform() {
 }
 
 void Platform::Update(void const* buffer, int pitch) {
-	SDL_UpdateTexture(texture, nullptr, buffer, pitch);
+	Update(buffer, pitch, 0, textureHeight);
+}
+
+void Platform::Update(void const* buffer, int pitch, int firstRow, 
+	int rowCount) {
+	if (rowCount > 0) {
+		SDL_Rect rows = { 0, firstRow, textureWidth, rowCount };
+		SDL_UpdateTexture(texture, &rows, 
+			(const uint8_t*)buffer + firstRow * pitch, pitch);
+	}
+	else if (!needsRedraw) {
+		return;
+	}
+
+	// The whole texture is still copied, since the contents of the back 
+	// buffer are undefined after presenting.
 	SDL_RenderClear(renderer);
 	SDL_RenderCopy(renderer, texture, nullptr, nullptr);
 	SDL_RenderPresent(renderer);
+	needsRedraw = false;
 }
 
-bool Platform::ProcessInputs(uint8_t* keypad) {
+// Keypad key bound to a keyboard key, or -1 if it is not bound
+static int KeypadIndex(SDL_Keycode key) {
+	/*
+		Key Bindings:
+		1  2  3  4		 keypad[1] keypad[2] keypad[3] keypad[C]		
+		Q  W  E  R	-->	 keypad[4] keypad[5] keypad[6] keypad[D]
+		A  S  D  F		 keypad[7] keypad[8] keypad[9] keypad[E]
+		Z  X  C  V		 keypad[A] keypad[0] keypad[B] keypad[F]
+	*/
+	switch (key) {
+	case SDLK_x: return 0;
+	case SDLK_1: return 1;
+	case SDLK_2: return 2;
+	case SDLK_3: return 3;
+	case SDLK_q: return 4;
+	case SDLK_w: return 5;
+	case SDLK_e: return 6;
+	case SDLK_a: return 7;
+	case SDLK_s: return 8;
+	case SDLK_d: return 9;
+	case SDLK_z: return 0xA;
+	case SDLK_c: return 0xB;
+	case SDLK_4: return 0xC;
+	case SDLK_r: return 0xD;
+	case SDLK_f: return 0xE;
+	case SDLK_v: return 0xF;
+	default: return -1;
+	}
+}
+
+bool Platform::ProcessInputs(InputQueue& input) {
 	bool isRunning = true;
 
 	SDL_Event event;
@@ -57,158 +116,88 @@ bool Platform::ProcessInputs(uint8_t* keypad) {
 			isRunning = false;
 		}
 
-		/*
-			Key Bindings:
-			1  2  3  4		 keypad[1] keypad[2] keypad[3] keypad[C]		
-			Q  W  E  R	-->	 keypad[4] keypad[5] keypad[6] keypad[D]
-			A  S  D  F		 keypad[7] keypad[8] keypad[9] keypad[E]
-			Z  X  C  V		 keypad[A] keypad[0] keypad[B] keypad[F]
-		*/
-
-		switch (event.type) {
-			case SDL_KEYDOWN:
-			{
-				switch (event.key.keysym.sym) {
-				case SDLK_ESCAPE:
-					isRunning = false;
-					break;
-
-				case SDLK_x:
-					keypad[0] = 1;
-					break;
-
-				case SDLK_1:
-					keypad[1] = 1;
-					break;
-
-				case SDLK_2:
-					keypad[2] = 1;
-					break;
-
-				case SDLK_3:
-					keypad[3] = 1;
-					break;
-
-				case SDLK_q:
-					keypad[4] = 1;
-					break;
-
-				case SDLK_w:
-					keypad[5] = 1;
-					break;
-
-				case SDLK_e:
-					keypad[6] = 1;
-					break;
-
-				case SDLK_a:
-					keypad[7] = 1;
-					break;
-
-				case SDLK_s:
-					keypad[8] = 1;
-					break;
-
-				case SDLK_d:
-					keypad[9] = 1;
-					break;
-
-				case SDLK_z:
-					keypad[0xA] = 1;
-					break;
-
-				case SDLK_c:
-					keypad[0xB] = 1;
-					break;
-
-				case SDLK_4:
-					keypad[0xC] = 1;
-					break;
-
-				case SDLK_r:
-					keypad[0xD] = 1;
-					break;
-
-				case SDLK_f:
-					keypad[0xE] = 1;
-					break;
-
-				case SDLK_v:
-					keypad[0xF] = 1;
-					break;
-				}
-				break;
-			}
-			case SDL_KEYUP: 
-			{
-				switch (event.key.keysym.sym) {
-				case SDLK_x:
-					keypad[0] = 0;
-					break;
-
-				case SDLK_1:
-					keypad[1] = 0;
-					break;
-
-				case SDLK_2:
-					keypad[2] = 0;
-					break;
-
-				case SDLK_3:
-					keypad[3] = 0;
-					break;
-
-				case SDLK_q:
-					keypad[4] = 0;
-					break;
-
-				case SDLK_w:
-					keypad[5] = 0;
-					break;
-
-				case SDLK_e:
-					keypad[6] = 0;
-					break;
-
-				case SDLK_a:
-					keypad[7] = 0;
-					break;
-
-				case SDLK_s:
-					keypad[8] = 0;
-					break;
-
-				case SDLK_d:
-					keypad[9] = 0;
-					break;
-
-				case SDLK_z:
-					keypad[0xA] = 0;
-					break;
-
-				case SDLK_c:
-					keypad[0xB] = 0;
-					break;
-
-				case SDLK_4:
-					keypad[0xC] = 0;
-					break;
-
-				case SDLK_r:
-					keypad[0xD] = 0;
-					break;
-
-				case SDLK_f:
-					keypad[0xE] = 0;
-					break;
-
-				case SDLK_v:
-					keypad[0xF] = 0;
-					break;
-				}
-				break;
-			}
+		// The window contents may have been lost, present them again
+		if (event.type == SDL_WINDOWEVENT 
+			&& (event.window.event == SDL_WINDOWEVENT_EXPOSED
+				|| event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)) {
+			needsRedraw = true;
+		}
+
+		if (event.type != SDL_KEYDOWN && event.type != SDL_KEYUP) {
+			continue;
+		}
+		bool isDown = event.type == SDL_KEYDOWN;
+		SDL_Keycode key = event.key.keysym.sym;
+		int index = KeypadIndex(key);
+
+		if (key == SDLK_ESCAPE && isDown) {
+			isRunning = false;
+		}
+		else if (key == SDLK_BACKSPACE) {
+			inputChanged |= rewindHeld != isDown;
+			rewindHeld = isDown;
+		}
+		else if (index >= 0) {
+			uint16_t keys = isDown 
+				? keypad | (1u << index) : keypad & ~(1u << index);
+			inputChanged |= keys != keypad;
+			keypad = keys;
 		}
 	}
+
+	// If the queue is full, the emulation is behind. Try again next time, 
+	// the latest state is all that counts.
+	if (inputChanged && input.Push({ keypad, rewindHeld })) {
+		inputChanged = false;
+	}
 	return isRunning;
+}
+
+/* ----- Sound ----- */
+
+// Sound buffered before playing starts, and again after running dry. A 
+// frame that runs a little late then doesn't cut the sound.
+const size_t AUDIO_PRIME_SAMPLES = AUDIO_SAMPLES_PER_FRAME * 2;
+
+bool Platform::OpenAudio(AudioRing& ring) {
+	SDL_AudioSpec desired;
+	SDL_AudioSpec obtained;
+	SDL_zero(desired);
+	desired.freq = AUDIO_SAMPLE_RATE;
+	desired.format = AUDIO_S16SYS;
+	desired.channels = 1;
+	desired.samples = 512;			// About 10 ms per callback
+	desired.callback = &Platform::AudioCallback;
+	desired.userdata = this;
+
+	// SDL converts if the device wants another format
+	audioRing = &ring;
+	audioDevice = SDL_OpenAudioDevice(nullptr, 0, &desired, &obtained, 0);
+	if (audioDevice == 0) {
+		audioRing = nullptr;
+		return false;
+	}
+	SDL_PauseAudioDevice(audioDevice, 0);
+	return true;
+}
+
+void Platform::AudioCallback(void* userdata, Uint8* stream, int len) {
+	Platform* platform = (Platform*)userdata;
+	AudioRing& ring = *platform->audioRing;
+	int16_t* samples = (int16_t*)stream;
+	size_t count = len / sizeof(int16_t);
+
+	// Play silence until enough is buffered, rather than stuttering on
+	// every callback when the emulation runs behind
+	size_t played = 0;
+	if (platform->audioPrimed || ring.Size() >= AUDIO_PRIME_SAMPLES) {
+		platform->audioPrimed = true;
+		played = ring.Read(samples, count);
+	}
+	if (played < count) {
+		platform->audioPrimed = false;
+		for (size_t i = played; i < count; ++i) {
+			samples[i] = 0;
+		}
+	}
 }
\ No newline at end of file
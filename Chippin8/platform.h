@@ -1,11 +1,14 @@
 /*
 	The emulator is rendered using SDL2. All SDL related code goes here, 
-	including rendering and key inputs
+	including rendering, sound and key inputs
 */
 
 #ifndef PLATFORM_H
 #define PLATFORM_H
 
+#include "emulationthread.h"
+#include "audio.h"
+
 #include <SDL.h>
 #include <string>
 #include <stdint.h>
@@ -15,14 +18,45 @@ private:
 	SDL_Window* window;
 	SDL_Renderer* renderer;
 	SDL_Texture* texture;
-	
+	int textureWidth;
+	int textureHeight;
+
+	// Set when the window has to be redrawn even if nothing changed
+	bool needsRedraw;
+
+	// Current input, and whether it has yet to be sent
+	uint16_t keypad;		// Bit n set if key n is pressed
+	bool rewindHeld;		// Whether the rewind hotkey (Backspace) is held
+	bool inputChanged;
+
+	// Sound device, 0 if none, and the ring it plays from. Only the audio
+	// thread touches audioPrimed.
+	SDL_AudioDeviceID audioDevice;
+	AudioRing* audioRing;
+	bool audioPrimed;		// Whether enough sound is buffered to play
+
+	// Called by SDL on the audio thread to fill stream with len bytes
+	static void AudioCallback(void* userdata, Uint8* stream, int len);
 
 public:
 	Platform(std::string title, int width, int height, int tWidth, int tHeight);
 	~Platform();
 
 	void Update(const void* buffer, int pitch);
-	bool ProcessInputs(uint8_t* keys);
+
+	// Upload only rows firstRow to firstRow + rowCount - 1 of the buffer to 
+	// the texture, then present. If no rows changed (rowCount is 0), nothing
+	// is presented unless the window needs to be redrawn.
+	void Update(const void* buffer, int pitch, int firstRow, int rowCount);
+
+	// Handle the pending window events. Changes to the keypad and the rewind
+	// hotkey are sent to the emulation thread through input. Returns false
+	// if the window was closed.
+	bool ProcessInputs(InputQueue& input);
+
+	// Start playing the sound synthesized into ring (see AudioSynthesizer).
+	// Returns false if there is no audio device.
+	bool OpenAudio(AudioRing& ring);
 
 };
 
@@ -0,0 +1,131 @@
+#include "profiler.h"
+#include "emulator.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+
+Profiler::Profiler() : opcodeCounts(0x10000), addressCounts(0x10000) {
+	Reset();
+}
+
+void Profiler::Reset() {
+	std::fill(opcodeCounts.begin(), opcodeCounts.end(), 0);
+	std::fill(addressCounts.begin(), addressCounts.end(), 0);
+	frameCount = 0;
+	frameInstructions = 0;
+	minFrameInstructions = 0;
+	maxFrameInstructions = 0;
+	framedInstructions = 0;
+	idleInstructions = 0;
+}
+
+void Profiler::EndFrame() {
+	if (frameCount == 0 || frameInstructions < minFrameInstructions) {
+		minFrameInstructions = frameInstructions;
+	}
+	maxFrameInstructions = std::max(maxFrameInstructions, frameInstructions);
+	framedInstructions += frameInstructions;
+	frameInstructions = 0;
+	++frameCount;
+}
+
+uint64_t Profiler::GetInstructionCount() const {
+	return framedInstructions + frameInstructions;
+}
+
+uint64_t Profiler::GetMinInstructionsPerFrame() const {
+	return minFrameInstructions;
+}
+
+uint64_t Profiler::GetMaxInstructionsPerFrame() const {
+	return maxFrameInstructions;
+}
+
+double Profiler::GetAverageInstructionsPerFrame() const {
+	return frameCount > 0 ? (double)framedInstructions / frameCount : 0;
+}
+
+std::vector<Profiler::OpcodeClassCount> Profiler::GetOpcodeClasses() const {
+	// Opcodes are only grouped into classes here, so that counting is just
+	// an increment
+	std::map<std::string, uint64_t> classes;
+	for (size_t opcode = 0; opcode < opcodeCounts.size(); ++opcode) {
+		if (opcodeCounts[opcode] > 0) {
+			classes[Chippin8::GetOpcodeName((uint16_t)opcode)]
+				+= opcodeCounts[opcode];
+		}
+	}
+
+	std::vector<OpcodeClassCount> result;
+	for (const auto& entry : classes) {
+		result.push_back({ entry.first, entry.second });
+	}
+	std::stable_sort(result.begin(), result.end(),
+		[](const OpcodeClassCount& a, const OpcodeClassCount& b) {
+			return a.count > b.count;
+		});
+	return result;
+}
+
+std::vector<Profiler::AddressCount> Profiler::GetHotAddresses(
+	size_t count) const {
+	std::vector<AddressCount> result;
+	for (size_t address = 0; address < addressCounts.size(); ++address) {
+		if (addressCounts[address] > 0) {
+			result.push_back({ (uint16_t)address, addressCounts[address] });
+		}
+	}
+	std::stable_sort(result.begin(), result.end(),
+		[](const AddressCount& a, const AddressCount& b) {
+			return a.count > b.count;
+		});
+	if (count > 0 && result.size() > count) {
+		result.resize(count);
+	}
+	return result;
+}
+
+void Profiler::WriteJSON(std::ostream& out) const {
+	uint64_t total = GetInstructionCount();
+
+	out << "{\n"
+		<< "  \"instructions\": " << total << ",\n"
+		<< "  \"idle_instructions\": " << idleInstructions << ",\n"
+		<< "  \"frames\": " << frameCount << ",\n"
+		<< "  \"instructions_per_frame\": {\"min\": "
+		<< GetMinInstructionsPerFrame()
+		<< ", \"max\": " << GetMaxInstructionsPerFrame()
+		<< ", \"average\": " << GetAverageInstructionsPerFrame() << "},\n";
+
+	out << "  \"opcodes\": [";
+	std::vector<OpcodeClassCount> classes = GetOpcodeClasses();
+	for (size_t i = 0; i < classes.size(); ++i) {
+		out << (i > 0 ? ",\n" : "\n")
+			<< "    {\"class\": \"" << classes[i].name
+			<< "\", \"count\": " << classes[i].count
+			<< ", \"share\": " << (double)classes[i].count / total << "}";
+	}
+	out << "\n  ],\n";
+
+	out << "  \"addresses\": [";
+	std::vector<AddressCount> addresses = GetHotAddresses(0);
+	for (size_t i = 0; i < addresses.size(); ++i) {
+		out << (i > 0 ? ",\n" : "\n")
+			<< "    {\"address\": \"0x" << std::hex << std::setfill('0')
+			<< std::setw(4) << addresses[i].address << std::dec
+			<< std::setfill(' ') << "\", \"count\": " << addresses[i].count
+			<< ", \"share\": " << (double)addresses[i].count / total << "}";
+	}
+	out << "\n  ]\n}\n";
+}
+
+bool Profiler::WriteJSON(const std::string& filename) const {
+	std::ofstream file(filename);
+	if (!file.is_open()) {
+		return false;
+	}
+	WriteJSON(file);
+	return file.good();
+}
\ No newline at end of file
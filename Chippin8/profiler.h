@@ -0,0 +1,98 @@
+/*
+	Execution profiler. When attached to a Chippin8 (see Chippin8::profiler)
+	it counts every instruction executed, by opcode and by address, and the
+	number of instructions in every frame. The counts can be polled while
+	running, or written as JSON at the end.
+
+	Nothing is counted while no profiler is attached, which costs a single
+	branch per instruction. While profiling, the Recompiler runs the
+	interpreter, so the counts are the same with and without --jit.
+
+	The profiler is not thread-safe: poll it from the thread running the
+	emulator, or once it has stopped.
+*/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class Profiler {
+public:
+	// Instructions executed per opcode class (e.g. "8XY4"), see
+	// GetOpcodeClasses
+	struct OpcodeClassCount {
+		std::string name;
+		uint64_t count;
+	};
+
+	// Instructions executed at an address, see GetHotAddresses
+	struct AddressCount {
+		uint16_t address;
+		uint64_t count;
+	};
+
+	Profiler();
+
+	// Clear all counts
+	void Reset();
+
+	/* ----- Counting (called by Chippin8) ----- */
+
+	void CountInstruction(uint16_t pc, uint16_t opcode) {
+		++addressCounts[pc];
+		++opcodeCounts[opcode];
+		++frameInstructions;
+	}
+
+	// Called when the timers tick, which ends a frame
+	void EndFrame();
+
+	// Called for instructions skipped in an idle loop. They are not counted
+	// as executed.
+	void CountIdle(uint64_t cycles) { idleInstructions += cycles; }
+
+	/* ----- Results ----- */
+
+	uint64_t GetInstructionCount() const;
+	uint64_t GetFrameCount() const { return frameCount; }
+	uint64_t GetIdleInstructionCount() const { return idleInstructions; }
+
+	// Instructions per frame over all frames ended so far. 0 if none.
+	uint64_t GetMinInstructionsPerFrame() const;
+	uint64_t GetMaxInstructionsPerFrame() const;
+	double GetAverageInstructionsPerFrame() const;
+
+	// Instructions executed at address (the histogram over all 64KB)
+	uint64_t GetAddressCount(uint16_t address) const {
+		return addressCounts[address];
+	}
+
+	// Opcode classes that were executed, most executed first
+	std::vector<OpcodeClassCount> GetOpcodeClasses() const;
+
+	// The count addresses executed the most, most executed first. All
+	// executed addresses if count is 0.
+	std::vector<AddressCount> GetHotAddresses(size_t count) const;
+
+	// Write all of the above as a JSON object
+	void WriteJSON(std::ostream& out) const;
+	bool WriteJSON(const std::string& filename) const;
+
+private:
+	std::vector<uint64_t> opcodeCounts;		// By opcode, 64K entries
+	std::vector<uint64_t> addressCounts;	// By address, 64K entries
+
+	uint64_t frameCount;
+	uint64_t frameInstructions;		// Instructions in the current frame
+	uint64_t minFrameInstructions;
+	uint64_t maxFrameInstructions;
+	uint64_t framedInstructions;	// Instructions in all ended frames
+	uint64_t idleInstructions;		// Instructions skipped
+};
+
+#endif // PROFILER_H
\ No newline at end of file
@@ -0,0 +1,97 @@
+/*
+	Quirk profiles. The interpreters CHIP-8 programs were written for
+	disagree on a few instructions, and programs rely on the behavior of
+	the one they were written for. Each profile describes one of them:
+
+					COSMAC VIP	CHIP-48		SUPER-CHIP	XO-CHIP
+		8XY6/8XYE	shift VY	shift VX	shift VX	shift VY
+		FX55/FX65	I += X + 1	I += X		I unchanged	I += X + 1
+		BNNN		NNN + V0	XNN + VX	XNN + VX	NNN + V0
+		Sprites		clipped		clipped		clipped		wrapped
+		8XY1/2/3	VF = 0		-			-			-
+		DXYN VF		1 bit		1 bit		rows (*)	1 bit
+
+	(*) In high resolution mode, VF is set to the number of sprite rows that
+	collided or were clipped at the bottom edge.
+
+	The profiles are types rather than values, so that Chippin8 (and the
+	LockstepEngine) can be instantiated for each of them. Every quirk is a
+	compile-time constant there, and costs nothing while running. Which
+	instantiation runs is picked once, when the profile is set (see
+	WithQuirks).
+*/
+
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+#include <stdint.h>
+
+enum class QuirkProfile : uint8_t {
+	CosmacVIP,		// The original interpreter (1977)
+	Chip48,			// HP48 calculators (1990)
+	SuperChip,		// SUPER-CHIP 1.1 (1991)
+	XOChip			// Octo (2014)
+};
+
+// Number of quirk profiles
+const int QUIRK_PROFILE_COUNT = 4;
+
+// How far FX55 and FX65 move I
+enum class IndexAdvance {
+	None,			// I is left unchanged
+	ByX,			// I points at the last register transferred
+	ByXPlusOne		// I points past the last register transferred
+};
+
+struct CosmacVIPQuirks {
+	static constexpr bool SHIFT_USES_VY = true;
+	static constexpr IndexAdvance INDEX_ADVANCE = IndexAdvance::ByXPlusOne;
+	static constexpr bool JUMP_USES_VX = false;
+	static constexpr bool CLIP_SPRITES = true;
+	static constexpr bool LOGIC_RESETS_VF = true;
+	static constexpr bool COLLISION_COUNTS_ROWS = false;
+};
+
+struct Chip48Quirks {
+	static constexpr bool SHIFT_USES_VY = false;
+	static constexpr IndexAdvance INDEX_ADVANCE = IndexAdvance::ByX;
+	static constexpr bool JUMP_USES_VX = true;
+	static constexpr bool CLIP_SPRITES = true;
+	static constexpr bool LOGIC_RESETS_VF = false;
+	static constexpr bool COLLISION_COUNTS_ROWS = false;
+};
+
+struct SuperChipQuirks {
+	static constexpr bool SHIFT_USES_VY = false;
+	static constexpr IndexAdvance INDEX_ADVANCE = IndexAdvance::None;
+	static constexpr bool JUMP_USES_VX = true;
+	static constexpr bool CLIP_SPRITES = true;
+	static constexpr bool LOGIC_RESETS_VF = false;
+	static constexpr bool COLLISION_COUNTS_ROWS = true;
+};
+
+struct XOChipQuirks {
+	static constexpr bool SHIFT_USES_VY = true;
+	static constexpr IndexAdvance INDEX_ADVANCE = IndexAdvance::ByXPlusOne;
+	static constexpr bool JUMP_USES_VX = false;
+	static constexpr bool CLIP_SPRITES = false;
+	static constexpr bool LOGIC_RESETS_VF = false;
+	static constexpr bool COLLISION_COUNTS_ROWS = false;
+};
+
+// Call f with (a value of) the quirks type of profile, e.g. to pick the
+// instantiation of a template for it:
+//		WithQuirks(profile, [](auto quirks) {
+//			return &Run<decltype(quirks)>;
+//		});
+template <typename F>
+auto WithQuirks(QuirkProfile profile, F f) {
+	switch (profile) {
+	case QuirkProfile::Chip48: return f(Chip48Quirks());
+	case QuirkProfile::SuperChip: return f(SuperChipQuirks());
+	case QuirkProfile::XOChip: return f(XOChipQuirks());
+	default: return f(CosmacVIPQuirks());
+	}
+}
+
+#endif // QUIRKS_H
\ No newline at end of file
@@ -0,0 +1,584 @@
+#include "recompiler.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef CHIPPIN8_JIT_X64
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif // CHIPPIN8_JIT_X64
+
+// Longest run of instructions that is translated into one block
+const uint16_t MAX_BLOCK_LENGTH = 64;
+
+// Size of the executable memory. Everything is flushed when it runs out.
+const size_t CODE_CAPACITY = 4 * 1024 * 1024;
+
+// Number of bytes FX33/FX55/5XY2 write to memory, 0 for any other opcode
+static uint16_t WriteLength(uint16_t opcode) {
+	if ((opcode & 0xF0FFu) == 0xF033u) return 3;
+	if ((opcode & 0xF0FFu) == 0xF055u) return ((opcode & 0x0F00u) >> 8) + 1;
+	if ((opcode & 0xF00Fu) == 0x5002u) {
+		int X = (opcode & 0x0F00u) >> 8;
+		int Y = (opcode & 0x00F0u) >> 4;
+		return (uint16_t)(abs(Y - X) + 1);
+	}
+	return 0;
+}
+
+// Whether the instruction (possibly) changes the program counter, which ends
+// the block. Instructions that write to memory end the block as well, so
+// that self-modifying code is picked up before the next block is run.
+static bool IsBlockTerminator(uint16_t opcode) {
+	switch ((opcode & 0xF000u) >> 12) {
+	case 0x0: return opcode == 0x00EE || opcode == 0x00FD;
+	case 0x1:									// 1NNN
+	case 0x2:									// 2NNN
+	case 0x3:									// 3XNN
+	case 0x4:									// 4XNN
+	case 0x5:									// 5XY0, 5XY2
+	case 0x9:									// 9XY0
+	case 0xB:									// BNNN
+	case 0xE: return true;						// EX9E, EXA1
+	case 0xF: return (opcode & 0x00FFu) == 0x0A || opcode == 0xF000
+		|| WriteLength(opcode) > 0;				// FX0A, F000 NNNN
+	default: return false;
+	}
+}
+
+bool Recompiler::IsSupported() {
+#ifdef CHIPPIN8_JIT_X64
+	return true;
+#else
+	return false;
+#endif // CHIPPIN8_JIT_X64
+}
+
+Recompiler::Recompiler(Chippin8& c8) : c8(c8) {
+	code = nullptr;
+	codeSize = 0;
+	codeCapacity = 0;
+	isWritable = true;
+	pendingWrite = false;
+	writeStart = 0;
+	writeLength = 0;
+
+#ifdef CHIPPIN8_JIT_X64
+#ifdef _WIN32
+	code = (uint8_t*)VirtualAlloc(nullptr, CODE_CAPACITY,
+		MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+	void* memory = mmap(nullptr, CODE_CAPACITY, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	code = (memory == MAP_FAILED) ? nullptr : (uint8_t*)memory;
+#endif // _WIN32
+	if (code) {
+		codeCapacity = CODE_CAPACITY;
+	}
+#endif // CHIPPIN8_JIT_X64
+	SetWritable(false);
+
+	for (int i = 0; i < 4096; ++i) {
+		blocks[i].entry = nullptr;
+	}
+	Flush();
+}
+
+Recompiler::~Recompiler() {
+#ifdef CHIPPIN8_JIT_X64
+	if (code) {
+#ifdef _WIN32
+		VirtualFree(code, 0, MEM_RELEASE);
+#else
+		munmap(code, codeCapacity);
+#endif // _WIN32
+	}
+#endif // CHIPPIN8_JIT_X64
+}
+
+void Recompiler::Flush() {
+	for (int i = 0; i < 4096; ++i) {
+		blocks[i].entry = nullptr;
+		blocks[i].calls.clear();
+		coverage[i] = 0;
+	}
+	codeSize = 0;
+	pendingWrite = false;
+	codeVersion = c8.codeVersion;
+	c8.ClearCodeDirty();
+}
+
+void Recompiler::DiscardReplacedCode() {
+	if (codeVersion != c8.codeVersion) {
+		Flush();
+	}
+	else if (c8.codeDirty) {
+		Invalidate(c8.dirtyCodeFirst, 
+			c8.dirtyCodeLast - c8.dirtyCodeFirst + 1);
+		c8.ClearCodeDirty();
+	}
+}
+
+void Recompiler::RestoreSnapshot(const Chippin8::Snapshot& snapshot) {
+	uint16_t codeStart;
+	uint16_t codeLength;
+	c8.RestoreSnapshot(snapshot, codeStart, codeLength);
+	if (codeLength > 0) {
+		Invalidate(codeStart, codeLength);
+	}
+}
+
+void Recompiler::Precompile(const std::vector<uint16_t>& addresses) {
+	DiscardReplacedCode();
+	if (codeCapacity == 0) {
+		return;
+	}
+
+	// Changing the protection of the whole code memory costs far more than
+	// compiling a block, so it is only done once for all of them
+	SetWritable(true);
+	for (uint16_t address : addresses) {
+		// A block that ends at a write or at the length limit is followed by
+		// the next instruction, which starts a block of its own when running
+		while (address <= 0x0FFE && blocks[address].entry == nullptr) {
+			Block& block = Compile(address);
+			uint16_t last = (c8.ReadMemory(block.end - 2) << 8)
+				| c8.ReadMemory(block.end - 1);
+			if (IsBlockTerminator(last) && WriteLength(last) == 0) {
+				break;
+			}
+			address = block.end;
+		}
+	}
+	SetWritable(false);
+}
+
+void Recompiler::SetWritable(bool writable) {
+	if (writable == isWritable || codeCapacity == 0) {
+		return;
+	}
+	isWritable = writable;
+#ifdef CHIPPIN8_JIT_X64
+	// The memory is only ever writable or executable, never both
+#ifdef _WIN32
+	DWORD oldProtection;
+	VirtualProtect(code, codeCapacity, 
+		writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &oldProtection);
+	if (!writable) {
+		FlushInstructionCache(GetCurrentProcess(), code, codeSize);
+	}
+#else
+	mprotect(code, codeCapacity, 
+		writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC);
+#endif // _WIN32
+#endif // CHIPPIN8_JIT_X64
+}
+
+void Recompiler::Run(uint64_t cycles) {
+	RunCycles(cycles, false);
+}
+
+void Recompiler::RunFrame(int cyclesPerFrame) {
+	c8.ResetIdleDetection();
+	RunCycles(cyclesPerFrame, true);
+	c8.TickTimers();
+}
+
+void Recompiler::RunCycles(uint64_t cycles, bool isFrame) {
+	uint64_t total = cycles;
+
+	// Memory may have been replaced since the blocks were compiled
+	DiscardReplacedCode();
+
+	while (cycles > 0) {
+		// Blocks never wrap around the end of memory, so any code there (and
+		// any program counter beyond it) is left to the interpreter. So is
+		// everything while profiling, which counts every instruction.
+		Block* block = nullptr;
+		if (codeCapacity > 0 && c8.pc <= 0x0FFE && c8.profiler == nullptr) {
+			block = &blocks[c8.pc];
+			if (block->entry == nullptr) {
+				block = &Compile(c8.pc);
+			}
+		}
+
+		// Interpret a single instruction if there is no block, or not 
+		// enough cycles left for the whole block. Writes still have to 
+		// invalidate compiled blocks.
+		if (block == nullptr || block->length > cycles) {
+			uint16_t address = c8.index;
+			c8.Cycle();
+			--cycles;
+			if (WriteLength(c8.opcode) > 0) {
+				Invalidate(address, WriteLength(c8.opcode));
+			}
+		}
+		else {
+			uint16_t length = block->length;
+			uint16_t end = block->end;
+			block->entry(&c8);
+			cycles -= length;
+
+			if (pendingWrite) {
+				pendingWrite = false;
+				Invalidate(writeStart, writeLength);
+			}
+
+			// Native jumps don't set jumpedBack. Anything that went back
+			// into or before the block may have closed an idle loop.
+			c8.jumpedBack |= c8.pc < end;
+		}
+
+		// Same idle loop detection as Chippin8::RunFrame
+		if (isFrame && c8.jumpedBack) {
+			cycles -= c8.SkipIdleCycles((int)(total - cycles), (int)cycles);
+		}
+	}
+}
+
+void Recompiler::Invalidate(uint16_t address, uint16_t length) {
+	// Check whether the write touched any compiled code at all. Most writes
+	// go to data, so this is usually all that has to be done.
+	bool touchesCode = false;
+	for (uint16_t i = 0; i < length; ++i) {
+		uint16_t written = address + i;
+		if (written < 4096 && coverage[written]) {
+			touchesCode = true;
+			break;
+		}
+	}
+	if (!touchesCode) {
+		return;
+	}
+
+	// A write past the end of memory wraps around to its start
+	int end = address + length;
+	for (int i = 0; i < 4096; ++i) {
+		Block& block = blocks[i];
+		if (block.entry == nullptr) continue;
+
+		bool overlaps = (block.start < end && address < block.coverEnd)
+			|| block.start < end - 0x10000;
+		if (overlaps) {
+			for (uint16_t k = block.start; k < block.coverEnd && k < 4096;
+				++k) {
+				--coverage[k];
+			}
+			block.entry = nullptr;
+			block.calls.clear();
+		}
+	}
+}
+
+void Recompiler::ExecuteWrite(Recompiler* recompiler,
+	const Chippin8::Instruction* instruction) {
+	// The written range is recorded before the instruction runs, so that it
+	// does not depend on what the instruction does to I.
+	recompiler->pendingWrite = true;
+	recompiler->writeStart = recompiler->c8.index;
+	recompiler->writeLength = WriteLength(instruction->opcode);
+
+	instruction->handler(recompiler->c8, *instruction);
+}
+
+/* ----- x86-64 code generation ----- */
+
+namespace {
+
+// Appends x86-64 machine code to a buffer. All emulator state is addressed
+// relative to rbx, which holds the Chippin8 pointer inside a block.
+class Emitter {
+public:
+	std::vector<uint8_t> bytes;
+
+	void Byte(uint8_t b) { bytes.push_back(b); }
+
+	void Word(uint16_t w) {
+		Byte(w & 0xFF);
+		Byte(w >> 8);
+	}
+
+	void Dword(uint32_t d) {
+		for (int i = 0; i < 4; ++i) Byte((d >> (i * 8)) & 0xFF);
+	}
+
+	void Qword(uint64_t q) {
+		for (int i = 0; i < 8; ++i) Byte((q >> (i * 8)) & 0xFF);
+	}
+
+	// ModRM byte for [rbx + disp32] followed by the displacement
+	void Memory(uint8_t reg, int32_t offset) {
+		Byte(0x83 | (reg << 3));
+		Dword((uint32_t)offset);
+	}
+
+	void Prologue() {
+		Byte(0x53);									// push rbx
+#ifdef _WIN32
+		Byte(0x48); Byte(0x83); Byte(0xEC); Byte(0x20);	// sub rsp, 32
+		Byte(0x48); Byte(0x89); Byte(0xCB);			// mov rbx, rcx
+#else
+		Byte(0x48); Byte(0x89); Byte(0xFB);			// mov rbx, rdi
+#endif // _WIN32
+	}
+
+	void Epilogue() {
+#ifdef _WIN32
+		Byte(0x48); Byte(0x83); Byte(0xC4); Byte(0x20);	// add rsp, 32
+#endif // _WIN32
+		Byte(0x5B);									// pop rbx
+		Byte(0xC3);									// ret
+	}
+
+	// mov byte [rbx + offset], value
+	void StoreByte(int32_t offset, uint8_t value) {
+		Byte(0xC6); Memory(0, offset); Byte(value);
+	}
+
+	// mov word [rbx + offset], value
+	void StoreWord(int32_t offset, uint16_t value) {
+		Byte(0x66); Byte(0xC7); Memory(0, offset); Word(value);
+	}
+
+	// add byte [rbx + offset], value
+	void AddByte(int32_t offset, uint8_t value) {
+		Byte(0x80); Memory(0, offset); Byte(value);
+	}
+
+	// cmp byte [rbx + offset], value
+	void CompareByte(int32_t offset, uint8_t value) {
+		Byte(0x80); Memory(7, offset); Byte(value);
+	}
+
+	// movzx eax, byte [rbx + offset]
+	void LoadAl(int32_t offset) {
+		Byte(0x0F); Byte(0xB6); Memory(0, offset);
+	}
+
+	// <op> byte [rbx + offset], al. op is the opcode of the r/m8, r8 form.
+	void OpAl(uint8_t op, int32_t offset) {
+		Byte(op); Memory(0, offset);
+	}
+
+	// Call function(first, second), where first is either rbx or a constant
+	void Call(const void* function, bool firstIsRbx, const void* first,
+		const void* second) {
+#ifdef _WIN32
+		if (firstIsRbx) {
+			Byte(0x48); Byte(0x89); Byte(0xD9);		// mov rcx, rbx
+		}
+		else {
+			Byte(0x48); Byte(0xB9); Qword((uint64_t)first);	// mov rcx, imm64
+		}
+		Byte(0x48); Byte(0xBA); Qword((uint64_t)second);	// mov rdx, imm64
+#else
+		if (firstIsRbx) {
+			Byte(0x48); Byte(0x89); Byte(0xDF);		// mov rdi, rbx
+		}
+		else {
+			Byte(0x48); Byte(0xBF); Qword((uint64_t)first);	// mov rdi, imm64
+		}
+		Byte(0x48); Byte(0xBE); Qword((uint64_t)second);	// mov rsi, imm64
+#endif // _WIN32
+		Byte(0x48); Byte(0xB8); Qword((uint64_t)function);	// mov rax, imm64
+		Byte(0xFF); Byte(0xD0);							// call rax
+	}
+
+	// Set pc to skip if the comparison before it was equal (or not equal).
+	// pc has already been set to the next instruction, the conditional jump
+	// jumps over the 9 byte store of the skip address.
+	void SkipIf(bool equal, int32_t pcOffset, uint16_t skip) {
+		Byte(equal ? 0x75 : 0x74);					// jne/je rel8
+		Byte(9);
+		StoreWord(pcOffset, skip);
+	}
+};
+
+} // namespace
+
+Recompiler::Block& Recompiler::Compile(uint16_t address) {
+	Block& block = blocks[address];
+
+	// Offsets of the emulator state from the Chippin8 pointer in rbx
+	const uint8_t* base = (const uint8_t*)&c8;
+	const int32_t pcOffset = (int32_t)((const uint8_t*)&c8.pc - base);
+	const int32_t indexOffset = (int32_t)((const uint8_t*)&c8.index - base);
+	const int32_t opcodeOffset = (int32_t)((const uint8_t*)&c8.opcode - base);
+	const int32_t registersOffset
+		= (int32_t)((const uint8_t*)&c8.registers[0] - base);
+
+	// The native logic instructions clear VF like the interpreter does on
+	// the profiles that do. Blocks are compiled again when the profile 
+	// changes (it changes the code version).
+	const bool logicResetsVF = WithQuirks(c8.GetQuirkProfile(), 
+		[](auto quirks) { return decltype(quirks)::LOGIC_RESETS_VF; });
+
+	block.start = address;
+	block.length = 0;
+	block.calls.clear();
+	// The native code holds pointers into calls, so it must not reallocate
+	block.calls.reserve(MAX_BLOCK_LENGTH);
+
+	Emitter emit;
+	emit.Prologue();
+
+	uint16_t pc = address;
+	uint16_t lastOpcode = c8.opcode;
+	bool terminated = false;
+	bool skipsNext = false;		// The block ends with a native skip
+
+	while (!terminated && block.length < MAX_BLOCK_LENGTH && pc <= 0x0FFE) {
+		uint16_t opcode = (c8.ReadMemory(pc) << 8) | c8.ReadMemory(pc + 1);
+		Chippin8::Instruction instruction = c8.Decode(opcode);
+		uint16_t next = pc + 2;
+
+		// Where a skip goes. F000 NNNN (XO-CHIP) is skipped as a whole, so
+		// the length of the instruction after a native skip is compiled in.
+		bool isLong = c8.ReadMemory(next) == 0xF0
+			&& c8.ReadMemory(next + 1) == 0x00;
+		uint16_t skip = next + (isLong ? 4 : 2);
+		int32_t Vx = registersOffset + instruction.X;
+		int32_t Vy = registersOffset + instruction.Y;
+		bool native = true;
+
+		switch ((opcode & 0xF000u) >> 12) {
+		case 0x1:
+			emit.StoreWord(pcOffset, instruction.NNN);
+			break;
+
+		case 0x3:
+		case 0x4:
+			emit.StoreWord(pcOffset, next);
+			emit.CompareByte(Vx, instruction.NN);
+			emit.SkipIf(((opcode & 0xF000u) >> 12) == 0x3, pcOffset,
+				skip);
+			skipsNext = true;
+			break;
+
+		case 0x5:
+		case 0x9:
+			// 5XY2 and 5XY3 (XO-CHIP) copy registers to and from memory
+			if (((opcode & 0xF000u) >> 12) == 0x5 && instruction.N != 0) {
+				native = false;
+				break;
+			}
+			emit.StoreWord(pcOffset, next);
+			emit.LoadAl(Vy);
+			emit.OpAl(0x38, Vx);						// cmp [Vx], al
+			emit.SkipIf(((opcode & 0xF000u) >> 12) == 0x5, pcOffset,
+				skip);
+			skipsNext = true;
+			break;
+
+		case 0x6:
+			emit.StoreByte(Vx, instruction.NN);
+			break;
+
+		case 0x7:
+			emit.AddByte(Vx, instruction.NN);
+			break;
+
+		case 0x8:
+			switch (instruction.N) {
+			case 0x0:
+				emit.LoadAl(Vy);
+				emit.OpAl(0x88, Vx);					// mov [Vx], al
+				break;
+			case 0x1:
+				emit.LoadAl(Vy);
+				emit.OpAl(0x08, Vx);					// or [Vx], al
+				break;
+			case 0x2:
+				emit.LoadAl(Vy);
+				emit.OpAl(0x20, Vx);					// and [Vx], al
+				break;
+			case 0x3:
+				emit.LoadAl(Vy);
+				emit.OpAl(0x30, Vx);					// xor [Vx], al
+				break;
+			default:
+				native = false;
+				break;
+			}
+			if (native && instruction.N != 0x0 && logicResetsVF) {
+				emit.StoreByte(registersOffset + 0xF, 0);
+			}
+			break;
+
+		case 0xA:
+			emit.StoreWord(indexOffset, instruction.NNN);
+			break;
+
+		default:
+			native = false;
+			break;
+		}
+
+		terminated = IsBlockTerminator(opcode);
+
+		if (!native) {
+			// Instructions that change the program counter expect it to
+			// point to the next instruction already
+			if (terminated) {
+				emit.StoreWord(pcOffset, next);
+			}
+
+			block.calls.push_back(instruction);
+			const Chippin8::Instruction* call = &block.calls.back();
+			if (WriteLength(opcode) > 0) {
+				emit.Call((const void*)&Recompiler::ExecuteWrite, false, this,
+					call);
+			}
+			else {
+				emit.Call((const void*)instruction.handler, true, nullptr,
+					call);
+			}
+		}
+
+		lastOpcode = opcode;
+		++block.length;
+		pc = next;
+	}
+
+	if (!terminated) {
+		emit.StoreWord(pcOffset, pc);
+	}
+	emit.StoreWord(opcodeOffset, lastOpcode);
+	emit.Epilogue();
+	block.end = pc;
+	block.coverEnd = skipsNext ? pc + 2 : pc;
+
+	// Start over if the executable memory is full
+	size_t alignedSize = (emit.bytes.size() + 15) & ~(size_t)15;
+	if (codeSize + alignedSize > codeCapacity) {
+		std::vector<Chippin8::Instruction> calls;
+		calls.swap(block.calls);
+		Flush();
+		block.calls.swap(calls);
+	}
+
+	uint8_t* entry = code + codeSize;
+#ifdef CHIPPIN8_JIT_X64
+	// Precompile leaves the memory writable for the whole batch
+	bool wasWritable = isWritable;
+	SetWritable(true);
+	memcpy(entry, emit.bytes.data(), emit.bytes.size());
+	if (!wasWritable) {
+		SetWritable(false);
+	}
+#endif // CHIPPIN8_JIT_X64
+	codeSize += alignedSize;
+
+	block.entry = (void (*)(Chippin8*))entry;
+	for (uint16_t i = block.start; i < block.coverEnd && i < 4096; ++i) {
+		++coverage[i];
+	}
+
+	return block;
+}
@@ -0,0 +1,111 @@
+/*
+	Optional execution engine that recompiles CHIP-8 code into native x86-64
+	code. Straight-line runs of instructions (basic blocks) are translated the
+	first time they are reached and cached by their start address. Simple
+	instructions are emitted as native code, everything else calls the same
+	instruction functions the interpreter uses, so Chippin8 stays the
+	reference implementation.
+
+	On other architectures the Recompiler simply runs the interpreter.
+*/
+
+#ifndef RECOMPILER_H
+#define RECOMPILER_H
+
+#include "emulator.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIPPIN8_JIT_X64
+#endif
+
+class Recompiler {
+public:
+	Recompiler(Chippin8& c8);
+	~Recompiler();
+
+	// Whether native code is generated on this platform
+	static bool IsSupported();
+
+	// Execute exactly the given number of instructions. Produces the same
+	// state as calling Chippin8::Cycle() that many times.
+	void Run(uint64_t cycles);
+
+	// Same as Chippin8::RunFrame()
+	void RunFrame(int cyclesPerFrame);
+
+	// Discard all compiled blocks. Must be called if memory is modified from
+	// outside of the emulated program. LoadROM, LoadState and SetMemory are
+	// detected automatically.
+	void Flush();
+
+	// Translate the blocks starting at the given addresses now, rather than
+	// the first time they are reached (see ROMAnalysis::GetBlockStarts). 
+	// A block that is never reached only takes up code space, and any block
+	// that is not given is still translated when it is reached.
+	void Precompile(const std::vector<uint16_t>& addresses);
+
+	// Same as Chippin8::RestoreSnapshot, also discarding the blocks compiled
+	// from code that the snapshot changes. All other blocks are kept.
+	void RestoreSnapshot(const Chippin8::Snapshot& snapshot);
+
+private:
+	// A compiled basic block
+	struct Block {
+		void (*entry)(Chippin8*);	// Native code. nullptr if not compiled
+		uint16_t start;				// Address of the first instruction
+		uint16_t end;				// Address after the last instruction
+		uint16_t coverEnd;			// Address after the last byte the code
+									// depends on. A skip at the end also
+									// depends on the instruction after it.
+		uint16_t length;			// Number of instructions
+
+		// Instructions that are executed by calling their instruction
+		// function. The native code points into this list.
+		std::vector<Chippin8::Instruction> calls;
+	};
+
+	Chippin8& c8;
+	uint32_t codeVersion;			// Chippin8::codeVersion of the blocks
+	Block blocks[4096];				// Blocks by start address
+	uint16_t coverage[4096];		// Number of blocks containing each byte
+
+	uint8_t* code;					// Executable memory for the native code
+	size_t codeSize;				// Bytes used in code
+	size_t codeCapacity;			// Total size of code
+	bool isWritable;				// Whether code can be written (and not
+									// executed) at the moment
+
+	// Memory written by the last block (FX33/FX55). Compiled blocks in this
+	// range are invalidated once the block has returned.
+	bool pendingWrite;
+	uint16_t writeStart;
+	uint16_t writeLength;
+
+	// Flush if memory was replaced as a whole since the blocks were 
+	// compiled (Chippin8::codeVersion), or discard the blocks compiled from
+	// the code that changed (Chippin8::codeDirty)
+	void DiscardReplacedCode();
+
+	// Run, skipping idle loops (see Chippin8::SkipIdleCycles) if the cycles
+	// are a whole frame
+	void RunCycles(uint64_t cycles, bool isFrame);
+
+	// Translate the basic block starting at address
+	Block& Compile(uint16_t address);
+
+	// Make the code memory writable, or executable again
+	void SetWritable(bool writable);
+
+	// Discard the blocks that overlap the given memory range
+	void Invalidate(uint16_t address, uint16_t length);
+
+	// Called from native code for instructions that write to memory
+	static void ExecuteWrite(Recompiler* recompiler,
+		const Chippin8::Instruction* instruction);
+};
+
+#endif // RECOMPILER_H
@@ -0,0 +1,278 @@
+#include "recorder.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// The timers run at 60 Hz, and one frame is recorded per timer tick
+const int FRAMES_PER_SECOND = 60;
+
+// Chroma of gray in Y4M (4:2:0, so one sample per 2 x 2 pixels)
+const uint8_t NEUTRAL_CHROMA = 128;
+
+FrameRecorder::FrameRecorder()
+	: format(RecordFormat::Y4M), isOpen(false), dropWhenFull(false),
+	frameCount(0), droppedFrames(0), hasPending(false), isClosing(false),
+	failed(false), pixels(DISPLAY_WIDTH * DISPLAY_HEIGHT), 
+	gray(DISPLAY_WIDTH * DISPLAY_HEIGHT) {
+}
+
+FrameRecorder::~FrameRecorder() {
+	Close();
+}
+
+RecordFormat FrameRecorder::GetFormatForFile(const std::string& path) {
+	std::string extension = fs::path(path).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(),
+		[](unsigned char c) { return (char)tolower(c); });
+	return extension == ".y4m" ? RecordFormat::Y4M : RecordFormat::PNG;
+}
+
+bool FrameRecorder::Open(const std::string& path, bool dropWhenFull) {
+	Close();
+	this->path = path;
+	this->dropWhenFull = dropWhenFull;
+	format = GetFormatForFile(path);
+	frameCount = 0;
+	droppedFrames = 0;
+	hasPending = false;
+	isClosing = false;
+	failed = false;
+
+	if (format == RecordFormat::Y4M) {
+		video.open(path, std::ios::binary | std::ios::trunc);
+		if (!video.is_open()) {
+			return false;
+		}
+		// Full range 4:2:0, which is what the gray levels are in. Without
+		// XCOLORRANGE, players assume limited range and wash them out.
+		video << "YUV4MPEG2 W" << DISPLAY_WIDTH << " H" << DISPLAY_HEIGHT
+			<< " F" << FRAMES_PER_SECOND << ":1 Ip A1:1 C420jpeg"
+			<< " XCOLORRANGE=FULL\n";
+	}
+	else {
+		// Screenshots are written into an existing directory
+		fs::path parent = fs::path(path).parent_path();
+		if (!parent.empty() && !fs::is_directory(parent)) {
+			return false;
+		}
+	}
+
+	isOpen = true;
+	encoder = std::thread(&FrameRecorder::Encode, this);
+	return true;
+}
+
+bool FrameRecorder::Close() {
+	if (!isOpen) {
+		return true;
+	}
+	if (hasPending) {
+		Flush();
+		hasPending = false;
+	}
+	isClosing.store(true, std::memory_order_release);
+	encoder.join();
+	isOpen = false;
+
+	if (video.is_open()) {
+		video.close();
+		failed = failed || video.fail();
+	}
+	return !failed;
+}
+
+void FrameRecorder::Record(const Chippin8& c8) {
+	if (!isOpen) {
+		return;
+	}
+	uint64_t number = frameCount++;
+
+	if (hasPending && pending.frame.highResolution == c8.highResolution
+		&& memcmp(pending.frame.display, c8.display, sizeof(c8.display))
+		== 0) {
+		++pending.repeats;
+		return;
+	}
+
+	// If there is no room for the frame before, this one is lost and the
+	// frame before is shown once more instead
+	if (hasPending && !Flush()) {
+		++pending.repeats;
+		++droppedFrames;
+		return;
+	}
+	memcpy(pending.frame.display, c8.display, sizeof(c8.display));
+	pending.frame.highResolution = c8.highResolution;
+	pending.number = number;
+	pending.repeats = 0;
+	hasPending = true;
+}
+
+bool FrameRecorder::Flush() {
+	while (!queue.Push(pending)) {
+		// Nothing can be written any more, so there is nothing to wait for
+		if (dropWhenFull || failed.load(std::memory_order_relaxed)) {
+			return false;
+		}
+		std::this_thread::yield();
+	}
+	return true;
+}
+
+void FrameRecorder::Encode() {
+	Entry entry;
+	for (;;) {
+		// Close is only signalled after the last entry was queued, so once
+		// it is seen an empty queue means everything has been written
+		bool closing = isClosing.load(std::memory_order_acquire);
+		if (queue.Pop(entry)) {
+			bool written = format == RecordFormat::Y4M
+				? WriteY4M(entry) : WritePNG(entry);
+			if (!written) {
+				failed = true;
+			}
+		}
+		else if (closing) {
+			break;
+		}
+		else {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+}
+
+void FrameRecorder::ExpandGray(const VideoFrame& frame) {
+	int rows = frame.highResolution ? DISPLAY_HEIGHT : DISPLAY_HEIGHT / 2;
+	ExpandFramebuffer(frame.display, frame.highResolution, 0, rows, 
+		pixels.data(), PIXEL_COLORS);
+
+	// The colors are gray, so any of the color channels will do
+	for (size_t i = 0; i < gray.size(); ++i) {
+		gray[i] = (uint8_t)(pixels[i] >> 24);
+	}
+}
+
+/* ----- Y4M ----- */
+
+bool FrameRecorder::WriteY4M(const Entry& entry) {
+	// Each frame is the gray levels, followed by both chroma planes
+	const size_t chromaSize = gray.size() / 4 * 2;
+	static const std::vector<uint8_t> chroma(chromaSize, NEUTRAL_CHROMA);
+	ExpandGray(entry.frame);
+
+	for (uint32_t i = 0; i <= entry.repeats; ++i) {
+		video << "FRAME\n";
+		video.write((const char*)gray.data(), gray.size());
+		video.write((const char*)chroma.data(), chroma.size());
+	}
+	return video.good();
+}
+
+/* ----- PNG ----- */
+
+static uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc) {
+	static const std::array<uint32_t, 256> table = []() {
+		std::array<uint32_t, 256> table;
+		for (uint32_t n = 0; n < 256; ++n) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; ++k) {
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			}
+			table[n] = c;
+		}
+		return table;
+	}();
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; ++i) {
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static void PutBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		out.push_back((uint8_t)(value >> shift));
+	}
+}
+
+// Append a chunk, with its length and CRC, to out
+static void PutChunk(std::vector<uint8_t>& out, const char type[4],
+	const std::vector<uint8_t>& data) {
+	PutBigEndian(out, (uint32_t)data.size());
+	size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	PutBigEndian(out, Crc32(&out[start], out.size() - start, 0));
+}
+
+bool FrameRecorder::WritePNG(const Entry& entry) {
+	ExpandGray(entry.frame);
+
+	// Every row starts with its filter type, 0 (none)
+	std::vector<uint8_t> raw;
+	raw.reserve((DISPLAY_WIDTH + 1) * DISPLAY_HEIGHT);
+	for (int y = 0; y < DISPLAY_HEIGHT; ++y) {
+		raw.push_back(0);
+		raw.insert(raw.end(), gray.begin() + y * DISPLAY_WIDTH,
+			gray.begin() + (y + 1) * DISPLAY_WIDTH);
+	}
+
+	// zlib stream of stored (uncompressed) deflate blocks of at most 64KB
+	std::vector<uint8_t> image = { 0x78, 0x01 };
+	size_t offset = 0;
+	do {
+		size_t length = std::min(raw.size() - offset, (size_t)0xFFFF);
+		bool isLast = offset + length == raw.size();
+		image.push_back(isLast ? 1 : 0);
+		image.push_back((uint8_t)length);
+		image.push_back((uint8_t)(length >> 8));
+		image.push_back((uint8_t)~length);
+		image.push_back((uint8_t)(~length >> 8));
+		image.insert(image.end(), raw.begin() + offset,
+			raw.begin() + offset + length);
+		offset += length;
+	} while (offset < raw.size());
+	uint32_t a = 1;
+	uint32_t b = 0;
+	for (uint8_t byte : raw) {
+		a = (a + byte) % 65521;
+		b = (b + a) % 65521;
+	}
+	PutBigEndian(image, (b << 16) | a);
+
+	// 8-bit grayscale, no interlacing
+	std::vector<uint8_t> header;
+	PutBigEndian(header, DISPLAY_WIDTH);
+	PutBigEndian(header, DISPLAY_HEIGHT);
+	header.insert(header.end(), { 8, 0, 0, 0, 0 });
+
+	const uint8_t signature[8] = { 
+		0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' 
+	};
+	std::vector<uint8_t> png(signature, signature + sizeof(signature));
+	PutChunk(png, "IHDR", header);
+	PutChunk(png, "IDAT", image);
+	PutChunk(png, "IEND", std::vector<uint8_t>());
+
+	// shots/frame.png is written as shots/frame_000042.png
+	fs::path file = fs::path(path);
+	std::string extension = file.has_extension()
+		? file.extension().string() : ".png";
+	char number[32];
+	snprintf(number, sizeof(number), "_%06llu",
+		(unsigned long long)entry.number);
+	file.replace_filename(file.stem().string() + number + extension);
+
+	std::ofstream out(file, std::ios::binary | std::ios::trunc);
+	out.write((const char*)png.data(), png.size());
+	return out.good();
+}
\ No newline at end of file
@@ -0,0 +1,117 @@
+/*
+	Records the display to a video file or to screenshots, one frame per
+	60 Hz frame, without holding up the emulation. Record only copies the
+	packed 1-bit display planes into a lock-free queue, and a thread of its
+	own expands and writes them to disk.
+
+	A frame that is the same as the one before it is not queued again, it
+	only counts as one more frame of the one before. Most frames of most
+	programs don't change the display (e.g. while waiting on the delay
+	timer), so this keeps the queue and the encoder mostly idle.
+
+	The output is always DISPLAY_WIDTH x DISPLAY_HEIGHT, with low resolution
+	pixels doubled like on screen, in the gray levels of PIXEL_COLORS:
+	- Y4M (.y4m): uncompressed 4:2:0 video at 60 frames per second, which
+	  ffmpeg, mpv and most editors read directly. Every frame is written.
+	- PNG (any other name): 8-bit grayscale screenshots, one file for every
+	  frame that differs from the one before it, numbered by frame:
+	  shots/frame.png is written as shots/frame_000000.png,
+	  shots/frame_000042.png, ... The image data is stored uncompressed, so
+	  no zlib is needed.
+*/
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "emulator.h"
+#include "framebuffer.h"
+#include "lockfree.h"
+
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+enum class RecordFormat {
+	Y4M,
+	PNG
+};
+
+class FrameRecorder {
+public:
+	FrameRecorder();
+	~FrameRecorder();
+
+	// Start recording to path, as Y4M if it ends in .y4m and as PNG files
+	// otherwise. If the encoder falls behind, Record waits for it unless
+	// dropWhenFull is set, in which case frames are dropped instead (see
+	// GetDroppedFrames). Returns false if the file can't be written.
+	bool Open(const std::string& path, bool dropWhenFull);
+
+	// Write the frames still queued and stop. Returns false if any of them
+	// could not be written. Called by the destructor.
+	bool Close();
+
+	bool IsOpen() const { return isOpen; }
+
+	// Record the display of c8 as the next frame. Call once per frame.
+	void Record(const Chippin8& c8);
+
+	// Number of frames recorded so far
+	uint64_t GetFrameCount() const { return frameCount; }
+
+	// Number of frames that were dropped because the queue was full. Their
+	// place in the video is taken by the frame before them.
+	uint64_t GetDroppedFrames() const { return droppedFrames; }
+
+	// Format recording to path would use
+	static RecordFormat GetFormatForFile(const std::string& path);
+
+private:
+	// A distinct frame and the number of frames it is shown for
+	struct Entry {
+		VideoFrame frame;
+		uint64_t number;		// Frame it was first shown in
+		uint32_t repeats;		// Frames shown after that
+	};
+
+	// At 60 frames per second, and frames only queued when they change,
+	// this is several seconds of drawing on every frame
+	typedef SpscQueue<Entry, 256> EntryQueue;
+
+	RecordFormat format;
+	std::string path;
+	bool isOpen;
+	bool dropWhenFull;
+	uint64_t frameCount;
+	uint64_t droppedFrames;
+
+	// Latest distinct frame, queued once the next one comes (or on Close)
+	Entry pending;
+	bool hasPending;
+
+	EntryQueue queue;
+	std::thread encoder;
+	std::atomic<bool> isClosing;
+	std::atomic<bool> failed;		// A write failed on the encoder thread
+
+	std::ofstream video;			// Y4M output
+
+	// Scratch space of the encoder thread
+	std::vector<uint32_t> pixels;
+	std::vector<uint8_t> gray;		// Gray level of every pixel
+
+	// Queue pending, waiting for room unless dropWhenFull is set. Returns
+	// false if there was no room.
+	bool Flush();
+
+	// Encoder thread: write the frames queued until Close
+	void Encode();
+	void ExpandGray(const VideoFrame& frame);
+	bool WriteY4M(const Entry& entry);
+	bool WritePNG(const Entry& entry);
+};
+
+#endif // RECORDER_H
\ No newline at end of file
@@ -0,0 +1,259 @@
+#include "rewind.h"
+
+#include <string.h>
+#include <stdint.h>
+
+// Keyframes are encoded against an all-zero state
+static const uint8_t ZERO_STATE[Chippin8::STATE_SIZE] = { 0 };
+
+// Runs of fewer equal bytes than this are cheaper to store as literals
+const size_t MIN_ZERO_RUN = 3;
+
+static void PutVarint(std::vector<uint8_t>& out, size_t value) {
+	while (value >= 0x80) {
+		out.push_back((uint8_t)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((uint8_t)value);
+}
+
+static const uint8_t* GetVarint(const uint8_t* in, size_t& value) {
+	value = 0;
+	for (int shift = 0; ; shift += 7) {
+		uint8_t byte = *in++;
+		value |= (size_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) break;
+	}
+	return in;
+}
+
+RewindBuffer::RewindBuffer(size_t capacity, int keyframeInterval)
+	: ring(capacity), keyframeInterval(keyframeInterval) {
+	encoded.reserve(Chippin8::STATE_SIZE * 2);
+	nextKeyframe = 0;
+	Clear();
+}
+
+void RewindBuffer::Clear() {
+	entries.clear();
+	head = 0;
+	hasReference = false;
+	referenceKeyframe = 0;
+	hasKeyframePages = false;
+}
+
+void RewindBuffer::AddChange(size_t start, size_t end) {
+	if (!changes.empty() && changes.back().end == start) {
+		changes.back().end = end;
+	}
+	else {
+		changes.push_back({ start, end });
+	}
+}
+
+void RewindBuffer::Encode(const uint8_t* state, const uint8_t* base) {
+	// The difference is stored as pairs of (number of unchanged bytes,
+	// number of changed bytes), followed by the changed bytes XOR base.
+	size_t position = 0;	// Everything before has been encoded
+
+	encoded.clear();
+	for (const Range& range : changes) {
+		size_t i = range.start;
+		while (i < range.end) {
+			// Most of the state doesn't change, so the unchanged bytes are
+			// skipped 8 at a time
+			while (i + 8 <= range.end) {
+				uint64_t a, b;
+				memcpy(&a, state + i, 8);
+				memcpy(&b, base + i, 8);
+				if (a != b) break;
+				i += 8;
+			}
+			while (i < range.end && state[i] == base[i]) {
+				++i;
+			}
+			if (i == range.end) {
+				break;
+			}
+
+			// The changed run ends at the next run of unchanged bytes that
+			// is long enough to be worth encoding separately
+			size_t changed = 0;
+			while (i + changed < range.end) {
+				size_t run = 0;
+				while (run < MIN_ZERO_RUN && i + changed + run < range.end
+					&& state[i + changed + run] == base[i + changed + run]) {
+					++run;
+				}
+				if (run == MIN_ZERO_RUN || i + changed + run == range.end) {
+					break;
+				}
+				changed += run + 1;
+			}
+
+			PutVarint(encoded, i - position);
+			PutVarint(encoded, changed);
+			size_t end = encoded.size();
+			encoded.resize(end + changed);
+			for (size_t j = 0; j < changed; ++j) {
+				encoded[end + j] = state[i + j] ^ base[i + j];
+			}
+			i += changed;
+			position = i;
+		}
+	}
+
+	// A state that didn't change at all still takes up an entry
+	if (encoded.empty()) {
+		PutVarint(encoded, 0);
+		PutVarint(encoded, 0);
+	}
+}
+
+void RewindBuffer::Decode(const uint8_t* data, size_t size, uint8_t* state) {
+	const uint8_t* end = data + size;
+	size_t position = 0;
+
+	while (data < end) {
+		size_t unchanged, changed;
+		data = GetVarint(data, unchanged);
+		data = GetVarint(data, changed);
+		position += unchanged;
+		for (size_t j = 0; j < changed; ++j) {
+			state[position++] ^= *data++;
+		}
+	}
+}
+
+void RewindBuffer::LoadReference(uint64_t keyframe) {
+	if (hasReference && referenceKeyframe == keyframe) {
+		return;
+	}
+
+	for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+		if (it->isKeyframe && it->keyframe == keyframe) {
+			memset(reference, 0, sizeof(reference));
+			Decode(&ring[it->offset], it->size, reference);
+			referenceKeyframe = keyframe;
+			hasReference = true;
+			return;
+		}
+	}
+}
+
+void RewindBuffer::Evict(size_t offset, size_t size) {
+	while (!entries.empty()) {
+		const Entry& oldest = entries.front();
+		bool overlaps = oldest.offset < offset + size
+			&& offset < oldest.offset + oldest.size;
+		// Deltas are useless once their keyframe is gone
+		bool orphaned = !oldest.isKeyframe;
+		if (!overlaps && !orphaned) break;
+		entries.pop_front();
+	}
+}
+
+void RewindBuffer::Push(const Chippin8& c8) {
+	uint8_t state[Chippin8::STATE_SIZE];
+	const size_t memoryStart = Chippin8::STATE_MEMORY_OFFSET;
+	const size_t memoryEnd = memoryStart + Chippin8::MEMORY_SIZE;
+
+	// Start a new keyframe if the last one is too far back, or if it was
+	// rewound past (its pages are no longer the ones held)
+	size_t sinceKeyframe = 0;
+	for (auto it = entries.rbegin(); it != entries.rend() && !it->isKeyframe;
+		++it) {
+		++sinceKeyframe;
+	}
+	bool isKeyframe = entries.empty() || !hasKeyframePages
+		|| sinceKeyframe + 1 >= (size_t)keyframeInterval;
+
+	Entry entry;
+	entry.isKeyframe = isKeyframe;
+	changes.clear();
+	if (isKeyframe) {
+		c8.SaveState(state, sizeof(state));
+		AddChange(0, Chippin8::STATE_SIZE);
+		entry.keyframe = nextKeyframe++;
+		Encode(state, ZERO_STATE);
+		memcpy(reference, state, sizeof(reference));
+		referenceKeyframe = entry.keyframe;
+		hasReference = true;
+		c8.TakeSnapshot(keyframePages);
+		hasKeyframePages = true;
+	}
+	else {
+		// Only the pages written since the keyframe are copied into the
+		// state and compared. The others are the same as in reference.
+		c8.SaveState(state, sizeof(state), false);
+		AddChange(0, memoryStart);
+		for (size_t page = 0; page < Chippin8::PAGE_COUNT; ++page) {
+			const Chippin8::MemoryPage& contents = c8.GetPage(page);
+			if (&contents != keyframePages.pages[page].get()) {
+				size_t start = memoryStart + page * Chippin8::PAGE_SIZE;
+				memcpy(state + start, contents.data(), Chippin8::PAGE_SIZE);
+				AddChange(start, start + Chippin8::PAGE_SIZE);
+			}
+		}
+		AddChange(memoryEnd, Chippin8::STATE_SIZE);
+		entry.keyframe = entries.back().keyframe;
+		LoadReference(entry.keyframe);
+		Encode(state, reference);
+	}
+
+	entry.size = encoded.size();
+	if (entry.size > ring.size()) {
+		Clear();
+		return;
+	}
+
+	// Entries are never split. If there is no room left at the end of the
+	// ring, wrap around. The entries at the end are the oldest ones then.
+	entry.offset = head;
+	if (entry.offset + entry.size > ring.size()) {
+		while (!entries.empty() && entries.front().offset >= head) {
+			entries.pop_front();
+		}
+		entry.offset = 0;
+	}
+	Evict(entry.offset, entry.size);
+
+	// The whole history, including this delta's keyframe, was dropped
+	if (!isKeyframe && entries.empty()) {
+		Clear();
+		Push(c8);
+		return;
+	}
+
+	memcpy(&ring[entry.offset], encoded.data(), entry.size);
+	entries.push_back(entry);
+	head = entry.offset + entry.size;
+}
+
+bool RewindBuffer::Pop(Chippin8& c8) {
+	if (entries.empty()) {
+		return false;
+	}
+
+	Entry entry = entries.back();
+	uint8_t state[Chippin8::STATE_SIZE];
+
+	if (entry.isKeyframe) {
+		memset(state, 0, sizeof(state));
+	}
+	else {
+		LoadReference(entry.keyframe);
+		memcpy(state, reference, sizeof(state));
+	}
+	Decode(&ring[entry.offset], entry.size, state);
+
+	// The newest entry is always the last one written, so its space can be
+	// reused right away
+	entries.pop_back();
+	head = entry.offset;
+	if (entry.isKeyframe) {
+		hasKeyframePages = false;
+	}
+
+	return c8.LoadState(state, sizeof(state));
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+/*
+	Rewind history. A save state is pushed every frame into a ring buffer of
+	fixed size, and popped again to step back in time. To keep minutes of
+	history in little memory, only every keyframeInterval-th state is stored
+	in full. The states in between are stored as the difference (XOR) with
+	their keyframe, and both are run-length encoded, since most of memory
+	does not change from frame to frame.
+
+	Memory isn't even compared in full for the states in between. The pages
+	of memory at the keyframe are held on to, which makes the machine copy
+	any of them before writing to it (see Chippin8::GetPage). The pages
+	that are still the same objects haven't changed, so only the other ones
+	(usually a few, if any) and the rest of the state are compared.
+*/
+
+#ifndef REWIND_H
+#define REWIND_H
+
+#include "emulator.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <vector>
+
+class RewindBuffer {
+public:
+	// capacity is the number of bytes used for the history
+	RewindBuffer(size_t capacity, int keyframeInterval = 60);
+
+	// Record the state of c8. Call once per frame. The oldest frames are
+	// dropped when the buffer is full.
+	void Push(const Chippin8& c8);
+
+	// Restore c8 to the most recently pushed state and remove it from the
+	// history. Returns false if there is no history left.
+	bool Pop(Chippin8& c8);
+
+	// Number of frames in the history
+	size_t FrameCount() const { return entries.size(); }
+
+	void Clear();
+
+private:
+	struct Entry {
+		size_t offset;				// Position of the data in ring
+		size_t size;				// Size of the encoded data
+		uint64_t keyframe;			// Id of the keyframe of this entry
+		bool isKeyframe;
+	};
+
+	std::vector<uint8_t> ring;		// Encoded states
+	size_t head;					// Where the next state is written
+	std::deque<Entry> entries;		// Oldest first
+	int keyframeInterval;
+	uint64_t nextKeyframe;			// Id of the next keyframe
+
+	// Decoded keyframe that deltas are encoded against
+	uint8_t reference[Chippin8::STATE_SIZE];
+	uint64_t referenceKeyframe;		// Id of the keyframe in reference
+	bool hasReference;
+
+	// The memory pages of the keyframe in reference, while they are the
+	// ones of the newest keyframe in the history
+	Chippin8::Snapshot keyframePages;
+	bool hasKeyframePages;
+
+	// Part of a state that may have changed, from start to end (exclusive)
+	struct Range {
+		size_t start;
+		size_t end;
+	};
+
+	std::vector<uint8_t> encoded;	// Scratch space for encoding
+	std::vector<Range> changes;		// Scratch space for Push
+
+	// Set encoded to the run-length encoding of (state XOR base). Only the
+	// ranges in changes (in order) are compared, and all other bytes are
+	// taken to be the same.
+	void Encode(const uint8_t* state, const uint8_t* base);
+
+	// Add a range to changes, merging it into the last one if they touch
+	void AddChange(size_t start, size_t end);
+
+	// Decode data into state. state must hold the base on input.
+	static void Decode(const uint8_t* data, size_t size, uint8_t* state);
+
+	// Decode the keyframe with the given id into reference
+	void LoadReference(uint64_t keyframe);
+
+	// Drop the oldest entries that overlap ring[offset, offset + size), and
+	// any deltas left without their keyframe.
+	void Evict(size_t offset, size_t size);
+};
+
+#endif // REWIND_H
\ No newline at end of file
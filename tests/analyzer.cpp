@@ -0,0 +1,156 @@
+/*
+	Test of the static analysis (see ROMAnalysis). A small program has to be
+	split into exactly its code, sprites and data, paths have to end at the
+	end of the ROM and at bytes that are not instructions, and the blocks
+	found in random ROMs, once precompiled (see Recompiler::Precompile),
+	have to run the same as the interpreter.
+*/
+
+#include "test.h"
+#include "emulator.h"
+#include "analyzer.h"
+#include "recompiler.h"
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Random ROMs analyzed, and how large they are
+const int RANDOM_ROM_COUNT = 100;
+const size_t RANDOM_ROM_SIZE = 300;
+
+// Draws a sprite, calls a subroutine that writes the BCD of V0, and loops
+const uint8_t PROGRAM_ROM[] = {
+	0xA2, 0x0E,			// 200: LD I, 0x20E
+	0xD0, 0x15,			// 202: DRW V0, V1, 5
+	0x22, 0x08,			// 204: CALL 0x208
+	0x12, 0x06,			// 206: JP 0x206
+	0xA2, 0x16,			// 208: LD I, 0x216
+	0xF0, 0x33,			// 20A: LD B, V0
+	0x00, 0xEE,			// 20C: RET
+	0xF0, 0x90, 0x90,	// 20E: Sprite
+	0x90, 0xF0,
+	0x00, 0x00, 0x00,	// 213: Padding
+	0x00, 0x00, 0x00,	// 216: BCD
+	0x12, 0x00			// 219: Never reached
+};
+
+static std::unique_ptr<Chippin8> Load(const std::vector<uint8_t>& rom) {
+	std::unique_ptr<Chippin8> c8(new Chippin8());
+	c8->LoadROM(rom.data(), rom.size());
+	c8->Seed(5);
+	return c8;
+}
+
+static void TestProgram() {
+	std::unique_ptr<Chippin8> c8 = Load(std::vector<uint8_t>(
+		std::begin(PROGRAM_ROM), std::end(PROGRAM_ROM)));
+	ROMAnalysis analysis;
+	analysis.Analyze(*c8);
+
+	for (uint16_t address = 0x200; address < 0x21B; ++address) {
+		uint8_t expected = address < 0x20E ? ROMAnalysis::CODE
+			: address < 0x213 ? ROMAnalysis::SPRITE
+			: address >= 0x216 && address < 0x219 ? ROMAnalysis::DATA : 0;
+		if (analysis.GetFlags(address) != expected) {
+			Fail("The byte at " + std::to_string(address) + " is "
+				+ std::to_string(analysis.GetFlags(address)));
+		}
+	}
+	CHECK(analysis.CountBytes(ROMAnalysis::CODE) == 14);
+	CHECK(analysis.CountBytes(0) == 5);
+	CHECK(analysis.GetInvalidCount() == 0);
+	CHECK(analysis.GetSubroutines() == std::vector<uint16_t>{ 0x208 });
+	CHECK(analysis.GetBlockStarts()
+		== (std::vector<uint16_t>{ 0x200, 0x206, 0x208 }));
+	CHECK(analysis.Disassemble(0x202) == "DRW V0, V1, 5");
+
+	const std::vector<ROMAnalysis::BasicBlock>& blocks = analysis.GetBlocks();
+	CHECK(blocks.size() == 3);
+	if (blocks.size() == 3) {
+		CHECK(blocks[0].end == 0x206);
+		CHECK(blocks[0].successors
+			== (std::vector<uint16_t>{ 0x206, 0x208 }));
+		CHECK(blocks[1].successors == std::vector<uint16_t>{ 0x206 });
+		CHECK(blocks[2].isReturn && blocks[2].successors.empty());
+	}
+}
+
+// Paths end at bytes that are not instructions, and at the end of the ROM,
+// rather than going on through the rest of memory
+static void TestPathEnds() {
+	// Zero padding
+	std::unique_ptr<Chippin8> c8 = Load({ 0x60, 0x01, 0x00, 0x00,
+		0x60, 0x02 });
+	ROMAnalysis analysis;
+	analysis.Analyze(*c8);
+	CHECK(analysis.GetFlags(0x200) == ROMAnalysis::CODE);
+	CHECK(analysis.GetFlags(0x204) == 0);
+	CHECK(analysis.GetBlocks().size() == 1);
+
+	// An opcode no profile has
+	c8 = Load({ 0x60, 0x01, 0xE0, 0x00, 0x60, 0x02 });
+	analysis.Analyze(*c8);
+	CHECK(analysis.GetInvalidCount() == 1);
+	CHECK(analysis.GetFlags(0x204) == 0);
+
+	// The end of the ROM, with code left in memory after it
+	c8 = Load({ 0x60, 0x01, 0x60, 0x02 });
+	std::vector<uint8_t> memory(Chippin8::MEMORY_SIZE);
+	c8->GetMemory(memory.data());
+	memory[0x204] = 0x60;
+	memory[0x205] = 0x03;
+	c8->SetMemory(memory.data());
+	analysis.Analyze(*c8);
+	CHECK(analysis.CountBytes(ROMAnalysis::CODE) == 4);
+	CHECK(analysis.GetFlags(0x204) == 0);
+}
+
+// Random bytes never lead the analysis far out of the ROM, and the blocks
+// found run the same precompiled as on the interpreter
+static void TestRandomROMs() {
+	std::mt19937_64 random(11);
+	for (int i = 0; i < RANDOM_ROM_COUNT; ++i) {
+		std::vector<uint8_t> rom(RANDOM_ROM_SIZE);
+		for (uint8_t& byte : rom) {
+			byte = (uint8_t)random();
+		}
+		std::unique_ptr<Chippin8> reference = Load(rom);
+		std::unique_ptr<Chippin8> precompiled = Load(rom);
+		ROMAnalysis analysis;
+		analysis.Analyze(*precompiled);
+
+		// An instruction at the last byte reaches past it, F000 NNNN by 3
+		size_t romEnd = 0x200 + rom.size();
+		for (size_t address = 0; address < Chippin8::MEMORY_SIZE;
+			++address) {
+			if ((analysis.GetFlags((uint16_t)address) & ROMAnalysis::CODE)
+				&& (address < 0x200 || address >= romEnd + 3)) {
+				Fail("Random ROM " + std::to_string(i) + " has code at "
+					+ std::to_string(address));
+				break;
+			}
+		}
+		CHECK(analysis.GetBlocks().size() <= RANDOM_ROM_SIZE / 2);
+
+		Recompiler recompiler(*precompiled);
+		recompiler.Precompile(analysis.GetBlockStarts());
+		for (int frame = 0; frame < 30; ++frame) {
+			reference->RunFrame(50);
+			recompiler.RunFrame(50);
+		}
+		if (GetState(*precompiled) != GetState(*reference)) {
+			Fail("Random ROM " + std::to_string(i)
+				+ " runs differently precompiled");
+		}
+	}
+}
+
+int main() {
+	TestProgram();
+	TestPathEnds();
+	TestRandomROMs();
+	return TestResult();
+}
\ No newline at end of file
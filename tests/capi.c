@@ -0,0 +1,268 @@
+/*
+	Test of the library interface (see chippin8.h). It is written in C, so
+	that it also checks that chippin8.h can be used from C. A machine has to
+	refuse ROMs that do not fit, start every ROM loaded like a machine just
+	created, whatever ran on it before, run the same on the interpreter and
+	the recompiler, and show the display, keypad and buzzer the way the
+	program left them.
+*/
+
+#include "chippin8.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of checks that failed so far (see test.h, which is C++)
+static int testFailures = 0;
+
+// Report condition, and where it is, as failed unless it holds
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+				#condition); \
+			++testFailures; \
+		} \
+	} while (0)
+
+const int CYCLES_PER_FRAME = 20;
+
+// Clears the screen, draws a bar and starts the buzzer, then waits for a
+// key and draws its digit next to the bar. After that it keeps drawing
+// random numbers, so that the random number generator shows in the state.
+static const uint8_t TEST_ROM[] = {
+	0x00, 0xE0,		// 200: CLS
+	0xA2, 0x1C,		// 202: LD I, 0x21C
+	0x61, 0x08,		// 204: LD V1, 8
+	0x62, 0x04,		// 206: LD V2, 4
+	0xD1, 0x21,		// 208: DRW V1, V2, 1
+	0x63, 0x0F,		// 20A: LD V3, 15
+	0xF3, 0x18,		// 20C: LD ST, V3
+	0xF3, 0x0A,		// 20E: LD V3, K
+	0xF3, 0x29,		// 210: LD F, V3
+	0x61, 0x10,		// 212: LD V1, 16
+	0xD1, 0x25,		// 214: DRW V1, V2, 5
+	0xC4, 0xFF,		// 216: RND V4, 0xFF
+	0x12, 0x16,		// 218: JP 0x216
+	0x00, 0x00,
+	0xF0			// 21C: The bar
+};
+
+// Calls itself until the stack overflows
+static const uint8_t OVERFLOW_ROM[] = { 0x22, 0x00 };
+
+static uint8_t* GetState(const Chippin8Machine* machine) {
+	uint8_t* state = (uint8_t*)malloc(Chippin8_GetStateSize());
+	CHECK(Chippin8_SaveState(machine, state, Chippin8_GetStateSize())
+		== Chippin8_GetStateSize());
+	return state;
+}
+
+static bool IsSameState(const Chippin8Machine* a, const Chippin8Machine* b) {
+	uint8_t* stateA = GetState(a);
+	uint8_t* stateB = GetState(b);
+	bool isSame = memcmp(stateA, stateB, Chippin8_GetStateSize()) == 0;
+	free(stateA);
+	free(stateB);
+	return isSame;
+}
+
+// Whether the pixel at (x, y) is set in plane 0
+static bool IsPixelSet(const Chippin8Framebuffer* frame, int x, int y) {
+	uint64_t word = frame->planes[0][y * frame->stride + x / 64];
+	return (word >> (63 - x % 64)) & 1;
+}
+
+// ROMs that are empty or do not fit are refused, and the machine keeps
+// running what it ran
+static void TestLoadROM(void) {
+	Chippin8Machine* machine = Chippin8_Create(1);
+	CHECK(machine != NULL);
+	CHECK(Chippin8_LoadROM(machine, TEST_ROM, sizeof(TEST_ROM),
+		CHIPPIN8_QUIRKS_VIP));
+	Chippin8_RunFrame(machine, CYCLES_PER_FRAME);
+	uint8_t* before = GetState(machine);
+
+	// Everything from 0x200 to the end of memory
+	size_t tooLargeSize = 65536 - 0x200 + 1;
+	uint8_t* tooLarge = (uint8_t*)calloc(tooLargeSize, 1);
+	CHECK(!Chippin8_LoadROM(machine, tooLarge, tooLargeSize,
+		CHIPPIN8_QUIRKS_XOCHIP));
+	CHECK(!Chippin8_LoadROM(machine, TEST_ROM, 0, CHIPPIN8_QUIRKS_VIP));
+	uint8_t* after = GetState(machine);
+	CHECK(memcmp(before, after, Chippin8_GetStateSize()) == 0);
+	CHECK(Chippin8_LoadROM(machine, tooLarge, tooLargeSize - 1,
+		CHIPPIN8_QUIRKS_XOCHIP));
+
+	free(tooLarge);
+	free(before);
+	free(after);
+	Chippin8_Destroy(machine);
+}
+
+// The display, keypad and buzzer, as the test ROM uses them
+static void TestFramebuffer(bool useRecompiler) {
+	Chippin8Machine* machine = Chippin8_Create(2);
+	Chippin8_UseRecompiler(machine, useRecompiler);
+	Chippin8_LoadROM(machine, TEST_ROM, sizeof(TEST_ROM),
+		CHIPPIN8_QUIRKS_VIP);
+	Chippin8_RunFrame(machine, CYCLES_PER_FRAME);
+
+	Chippin8Framebuffer frame = Chippin8_GetFramebuffer(machine);
+	CHECK(frame.width == 64 && frame.height == 32);
+	CHECK(frame.stride * 64 >= frame.width);
+	CHECK(frame.dirty);
+	CHECK(frame.dirtyFirstRow <= 4 && frame.dirtyLastRow >= 4);
+	CHECK(IsPixelSet(&frame, 8, 4) && IsPixelSet(&frame, 11, 4));
+	CHECK(!IsPixelSet(&frame, 12, 4) && !IsPixelSet(&frame, 8, 5));
+	CHECK(Chippin8_IsSoundOn(machine));
+	Chippin8_ClearDirty(machine);
+	CHECK(!Chippin8_GetFramebuffer(machine).dirty);
+
+	// Low resolution pixels are 2 x 2 when expanded
+	uint32_t* pixels = (uint32_t*)malloc(128 * 64 * sizeof(uint32_t));
+	Chippin8_ExpandFramebuffer(machine, pixels);
+	CHECK(pixels[8 * 128 + 16] == pixels[9 * 128 + 17]);
+	CHECK(pixels[8 * 128 + 16] != pixels[0]);
+	CHECK(pixels[8 * 128 + 24] == pixels[0]);
+	free(pixels);
+
+	// Nothing is drawn while it waits for a key, and the buzzer stops
+	for (int i = 0; i < 20; ++i) {
+		Chippin8_RunFrame(machine, CYCLES_PER_FRAME);
+	}
+	CHECK(!Chippin8_GetFramebuffer(machine).dirty);
+	CHECK(!Chippin8_IsSoundOn(machine));
+
+	// The digit of key 7 is drawn at x = 16
+	Chippin8_SetKeypad(machine, 1 << 7);
+	CHECK(Chippin8_GetKeypad(machine) == 1 << 7);
+	Chippin8_RunFrame(machine, CYCLES_PER_FRAME);
+	frame = Chippin8_GetFramebuffer(machine);
+	CHECK(frame.dirty);
+	CHECK(IsPixelSet(&frame, 16, 4) && IsPixelSet(&frame, 19, 4));
+	CHECK(!IsPixelSet(&frame, 16, 5) && IsPixelSet(&frame, 18, 6));
+
+	Chippin8_Destroy(machine);
+}
+
+// A machine that ran something else, on either engine, starts a ROM like
+// one just created, and both engines run it the same
+static void TestReuse(void) {
+	Chippin8Machine* reused = Chippin8_Create(3);
+	Chippin8_UseRecompiler(reused, true);
+	Chippin8_LoadROM(reused, OVERFLOW_ROM, sizeof(OVERFLOW_ROM),
+		CHIPPIN8_QUIRKS_SCHIP);
+	Chippin8_SetKeypad(reused, 0xFFFF);
+	Chippin8_RunFrame(reused, 1000);
+	CHECK(Chippin8_LoadROM(reused, TEST_ROM, sizeof(TEST_ROM),
+		CHIPPIN8_QUIRKS_VIP));
+
+	Chippin8Machine* fresh = Chippin8_Create(3);
+	Chippin8_LoadROM(fresh, TEST_ROM, sizeof(TEST_ROM), CHIPPIN8_QUIRKS_VIP);
+	CHECK(IsSameState(reused, fresh));
+	CHECK(Chippin8_GetKeypad(reused) == 0);
+
+	for (int frame = 0; frame < 60; ++frame) {
+		uint16_t keypad = frame >= 30 ? 1 << 3 : 0;
+		Chippin8_SetKeypad(reused, keypad);
+		Chippin8_SetKeypad(fresh, keypad);
+		Chippin8_RunFrame(reused, CYCLES_PER_FRAME);
+		Chippin8_RunFrame(fresh, CYCLES_PER_FRAME);
+	}
+	Chippin8_RunCycles(reused, 777);
+	Chippin8_RunCycles(fresh, 777);
+	CHECK(IsSameState(reused, fresh));
+
+	Chippin8_Destroy(reused);
+	Chippin8_Destroy(fresh);
+}
+
+// Timers only tick at the end of a frame, not between cycles
+static void TestRunCycles(void) {
+	Chippin8Machine* machine = Chippin8_Create(4);
+	Chippin8_LoadROM(machine, TEST_ROM, sizeof(TEST_ROM),
+		CHIPPIN8_QUIRKS_CHIP48);
+	Chippin8_RunCycles(machine, 10000);
+	CHECK(Chippin8_IsSoundOn(machine));
+	for (int i = 0; i < 15; ++i) {
+		Chippin8_RunFrame(machine, 0);
+	}
+	CHECK(!Chippin8_IsSoundOn(machine));
+	Chippin8_Destroy(machine);
+}
+
+// A state restores a machine running something else, and one that is not
+// valid is refused
+static void TestSaveState(void) {
+	Chippin8Machine* original = Chippin8_Create(5);
+	Chippin8_LoadROM(original, TEST_ROM, sizeof(TEST_ROM),
+		CHIPPIN8_QUIRKS_VIP);
+	Chippin8_SetKeypad(original, 1 << 12);
+	for (int frame = 0; frame < 10; ++frame) {
+		Chippin8_RunFrame(original, CYCLES_PER_FRAME);
+	}
+	uint8_t* state = GetState(original);
+
+	Chippin8Machine* restored = Chippin8_Create(6);
+	Chippin8_UseRecompiler(restored, true);
+	Chippin8_LoadROM(restored, OVERFLOW_ROM, sizeof(OVERFLOW_ROM),
+		CHIPPIN8_QUIRKS_XOCHIP);
+	Chippin8_RunFrame(restored, CYCLES_PER_FRAME);
+	CHECK(Chippin8_LoadState(restored, state, Chippin8_GetStateSize()));
+	CHECK(IsSameState(restored, original));
+	CHECK(Chippin8_GetKeypad(restored) == 1 << 12);
+	for (int frame = 0; frame < 10; ++frame) {
+		Chippin8_RunFrame(original, CYCLES_PER_FRAME);
+		Chippin8_RunFrame(restored, CYCLES_PER_FRAME);
+	}
+	CHECK(IsSameState(restored, original));
+
+	uint8_t magic = state[0];
+	state[0] = 'X';
+	CHECK(!Chippin8_LoadState(restored, state, Chippin8_GetStateSize()));
+	state[0] = magic;
+	CHECK(!Chippin8_LoadState(restored, state, Chippin8_GetStateSize() - 1));
+	CHECK(Chippin8_SaveState(restored, state, Chippin8_GetStateSize() - 1)
+		== 0);
+	CHECK(IsSameState(restored, original));
+
+	free(state);
+	Chippin8_Destroy(original);
+	Chippin8_Destroy(restored);
+}
+
+// A ROM that overflows the stack keeps running, the same on both engines
+static void TestStackOverflow(void) {
+	Chippin8Machine* interpreted = Chippin8_Create(7);
+	Chippin8Machine* recompiled = Chippin8_Create(7);
+	Chippin8_UseRecompiler(recompiled, true);
+	Chippin8_LoadROM(interpreted, OVERFLOW_ROM, sizeof(OVERFLOW_ROM),
+		CHIPPIN8_QUIRKS_VIP);
+	Chippin8_LoadROM(recompiled, OVERFLOW_ROM, sizeof(OVERFLOW_ROM),
+		CHIPPIN8_QUIRKS_VIP);
+	for (int frame = 0; frame < 10; ++frame) {
+		Chippin8_RunFrame(interpreted, 100);
+		Chippin8_RunFrame(recompiled, 100);
+	}
+	CHECK(IsSameState(interpreted, recompiled));
+	Chippin8_Destroy(interpreted);
+	Chippin8_Destroy(recompiled);
+}
+
+int main(void) {
+	TestLoadROM();
+	TestFramebuffer(false);
+	TestFramebuffer(true);
+	TestReuse();
+	TestRunCycles();
+	TestSaveState();
+	TestStackOverflow();
+
+	if (testFailures > 0) {
+		fprintf(stderr, "%d checks failed\n", testFailures);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
\ No newline at end of file
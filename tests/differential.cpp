@@ -0,0 +1,352 @@
+/*
+	Differential test of the execution engines. Every program is run on the
+	interpreter (the reference), on the interpreter without idle skipping
+	(see Chippin8::SkipIdleCycles) and on the Recompiler, and after every
+	frame all of them have to be in exactly the same state, as written by
+	Chippin8::SaveState.
+
+	The programs are the benchmark instruction streams and ROMs (see
+	benchroms.h), and random ROMs for every quirk profile. Random bytes
+	reach what no real ROM does, e.g. jumps into data, code that overwrites
+	itself and stack overflows, which is where the engines are most likely
+	to disagree. They are the same on every run, so a failure reproduces.
+
+	The programs that stay within what lanes hold (see lockstep.h) also run
+	on the LockstepEngine, every lane with its own seed and keypad, and 
+	every lane has to be in the same state as an interpreter run with them.
+	Random bytes would soon leave the first 4KB, so the random ROMs for 
+	lanes are made of random instructions that stay within it instead.
+*/
+
+#include "test.h"
+#include "emulator.h"
+#include "recompiler.h"
+#include "lockstep.h"
+#include "benchroms.h"
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Random ROMs run, and how large they are
+const int RANDOM_ROM_COUNT = 200;
+const size_t RANDOM_ROM_SIZE = 512;
+
+// Random ROMs for lanes: instructions from 0x200 up to CODE_END, and data
+// for them to read and write from there up to DATA_END
+const int LANE_ROM_COUNT = 200;
+const uint16_t CODE_END = 0x600;
+const uint16_t DATA_END = 0xF00;
+
+// Lanes per LockstepEngine, more than one AVX2 vector of them
+const int LANE_COUNT = 40;
+
+// Seed of the random number generator of every machine
+const uint64_t MACHINE_SEED = 42;
+
+// A program to run on every engine, and how to run it
+struct Program {
+	std::string name;
+	QuirkProfile quirkProfile;
+	std::vector<uint8_t> rom;
+	uint16_t keypad;		// Keys held down for the whole run
+	int cyclesPerFrame;
+	int frames;
+	bool fitsLanes;			// Stays within what lanes hold
+};
+
+static void LoadProgram(Chippin8& c8, const Program& program) {
+	c8.LoadROM(program.rom.data(), program.rom.size());
+	c8.SetQuirkProfile(program.quirkProfile);
+	c8.Seed(MACHINE_SEED);
+	c8.SetKeypadMask(program.keypad);
+}
+
+// Run program on every engine, and report the first frame after which an
+// engine is not in the same state as the reference
+static void RunEngines(const Program& program) {
+	// Chippin8 is large, so the machines are not kept on the stack
+	std::unique_ptr<Chippin8> reference(new Chippin8());
+	std::unique_ptr<Chippin8> withoutIdleSkipping(new Chippin8());
+	std::unique_ptr<Chippin8> recompiled(new Chippin8());
+	LoadProgram(*reference, program);
+	LoadProgram(*withoutIdleSkipping, program);
+	LoadProgram(*recompiled, program);
+	withoutIdleSkipping->skipIdle = false;
+	Recompiler recompiler(*recompiled);
+
+	for (int frame = 0; frame < program.frames; ++frame) {
+		reference->RunFrame(program.cyclesPerFrame);
+		withoutIdleSkipping->RunFrame(program.cyclesPerFrame);
+		recompiler.RunFrame(program.cyclesPerFrame);
+
+		std::vector<uint8_t> state = GetState(*reference);
+		std::string where = " differs from the interpreter on "
+			+ program.name + " after frame " + std::to_string(frame);
+		if (GetState(*withoutIdleSkipping) != state) {
+			Fail("The interpreter without idle skipping" + where);
+			return;
+		}
+		if (GetState(*recompiled) != state) {
+			Fail("The recompiler" + where);
+			return;
+		}
+	}
+}
+
+// Whether lane is in the same state as expected, as far as lanes hold it
+static bool IsSameLane(const Chippin8& expected, const Chippin8& lane) {
+	uint8_t expectedMemory[4096];
+	uint8_t laneMemory[4096];
+	expected.GetMemory(expectedMemory, sizeof(expectedMemory));
+	lane.GetMemory(laneMemory, sizeof(laneMemory));
+	return expected.pc == lane.pc && expected.index == lane.index
+		&& expected.sp == lane.sp
+		&& expected.delayTimer == lane.delayTimer
+		&& expected.soundTimer == lane.soundTimer
+		&& expected.rngState == lane.rngState
+		&& memcmp(expected.registers, lane.registers,
+			sizeof(expected.registers)) == 0
+		&& memcmp(expected.stack, lane.stack, sizeof(expected.stack)) == 0
+		&& memcmp(expected.display[0], lane.display[0],
+			sizeof(expected.display[0])) == 0
+		&& memcmp(expectedMemory, laneMemory, sizeof(laneMemory)) == 0;
+}
+
+// Run program on LANE_COUNT lanes, lane k with seed MACHINE_SEED + k and 
+// its own keypad, and on an interpreter for every lane, and report the
+// first frame after which a lane is not in the same state as its 
+// interpreter
+static void RunLanes(const Program& program) {
+	std::vector<std::unique_ptr<Chippin8>> references;
+	for (int lane = 0; lane < LANE_COUNT; ++lane) {
+		references.emplace_back(new Chippin8());
+		LoadProgram(*references.back(), program);
+		references.back()->Seed(MACHINE_SEED + lane);
+		references.back()->SetKeypadMask(
+			(uint16_t)(program.keypad * (lane + 1)));
+	}
+	LockstepEngine engine(*references[0], LANE_COUNT);
+	for (int lane = 0; lane < LANE_COUNT; ++lane) {
+		engine.SetLane(lane, *references[lane]);
+	}
+
+	std::unique_ptr<Chippin8> lane(new Chippin8());
+	for (int frame = 0; frame < program.frames; ++frame) {
+		engine.RunFrame(program.cyclesPerFrame);
+		for (int i = 0; i < LANE_COUNT; ++i) {
+			references[i]->RunFrame(program.cyclesPerFrame);
+			engine.GetLane(i, *lane);
+			if (!IsSameLane(*references[i], *lane)) {
+				Fail("Lane " + std::to_string(i) 
+					+ " differs from the interpreter on " + program.name 
+					+ " after frame " + std::to_string(frame));
+				return;
+			}
+		}
+	}
+}
+
+static Program GetBenchProgram(const char* kind, const BenchROM& rom,
+	int cyclesPerFrame, int frames) {
+	Program program;
+	program.name = std::string(kind) + "/" + rom.name;
+	program.quirkProfile = rom.quirkProfile;
+	program.rom.assign(rom.data, rom.data + rom.size);
+	program.keypad = 0;
+	program.cyclesPerFrame = cyclesPerFrame;
+	program.frames = frames;
+	// The SUPER-CHIP and XO-CHIP ROMs draw in high resolution and to both
+	// planes, which lanes don't hold
+	program.fitsLanes = rom.quirkProfile == QuirkProfile::CosmacVIP;
+	return program;
+}
+
+static Program GetRandomProgram(int number, std::mt19937_64& random) {
+	Program program;
+	program.name = "random/" + std::to_string(number);
+	program.quirkProfile = (QuirkProfile)(number % QUIRK_PROFILE_COUNT);
+	program.rom.resize(RANDOM_ROM_SIZE);
+	for (uint8_t& byte : program.rom) {
+		byte = (uint8_t)random();
+	}
+	program.keypad = (uint16_t)random();
+	program.cyclesPerFrame = 1 + (int)(random() % 50);
+	program.frames = 60;
+	program.fitsLanes = false;
+	return program;
+}
+
+// Random instructions that only use the first plane of the low resolution
+// display, and only read and write memory between CODE_END and DATA_END.
+// So that the index register can't wander off, I is set right before 
+// every instruction that uses it, and nothing jumps or skips in between.
+// The jumps and calls go to the start of a group of such instructions.
+static Program GetLaneProgram(int number, std::mt19937_64& random) {
+	Program program;
+	program.name = "lanes/" + std::to_string(number);
+	program.quirkProfile = (QuirkProfile)(number % QUIRK_PROFILE_COUNT);
+	program.keypad = (uint16_t)random();
+	program.cyclesPerFrame = 1 + (int)(random() % 50);
+	program.frames = 60;
+	program.fitsLanes = true;
+
+	auto x = [&random]() { return (uint16_t)((random() % 16) << 8); };
+	auto y = [&random]() { return (uint16_t)((random() % 16) << 4); };
+	auto nn = [&random]() { return (uint16_t)(random() % 256); };
+	auto data = [&random]() {
+		return (uint16_t)(CODE_END + random() % (DATA_END - CODE_END - 32));
+	};
+	// An instruction that never jumps, skips or uses I
+	auto simple = [&]() -> uint16_t {
+		static const uint16_t ALU[] = { 0, 1, 2, 3, 4, 5, 6, 7, 0xE };
+		switch (random() % 9) {
+		case 0: return 0x6000 | x() | nn();
+		case 1: return 0x7000 | x() | nn();
+		case 2: return 0x8000 | x() | y() | ALU[random() % 9];
+		case 3: return 0xC000 | x() | nn();
+		case 4: return 0xF007 | x();
+		case 5: return 0xF015 | x();
+		case 6: return 0xF018 | x();
+		case 7: return 0x00C0 | (uint16_t)(random() % 16);	// Scroll down
+		default: return random() % 2 ? 0x00FB : 0x00FC;		// Scroll
+		}
+	};
+
+	// An instruction that skips the next one. 5XY0 and 9XY0 compare 
+	// registers, the others a register with a constant or a key.
+	auto skip = [&]() -> uint16_t {
+		static const uint16_t SKIPS[] = { 0x3000, 0x4000, 0x5000, 0x9000,
+			0xE09E, 0xE0A1 };
+		uint16_t kind = SKIPS[random() % 6];
+		return kind | x() | (kind == 0x5000 || kind == 0x9000 ? y()
+			: kind < 0xE000 ? nn() : 0);
+	};
+	// I set to data, and an instruction that uses it
+	auto usingI = [&](std::vector<uint16_t>& group) {
+		static const uint16_t USES_I[] = { 0xD000, 0xF033, 0xF055, 0xF065,
+			0xF029, 0xF030 };
+		uint16_t kind = USES_I[random() % 6];
+		group.push_back(0xA000 | data());
+		if (random() % 2) {
+			group.push_back(0xF01E | x());
+		}
+		group.push_back(kind == 0xD000 
+			? 0xD000 | x() | y() | (uint16_t)(random() % 16) : kind | x());
+	};
+
+	// Groups of instructions, the jumps and calls in them with the number
+	// of the group they go to until the addresses are known. The main 
+	// program comes first, mostly straight-line code and jumps forward so
+	// that it runs through most of itself, and then jumps back to the 
+	// start. It calls subroutines after it, which may call the ones after
+	// them, so the stack never overflows and every return has somewhere to
+	// go.
+	const size_t MAIN_GROUPS = 96;
+	const size_t SUBROUTINE_COUNT = 8;
+	const size_t SUBROUTINE_GROUPS = 4;		// Followed by 00EE
+	const size_t SUBROUTINE_START = MAIN_GROUPS + 1;
+	std::vector<std::vector<uint16_t>> groups(SUBROUTINE_START 
+		+ SUBROUTINE_COUNT * (SUBROUTINE_GROUPS + 1));
+	auto subroutine = [&](size_t first) {
+		return (uint16_t)(SUBROUTINE_START + (first + random() 
+			% (SUBROUTINE_COUNT - first)) * (SUBROUTINE_GROUPS + 1));
+	};
+	for (size_t i = 0; i < groups.size(); ++i) {
+		std::vector<uint16_t>& group = groups[i];
+		bool isMain = i < MAIN_GROUPS;
+		size_t routine = (i - SUBROUTINE_START) / (SUBROUTINE_GROUPS + 1);
+		if (i == MAIN_GROUPS) {
+			group.push_back(0x1000);
+			continue;
+		}
+		if (!isMain && (i - SUBROUTINE_START) % (SUBROUTINE_GROUPS + 1) 
+			== SUBROUTINE_GROUPS) {
+			group.push_back(0x00EE);
+			continue;
+		}
+		size_t kind = random() % 32;
+		if (kind < 14) {
+			group.push_back(simple());
+		}
+		else if (kind < 20) {
+			group.push_back(skip());
+			group.push_back(simple());
+		}
+		else if (kind < 27) {
+			usingI(group);
+		}
+		else if (kind < 30 && isMain) {
+			// A few groups ahead, to the jump back to the start at most
+			group.push_back(0x1000 | (uint16_t)std::min(MAIN_GROUPS, 
+				i + 1 + random() % 4));
+		}
+		else if (kind < 31 && isMain) {
+			// A loop, which the skip may leave
+			group.push_back(skip());
+			group.push_back(0x1000 | (uint16_t)(random() % MAIN_GROUPS));
+		}
+		else if (isMain || routine + 1 < SUBROUTINE_COUNT) {
+			group.push_back(random() % 4 
+				? 0x2000 | subroutine(isMain ? 0 : routine + 1)
+				: 0xF00A | x());
+		}
+		else {
+			group.push_back(simple());
+		}
+	}
+
+	// Lay the groups out one after the other, then patch the jumps
+	std::vector<uint16_t> addresses;
+	std::vector<uint16_t> code;
+	for (const std::vector<uint16_t>& group : groups) {
+		addresses.push_back((uint16_t)(0x200 + code.size() * 2));
+		code.insert(code.end(), group.begin(), group.end());
+	}
+	for (uint16_t& instruction : code) {
+		uint16_t kind = instruction & 0xF000;
+		if (kind == 0x1000 || kind == 0x2000) {
+			instruction = kind | addresses[instruction & 0x0FFF];
+		}
+	}
+
+	program.rom.resize(DATA_END - 0x200);
+	for (uint8_t& byte : program.rom) {
+		byte = (uint8_t)random();
+	}
+	for (size_t i = 0; i < code.size(); ++i) {
+		program.rom[i * 2] = (uint8_t)(code[i] >> 8);
+		program.rom[i * 2 + 1] = (uint8_t)code[i];
+	}
+	return program;
+}
+
+int main() {
+	std::vector<Program> programs;
+	for (const BenchROM& stream : BENCH_STREAMS) {
+		programs.push_back(GetBenchProgram("stream", stream, 997, 50));
+	}
+	for (const BenchROM& rom : BENCH_ROMS) {
+		programs.push_back(GetBenchProgram("rom", rom, 13, 300));
+	}
+	std::mt19937_64 random(1);
+	for (int i = 0; i < RANDOM_ROM_COUNT; ++i) {
+		programs.push_back(GetRandomProgram(i, random));
+	}
+	for (int i = 0; i < LANE_ROM_COUNT; ++i) {
+		programs.push_back(GetLaneProgram(i, random));
+	}
+
+	for (const Program& program : programs) {
+		RunEngines(program);
+		if (program.fitsLanes) {
+			RunLanes(program);
+		}
+	}
+
+	return TestResult();
+}
\ No newline at end of file
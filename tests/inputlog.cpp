@@ -0,0 +1,236 @@
+/*
+	Test of input logs (see InputLog). A run recorded like the frontend
+	records it has to replay in headless mode (see RunROM) to exactly the
+	same state, on every engine. A log has to survive being saved and
+	loaded, and a log recorded with another ROM or other quirks has to be
+	refused.
+*/
+
+#include "test.h"
+#include "emulator.h"
+#include "inputlog.h"
+#include "headless.h"
+#include "benchroms.h"
+
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+
+const int RECORDED_FRAMES = 300;
+const int CYCLES_PER_FRAME = 17;
+const uint64_t RECORDED_SEED = 1234;
+
+static bool WriteFile(const std::string& filename, const void* data,
+	size_t size) {
+	std::ofstream file(filename, std::ios::binary);
+	file.write((const char*)data, size);
+	return file.good();
+}
+
+// Write rom to a file, with the extension of its quirk profile
+static std::string WriteROM(const BenchROM& rom) {
+	static const char* EXTENSIONS[QUIRK_PROFILE_COUNT] = { ".ch8", ".ch8",
+		".sc8", ".xo8" };
+	std::string filename = std::string("inputlog_test_") + rom.name
+		+ EXTENSIONS[(int)rom.quirkProfile];
+	CHECK(WriteFile(filename, rom.data, rom.size));
+	return filename;
+}
+
+static HeadlessOptions GetReplayOptions(const std::string& romFile,
+	const std::string& logFile) {
+	HeadlessOptions options;
+	options.romFile = romFile;
+	options.cycles = 0;
+	options.frames = 0;
+	options.cyclesPerFrame = 0;
+	options.useRecompiler = false;
+	options.hasSeed = false;
+	options.seed = 0;
+	options.hasQuirkProfile = false;
+	options.quirkProfile = QuirkProfile::CosmacVIP;
+	options.replayFile = logFile;
+	options.lanes = 1;
+	return options;
+}
+
+// Run romFile with random keys, recording them the way EmulationThread
+// does, and save the log. Returns the machine at the end of the run.
+static std::unique_ptr<Chippin8> Record(const std::string& romFile,
+	const std::string& logFile) {
+	std::unique_ptr<Chippin8> c8(new Chippin8());
+	CHECK(c8->LoadROM(romFile));
+	c8->Seed(RECORDED_SEED);
+
+	InputLog log;
+	log.Reset(RECORDED_SEED, CYCLES_PER_FRAME, c8->GetROMHash(),
+		c8->GetQuirkProfile());
+	std::mt19937_64 random(5);
+	uint16_t keypad = 0;
+	for (int frame = 0; frame < RECORDED_FRAMES; ++frame) {
+		// Keys are held for a few frames at a time, like a player would
+		if (random() % 10 == 0) {
+			keypad = (uint16_t)(1 << (random() % 16));
+		}
+		c8->SetKeypadMask(keypad);
+		log.Record(frame, keypad);
+		c8->RunFrame(CYCLES_PER_FRAME);
+	}
+	CHECK(log.Save(logFile));
+	return c8;
+}
+
+static void TestReplay(const BenchROM& rom) {
+	std::string romFile = WriteROM(rom);
+	std::string logFile = romFile + ".c8in";
+	std::unique_ptr<Chippin8> recorded = Record(romFile, logFile);
+	std::vector<uint8_t> expected = GetState(*recorded);
+
+	// Lanes only hold the low resolution display (see lockstep.h)
+	std::vector<int> laneCounts = { 1 };
+	if (rom.quirkProfile == QuirkProfile::CosmacVIP) {
+		laneCounts.push_back(4);
+	}
+	for (bool useRecompiler : { false, true }) {
+		for (int lanes : laneCounts) {
+			HeadlessOptions options = GetReplayOptions(romFile, logFile);
+			options.useRecompiler = useRecompiler;
+			options.lanes = lanes;
+			std::unique_ptr<Chippin8> replayed(new Chippin8());
+			HeadlessResult result;
+			CHECK(RunROM(*replayed, options, result));
+			CHECK(result.frames == RECORDED_FRAMES);
+			CHECK(result.cyclesPerFrame == CYCLES_PER_FRAME);
+			if (GetState(*replayed) != expected) {
+				Fail(std::string("Replaying ") + rom.name + " with "
+					+ std::to_string(lanes) + " lanes" + (useRecompiler
+					? " on the recompiler" : "") + " ends somewhere else");
+			}
+		}
+	}
+	remove(romFile.c_str());
+	remove(logFile.c_str());
+}
+
+static void TestSaveLoad() {
+	InputLog log;
+	log.Reset(99, 12, 0x123456789ABCDEF0ull, QuirkProfile::XOChip);
+	for (uint64_t frame = 0; frame < 1000; ++frame) {
+		log.Record(frame, (uint16_t)(frame / 70 * 0x1111));
+	}
+	const std::string filename = "inputlog_test.c8in";
+	CHECK(log.Save(filename));
+
+	InputLog loaded;
+	CHECK(loaded.Load(filename));
+	QuirkProfile profile = QuirkProfile::CosmacVIP;
+	CHECK(loaded.GetQuirkProfile(profile));
+	CHECK(profile == QuirkProfile::XOChip);
+	CHECK(loaded.GetSeed() == 99);
+	CHECK(loaded.GetCyclesPerFrame() == 12);
+	CHECK(loaded.GetROMHash() == 0x123456789ABCDEF0ull);
+	CHECK(loaded.GetFrameCount() == 1000);
+	for (uint64_t frame = 0; frame < 1000; ++frame) {
+		CHECK(loaded.MaskAt(frame) == log.MaskAt(frame));
+	}
+
+	// Recording a frame again, after rewinding, drops the ones after it
+	loaded.Record(500, 0x8000);
+	CHECK(loaded.GetFrameCount() == 501);
+	CHECK(loaded.MaskAt(499) == log.MaskAt(499));
+	CHECK(loaded.MaskAt(500) == 0x8000);
+
+	// A file that is not a log leaves the log empty
+	uint8_t garbage[64] = { 'C', '8', 'I', 'N', 9 };
+	CHECK(WriteFile(filename, garbage, sizeof(garbage)));
+	CHECK(!loaded.Load(filename));
+	CHECK(loaded.GetFrameCount() == 0);
+	remove(filename.c_str());
+}
+
+// Logs of the first version have neither the ROM hash nor the quirk
+// profile, and are replayed with any ROM
+static void TestVersion1() {
+	uint8_t data[36] = { 'C', '8', 'I', 'N', 1, 0, 0, 0,
+		42, 0, 0, 0, 0, 0, 0, 0,	// Seed
+		CYCLES_PER_FRAME, 0, 0, 0,
+		20, 0, 0, 0, 0, 0, 0, 0,	// Frames
+		0, 0, 0, 0, 0, 0, 0, 0		// Events
+	};
+	const std::string logFile = "inputlog_test_v1.c8in";
+	CHECK(WriteFile(logFile, data, sizeof(data)));
+	InputLog log;
+	CHECK(log.Load(logFile));
+	QuirkProfile profile;
+	CHECK(!log.GetQuirkProfile(profile));
+	CHECK(log.GetROMHash() == 0);
+	CHECK(log.GetSeed() == 42 && log.GetFrameCount() == 20);
+
+	std::string romFile = WriteROM(BENCH_ROMS[0]);
+	std::unique_ptr<Chippin8> replayed(new Chippin8());
+	HeadlessResult result;
+	CHECK(RunROM(*replayed, GetReplayOptions(romFile, logFile), result));
+	CHECK(result.frames == 20);
+	remove(romFile.c_str());
+	remove(logFile.c_str());
+}
+
+// A log is only replayed with the ROM and the quirks it was recorded with,
+// given on the command line or by a save state
+static void TestRefused() {
+	std::string romFile = WriteROM(BENCH_ROMS[0]);
+	std::string otherROMFile = WriteROM(BENCH_ROMS[1]);
+	std::string logFile = romFile + ".c8in";
+	Record(romFile, logFile);
+
+	std::unique_ptr<Chippin8> c8(new Chippin8());
+	HeadlessResult result;
+	HeadlessOptions options = GetReplayOptions(otherROMFile, logFile);
+	CHECK(!RunROM(*c8, options, result));
+	CHECK(!result.error.empty());
+
+	options = GetReplayOptions(romFile, logFile);
+	options.hasQuirkProfile = true;
+	options.quirkProfile = QuirkProfile::SuperChip;
+	result.error.clear();
+	CHECK(!RunROM(*c8, options, result));
+	CHECK(!result.error.empty());
+
+	options.quirkProfile = BENCH_ROMS[0].quirkProfile;
+	CHECK(RunROM(*c8, options, result));
+
+	// A save state brings its own quirks, which have to be the log's too
+	const std::string stateFile = "inputlog_test.state";
+	std::unique_ptr<Chippin8> saved(new Chippin8());
+	CHECK(saved->LoadROM(romFile));
+	saved->SetQuirkProfile(QuirkProfile::SuperChip);
+	CHECK(saved->SaveState(stateFile));
+	options = GetReplayOptions(romFile, logFile);
+	options.loadStateFile = stateFile;
+	result.error.clear();
+	CHECK(!RunROM(*c8, options, result));
+	CHECK(!result.error.empty());
+
+	saved->SetQuirkProfile(BENCH_ROMS[0].quirkProfile);
+	CHECK(saved->SaveState(stateFile));
+	CHECK(RunROM(*c8, options, result));
+
+	remove(stateFile.c_str());
+	remove(romFile.c_str());
+	remove(otherROMFile.c_str());
+	remove(logFile.c_str());
+}
+
+int main() {
+	for (const BenchROM& rom : BENCH_ROMS) {
+		TestReplay(rom);
+	}
+	TestSaveLoad();
+	TestVersion1();
+	TestRefused();
+	return TestResult();
+}
\ No newline at end of file
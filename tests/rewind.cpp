@@ -0,0 +1,113 @@
+/*
+	Test of the rewind history (see RewindBuffer). Every state popped has to
+	be exactly the state that was pushed last and not popped yet, whether
+	it was stored as a keyframe or as a delta, and however the machine got
+	there: instructions writing memory, memory replaced from outside with
+	SetMemory, rewinding and then running on from there, and the oldest
+	frames being dropped when the buffer is full.
+*/
+
+#include "test.h"
+#include "emulator.h"
+#include "rewind.h"
+#include "benchroms.h"
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Pushes and pops frames, and keeps every state that should be in the
+// history, newest last, to check the popped ones against
+class RewindTest {
+public:
+	RewindTest(const BenchROM& rom, size_t capacity, int keyframeInterval)
+		: rewind(capacity, keyframeInterval), c8(new Chippin8()),
+		random(rom.size), name(rom.name) {
+		c8->LoadROM(rom.data, rom.size);
+		c8->SetQuirkProfile(rom.quirkProfile);
+		c8->Seed(3);
+	}
+
+	// Run and push frames. Now and then, a byte of memory is changed from
+	// outside, which the history has to notice as well.
+	void Run(int frames) {
+		for (int frame = 0; frame < frames; ++frame) {
+			c8->SetKeypadMask((uint16_t)(1 << (random() % 16)));
+			if (random() % 8 == 0) {
+				std::vector<uint8_t> memory(Chippin8::MEMORY_SIZE);
+				c8->GetMemory(memory.data());
+				memory[0x300 + random() % 0x8000] ^= 0x5A;
+				c8->SetMemory(memory.data());
+			}
+			c8->RunFrame(37);
+			rewind.Push(*c8);
+			history.push_back(GetState(*c8));
+		}
+		// Only the newest frames are kept when the buffer is full
+		CHECK(rewind.FrameCount() <= history.size());
+		if (rewind.FrameCount() < history.size()) {
+			history.erase(history.begin(),
+				history.end() - rewind.FrameCount());
+		}
+	}
+
+	// Pop frames, and check that each is the state pushed last
+	void Rewind(int frames) {
+		for (int frame = 0; frame < frames && !history.empty(); ++frame) {
+			CHECK(rewind.Pop(*c8));
+			if (GetState(*c8) != history.back()) {
+				Fail("Popped the wrong state on " + name + " with "
+					+ std::to_string(history.size()) + " frames left");
+			}
+			history.pop_back();
+		}
+		CHECK(rewind.FrameCount() == history.size());
+	}
+
+	void RewindAll() {
+		Rewind((int)history.size());
+		CHECK(!rewind.Pop(*c8));
+	}
+
+	size_t FrameCount() const { return history.size(); }
+
+private:
+	RewindBuffer rewind;
+	std::unique_ptr<Chippin8> c8;
+	std::vector<std::vector<uint8_t>> history;
+	std::mt19937_64 random;
+	std::string name;
+};
+
+int main() {
+	std::vector<BenchROM> roms(std::begin(BENCH_ROMS), std::end(BENCH_ROMS));
+	roms.insert(roms.end(), std::begin(BENCH_STREAMS),
+		std::end(BENCH_STREAMS));
+
+	for (const BenchROM& rom : roms) {
+		// Rewinding and running on again, with deltas against keyframes
+		// that were popped and pushed again
+		RewindTest test(rom, 8 * 1024 * 1024, 7);
+		test.Run(100);
+		test.Rewind(30);
+		test.Run(45);
+		test.Rewind(3);
+		test.Run(20);
+		CHECK(test.FrameCount() == 132);
+		test.RewindAll();
+	}
+
+	for (const BenchROM& rom : roms) {
+		// A buffer that only holds a few keyframes (about 10 to 80 frames)
+		RewindTest test(rom, 8 * 1024, 5);
+		test.Run(200);
+		CHECK(test.FrameCount() > 0 && test.FrameCount() < 200);
+		test.Rewind(10);
+		test.Run(30);
+		test.RewindAll();
+	}
+
+	return TestResult();
+}
\ No newline at end of file
@@ -0,0 +1,143 @@
+/*
+	Test of save states (see Chippin8::SaveState). A machine restored from
+	a save state has to be in exactly the same state as the one it was
+	saved from, and keep running the same way, on the interpreter and on
+	the Recompiler. A state that is not valid has to be refused, without
+	changing the machine it was loaded into.
+*/
+
+#include "test.h"
+#include "emulator.h"
+#include "recompiler.h"
+#include "benchroms.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+
+// Where some of the fields are in a save state (see Chippin8::SaveState),
+// counted from the end, to make states that are not valid
+const size_t SP_FROM_END = 48;
+const size_t RNG_FROM_END = 43;
+const size_t HIGH_RESOLUTION_FROM_END = 35;
+const size_t PLANE_MASK_FROM_END = 34;
+
+// Run rom for a while, with a key held, and return the machine
+static std::unique_ptr<Chippin8> RunROM(const BenchROM& rom, int frames) {
+	std::unique_ptr<Chippin8> c8(new Chippin8());
+	c8->LoadROM(rom.data, rom.size);
+	c8->SetQuirkProfile(rom.quirkProfile);
+	c8->Seed(7);
+	c8->SetKeypadMask(0x0010);
+	for (int frame = 0; frame < frames; ++frame) {
+		c8->RunFrame(13);
+	}
+	return c8;
+}
+
+// Save rom halfway, restore it into a machine that ran something else,
+// and check that both go on exactly the same way
+static void TestRoundTrip(const BenchROM& rom, bool useRecompiler) {
+	std::unique_ptr<Chippin8> original = RunROM(rom, 100);
+	std::vector<uint8_t> state = GetState(*original);
+
+	std::unique_ptr<Chippin8> restored = RunROM(BENCH_ROMS[0], 30);
+	std::unique_ptr<Recompiler> recompiler;
+	if (useRecompiler) {
+		// Compiled before the state is loaded, so it has to notice
+		recompiler.reset(new Recompiler(*restored));
+		recompiler->RunFrame(13);
+	}
+	CHECK(restored->LoadState(state.data(), state.size()));
+	CHECK(GetState(*restored) == state);
+	CHECK(restored->GetQuirkProfile() == rom.quirkProfile);
+
+	for (int frame = 0; frame < 100; ++frame) {
+		original->RunFrame(13);
+		if (recompiler) {
+			recompiler->RunFrame(13);
+		}
+		else {
+			restored->RunFrame(13);
+		}
+	}
+	if (GetState(*restored) != GetState(*original)) {
+		Fail(std::string("Restoring ") + rom.name + (useRecompiler
+			? " on the recompiler" : "") + " does not give the same run");
+	}
+}
+
+// Every state that is not valid has to be refused, without changing the
+// machine it was loaded into
+static void TestRefused() {
+	std::unique_ptr<Chippin8> source = RunROM(BENCH_ROMS[0], 50);
+	std::unique_ptr<Chippin8> target = RunROM(BENCH_ROMS[1], 50);
+	const std::vector<uint8_t> valid = GetState(*source);
+	const std::vector<uint8_t> before = GetState(*target);
+	const size_t end = Chippin8::STATE_SIZE;
+
+	std::vector<std::vector<uint8_t>> invalid;
+	invalid.push_back(std::vector<uint8_t>(valid.begin(), valid.end() - 1));
+	invalid.push_back(valid);
+	invalid.back()[0] = 'X';				// Magic
+	invalid.push_back(valid);
+	invalid.back()[4] = 3;					// Version
+	invalid.push_back(valid);
+	invalid.back()[6] = QUIRK_PROFILE_COUNT + 1;
+	invalid.push_back(valid);
+	invalid.back()[end - SP_FROM_END] = 17;
+	invalid.push_back(valid);
+	for (size_t i = 0; i < 8; ++i) {
+		invalid.back()[end - RNG_FROM_END + i] = 0;
+	}
+	invalid.push_back(valid);
+	invalid.back()[end - HIGH_RESOLUTION_FROM_END] = 2;
+	invalid.push_back(valid);
+	invalid.back()[end - PLANE_MASK_FROM_END] = 4;
+
+	for (size_t i = 0; i < invalid.size(); ++i) {
+		if (target->LoadState(invalid[i].data(), invalid[i].size())) {
+			Fail("Invalid save state " + std::to_string(i) + " was loaded");
+		}
+		CHECK(GetState(*target) == before);
+	}
+	CHECK(!target->LoadState(nullptr, Chippin8::STATE_SIZE));
+
+	// The fields changed above are where the test thinks they are
+	std::vector<uint8_t> changed = valid;
+	changed[end - SP_FROM_END] = 16;
+	changed[end - PLANE_MASK_FROM_END] = 3;
+	CHECK(target->LoadState(changed.data(), changed.size()));
+	CHECK(target->sp == 16 && target->planeMask == 3);
+	CHECK(target->rngState == source->rngState);
+
+	std::vector<uint8_t> small(Chippin8::STATE_SIZE - 1);
+	CHECK(source->SaveState(small.data(), small.size()) == 0);
+}
+
+static void TestFile() {
+	const std::string filename = "savestate_test.state";
+	std::unique_ptr<Chippin8> original = RunROM(BENCH_ROMS[2], 80);
+	CHECK(original->SaveState(filename));
+	std::unique_ptr<Chippin8> restored(new Chippin8());
+	CHECK(restored->LoadState(filename));
+	CHECK(GetState(*restored) == GetState(*original));
+	remove(filename.c_str());
+	CHECK(!restored->LoadState(filename));
+}
+
+int main() {
+	for (const BenchROM& rom : BENCH_ROMS) {
+		TestRoundTrip(rom, false);
+		TestRoundTrip(rom, true);
+	}
+	for (const BenchROM& stream : BENCH_STREAMS) {
+		TestRoundTrip(stream, false);
+		TestRoundTrip(stream, true);
+	}
+	TestRefused();
+	TestFile();
+	return TestResult();
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+/*
+	Helpers shared by the tests. Every test is a program of its own, run by
+	ctest (see CMakeLists.txt). It reports every check that fails on stderr
+	and carries on, and exits with EXIT_FAILURE if any of them did.
+*/
+
+#ifndef TEST_H
+#define TEST_H
+
+#include "emulator.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Number of checks that failed so far
+inline int testFailures = 0;
+
+// Report a failed check
+inline void Fail(const std::string& message) {
+	std::cerr << message << '\n';
+	++testFailures;
+}
+
+// Report condition, and where it is, as failed unless it holds
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			Fail(std::string(__FILE__) + ":" + std::to_string(__LINE__) \
+				+ ": CHECK(" #condition ") failed"); \
+		} \
+	} while (0)
+
+// The whole state of the machine, as written by Chippin8::SaveState, to
+// compare machines with
+inline std::vector<uint8_t> GetState(const Chippin8& c8) {
+	std::vector<uint8_t> state(Chippin8::STATE_SIZE);
+	CHECK(c8.SaveState(state.data(), state.size()) == Chippin8::STATE_SIZE);
+	return state;
+}
+
+// Exit code of the test, to return from main
+inline int TestResult() {
+	if (testFailures > 0) {
+		std::cerr << testFailures << " checks failed\n";
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+#endif // TEST_H
\ No newline at end of file